@@ -17,14 +17,24 @@ typedef struct mp_gsave_s  mp_gsave_t;
 bool         mp_gstack_init(const mp_config_t* config); // normally called automatically
 void         mp_gstack_clear_cache(void);               // clear thread-local cache of gstacks (called automatically on thread termination)
 
-mp_gstack_t* mp_gstack_alloc(ssize_t extra_size, void** extra); 
+mp_gstack_t* mp_gstack_alloc(ssize_t stack_size, const void* site, ssize_t extra_size, void** extra);  // use 0 for the default stack size
 void         mp_gstack_free(mp_gstack_t* gstack, bool delay);
 void         mp_gstack_enter(mp_gstack_t* g, mp_jmpbuf_t** return_jmp, mp_stack_start_fun_t* fun, void* arg);
+void         mp_gstack_entered(mp_gstack_t* g);
+void         mp_gstack_detach(mp_gstack_t* g);    // return to the current thread when freed by another thread
+void         mp_gstack_attach(mp_gstack_t* g);    // prepare the current thread to run on a gstack detached by another thread
+bool         mp_gstack_contains(const mp_gstack_t* g, const uint8_t* p);  // is `p` inside the stack area of `g`?
+bool         mp_gstack_contains_committed(const mp_gstack_t* g, const uint8_t* p);  // and in its committed part?
+ssize_t      mp_gstack_prewarm(ssize_t count, ssize_t commit, ssize_t extra_size);  // pre-allocate gstacks in the thread-local cache
 
-mp_gsave_t*  mp_gstack_save(mp_gstack_t* gstack, uint8_t* sp);    // save up to the given stack pointer (that should be in `gstack`)
+mp_gsave_t*  mp_gstack_save(mp_gstack_t* gstack, uint8_t* sp, mp_scope_t* scope);  // save up to the given stack pointer (that should be in `gstack`)
 void         mp_gsave_restore(mp_gsave_t* gsave);
 void         mp_gsave_free(mp_gsave_t* gsave);
 
+void*        mp_arena_alloc(ssize_t size);        // allocate from the thread-local arena for saves
+void         mp_arena_free(void* p);              // free to the arena of `p` (which can be in another thread)
+void*        mp_arena_alloc_in(mp_scope_t* scope, ssize_t size);  // allocate in `scope` (or the thread-local arena if `scope` is NULL)
+
 mp_gstack_t* mp_gstack_current(void);             // implemented in <mprompt.c>
 
 
@@ -38,6 +48,9 @@ mp_gstack_t* mp_gstack_current(void);             // implemented in <mprompt.c>
 #define MP_USE_ASAN 1
 #endif
 #endif
+#if defined(__SANITIZE_ADDRESS__) && !defined(MP_USE_ASAN)  // gcc
+#define MP_USE_ASAN 1
+#endif
 
 #if !defined(MP_USE_ASAN)
 #define MP_USE_ASAN 0
@@ -30,6 +30,9 @@
 // A register context. Always has `reg_ip` and `reg_sp` members.
 typedef struct mp_jmpbuf_s mp_jmpbuf_t;
 
+// The saved frame pointer of a register context (used for frame pointer backtraces)
+static inline void* mp_jmpbuf_fp(const mp_jmpbuf_t* jmp);
+
 // On some platforms (like windows) we need an unwind frame on the stack that 
 // is updated inplace when the return_point changes so backtraces go to the right return address.
 typedef struct mp_unwind_frame_s mp_unwind_frame_t;
@@ -48,6 +51,16 @@ mp_decl_externc mp_decl_noreturn       void  mp_longjmp(mp_jmpbuf_t* jmp);
 mp_decl_externc void* mp_stack_enter(void* stack_base, void* stack_commit_limit, void* stack_limit, 
                                      mp_jmpbuf_t** return_jmp, mp_stack_start_fun_t* fun, void* arg);
 
+// Save the current context in `from` and jump to `to` in one routine, i.e. a fused
+// `if (!mp_setjmp(from)) mp_longjmp(to)`. The context in `from` is as saved by `mp_setjmp`
+// and a later `mp_longjmp(from)` returns (again) from the `mp_stack_switch` call.
+// On windows we still use a separate setjmp and longjmp (as these also save the TIB fields).
+#if defined(_WIN32) && defined(_M_X64)
+#define mp_stack_switch(from,to)  do { if (!mp_setjmp(from)) { mp_longjmp(to); } } while(0)
+#else
+mp_decl_externc mp_decl_returns_twice  void  mp_stack_switch(mp_jmpbuf_t* from, mp_jmpbuf_t* to);
+#endif
+
 
 
 // Register context definitions are platform specific
@@ -90,6 +103,10 @@ struct mp_jmpbuf_s {
   uint16_t  context_padding;
 };
 
+static inline void* mp_jmpbuf_fp(const mp_jmpbuf_t* jmp) {
+  return (void*)jmp->reg_rbp;
+}
+
 // On windows we do not have dwarf expressions and update the return address
 // and stack pointer on the stack via the unwind frame. (note: this is just for
 // the debugger; we never actually return this way but always longjmp out of it)
@@ -146,6 +163,10 @@ struct mp_jmpbuf_s {
   uint16_t  context_padding;
 };
 
+static inline void* mp_jmpbuf_fp(const mp_jmpbuf_t* jmp) {
+  return jmp->reg_rbp;
+}
+
 
 // ARM64, Aarch64
 #elif defined(_M_ARM64) || defined(__aarch64__)
@@ -177,6 +198,10 @@ struct mp_jmpbuf_s {
   int64_t   reg_d15;
 };
 
+static inline void* mp_jmpbuf_fp(const mp_jmpbuf_t* jmp) {
+  return jmp->reg_fp;
+}
+
 
 #else
 #error "unsupported platform"
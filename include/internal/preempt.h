@@ -0,0 +1,33 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#pragma once
+#ifndef MP_PREEMPT_H
+#define MP_PREEMPT_H
+
+/*------------------------------------------------------------------------------
+  Preemption flag of the current thread (see `mp_maybe_yield`)
+  Exposed so frequent preemption points (like `mpe_perform`) can test the
+  flag inline and only call out of line when preemption was requested.
+------------------------------------------------------------------------------*/
+
+#include "util.h"
+#include "atomic.h"
+
+struct mp_preempt_s {
+  _Atomic(intptr_t) requested;
+};
+
+extern mp_decl_thread mp_preempt_t _mp_preempt;
+
+// Note: as the preemption handler may resume us in another thread, a caller should not access
+// any thread-local after calling `mp_maybe_yield` in the same function (the compiler may reuse
+// the thread-local address computed for the test).
+static inline bool mp_preempt_is_requested(void) {
+  return mp_unlikely(mp_atomic_load(&_mp_preempt.requested) != 0);
+}
+
+#endif
@@ -0,0 +1,77 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#pragma once
+#ifndef MP_TRACE_H
+#define MP_TRACE_H
+
+/*------------------------------------------------------------------------------
+  Trace events (see `mp_trace_events`)
+  Only recorded when compiled with `MP_TRACE=1` (or `cmake -DMP_TRACE=ON`);
+  otherwise `mp_trace` expands to nothing.
+
+  Events are written to a thread-local ring buffer of `MP_TRACE_SIZE` entries
+  without any synchronization; the ring is only read by its own thread.
+  Events are also recorded from the commit-on-demand fault handler where
+  an event that is interrupted by the fault may end up garbled.
+------------------------------------------------------------------------------*/
+
+#ifndef MP_TRACE
+#define MP_TRACE  (0)
+#endif
+
+#if MP_TRACE
+
+#ifndef MP_TRACE_SIZE
+#define MP_TRACE_SIZE  (1024)   // must be a power of 2
+#endif
+
+typedef struct mp_trace_buffer_s {
+  uint64_t          count;                    // total events recorded (the next entry is at `count % MP_TRACE_SIZE`)
+  mp_trace_event_t  events[MP_TRACE_SIZE];
+} mp_trace_buffer_t;
+
+extern mp_decl_thread mp_trace_buffer_t _mp_trace_buffer;
+
+// A cheap timestamp: the cycle counter where available, nano seconds otherwise
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+static inline uint64_t mp_trace_now(void) { return __rdtsc(); }
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+static inline uint64_t mp_trace_now(void) { return __rdtsc(); }
+#elif defined(__GNUC__) && defined(__aarch64__)
+static inline uint64_t mp_trace_now(void) {
+  uint64_t t;
+  __asm __volatile("mrs %0, cntvct_el0" : "=r" (t));
+  return t;
+}
+#else
+#include <time.h>
+static inline uint64_t mp_trace_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((uint64_t)t.tv_sec * 1000000000ULL) + (uint64_t)t.tv_nsec;
+}
+#endif
+
+static inline void mp_trace_record(mp_trace_kind_t kind, const void* obj, int64_t arg) {
+  mp_trace_event_t* ev = &_mp_trace_buffer.events[_mp_trace_buffer.count++ & (MP_TRACE_SIZE - 1)];
+  ev->time = mp_trace_now();
+  ev->kind = kind;
+  ev->obj  = obj;
+  ev->arg  = arg;
+}
+
+#define mp_trace(kind,obj,arg)   mp_trace_record(kind,(const void*)(obj),(int64_t)(arg))
+
+#else
+
+#define mp_trace(kind,obj,arg)   ((void)0)
+
+#endif
+
+#endif
@@ -166,4 +166,18 @@ static inline void* mp_zalloc_safe(size_t size) {
 
 
 
+/*------------------------------------------------------------------------------
+  Statistics (see `mp_stats_get`)
+  Counters are thread-local and only merged on request.
+------------------------------------------------------------------------------*/
+
+extern mp_decl_thread mp_stats_t _mp_stats;
+
+#define mp_stat_add(stat,n)    (_mp_stats.stat += (int64_t)(n))
+#define mp_stat_inc(stat)      mp_stat_add(stat,1)
+
+void mp_stats_thread_init(void);   // register the counters of the current thread
+void mp_stats_thread_done(void);   // merge the counters of the current thread on termination
+
+
 #endif
\ No newline at end of file
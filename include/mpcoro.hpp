@@ -0,0 +1,227 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#pragma once
+#ifndef MP_MPCORO_HPP
+#define MP_MPCORO_HPP
+
+/*-----------------------------------------------------------------
+  Interoperation between C++20 (stackless) coroutines and prompts (header only).
+
+  - `mp::task<T>` is a lazy coroutine task that can be awaited by other
+    coroutines (using symmetric transfer) or by a prompt.
+  - `co_await mp::on_prompt(fun)` runs `fun(p)` in a fresh prompt `p` and
+    suspends the awaiting coroutine until `fun` returns; `fun` runs on a gstack
+    and can use regular (effect handler) code.
+  - `mp::await(p,task)` can be called from code running under a prompt `p`:
+    it yields up to `p`, runs the task, and resumes (the once-resumption of) `p`
+    when the task completes.
+
+  For example:
+
+    mp::task<int> co_read();                      // some coroutine
+    int legacy(mp_prompt_t* p) { return mp::await(p, co_read()) + 1; }
+    mp::task<int> co_main() { co_return co_await mp::on_prompt(&legacy); }
+
+  No allocations are done beyond the coroutine frames and the gstack of a prompt:
+  the awaiters live in the frame of the awaiting coroutine and the yield environment
+  on the suspended gstack. A prompt that is suspended on a task is resumed when the task
+  completes (on the stack of whoever resumed the task) so this should happen in the same
+  thread (or the prompt chain should be detached and attached, see `mp_resume_detach`).
+-----------------------------------------------------------------*/
+
+#include <mprompt.h>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace mp {
+
+namespace detail {
+
+// Synchronize a completion with a suspension: whichever comes second continues.
+enum { coro_running = 0, coro_suspended = 1, coro_done = 2 };
+
+// A result value or exception
+template<class T>
+struct coro_result {
+  std::optional<T>   value;
+  std::exception_ptr exn;
+  template<class U> void set(U&& x) { value.emplace(std::forward<U>(x)); }
+  T get() {
+    if (exn) std::rethrow_exception(exn);
+    return std::move(*value);
+  }
+};
+
+template<>
+struct coro_result<void> {
+  std::exception_ptr exn;
+  void get() {
+    if (exn) std::rethrow_exception(exn);
+  }
+};
+
+template<class T>
+struct task_promise_value {
+  coro_result<T> result;
+  template<class U> void return_value(U&& x) { result.set(std::forward<U>(x)); }
+};
+
+template<>
+struct task_promise_value<void> {
+  coro_result<void> result;
+  void return_void() { }
+};
+
+}  // namespace detail
+
+
+/*-----------------------------------------------------------------
+  Tasks
+-----------------------------------------------------------------*/
+
+template<class T = void>
+class task {
+public:
+  struct promise_type : detail::task_promise_value<T> {
+    std::coroutine_handle<> continuation;            // an awaiting coroutine, or
+    mp_resume_t*            resume = nullptr;        // an awaiting prompt
+    std::atomic<int>        state{ detail::coro_running };
+
+    task get_return_object() { return task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    void unhandled_exception() { this->result.exn = std::current_exception(); }
+
+    struct final_awaiter {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+        promise_type& pr = h.promise();
+        if (pr.continuation) {
+          return pr.continuation;   // symmetric transfer to the awaiting coroutine
+        }
+        if (pr.resume != nullptr && pr.state.exchange(detail::coro_done) == detail::coro_suspended) {
+          mp_resume(pr.resume, nullptr);  // resume the awaiting prompt (which suspended already)
+        }
+        return std::noop_coroutine();
+      }
+      void await_resume() noexcept { }
+    };
+    final_awaiter final_suspend() noexcept { return {}; }
+  };
+
+  task(task&& t) noexcept : handle_(std::exchange(t.handle_, nullptr)) { }
+  task(const task&) = delete;
+  task& operator=(const task&) = delete;
+  ~task() { if (handle_) { handle_.destroy(); } }
+
+  // Await from another coroutine
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept {
+    handle_.promise().continuation = h;
+    return handle_;
+  }
+  T await_resume() { return handle_.promise().result.get(); }
+
+  // Drive from plain code: start the task (once) and test if it completed
+  void start() { handle_.resume(); }
+  bool done() const { return handle_.done(); }
+  T result() { return handle_.promise().result.get(); }
+
+private:
+  template<class U> friend U await(mp_prompt_t* p, task<U> t);
+  explicit task(std::coroutine_handle<promise_type> h) : handle_(h) { }
+  std::coroutine_handle<promise_type> handle_;
+};
+
+
+/*-----------------------------------------------------------------
+  A prompt awaits a task
+-----------------------------------------------------------------*/
+
+namespace detail {
+
+template<class T>
+void* await_yield_fun(mp_resume_t* r, void* arg) {
+  auto& pr = static_cast<std::coroutine_handle<typename task<T>::promise_type>*>(arg)->promise();
+  pr.resume = r;
+  static_cast<std::coroutine_handle<typename task<T>::promise_type>*>(arg)->resume();  // run until it suspends or completes
+  if (pr.state.exchange(coro_suspended) == coro_done) {
+    return mp_resume_tail(r, nullptr);  // completed synchronously
+  }
+  return nullptr;  // the task resumes us when it completes
+}
+
+}  // namespace detail
+
+// Yield up to the prompt `p`, run the task, and return its result once it completes.
+template<class T>
+T await(mp_prompt_t* p, task<T> t) {
+  mp_yield(p, &detail::await_yield_fun<T>, &t.handle_);
+  return t.handle_.promise().result.get();
+}
+
+
+/*-----------------------------------------------------------------
+  A coroutine awaits a prompt
+-----------------------------------------------------------------*/
+
+template<class T, class F>
+class prompt_awaiter {
+public:
+  explicit prompt_awaiter(F&& fun) : fun_(std::move(fun)) { }
+  explicit prompt_awaiter(const F& fun) : fun_(fun) { }
+  prompt_awaiter(const prompt_awaiter&) = delete;
+  prompt_awaiter& operator=(const prompt_awaiter&) = delete;
+
+  bool await_ready() const noexcept { return false; }
+  bool await_suspend(std::coroutine_handle<> h) {
+    handle_ = h;
+    mp_prompt(&entry, this);  // returns when `fun` is done or when it suspends
+    return (state_.exchange(detail::coro_suspended) != detail::coro_done);
+  }
+  T await_resume() { return result_.get(); }
+
+private:
+  static void* entry(mp_prompt_t* p, void* arg) {
+    prompt_awaiter* self = static_cast<prompt_awaiter*>(arg);
+    try {
+      if constexpr (std::is_void<T>::value) {
+        self->fun_(p);
+      }
+      else {
+        self->result_.set(self->fun_(p));
+      }
+    }
+    catch (...) {
+      self->result_.exn = std::current_exception();
+    }
+    if (self->state_.exchange(detail::coro_done) == detail::coro_suspended) {
+      self->handle_.resume();  // completed asynchronously (note: `self` may be deallocated now)
+    }
+    return nullptr;
+  }
+
+  F                         fun_;
+  std::coroutine_handle<>   handle_;
+  std::atomic<int>          state_{ detail::coro_running };
+  detail::coro_result<T>    result_;
+};
+
+// Run `fun(p)` under a fresh prompt `p` and await its result.
+template<class F>
+auto on_prompt(F&& fun) {
+  typedef typename std::decay<F>::type fun_t;
+  typedef typename std::invoke_result<fun_t&, mp_prompt_t*>::type result_t;
+  return prompt_awaiter<result_t, fun_t>(std::forward<F>(fun));
+}
+
+}  // namespace mp
+
+#endif
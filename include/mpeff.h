@@ -112,12 +112,19 @@ typedef struct mpe_handlerdef_s {
 
 mpe_decl_export void* mpe_handle(const mpe_handlerdef_t* hdef, void* local, mpe_actionfun_t* body, void* arg);
 mpe_decl_export void* mpe_perform(mpe_optag_t optag, void* arg);
+mpe_decl_export void* mpe_perform_op(mpe_effect_t effect, const mpe_operation_t* op, void* arg);  // perform `op` at the innermost handler of `effect` (which must have a prompt if `op` yields)
+mpe_decl_export void* mpe_handler_local(mpe_effect_t effect);  // local state of the innermost handler of `effect` (or NULL)
 
 mpe_decl_export void* mpe_resume(mpe_resume_t* resume, void* local, void* arg);
 mpe_decl_export void* mpe_resume_final(mpe_resume_t* resume, void* local, void* arg);  // final resumption
 mpe_decl_export void* mpe_resume_tail(mpe_resume_t* resume, void* local, void* arg);   // final resumption in tail position
 mpe_decl_export void  mpe_resume_release(mpe_resume_t* resume);                        // final resumption causing unwinding (raise unwind exception on resume)
 
+// Resume in another thread: detach in the thread that performed the operation, and attach in the thread 
+// that resumes (or releases) it. Only resumptions of `MPE_OP_ONCE` and `MPE_OP_MULTI` operations can migrate.
+mpe_decl_export void  mpe_resume_detach(mpe_resume_t* resume);
+mpe_decl_export void  mpe_resume_attach(mpe_resume_t* resume);
+
 
 mpe_decl_export void* mpe_mask(mpe_effect_t eff, size_t from, mpe_actionfun_t* fun, void* arg);
 mpe_decl_export void* mpe_finally(void* local, mpe_releasefun_t* finally_fun, mpe_actionfun_t* fun, void* arg);
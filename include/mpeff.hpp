@@ -0,0 +1,276 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#pragma once
+#ifndef MPE_MPEFF_HPP
+#define MPE_MPEFF_HPP
+
+/*-----------------------------------------------------------------
+  Typed C++ interface to libmpeff (header only).
+
+  An effect is a class that derives from `mpe::effect<E,K>`, where `K`
+  is the most general operation kind used by its operations; and a handler
+  is an instance of (a subclass of) an effect class. For example:
+
+    struct state : mpe::effect<state,MPE_OP_TAIL> {
+      virtual long get() = 0;
+      virtual void set(long x) = 0;
+    };
+    struct state_handler : state {
+      long value;
+      ...
+    };
+
+    state_handler h(42);
+    long res = mpe::handle(h, [&]() { return mpe::handler_of<state>().get(); });
+
+  Operations are performed at compile-time known kinds:
+  - `handler_of<E>().op(...)` is a direct (virtual) call on the innermost
+    handler object for `MPE_OP_TAIL_NOOP` operations,
+  - `perform_tail<E>(f)` calls `f(h)` under the innermost handler `h` for `MPE_OP_TAIL`
+    operations (where `f` can perform operations itself),
+  - `perform<E,K,T,A>(f)` yields to the innermost handler and calls `f(h,r)`
+    with a resumption `r` of type `resume<T,A>` (for `MPE_OP_SCOPED_ONCE` and up),
+  - `perform_abort<E,A,K>(f)` calls `f(h)` without resuming (`MPE_OP_ABORT` and `MPE_OP_NEVER`).
+
+  Handlers are regular `mpe_handle` frames and interoperate with
+  handlers, masks, and finally frames installed through `mpeff.h`.
+  Values passed through resumptions, and results of handled actions, must
+  be trivially copyable and fit in a pointer (as these are passed as a `void*`).
+-----------------------------------------------------------------*/
+
+#include <mpeff.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <typeinfo>
+#include <type_traits>
+#include <utility>
+
+namespace mpe {
+
+/*-----------------------------------------------------------------
+  Effects
+-----------------------------------------------------------------*/
+
+template<class E, mpe_opkind_t MaxKind = MPE_OP_MULTI>
+class effect {
+public:
+  typedef E effect_type;
+  static constexpr mpe_opkind_t max_opkind = MaxKind;   // most general operation kind of this effect
+  static constexpr mpe_effect_t tag() { return names; }  // compatible with the effect tags of `mpeff.h`
+private:
+  static const char* names[2];
+};
+
+template<class E, mpe_opkind_t MaxKind>
+constexpr mpe_opkind_t effect<E,MaxKind>::max_opkind;
+
+template<class E, mpe_opkind_t MaxKind>
+const char* effect<E,MaxKind>::names[2] = { typeid(E).name(), NULL };
+
+
+namespace detail {
+
+// Values are passed as a `void*`
+template<class T>
+struct value {
+  static_assert(std::is_trivially_copyable<T>::value && sizeof(T) <= sizeof(void*),
+                "mpeff: values must be trivially copyable and fit in a pointer");
+  static void* box(T x) {
+    void* p = NULL;
+    memcpy(&p, &x, sizeof(T));
+    return p;
+  }
+  static T unbox(void* p) {
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type x;
+    memcpy(&x, &p, sizeof(T));
+    return *reinterpret_cast<T*>(&x);
+  }
+};
+
+template<>
+struct value<void> {
+  static void unbox(void* p) { (void)(p); }
+};
+
+// Call a function and box its result
+template<class R>
+struct call {
+  template<class F, class... Args>
+  static void* boxed(F& f, Args&&... args) { return value<R>::box(f(std::forward<Args>(args)...)); }
+};
+
+template<>
+struct call<void> {
+  template<class F, class... Args>
+  static void* boxed(F& f, Args&&... args) { f(std::forward<Args>(args)...); return NULL; }
+};
+
+// Only these operation kinds never yield and can run without a prompt (see `mpe_handle`)
+constexpr bool opkind_yields(mpe_opkind_t kind) {
+  return !(kind == MPE_OP_TAIL_NOOP || kind == MPE_OP_TAIL || kind == MPE_OP_NEVER);
+}
+
+// A handler definition with just one (unnamed) operation of the most general kind
+template<class E>
+struct handler_def {
+  static const mpe_handlerdef_t def;
+};
+
+template<class E>
+const mpe_handlerdef_t handler_def<E>::def = { E::tag(), NULL, { { E::max_opkind, NULL, NULL } } };
+
+template<class F, class R>
+struct action {
+  static void* run(void* arg) { return call<R>::boxed(*static_cast<F*>(arg)); }
+};
+
+#if defined(__GNUC__)
+__attribute__((noinline, noreturn))
+#endif
+inline void unhandled(mpe_effect_t effect) {
+  fprintf(stderr, "unhandled effect: %s\n", mpe_effect_name(effect));
+  abort();
+}
+
+}  // namespace detail
+
+
+/*-----------------------------------------------------------------
+  Handle
+-----------------------------------------------------------------*/
+
+// Handle `body()` with handler `h` (an instance of (a subclass of) an effect class).
+template<class H, class F>
+auto handle(H& h, F body) -> decltype(body()) {
+  typedef typename H::effect_type E;
+  typedef decltype(body()) R;
+  E* local = &h;
+  void* res = mpe_handle(&detail::handler_def<E>::def, local, &detail::action<F,R>::run, &body);
+  return detail::value<R>::unbox(res);
+}
+
+// The innermost handler for effect `E`; call `MPE_OP_TAIL_NOOP` operations directly on it.
+template<class E>
+inline typename E::effect_type& handler_of() {
+  typedef typename E::effect_type Eff;
+  void* local = mpe_handler_local(Eff::tag());
+  if (local == NULL) detail::unhandled(Eff::tag());
+  return *static_cast<Eff*>(local);
+}
+
+
+/*-----------------------------------------------------------------
+  Resumptions
+-----------------------------------------------------------------*/
+
+// A resumption that resumes with a `T` and returns the answer `A` of the handler.
+template<class T, class A>
+class resume {
+private:
+  mpe_resume_t* r;
+  void*         local;
+public:
+  resume(mpe_resume_t* r, void* local) : r(r), local(local) { }
+  A operator()(T x) { return detail::value<A>::unbox(mpe_resume(r, local, detail::value<T>::box(x))); }
+  A final(T x)      { return detail::value<A>::unbox(mpe_resume_final(r, local, detail::value<T>::box(x))); }
+  A tail(T x)       { return detail::value<A>::unbox(mpe_resume_tail(r, local, detail::value<T>::box(x))); }
+  void release()    { mpe_resume_release(r); }
+};
+
+template<class A>
+class resume<void,A> {
+private:
+  mpe_resume_t* r;
+  void*         local;
+public:
+  resume(mpe_resume_t* r, void* local) : r(r), local(local) { }
+  A operator()()    { return detail::value<A>::unbox(mpe_resume(r, local, NULL)); }
+  A final()         { return detail::value<A>::unbox(mpe_resume_final(r, local, NULL)); }
+  A tail()          { return detail::value<A>::unbox(mpe_resume_tail(r, local, NULL)); }
+  void release()    { mpe_resume_release(r); }
+};
+
+
+/*-----------------------------------------------------------------
+  Perform
+-----------------------------------------------------------------*/
+
+namespace detail {
+
+template<class E, class F, class T>
+struct tail_op {
+  static void* opfun(mpe_resume_t* r, void* local, void* arg) {
+    (void)(r);
+    return call<T>::boxed(*static_cast<F*>(arg), *static_cast<E*>(local));
+  }
+  static const mpe_operation_t op;
+};
+
+template<class E, class F, class T>
+const mpe_operation_t tail_op<E,F,T>::op = { MPE_OP_TAIL, NULL, &tail_op<E,F,T>::opfun };
+
+template<class E, mpe_opkind_t Kind, class T, class A, class F>
+struct yield_op {
+  static void* opfun(mpe_resume_t* r, void* local, void* arg) {
+    F f(*static_cast<F*>(arg));  // copy first as releasing `r` may free the stack of the perform
+    return call<A>::boxed(f, *static_cast<E*>(local), resume<T,A>(r, local));
+  }
+  static const mpe_operation_t op;
+};
+
+template<class E, mpe_opkind_t Kind, class T, class A, class F>
+const mpe_operation_t yield_op<E,Kind,T,A,F>::op = { Kind, NULL, &yield_op<E,Kind,T,A,F>::opfun };
+
+template<class E, mpe_opkind_t Kind, class A, class F>
+struct abort_op {
+  static void* opfun(mpe_resume_t* r, void* local, void* arg) {
+    (void)(r);
+    F f = value<F>::unbox(arg);  // passed by value as the stack of the perform is gone by now
+    return call<A>::boxed(f, *static_cast<E*>(local));
+  }
+  static const mpe_operation_t op;
+};
+
+template<class E, mpe_opkind_t Kind, class A, class F>
+const mpe_operation_t abort_op<E,Kind,A,F>::op = { Kind, NULL, &abort_op<E,Kind,A,F>::opfun };
+
+}  // namespace detail
+
+
+// Perform a tail resumptive operation (`MPE_OP_TAIL`): `f(h)` runs in place under the innermost handler `h`
+// and its result is returned. In contrast to `handler_of`, `f` can perform operations itself.
+template<class E, class F>
+auto perform_tail(F f) -> decltype(f(std::declval<typename E::effect_type&>())) {
+  typedef typename E::effect_type Eff;
+  typedef decltype(f(std::declval<Eff&>())) T;
+  return detail::value<T>::unbox(mpe_perform_op(Eff::tag(), &detail::tail_op<Eff,F,T>::op, &f));
+}
+
+// Yield to the innermost handler `h` and call `f(h,r)` with a resumption `r` of type `resume<T,A>`.
+template<class E, mpe_opkind_t Kind, class T, class A, class F>
+T perform(F f) {
+  typedef typename E::effect_type Eff;
+  static_assert(Kind >= MPE_OP_SCOPED_ONCE, "mpeff: use handler_of, perform_tail, or perform_abort for this operation kind");
+  static_assert(detail::opkind_yields(Eff::max_opkind), "mpeff: operation kind is more general than the maximal kind of the effect");
+  return detail::value<T>::unbox(mpe_perform_op(Eff::tag(), &detail::yield_op<Eff,Kind,T,A,F>::op, &f));
+}
+
+// Yield to the innermost handler `h` and call `f(h)` without resuming; its result is the answer of the handler.
+// `MPE_OP_NEVER` first unwinds (running destructors) while `MPE_OP_ABORT` does not.
+// Since `f` runs after the stack of the perform is discarded it must be trivially copyable and fit in a pointer.
+template<class E, class A, mpe_opkind_t Kind = MPE_OP_ABORT, class F>
+void perform_abort(F f) {
+  typedef typename E::effect_type Eff;
+  static_assert(Kind == MPE_OP_ABORT || Kind == MPE_OP_NEVER, "mpeff: perform_abort must use MPE_OP_ABORT or MPE_OP_NEVER");
+  static_assert(Kind == Eff::max_opkind || detail::opkind_yields(Eff::max_opkind), "mpeff: operation kind is more general than the maximal kind of the effect");
+  mpe_perform_op(Eff::tag(), &detail::abort_op<Eff,Kind,A,F>::op, detail::value<F>::box(f));
+}
+
+}  // namespace mpe
+
+#endif
@@ -0,0 +1,88 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#pragma once
+#ifndef MP_MPGEN_H
+#define MP_MPGEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mprompt.h>
+
+//---------------------------------------------------------------------------
+// Batched generators (part of libmprompt).
+// A producer runs in its own prompt and fills a buffer provided by the consumer;
+// it only switches back to the consumer when the buffer is full (or when it is done),
+// so each switch transfers an entire batch of elements instead of a single one.
+// A generator can only be used by one thread at a time.
+//---------------------------------------------------------------------------
+
+// Types
+typedef struct mp_gen_s  mp_gen_t;    // a generator
+
+// The producer function
+typedef void (mp_gen_fun_t)(mp_gen_t* gen, void* arg);
+
+// Create a generator that runs `fun(gen,arg)` (on its first fill) producing elements of `elem_size` bytes.
+// The producer runs on a stack of at least `stack_size` bytes (or the default size if 0).
+mp_decl_export mp_gen_t* mp_gen_create(ptrdiff_t stack_size, size_t elem_size, mp_gen_fun_t* fun, void* arg);
+
+// Free a generator; if the producer is not yet done, it is dropped without running further (as in `mp_resume_drop`).
+mp_decl_export void      mp_gen_free(mp_gen_t* gen);
+
+// Consumer: fill `buf` with at most `count` elements and return the number of elements produced.
+// Returns 0 when the generator is done.
+mp_decl_export ptrdiff_t mp_gen_fill(mp_gen_t* gen, void* buf, ptrdiff_t count);
+
+// Producer: return the free space in the current batch and its size (in elements) in `*count`;
+// if the batch is full, this first switches back to the consumer until the next fill.
+mp_decl_export void*     mp_gen_reserve(mp_gen_t* gen, ptrdiff_t* count);
+
+// Producer: mark `n` elements as produced after writing them to the space returned by `mp_gen_reserve`.
+mp_decl_export void      mp_gen_commit(mp_gen_t* gen, ptrdiff_t n);
+
+// Producer: produce a single element (copying `elem_size` bytes from `elem`).
+mp_decl_export void      mp_gen_emit(mp_gen_t* gen, const void* elem);
+
+
+//---------------------------------------------------------------------------
+// Consumer iteration over the elements of a generator using a batch buffer `buf`, as in:
+//
+//   long buf[256];
+//   mp_gen_iter_t it;
+//   mp_gen_iter_init(&it, gen, buf, 256, sizeof(long));
+//   for (long* x; (x = (long*)mp_gen_iter_next(&it)) != NULL; ) { ... }
+//---------------------------------------------------------------------------
+
+typedef struct mp_gen_iter_s {
+  mp_gen_t*  gen;
+  uint8_t*   buf;
+  size_t     elem_size;
+  ptrdiff_t  capacity;    // in elements
+  ptrdiff_t  count;       // elements in the current batch
+  ptrdiff_t  index;       // next element in the current batch
+} mp_gen_iter_t;
+
+static inline void mp_gen_iter_init(mp_gen_iter_t* it, mp_gen_t* gen, void* buf, ptrdiff_t capacity, size_t elem_size) {
+  it->gen = gen;
+  it->buf = (uint8_t*)buf;
+  it->elem_size = elem_size;
+  it->capacity = capacity;
+  it->count = 0;
+  it->index = 0;
+}
+
+// Return a pointer to the next element (valid until the next call), or NULL when the generator is done.
+static inline void* mp_gen_iter_next(mp_gen_iter_t* it) {
+  if (it->index >= it->count) {
+    it->count = mp_gen_fill(it->gen, it->buf, it->capacity);
+    it->index = 0;
+    if (it->count <= 0) return NULL;
+  }
+  return it->buf + (size_t)(it->index++) * it->elem_size;
+}
+
+#endif
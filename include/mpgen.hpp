@@ -0,0 +1,144 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#pragma once
+#ifndef MP_MPGEN_HPP
+#define MP_MPGEN_HPP
+
+/*-----------------------------------------------------------------
+  Typed C++ range interface to the batched generators of `mpgen.h` (header only).
+
+    mp::generator<long> gen([](mp::gen_output<long>& out) {
+      for (long i = 0; i < 1000000; i++) { out.emit(i); }
+    });
+    for (long x : gen) { ... }
+
+  The consumer side holds a buffer of `Batch` elements, and the producer only
+  switches back once that buffer is full. Elements must be trivially copyable.
+  A generator can be iterated only once (it is an input range).
+-----------------------------------------------------------------*/
+
+#include <mpgen.h>
+#include <stddef.h>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+namespace mp {
+
+template<class T, size_t Batch>
+class generator;
+
+// Producer side: emit elements into the current batch
+template<class T>
+class gen_output {
+public:
+  void emit(const T& x) {
+    if (next_ == end_) { reserve(); }
+    *next_++ = x;
+  }
+private:
+  template<class U, size_t B> friend class generator;
+  explicit gen_output(mp_gen_t* gen) : gen_(gen), base_(nullptr), next_(nullptr), end_(nullptr) { }
+
+  void flush() {
+    if (next_ != base_) { mp_gen_commit(gen_, next_ - base_); }
+    base_ = next_;
+  }
+  void reserve() {
+    flush();
+    ptrdiff_t count;
+    base_ = next_ = static_cast<T*>(mp_gen_reserve(gen_, &count));
+    end_  = base_ + count;
+  }
+
+  mp_gen_t* gen_;
+  T*        base_;   // first uncommitted element
+  T*        next_;
+  T*        end_;
+};
+
+
+template<class T, size_t Batch = 256>
+class generator {
+  static_assert(std::is_trivially_copyable<T>::value, "generator elements must be trivially copyable");
+  static_assert(Batch > 0, "the batch size must be positive");
+public:
+  template<class F>
+  explicit generator(F&& fun, ptrdiff_t stack_size = 0)
+    : fun_(std::forward<F>(fun)), count_(0), index_(0)
+  {
+    gen_ = mp_gen_create(stack_size, sizeof(T), &produce<typename std::decay<F>::type>, this);
+  }
+  ~generator() { mp_gen_free(gen_); }
+
+  generator(const generator&) = delete;
+  generator& operator=(const generator&) = delete;
+
+  // Input iterator over the elements
+  class iterator {
+  public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef T                       value_type;
+    typedef ptrdiff_t               difference_type;
+    typedef const T*                pointer;
+    typedef const T&                reference;
+
+    iterator() : gen_(nullptr) { }
+    reference operator*() const  { return gen_->buf_[gen_->index_]; }
+    pointer   operator->() const { return &gen_->buf_[gen_->index_]; }
+    iterator& operator++()       { if (!gen_->advance()) { gen_ = nullptr; } return *this; }
+    void      operator++(int)    { ++*this; }
+    bool operator==(const iterator& it) const { return (gen_ == it.gen_); }
+    bool operator!=(const iterator& it) const { return (gen_ != it.gen_); }
+  private:
+    friend class generator;
+    explicit iterator(generator* gen) : gen_(gen) { }
+    generator* gen_;
+  };
+
+  iterator begin() { return (index_ < count_ || fill() ? iterator(this) : iterator()); }
+  iterator end()   { return iterator(); }
+
+private:
+  template<class F>
+  static void produce(mp_gen_t* gen, void* arg) {
+    generator* g = static_cast<generator*>(arg);
+    gen_output<T> out(gen);
+    (*static_cast<F*>(g->fun_.ptr))(out);
+    out.flush();
+  }
+
+  bool fill() {
+    count_ = mp_gen_fill(gen_, buf_, (ptrdiff_t)Batch);
+    index_ = 0;
+    return (count_ > 0);
+  }
+  bool advance() {
+    return (++index_ < count_ || fill());
+  }
+
+  // owns a copy of the producer function (type-erased so the generator type does not depend on it)
+  struct fun_holder {
+    void* ptr;
+    void (*del)(void*);
+    template<class F>
+    explicit fun_holder(F&& f)
+      : ptr(new typename std::decay<F>::type(std::forward<F>(f))),
+        del([](void* p) { delete static_cast<typename std::decay<F>::type*>(p); }) { }
+    ~fun_holder() { del(ptr); }
+  };
+
+  fun_holder fun_;
+  mp_gen_t*  gen_;
+  ptrdiff_t  count_;
+  ptrdiff_t  index_;
+  T          buf_[Batch];
+};
+
+}  // namespace mp
+
+#endif
@@ -0,0 +1,75 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#pragma once
+#ifndef MPIO_MPIO_H
+#define MPIO_MPIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+//------------------------------------------------------
+// Compiler specific attributes
+//------------------------------------------------------
+#if defined(__GNUC__) // includes clang and icc
+#define mpio_decl_export      __attribute__((visibility("default")))
+#else
+#define mpio_decl_export
+#endif
+
+
+//---------------------------------------------------------------------------
+// Asynchronous I/O event loop (Linux only, using io_uring, or epoll as a fallback)
+// Each task runs in its own prompt; an I/O operation that would block suspends
+// the task until the file descriptor is ready (or the sleep expired), while the
+// event loop resumes the tasks that are ready in batches. The loop is single threaded.
+//
+// File descriptors must be in non-blocking mode (see `mpio_nonblock`), and at most
+// one task can wait on a particular file descriptor at a time.
+// Outside of `mpio_run` the operations are just the plain system calls.
+//---------------------------------------------------------------------------
+
+// Function types
+typedef void* (mpio_task_fun_t)(void* arg);
+
+// Run `fun(arg)` as the main task of an event loop in the current thread and return its result
+// once all tasks are done. Returns NULL (with `errno` set) if the event loop could not be created.
+mpio_decl_export void*   mpio_run(mpio_task_fun_t* fun, void* arg);
+
+// Use io_uring (if available) for the event loops that are started after this call (`true` by default);
+// otherwise epoll is used.
+mpio_decl_export void    mpio_use_uring(bool enable);
+
+// The backend of the current event loop ("io_uring" or "epoll"), or NULL outside an event loop.
+mpio_decl_export const char* mpio_backend(void);
+
+// Spawn a new (detached) task in the current event loop; it runs when the current task suspends.
+// Outside of an event loop, `fun(arg)` is called directly.
+mpio_decl_export void    mpio_spawn(mpio_task_fun_t* fun, void* arg);
+
+// Let other ready tasks run first.
+mpio_decl_export void    mpio_yield(void);
+
+// Suspend the current task for at least `msecs` milli-seconds.
+mpio_decl_export void    mpio_sleep(int64_t msecs);
+
+// I/O operations that suspend the current task while the operation would block.
+// These return as the corresponding system calls (with `errno` set on an error).
+mpio_decl_export ssize_t mpio_read(int fd, void* buf, size_t len);
+mpio_decl_export ssize_t mpio_write(int fd, const void* buf, size_t len);
+mpio_decl_export int     mpio_accept(int fd, struct sockaddr* addr, socklen_t* addrlen);   // the new socket is non-blocking
+mpio_decl_export int     mpio_connect(int fd, const struct sockaddr* addr, socklen_t addrlen);
+
+// Write all `len` bytes (unless an error occurs); returns `len` or -1.
+mpio_decl_export ssize_t mpio_write_all(int fd, const void* buf, size_t len);
+
+// Set a file descriptor in non-blocking mode; returns 0 on success.
+mpio_decl_export int     mpio_nonblock(int fd);
+
+#endif
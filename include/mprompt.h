@@ -29,6 +29,7 @@
 //---------------------------------------------------------------------------
 // Multi-prompt interface
 //---------------------------------------------------------------------------
+#include <stddef.h>  // ptrdiff_t
 
 // Types
 typedef struct mp_prompt_s   mp_prompt_t;     // resumable "prompts" (in-place growable stack chain)
@@ -41,6 +42,11 @@ typedef void* (mp_yield_fun_t)(mp_resume_t*, void* arg);
 // Continue with `fun(p,arg)` under a fresh prompt `p`.
 mp_decl_export void* mp_prompt(mp_start_fun_t* fun, void* arg); 
 
+// Continue under a fresh prompt whose stack is at least `stack_size` bytes but otherwise in the smallest
+// size class available (allowing small stacks, like for generators, to be allocated densely). 
+// Use 0 for the default size (`stack_max_size`).
+mp_decl_export void* mp_prompt_ex(ptrdiff_t stack_size, mp_start_fun_t* fun, void* arg); 
+
 // Yield back up to a parent prompt `p` and run `fun(r,arg)` from there, where `r` is a `mp_resume_t` resumption.
 mp_decl_export void* mp_yield(mp_prompt_t* p, mp_yield_fun_t* fun, void* arg);
 
@@ -49,6 +55,11 @@ mp_decl_export void* mp_resume(mp_resume_t* resume, void* arg);      // resume
 mp_decl_export void* mp_resume_tail(mp_resume_t* resume, void* arg); // resume as the last action in a `mp_yield_fun_t`
 mp_decl_export void  mp_resume_drop(mp_resume_t* resume);            // drop the resume object without resuming
 
+// Symmetric transfer: yield up to `p`, store its resumption in `*self`, and directly resume `target` with `arg`
+// in the place of `p` (as if `mp_resume_tail(target,arg)` is called from the parent of `p`).
+// Returns when the stored resumption is resumed. Switches just once if `target` is a once-resumption.
+mp_decl_export void* mp_resume_to(mp_prompt_t* p, mp_resume_t* target, void* arg, mp_resume_t** self);
+
 
 //---------------------------------------------------------------------------
 // Multi-shot resumptions; use with care in combination with linear resources.
@@ -57,6 +68,32 @@ mp_decl_export void  mp_resume_drop(mp_resume_t* resume);            // drop the
 mp_decl_export mp_resume_t* mp_resume_multi(mp_resume_t* r);  // consume a resumption and return one that can be invoked multiple times
 mp_decl_export mp_resume_t* mp_resume_dup(mp_resume_t* r);    // only multi-resumptions can be dup'd
 
+// A scope for multi-shot resumptions that are resumed and dropped only within the scope (like `MPE_OP_SCOPED` operations).
+// The resumption and its saved stacks are bump allocated in the scope (which starts with a small buffer and continues
+// in chunks from a thread-local cache) and released all at once by `mp_scope_done`. The fields are private.
+#define MP_SCOPE_BUFFER_SIZE  (512)
+
+typedef struct mp_scope_s {
+  void*    _free;
+  void*    _end;
+  void*    _chunks;
+  void*    _buffer[MP_SCOPE_BUFFER_SIZE/sizeof(void*)];
+} mp_scope_t;
+
+mp_decl_export void         mp_scope_init(mp_scope_t* scope);
+mp_decl_export void         mp_scope_done(mp_scope_t* scope);   // all resumptions in the scope must be dropped (or tail resumed)
+mp_decl_export mp_resume_t* mp_resume_multi_scoped(mp_resume_t* r, mp_scope_t* scope);  // like `mp_resume_multi` but allocate in `scope`
+
+
+//---------------------------------------------------------------------------
+// Resuming in another thread: first detach a (suspended) resumption in the thread that
+// yielded, and then attach it in the thread that is going to resume or drop it.
+// A resumption should be used by at most one thread at a time.
+//---------------------------------------------------------------------------
+
+mp_decl_export void mp_resume_detach(mp_resume_t* r);        // allow `r` to be used by another thread
+mp_decl_export void mp_resume_attach(mp_resume_t* r);        // adopt a detached resumption in the current thread
+
 
 
 //---------------------------------------------------------------------------
@@ -64,19 +101,29 @@ mp_decl_export mp_resume_t* mp_resume_dup(mp_resume_t* r);    // only multi-resu
 //---------------------------------------------------------------------------
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 // Configuration settings
 typedef struct mp_config_s {
   bool      gpool_enable;         // enable gpools for in-process reuse of stack memory (besides the thread-local cache)
+  bool      gpool_numa;           // keep gpools per NUMA node and allocate gstacks on the node of the current thread (Linux only)
+  bool      gpool_compact;        // keep all gpool stacks in a single accessible mapping (instead of 2 per stack) and check the gaps in the `userfaultfd` handler (Linux only, implies `stack_use_userfaultfd`).
   bool      stack_grow_fast;      // grow stacks by doubling (to up to 1MiB at a time) instead of per-page
   bool      stack_use_overcommit; // use overcommit on systems that support this (Linux only) -- disables gpools and fast stack growing.
   bool      stack_reset_decommits;// instead of resetting memory in a gpool, use a full decommit in instead.
+  bool      stack_reset_background;// reset the memory of freed gpool stacks in batches from a background thread instead of the freeing thread (not on Windows).
+  bool      stack_save_track_writes; // write protect saved stacks of multi-shot resumptions to only restore changed pages (requires gpools, not on Windows).
+  bool      stack_learn_commit;   // pre-commit fresh gstacks to the average committed size of earlier ones for the same start function or handler (not on Windows).
+  bool      stack_profile;        // record the peak stack usage of gstacks per start function or handler (see `mp_stack_profile_get`); this touches all committed stack memory.
+  bool      stack_use_userfaultfd;// serve page faults in gpool stacks from a `userfaultfd` handler thread instead of a signal handler (Linux with overcommit only; falls back to the signal handler).
+  bool      stack_huge_pages;     // back the base of gpool stacks with a transparent huge page (Linux only, not with `stack_use_userfaultfd`); this commits a huge page (2 MiB) per gstack.
   ptrdiff_t gpool_max_size;       // maximum virtual size per gpool (256 GiB)
   ptrdiff_t stack_max_size;       // maximum virtual size of a gstack (8 MiB)
   ptrdiff_t stack_exn_guaranteed; // guaranteed extra stack space available during exception unwinding (Windows only) (16 KiB)
   ptrdiff_t stack_initial_commit; // initial commit size of a gstack (OS page size, 4 KiB)
   ptrdiff_t stack_gap_size;       // virtual no-access gap between stacks for security (64 KiB)
   ptrdiff_t stack_cache_count;    // count of gstacks to keep in a thread-local cache (4)  
+  ptrdiff_t stack_cache_commit_max; // committed memory above this is decommitted when a cached gstack is evicted (256 KiB, -1 to never decommit)
 } mp_config_t;
 
 // Initialize with `config`; use NULL for default settings.
@@ -84,6 +131,7 @@ typedef struct mp_config_s {
 // Use as: `mp_config_t config = mp_config_default(); config.<setting> = <N>; mp_init(&config);`.
 mp_decl_export void        mp_init(const mp_config_t* config);
 mp_decl_export mp_config_t mp_config_default(void);  // default configuration for this platform
+mp_decl_export mp_config_t mp_config_current(void);  // configuration in effect after `mp_init` (where settings that are not available are disabled)
 
 
 
@@ -95,17 +143,140 @@ mp_decl_export mp_config_t mp_config_default(void);  // default configuration fo
 // Get a portable backtrace
 mp_decl_export int          mp_backtrace(void** backtrace, int len);
 
+// Get a backtrace by walking the frame pointers through all prompts in the current chain (without switching stacks).
+// This is async-signal-safe; in a signal handler (like `SIGPROF`), pass the instruction, stack, and frame pointer
+// of the interrupted context to `mp_backtrace_fp_from` (e.g. `REG_RIP`, `REG_RSP`, and `REG_RBP` of the `ucontext_t`).
+// The code needs to be compiled with frame pointers (`MP_FRAME_POINTERS`) to get complete backtraces.
+mp_decl_export int          mp_backtrace_fp(void** backtrace, int len);
+mp_decl_export int          mp_backtrace_fp_from(void* ip, void* sp, void* fp, void** backtrace, int len);
+
 // How often is this resumption resumed?
 mp_decl_export long         mp_resume_resume_count(mp_resume_t* r);
 mp_decl_export int          mp_resume_should_unwind(mp_resume_t* r);  // refcount==1 && resume_count==0
 
 // Separate prompt creation
 mp_decl_export mp_prompt_t* mp_prompt_create(void);
+mp_decl_export mp_prompt_t* mp_prompt_create_ex(ptrdiff_t stack_size);   // see `mp_prompt_ex`
+mp_decl_export mp_prompt_t* mp_prompt_create_at(ptrdiff_t stack_size, const void* site);  // learn the initial commit per `site` (like the start function)
 mp_decl_export void* mp_prompt_enter(mp_prompt_t* p, mp_start_fun_t* fun, void* arg) ;
 
+// Bytes held by the thread-local arena for saved stacks of multi-shot resumptions,
+// and return its unused memory (and the cached chunks of scopes) to the system.
+mp_decl_export ptrdiff_t    mp_save_arena_size(void);
+mp_decl_export void         mp_save_arena_collect(void);
+
+// Reclaim unused memory of the current thread: decommit cached gstacks (or free them all if `all`) 
+// and release unused memory of saved stacks.
+mp_decl_export void         mp_collect(bool all);
+
+// Pre-allocate `count` gstacks in the current thread with up to `commit` bytes committed and touched (to avoid a cold start).
+// Up to `stack_cache_count` gstacks are kept in the thread-local cache and the rest are freed to the gpool (if enabled).
+// Can be called by each worker thread when it starts. Returns the number of gstacks in the thread-local cache.
+mp_decl_export ptrdiff_t    mp_prewarm(ptrdiff_t count, ptrdiff_t commit);
+
+// Statistics; the counters are kept per thread and merged over all threads (including terminated ones) on request.
+// Counters of threads that are running are read without synchronization and thus approximate.
+typedef struct mp_stats_s {
+  int64_t   prompts_created;      // prompts created (`mp_prompt`, `mp_prompt_create`, ...)
+  int64_t   yields;               // yields to a parent prompt
+  int64_t   resumes;              // resumes of once resumptions (excluding tail resumes)
+  int64_t   resumes_tail;         // tail resumes of once resumptions
+  int64_t   resumes_multi;        // resumes of multi-shot resumptions (including tail resumes)
+  int64_t   gstack_allocs;        // gstacks allocated
+  int64_t   gstack_cache_hits;    // gstack allocations served by the thread-local cache
+  int64_t   gstack_gpool_allocs;  // fresh gstacks allocated in a gpool
+  int64_t   gstack_huge_pages;    // fresh gstacks with their base backed by a transparent huge page (see `stack_huge_pages`)
+  int64_t   gpool_numa_binds;     // gpools bound to the NUMA node of the thread that created them (see `gpool_numa`)
+  int64_t   gpool_compacts;       // gpools with all their gstacks in one accessible mapping (see `gpool_compact`)
+  int64_t   gstack_os_frees;      // gstacks released to the OS (or the gpool)
+  int64_t   gstack_delayed_frees; // gstacks freed with a delay (during exception unwinding)
+  int64_t   gstack_remote_frees;  // gstacks freed in another thread than the owner
+  int64_t   gstack_background_resets; // freed gstacks reset by the background thread (see `stack_reset_background`)
+  int64_t   gstack_reclaims;      // cached gstacks whose high-water mark was decommitted
+  int64_t   page_faults;          // page faults served to grow a gstack (commit-on-demand)
+  int64_t   uffd_faults;          // page faults served by the `userfaultfd` handler thread (included in `page_faults`)
+  int64_t   track_faults;         // write faults served to track changes to saved stacks (see `stack_save_track_writes`)
+  int64_t   committed;            // currently committed bytes in gstacks (estimate)
+  int64_t   reserved;             // currently reserved virtual bytes of gstacks
+  int64_t   saves;                // stack saves of multi-shot resumptions
+  int64_t   saves_shared;         // stack saves that shared an unchanged earlier snapshot
+  int64_t   save_bytes;           // bytes copied to save stacks
+  int64_t   restore_bytes;        // bytes copied to restore stacks
+  int64_t   restores_skipped;     // stack restores skipped as the stack was still in place
+} mp_stats_t;
+
+mp_decl_export mp_stats_t   mp_stats_get(void);
+mp_decl_export void         mp_stats_print(void);   // print the statistics to the output (`stderr`)
+
+// Stack profiles (if enabled with `stack_profile`): the peak stack usage of freed gstacks aggregated
+// per site (the start function of a prompt, or handler definition of an effect handler).
+#define MP_STACK_PROFILE_BUCKETS  (14)
+
+typedef struct mp_stack_profile_s {
+  const void* site;               // start function or handler definition (NULL for sites that are unknown or that did not fit)
+  int64_t     count;              // gstacks freed
+  int64_t     used_total;         // sum of the peak usages (in bytes)
+  int64_t     used_max;           // maximal peak usage
+  int64_t     committed_max;      // maximal committed size
+  int64_t     truncated;          // peak usages that exceeded the profiled area (only with overcommit, counted as 1MiB)
+  int64_t     histogram[MP_STACK_PROFILE_BUCKETS];  // count of peak usages of at most 1KiB, 2KiB, ..., 4MiB, and above
+} mp_stack_profile_t;
+
+mp_decl_export ptrdiff_t    mp_stack_profile_get(mp_stack_profile_t* profiles, ptrdiff_t max);  // copy up to `max` profiles and return the count
+mp_decl_export void         mp_stack_profile_print(void);   // print the histograms to the output (`stderr`)
+
+// Trace events; these are only recorded if the library is compiled with `MP_TRACE` (`cmake -DMP_TRACE=ON`).
+// Each thread records its most recent events in a ring buffer.
+typedef enum mp_trace_kind_e {
+  MP_TRACE_PROMPT_ENTER,   // enter a fresh prompt `obj`
+  MP_TRACE_YIELD,          // yield to prompt `obj`
+  MP_TRACE_RESUME,         // resume a suspended prompt `obj` (`arg` is 1 for a tail resume)
+  MP_TRACE_GSTACK_ALLOC,   // allocate gstack `obj` (`arg` is 1 if it came from the thread-local cache)
+  MP_TRACE_GSTACK_FREE,    // free gstack `obj` (`arg` is its committed size)
+  MP_TRACE_GSTACK_SAVE,    // save the stack of gstack `obj` for a multi-shot resumption (`arg` is the used stack size)
+  MP_TRACE_PAGE_FAULT,     // commit-on-demand of the stack page at `obj` (`arg` is the extra committed size)
+  MP_TRACE_TRACK_FAULT,    // write fault on a tracked saved stack at page `obj`
+  MP_TRACE_KIND_COUNT
+} mp_trace_kind_t;
+
+typedef struct mp_trace_event_s {
+  uint64_t        time;    // timestamp in cycles (on x64 and arm64) or nano seconds
+  mp_trace_kind_t kind;
+  const void*     obj;
+  int64_t         arg;
+} mp_trace_event_t;
+
+mp_decl_export ptrdiff_t    mp_trace_events(mp_trace_event_t* events, ptrdiff_t max);  // copy up to `max` most recent events of this thread (oldest first)
+mp_decl_export const char*  mp_trace_kind_name(mp_trace_kind_t kind);
+mp_decl_export void         mp_trace_print(void);   // print the recent events of this thread to the output (`stderr`)
+
 // Walk the chain of prompts.
 mp_decl_export mp_prompt_t* mp_prompt_top(void);
 mp_decl_export mp_prompt_t* mp_prompt_parent(mp_prompt_t* p);
 
+// Prompt local storage: slots that are stored in the current prompt (or the thread if not running in a prompt).
+// A fresh prompt inherits the values of its parent when it is entered, and the values are saved and restored
+// with multi-shot resumptions. Unlike thread-locals, they stay with a prompt that is resumed in another thread.
+// Use `mp_prompt_locals()[slot]` for direct access (valid until the next yield or resume).
+#define MP_PROMPT_LOCAL_COUNT  (8)
+
+mp_decl_export ptrdiff_t    mp_prompt_local_new(void);      // allocate a fresh slot (or -1 if all slots are in use)
+mp_decl_export void*        mp_prompt_local_get(ptrdiff_t slot);
+mp_decl_export void         mp_prompt_local_set(ptrdiff_t slot, void* value);
+mp_decl_export void**       mp_prompt_locals(void);         // the slots of the current prompt
+
+// Cooperative preemption: each thread has a "should yield" flag that can be set asynchronously (by a timer thread
+// or a signal handler) and is checked at preemption points, namely every `mpe_perform` and explicit `mp_maybe_yield` calls.
+// At a preemption point where the flag is set, the flag is cleared and the preemption handler of the thread is called;
+// a scheduler can use this to yield the current task back to its prompt (see `mps_set_time_slice`).
+typedef void (mp_preempt_fun_t)(void);
+typedef struct mp_preempt_s mp_preempt_t;
+
+mp_decl_export mp_preempt_t*     mp_preempt_current(void);                      // the flag of the current thread (valid while the thread is alive)
+mp_decl_export void              mp_preempt_request(mp_preempt_t* preempt);     // set the flag (from any thread; async-signal-safe)
+mp_decl_export void              mp_preempt_clear(mp_preempt_t* preempt);       // clear the flag (from any thread; async-signal-safe)
+mp_decl_export mp_preempt_fun_t* mp_preempt_set_handler(mp_preempt_fun_t* fun); // set the handler of the current thread and return the previous one
+mp_decl_export bool              mp_maybe_yield(void);                          // preemption point; returns `true` if the handler was called
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,100 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#pragma once
+#ifndef MPS_MPSCHED_H
+#define MPS_MPSCHED_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+//------------------------------------------------------
+// Compiler specific attributes
+//------------------------------------------------------
+#if defined(_MSC_VER) || defined(__MINGW32__)
+#if !defined(MP_SHARED_LIB)
+#define mps_decl_export
+#elif defined(MP_SHARED_LIB_EXPORT)
+#define mps_decl_export      __declspec(dllexport)
+#else
+#define mps_decl_export      __declspec(dllimport)
+#endif
+#elif defined(__GNUC__) // includes clang and icc
+#define mps_decl_export      __attribute__((visibility("default")))
+#else
+#define mps_decl_export
+#endif
+
+
+//---------------------------------------------------------------------------
+// Work-stealing scheduler
+// Tasks run in their own prompt on a pool of threads; each thread has a local
+// deque of runnable tasks and idle threads steal from the other threads.
+// A suspended task may resume in another thread than where it was suspended.
+//---------------------------------------------------------------------------
+
+// Types
+typedef struct mps_task_s   mps_task_t;       // a spawned task
+
+// Function types
+typedef void* (mps_task_fun_t)(void* arg);
+
+// Run `fun(arg)` as the root task on a pool of `thread_count` threads (including the calling thread)
+// and return its result when it is done. Use 0 for the number of processors.
+mps_decl_export void*       mps_run(size_t thread_count, mps_task_fun_t* fun, void* arg);
+
+// Spawn a new task; each spawned task must be awaited exactly once.
+mps_decl_export mps_task_t* mps_spawn(mps_task_fun_t* fun, void* arg);
+
+// Wait for a task to finish and return its result (and free the task).
+mps_decl_export void*       mps_await(mps_task_t* task);
+
+// Let other tasks run first.
+mps_decl_export void        mps_yield(void);
+
+// The number of threads in the current scheduler (or 0 if not running in a task).
+mps_decl_export size_t      mps_thread_count(void);
+
+// Set the time slice (in micro-seconds) for subsequent calls to `mps_run`; 0 (the default) disables preemption.
+// A timer thread asks a task that keeps running longer than a time slice to yield, which it does at its next
+// preemption point (`mpe_perform` or `mp_maybe_yield`) so other tasks on its thread can run in the mean time.
+mps_decl_export void        mps_set_time_slice(size_t usecs);
+
+
+//---------------------------------------------------------------------------
+// Bounded channels between tasks
+// A send suspends the task while the channel is full, and a receive suspends while
+// the channel is empty. Each channel has at most one receiving task at a time.
+//---------------------------------------------------------------------------
+
+typedef struct mps_chan_s   mps_chan_t;
+
+typedef enum mps_chan_kind_e {
+  MPS_CHAN_LOCAL,     // only used by tasks of a single threaded scheduler (`mps_run(1,...)`); needs no atomic operations
+  MPS_CHAN_MPSC       // any number of senders on any thread and a single receiver (lock-free)
+} mps_chan_kind_t;
+
+// Create a channel that buffers `capacity` values (rounded up to a power of 2 of at least 2).
+mps_decl_export mps_chan_t* mps_chan_create(size_t capacity, mps_chan_kind_t kind);
+
+// Free a channel; there should be no more tasks using it.
+mps_decl_export void        mps_chan_free(mps_chan_t* ch);
+
+// Send a value (suspending while the channel is full); returns `false` if the channel was closed.
+mps_decl_export bool        mps_chan_send(mps_chan_t* ch, void* value);
+
+// Receive a value (suspending while the channel is empty); returns `false` if the channel is closed and empty.
+mps_decl_export bool        mps_chan_recv(mps_chan_t* ch, void** value);
+
+// Receive a value from the first of `count` channels (of the same kind) that has one and return
+// the index of that channel, or -1 if all channels are closed and empty.
+mps_decl_export ptrdiff_t   mps_chan_select(mps_chan_t** chans, size_t count, void** value);
+
+// Close a channel: pending and later sends fail, while receives still return the buffered values.
+mps_decl_export void        mps_chan_close(mps_chan_t* ch);
+
+
+#endif
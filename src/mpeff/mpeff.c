@@ -16,6 +16,7 @@
 
 #include <mprompt.h>
 #include "mpeff.h"
+#include "internal/preempt.h"
 
 
 /*-----------------------------------------------------------------
@@ -80,7 +81,7 @@ typedef struct mpe_frame_s {
 // A handler frame
 typedef struct mpe_frame_handle_s {
   mpe_frame_t             frame;
-  mp_prompt_t*            prompt;
+  mp_prompt_t*            prompt;     // NULL if no operation can yield (see `mpe_handlerdef_is_promptless`)
   const mpe_handlerdef_t* hdef;
   void*                   local;
   mpe_frame_t*            resume_top;
@@ -121,19 +122,45 @@ typedef enum mpe_resumption_kind_e {
   MPE_RESUMPTION_INPLACE,           
   MPE_RESUMPTION_SCOPED_ONCE,       
   MPE_RESUMPTION_ONCE,              
+  MPE_RESUMPTION_SCOPED,            // only used for performing; resumptions are `MPE_RESUMPTION_MULTI` (allocated in a scope)
   MPE_RESUMPTION_MULTI
 } mpe_resumption_kind_t;
 
 
-// A resumption
+// A resumption.
+// Only in-place and scoped resumptions are represented by this structure (which is stack allocated).
+// Once and multi-shot resumptions are encoded as the `mp_resume_t*` itself tagged in the 
+// lower 2 bits (which are always zero for `mp_resume_t` pointers) so these need no allocation.
 struct mpe_resume_s {
-  mpe_resumption_kind_t kind;       // todo: encode kind in lower bits so we can avoid allocating resumes?
+  mpe_resumption_kind_t kind;       // MPE_RESUMPTION_INPLACE || MPE_RESUMPTION_SCOPED_ONCE
   union {
     void**        plocal;           // kind == MPE_RESUMPTION_INPLACE
-    mp_resume_t*  resume;           // kind == MPE_RESUMPTION_SCOPED_ONCE || MPE_RESUMPTION_ONCE || MPE_RESUME_MULTI
+    mp_resume_t*  resume;           // kind == MPE_RESUMPTION_SCOPED_ONCE
   } mp;
 };
 
+#define MPE_RESUME_TAG_ONCE   ((intptr_t)1)
+#define MPE_RESUME_TAG_MULTI  ((intptr_t)2)
+#define MPE_RESUME_TAG_MASK   ((intptr_t)3)
+
+static inline mpe_resume_t* mpe_resume_tagged(mp_resume_t* mpr, intptr_t tag) {
+  mpe_assert_internal(((intptr_t)mpr & MPE_RESUME_TAG_MASK) == 0);
+  return (mpe_resume_t*)((intptr_t)mpr | tag);
+}
+
+static inline mpe_resumption_kind_t mpe_resume_kind(const mpe_resume_t* r) {
+  const intptr_t tag = ((intptr_t)r & MPE_RESUME_TAG_MASK);
+  if (mpe_likely(tag == 0)) return r->kind;
+  return (tag == MPE_RESUME_TAG_ONCE ? MPE_RESUMPTION_ONCE : MPE_RESUMPTION_MULTI);
+}
+
+// The underlying `mp_resume_t` (for all kinds but `MPE_RESUMPTION_INPLACE`)
+static inline mp_resume_t* mpe_resume_mp(const mpe_resume_t* r) {
+  const intptr_t tag = ((intptr_t)r & MPE_RESUME_TAG_MASK);
+  if (tag == 0) return r->mp.resume;
+  return (mp_resume_t*)((intptr_t)r & ~MPE_RESUME_TAG_MASK);
+}
+
 
 /*-----------------------------------------------------------------
   Handler shadow stack
@@ -142,6 +169,129 @@ struct mpe_resume_s {
 // Top of the frames in the current execution stack
 mpe_decl_thread mpe_frame_t* mpe_frame_top;
 
+// A suspended handler may be resumed in another thread (see `mpe_resume_attach`) but a compiler 
+// can reuse the address of a thread-local that was computed before the suspension. We therefore
+// access `mpe_frame_top` through this non-inlined function after a potential suspension.
+static mpe_decl_noinline mpe_frame_t** mpe_frame_top_fresh(void) {
+  #if defined(__GNUC__)
+  __asm__ volatile ("");  // prevent the compiler from regarding this function as pure
+  #endif
+  return &mpe_frame_top;
+}
+
+
+
+/*-----------------------------------------------------------------
+  Find cache
+  Optionally cache the innermost handler per effect so repeated performs
+  of the same effect do not walk the whole chain of frames. Each state of
+  the frame chain is identified by a `version`; it changes whenever frames
+  are pushed, popped, or (un)linked on a yield or resume. On a pop we restore
+  the version of the frame chain at the push (if nothing was (un)linked since)
+  so the cache stays valid across (tail resumptive) operations and nested handlers.
+  Versions are allocated in blocks from a global counter and are thus unique
+  over all threads (as suspended frames may be resumed in another thread).
+-----------------------------------------------------------------*/
+
+#if !defined(MPE_USE_FIND_CACHE)
+#define MPE_USE_FIND_CACHE  (1)
+#endif
+
+#if MPE_USE_FIND_CACHE
+#include "internal/atomic.h"
+
+#define MPE_FIND_CACHE_SIZE     (16)              // power of 2
+#define MPE_FIND_VERSION_BLOCK  ((uint64_t)1 << 32)
+
+typedef struct mpe_find_entry_s {
+  mpe_effect_t        effect;
+  mpe_frame_t*        handler;
+  uint64_t            version;     // the version of the frame chain at the time of the lookup
+} mpe_find_entry_t;
+
+typedef struct mpe_find_cache_s {
+  uint64_t            version;     // version of the current frame chain (0 for the initial empty chain)
+  uint64_t            next;        // next fresh version
+  uint64_t            limit;       // end of the current version block
+  mpe_find_entry_t    entries[MPE_FIND_CACHE_SIZE];
+} mpe_find_cache_t;
+
+mpe_decl_thread mpe_find_cache_t mpe_find_cache;
+
+static _Atomic(uint64_t) mpe_find_version_blocks;
+
+// See `mpe_frame_top_fresh`
+static mpe_decl_noinline mpe_find_cache_t* mpe_find_cache_fresh(void) {
+  #if defined(__GNUC__)
+  __asm__ volatile ("");
+  #endif
+  return &mpe_find_cache;
+}
+
+// Set a fresh version as the frame chain changed
+static void mpe_find_cache_invalidate(mpe_find_cache_t* cache) {
+  if (mpe_unlikely(cache->next == cache->limit)) {
+    cache->next = (mp_atomic_add(&mpe_find_version_blocks, 1) + 1) * MPE_FIND_VERSION_BLOCK;
+    cache->limit = cache->next + MPE_FIND_VERSION_BLOCK;
+  }
+  cache->version = cache->next++;
+}
+
+static inline mpe_find_entry_t* mpe_find_cache_entry(mpe_find_cache_t* cache, mpe_effect_t effect) {
+  return &cache->entries[((uintptr_t)effect >> 4) % MPE_FIND_CACHE_SIZE];
+}
+#endif
+
+
+// Keeps the state needed to pop a frame again
+typedef struct mpe_frame_mark_s {
+  bool      once;       // for the C version of `mpe_with_frame`
+  #if MPE_USE_FIND_CACHE
+  uint64_t  version;    // find cache version at the push
+  uint64_t  pushed;     // find cache version right after the push
+  #endif
+} mpe_frame_mark_t;
+
+static inline mpe_frame_mark_t mpe_frame_push(mpe_frame_t* f) {
+  mpe_frame_mark_t mark;
+  mark.once = true;
+  f->parent = mpe_frame_top;
+  mpe_frame_top = f;
+  #if MPE_USE_FIND_CACHE
+  mpe_find_cache_t* cache = &mpe_find_cache;
+  mark.version = cache->version;
+  mpe_find_cache_invalidate(cache);
+  mark.pushed = cache->version;
+  #endif
+  return mark;
+}
+
+// Not inlined as we may be running in another thread than at the push (see `mpe_frame_top_fresh`)
+static mpe_decl_noinline void mpe_frame_pop(mpe_frame_t* f, mpe_frame_mark_t* mark) {
+  #if defined(__GNUC__)
+  __asm__ volatile ("");
+  #endif
+  mpe_assert_internal(mpe_frame_top == f);
+  mpe_frame_top = f->parent;
+  mark->once = false;
+  #if MPE_USE_FIND_CACHE
+  mpe_find_cache_t* cache = &mpe_find_cache;
+  if (mpe_likely(cache->version == mark->pushed)) {
+    cache->version = mark->version;  // back at the frame chain as it was at the push
+  }
+  else {
+    mpe_find_cache_invalidate(cache);
+  }
+  #endif
+}
+
+// The frame chain was changed directly
+static inline void mpe_frame_top_changed(void) {
+  #if MPE_USE_FIND_CACHE
+  mpe_find_cache_invalidate(mpe_find_cache_fresh());
+  #endif
+}
+
 
 // use as: `{mpe_with_frame(f){ <body> }}`
 #if MPE_HAS_TRY
@@ -150,23 +300,22 @@ mpe_decl_thread mpe_frame_t* mpe_frame_top;
 class mpe_raii_with_frame_t {
 private:
   mpe_frame_t* f;
+  mpe_frame_mark_t mark;
 public:
   mpe_raii_with_frame_t(mpe_frame_t* f) {
     this->f = f;
-    f->parent = mpe_frame_top;
-    mpe_frame_top = f;
+    this->mark = mpe_frame_push(f);
   }
   ~mpe_raii_with_frame_t() {
-    mpe_assert_internal(mpe_frame_top == f);
-    mpe_frame_top = f->parent;
+    mpe_frame_pop(f, &mark);
   }
 };
 #else
 // C version
 #define mpe_with_frame(f) \
-  for( bool _once = ((f)->parent = mpe_frame_top, mpe_frame_top = (f), true); \
-       _once; \
-       _once = (mpe_frame_top = (f)->parent, false) ) 
+  for( mpe_frame_mark_t _mark = mpe_frame_push(f); \
+       _mark.once; \
+       mpe_frame_pop(f, &_mark) ) 
 #endif
 
 
@@ -254,19 +403,49 @@ typedef struct mpe_resume_env_s {
 } mpe_resume_env_t;
 
 
+// Scoped multi-shot resumption: it is only used within the operation, so the resumption
+// and its saved stacks are allocated in a scope that is released when the operation returns.
+// (the initial part of the scope is in this frame; note that a tail resume never returns here 
+//  and releases the scope itself)
+static mpe_decl_noinline void* mpe_perform_op_clause_scoped(mp_resume_t* mpr, mpe_perform_env_t* env) {
+  mp_scope_t scope;
+  mp_scope_init(&scope);
+  mpe_resume_t* resume = mpe_resume_tagged(mp_resume_multi_scoped(mpr, &scope), MPE_RESUME_TAG_MULTI);
+  void* result = NULL;
+  #if MPE_HAS_TRY
+  try {
+  #endif
+    result = (env->opfun)(resume, env->local, env->oparg);
+  #if MPE_HAS_TRY
+  }
+  catch (...) {
+    mp_scope_done(&scope);
+    throw;
+  }
+  #endif
+  mp_scope_done(&scope);
+  return result;
+}
+
 // Regular once resumption
 static void* mpe_perform_op_clause(mp_resume_t* mpr, void* earg) {
   mpe_perform_env_t* env = (mpe_perform_env_t*)earg;
   mpe_resume_t resume_stack;
   mpe_resume_t* resume;
   if (mpe_likely(env->rkind == MPE_RESUMPTION_SCOPED_ONCE)) {
+    resume_stack.kind = MPE_RESUMPTION_SCOPED_ONCE;
+    resume_stack.mp.resume = mpr;
     resume = &resume_stack;
   }
+  else if (env->rkind == MPE_RESUMPTION_ONCE) {
+    resume = mpe_resume_tagged(mpr, MPE_RESUME_TAG_ONCE);
+  }
+  else if (env->rkind == MPE_RESUMPTION_SCOPED) {
+    return mpe_perform_op_clause_scoped(mpr, env);
+  }
   else {
-    resume = mpe_malloc_tp(mpe_resume_t);
-  }    
-  resume->kind = env->rkind;
-  resume->mp.resume = (env->rkind == MPE_RESUMPTION_MULTI ? mp_resume_multi(mpr) : mpr);
+    resume = mpe_resume_tagged(mp_resume_multi(mpr), MPE_RESUME_TAG_MULTI);
+  }
   return (env->opfun)(resume, env->local, env->oparg);
 }
 
@@ -274,13 +453,17 @@ static void* mpe_perform_op_clause(mp_resume_t* mpr, void* earg) {
 static void* mpe_perform_yield_to(mpe_resumption_kind_t rkind, mpe_frame_handle_t* h, const mpe_operation_t* op, void* arg) {
   mpe_frame_t* resume_top = mpe_frame_top; // save current top
   mpe_frame_top = h->frame.parent;           // and unlink handlers
+  mpe_frame_top_changed();
   mpe_perform_env_t penv = { rkind, op->opfun, h->local, arg };
+  mpe_assert(h->prompt != NULL);  // only operations of handlers with a prompt can yield
   // yield up
   mpe_resume_env_t* renv = (mpe_resume_env_t*)mp_yield(h->prompt, &mpe_perform_op_clause, &penv);
-  // resumed!                     
+  // resumed! (possibly in another thread)
+  mpe_frame_t** top = mpe_frame_top_fresh();
   h->local = renv->local;           // set new state
-  h->frame.parent = mpe_frame_top;  // relink handlers
-  mpe_frame_top = resume_top;
+  h->frame.parent = *top;           // relink handlers
+  *top = resume_top;
+  mpe_frame_top_changed();
   if (renv->unwind) {
     mpe_unwind_to(h, &mpe_op_unwind, renv->result);
   }
@@ -296,6 +479,9 @@ static void* mpe_perform_op_clause_abort(mp_resume_t* mpr, void* earg) {
 
 static void* mpe_perform_yield_to_abort(mpe_frame_handle_t* h, const mpe_operation_t* op, void* arg) {
   mpe_perform_env_t env = { MPE_RESUMPTION_SCOPED_ONCE /* unused */, op->opfun, h->local, arg };
+  mpe_assert(h->prompt != NULL);
+  mpe_frame_top = h->frame.parent;  // unlink handlers as the frames above are never popped
+  mpe_frame_top_changed();
   return mp_yield(h->prompt, &mpe_perform_op_clause_abort, &env);
 }
 
@@ -342,6 +528,9 @@ static void* mpe_perform_at(mpe_frame_handle_t* h, const mpe_operation_t* op, vo
   else if (opkind == MPE_OP_ABORT) {
     return mpe_perform_yield_to_abort(h, op, arg);
   }
+  else if (opkind == MPE_OP_SCOPED) {
+    return mpe_perform_yield_to(MPE_RESUMPTION_SCOPED, h, op, arg);
+  }
   else {
     return mpe_perform_yield_to(MPE_RESUMPTION_MULTI, h, op, arg);    
   }
@@ -352,12 +541,28 @@ static mpe_decl_noinline void* mpe_unhandled_operation(mpe_optag_t optag) {
   return NULL;
 }
 
+static mpe_decl_noinline void* mpe_unhandled_effect(mpe_effect_t effect) {
+  fprintf(stderr, "unhandled effect: %s\n", mpe_effect_name(effect));
+  return NULL;
+}
+
+// Does an operation of this kind yield to the prompt of its handler?
+static bool mpe_opkind_yields(mpe_opkind_t opkind) {
+  return !(opkind == MPE_OP_TAIL_NOOP || opkind == MPE_OP_TAIL || (MPE_HAS_TRY && opkind == MPE_OP_NEVER));
+}
+
+// An operation outside the handler definition that needs to yield but the handler has no prompt
+static mpe_decl_noinline void* mpe_unyieldable_operation(mpe_effect_t effect, const mpe_operation_t* op) {
+  fprintf(stderr, "operation of kind %d cannot yield to a handler without a prompt: %s\n", (int)op->opkind, mpe_effect_name(effect));
+  mpe_assert(false);
+  return NULL;
+}
+
 
 // Perform finds the innermost handler and performs the operation
 // note: this is performance sensitive code
-static mpe_frame_handle_t* mpe_find(mpe_optag_t optag) {
+static mpe_frame_handle_t* mpe_find(mpe_effect_t opeff) {
   mpe_frame_t* f = mpe_frame_top;
-  mpe_effect_t opeff = optag->effect;
   size_t mask_level = 0;
   while (mpe_likely(f != NULL)) {
     mpe_effect_t eff = f->effect;
@@ -390,13 +595,63 @@ static mpe_frame_handle_t* mpe_find(mpe_optag_t optag) {
   return NULL;
 }
 
+#if MPE_USE_FIND_CACHE
+static inline mpe_frame_handle_t* mpe_find_cached(mpe_effect_t effect) {
+  mpe_find_cache_t* cache = &mpe_find_cache;
+  mpe_find_entry_t* e = mpe_find_cache_entry(cache, effect);
+  if (mpe_likely(e->effect == effect && e->version == cache->version)) {
+    return (mpe_frame_handle_t*)e->handler;
+  }
+  mpe_frame_handle_t* h = mpe_find(effect);
+  if (mpe_likely(h != NULL)) {
+    e->effect = effect;
+    e->handler = &h->frame;
+    e->version = cache->version;
+  }
+  return h;
+}
+#else
+#define mpe_find_cached(effect)  mpe_find(effect)
+#endif
+
+// Called at a preemption point when preemption was requested; after `mp_maybe_yield` we
+// may run in another thread so the operation is performed afresh (see `mp_preempt_is_requested`).
+static mpe_decl_noinline void* mpe_perform_preempted(mpe_optag_t optag, void* arg) {
+  mp_maybe_yield();
+  return mpe_perform(optag, arg);
+}
+
+static mpe_decl_noinline void* mpe_perform_op_preempted(mpe_effect_t effect, const mpe_operation_t* op, void* arg) {
+  mp_maybe_yield();
+  return mpe_perform_op(effect, op, arg);
+}
+
 void* mpe_perform(mpe_optag_t optag, void* arg) {
-  mpe_frame_handle_t* h = mpe_find(optag);
+  // preemption point (before finding the handler as we may resume in another thread)
+  if (mp_preempt_is_requested()) return mpe_perform_preempted(optag, arg);
+  mpe_frame_handle_t* h = mpe_find_cached(optag->effect);
   if (mpe_unlikely(h == NULL)) return mpe_unhandled_operation(optag);
   const mpe_operation_t* op = &h->hdef->operations[optag->opidx];
   return mpe_perform_at(h, op, arg);
 }
 
+// Perform an operation `op` that is not part of the handler definition at the innermost handler for `effect`.
+// The handler has no prompt if its definition only has tail resumptive operations, in which case `op` cannot yield either.
+void* mpe_perform_op(mpe_effect_t effect, const mpe_operation_t* op, void* arg) {
+  if (mp_preempt_is_requested()) return mpe_perform_op_preempted(effect, op, arg);
+  mpe_frame_handle_t* h = mpe_find_cached(effect);
+  if (mpe_unlikely(h == NULL)) return mpe_unhandled_effect(effect);
+  if (mpe_unlikely(h->prompt == NULL && mpe_opkind_yields(op->opkind))) return mpe_unyieldable_operation(effect, op);
+  return mpe_perform_at(h, op, arg);
+}
+
+// The local state of the innermost handler for `effect` (or NULL if it is not handled).
+// Use directly from tail resumptive operations that do not perform other operations (`MPE_OP_TAIL_NOOP`).
+void* mpe_handler_local(mpe_effect_t effect) {
+  mpe_frame_handle_t* h = mpe_find_cached(effect);
+  return (mpe_likely(h != NULL) ? h->local : NULL);
+}
+
 
 
 /*-----------------------------------------------------------------
@@ -447,11 +702,27 @@ static mpe_decl_noinline void* mpe_handle_start(mp_prompt_t* prompt, void* earg)
   return result;
 }
 
+// Can the handler run without a prompt? This is the case if no operation ever yields;
+// i.e. all operations are tail resumptive and run in place (or unwind through an exception).
+static bool mpe_handlerdef_is_promptless(const mpe_handlerdef_t* hdef) {
+  const size_t count = sizeof(hdef->operations) / sizeof(hdef->operations[0]);
+  for (size_t i = 0; i < count; i++) {
+    const mpe_opkind_t opkind = hdef->operations[i].opkind;
+    if (opkind == MPE_OP_NULL) break;
+    if (mpe_opkind_yields(opkind)) return false;
+  }
+  return true;
+}
+
 /// Handle a particular effect.
 /// Handles operations yielded in `body(arg)` with the given handler definition `def`.
 void* mpe_handle(const mpe_handlerdef_t* hdef, void* local, mpe_actionfun_t* body, void* arg) {
   struct mpe_handle_start_env env = { hdef, local, body, arg };
-  return mp_prompt(&mpe_handle_start, &env);
+  if (mpe_handlerdef_is_promptless(hdef)) {
+    return mpe_handle_start(NULL, &env);  // just push a frame on the current stack
+  }
+  mp_prompt_t* p = mp_prompt_create_at(0, hdef);  // learn the stack usage per handler definition
+  return mp_prompt_enter(p, &mpe_handle_start, &env);
 }
 
 
@@ -460,31 +731,18 @@ void* mpe_handle(const mpe_handlerdef_t* hdef, void* local, mpe_actionfun_t* bod
 -----------------------------------------------------------------*/
 
 static void* mpe_resume_internal(bool final, mpe_resume_t* resume, void* local, void* arg, bool unwind) {
-  mpe_assert(resume->kind >= MPE_RESUMPTION_SCOPED_ONCE);
+  const mpe_resumption_kind_t kind = mpe_resume_kind(resume);
+  mpe_assert(kind >= MPE_RESUMPTION_SCOPED_ONCE);
   mpe_resume_env_t renv = { local, arg, unwind };
+  mp_resume_t* mpr = mpe_resume_mp(resume);
   // and resume
-  if (resume->kind == MPE_RESUMPTION_SCOPED_ONCE) {
-    mp_resume_t* mpr = resume->mp.resume;
-    return mp_resume(mpr, &renv);
-  }
-  else if (resume->kind == MPE_RESUMPTION_ONCE) {
-    mp_resume_t* mpr = resume->mp.resume;
+  if (kind == MPE_RESUMPTION_ONCE) {
     mpe_assert_internal(final);
-    //mpe_trace_message("free resume: %p\n", resume);
-    mpe_free(resume);
-    return mp_resume(mpr, &renv);
   }
-  else {
-    mp_resume_t* mpr = resume->mp.resume;
-    if (final) {
-      //mpe_trace_message("free resume: %p\n", resume);
-      mpe_free(resume);
-    }
-    else {
-      mp_resume_dup(mpr); 
-    }
-    return mp_resume(mpr, &renv);
+  else if (kind == MPE_RESUMPTION_MULTI && !final) {
+    mp_resume_dup(mpr); 
   }
+  return mp_resume(mpr, &renv);
 }
 
 // Resume to unwind (e.g. run destructors and finally clauses)
@@ -504,43 +762,45 @@ void* mpe_resume(mpe_resume_t* resume, void* local, void* arg) {
 
 // Last resume in tail-position
 void* mpe_resume_tail(mpe_resume_t* resume, void* local, void* arg) {  
-  if (mpe_likely(resume->kind == MPE_RESUMPTION_INPLACE)) {
+  if (mpe_likely(mpe_resume_kind(resume) == MPE_RESUMPTION_INPLACE)) {
     *resume->mp.plocal = local;
     return arg;
   }
   mpe_resume_env_t renv = { local, arg, false };
-  // and tail resume
-  if (resume->kind == MPE_RESUMPTION_SCOPED_ONCE) {
-    mp_resume_t* mpr = resume->mp.resume;
-    return mp_resume_tail(mpr, &renv);
-  }
-  else {
-    mp_resume_t* mpr = resume->mp.resume;    
-    mpe_free(resume); // always assume final?
-    return mp_resume_tail(mpr, &renv);
-  }
+  // and tail resume (always assumed to be final)
+  return mp_resume_tail(mpe_resume_mp(resume), &renv);
 }
 
 
 // Release without resuming 
 void mpe_resume_release(mpe_resume_t* resume) {
   if (resume == NULL) return; // in case someone tries to release a NULL (OP_NEVER or OP_ABORT) resumption
-  if (resume->kind == MPE_RESUMPTION_ONCE) {
+  if (mpe_resume_kind(resume) == MPE_RESUMPTION_ONCE) {
     mpe_resume_unwind(resume);    
   }
   else {
-    mpe_assert_internal(resume->kind == MPE_RESUMPTION_MULTI);
-    mp_resume_t* mpr = resume->mp.resume;
+    mpe_assert_internal(mpe_resume_kind(resume) == MPE_RESUMPTION_MULTI);
+    mp_resume_t* mpr = mpe_resume_mp(resume);
     if (mp_resume_should_unwind(mpr)) {
       mpe_resume_unwind(resume);
     }
     else {
-      mpe_free(resume);
       mp_resume_drop(mpr);
     }
   }
 }
 
+// Migrate a resumption to another thread
+void mpe_resume_detach(mpe_resume_t* resume) {
+  mpe_assert(mpe_resume_kind(resume) == MPE_RESUMPTION_ONCE || mpe_resume_kind(resume) == MPE_RESUMPTION_MULTI);
+  mp_resume_detach(mpe_resume_mp(resume));
+}
+
+void mpe_resume_attach(mpe_resume_t* resume) {
+  mpe_assert(mpe_resume_kind(resume) == MPE_RESUMPTION_ONCE || mpe_resume_kind(resume) == MPE_RESUMPTION_MULTI);
+  mp_resume_attach(mpe_resume_mp(resume));
+}
+
 /*-----------------------------------------------------------------
   Mask
 -----------------------------------------------------------------*/
@@ -0,0 +1,651 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/* ----------------------------------------------------------------------------
+  An io_uring (or epoll) based event loop on top of multi-prompts.
+
+  Each task runs in its own prompt. When an I/O operation would block, the
+  task polls its file descriptor (one-shot) and yields up to its prompt where
+  the resumption is stored in the task. The loop runs all ready tasks, and then
+  waits for I/O events (or the first sleeping task to expire) which each make
+  another task ready again.
+
+  With io_uring, the polls are queued as `IORING_OP_POLL_ADD` entries in the
+  submission ring while the tasks run, and the whole batch is submitted by the
+  same `io_uring_enter` that waits for completions; so a loop iteration is
+  a single system call. We poll for readiness rather than submitting the read
+  or write itself, as the file descriptors are non-blocking (where io_uring
+  would just complete with `EAGAIN`) and the operation is usually tried
+  directly first anyways. The raw system calls are used (no `liburing`), and
+  we need `IORING_FEAT_EXT_ARG` (Linux 5.11) to wait with a time-out.
+
+  When io_uring is not available (or disabled), we use epoll instead where the
+  task registers its file descriptor with `EPOLLONESHOT`. Registrations are left
+  in the epoll set (disabled by the one-shot) so that later waits only need an
+  `EPOLL_CTL_MOD`.
+-----------------------------------------------------------------------------*/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE   // for accept4
+#endif
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#if !defined(MPIO_USE_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_FEAT_EXT_ARG)
+#define MPIO_USE_URING  (1)
+#endif
+#endif
+#endif
+#if !defined(MPIO_USE_URING)
+#define MPIO_USE_URING  (0)
+#endif
+
+#if MPIO_USE_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include <mprompt.h>
+#include "mpio.h"
+
+
+/*-----------------------------------------------------------------
+  Defines
+-----------------------------------------------------------------*/
+
+#define mpio_decl_thread          __thread
+
+#define mpio_assert(x)            assert(x)
+#define mpio_assert_internal(x)   mpio_assert(x)
+#define mpio_zalloc_tp(tp)        (tp*)mpio_zalloc_safe(sizeof(tp))
+
+#define MPIO_EVENTS_MAX           (64)    // events per `epoll_wait`
+#define MPIO_URING_ENTRIES        (256)   // submission ring size
+
+static inline void* mpio_zalloc_safe(size_t size) {
+  void* p = calloc(1, size);
+  if (p != NULL) return p;
+  fprintf(stderr, "out of memory\n");
+  abort();
+}
+
+static inline void mpio_free(void* p) {
+  free(p);
+}
+
+static void mpio_fatal(const char* msg) {
+  fprintf(stderr, "libmpio: fatal error: %s\n", msg);
+  abort();
+}
+
+
+/*-----------------------------------------------------------------
+  Types
+-----------------------------------------------------------------*/
+
+typedef struct mpio_task_s mpio_task_t;
+typedef struct mpio_loop_s mpio_loop_t;
+typedef struct mpio_uring_s mpio_uring_t;
+
+struct mpio_task_s {
+  mpio_task_fun_t*  fun;
+  void*             arg;
+  void*             result;
+  mp_prompt_t*      prompt;     // set when started
+  mp_resume_t*      resume;     // the resumption when suspended
+  bool              done;
+  mpio_task_t*      next;       // in the ready queue
+  int64_t           deadline;   // when sleeping (in milli-seconds)
+  ptrdiff_t         heap_index; // index in the timer heap (or -1)
+};
+
+struct mpio_loop_s {
+  int             epfd;         // epoll instance (or -1 when using io_uring)
+  mpio_uring_t*   uring;        // io_uring instance (or NULL when using epoll)
+  mpio_task_t*    main;         // the main task (freed by `mpio_run`)
+  mpio_task_t*    current;      // currently running task
+  mpio_task_t*    ready;        // ready queue (first)
+  mpio_task_t*    ready_last;
+  ptrdiff_t       live;         // number of tasks that are not yet done
+  mpio_task_t**   timers;       // binary min-heap of sleeping tasks on their deadline
+  ptrdiff_t       timer_count;
+  ptrdiff_t       timer_capacity;
+};
+
+
+/*-----------------------------------------------------------------
+  Current loop
+-----------------------------------------------------------------*/
+
+static mpio_decl_thread mpio_loop_t* _mpio_loop;
+
+static inline mpio_loop_t* mpio_loop_current(void) {
+  return _mpio_loop;
+}
+
+static int64_t mpio_clock_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((int64_t)t.tv_sec * 1000) + (t.tv_nsec / 1000000);
+}
+
+
+/*-----------------------------------------------------------------
+  Ready queue
+-----------------------------------------------------------------*/
+
+static void mpio_ready_push(mpio_loop_t* loop, mpio_task_t* task) {
+  task->next = NULL;
+  if (loop->ready_last == NULL) {
+    loop->ready = task;
+  }
+  else {
+    loop->ready_last->next = task;
+  }
+  loop->ready_last = task;
+}
+
+static mpio_task_t* mpio_ready_pop(mpio_loop_t* loop) {
+  mpio_task_t* task = loop->ready;
+  if (task != NULL) {
+    loop->ready = task->next;
+    if (loop->ready == NULL) loop->ready_last = NULL;
+    task->next = NULL;
+  }
+  return task;
+}
+
+
+/*-----------------------------------------------------------------
+  Timers
+-----------------------------------------------------------------*/
+
+static void mpio_timer_swap(mpio_loop_t* loop, ptrdiff_t i, ptrdiff_t j) {
+  mpio_task_t* t = loop->timers[i];
+  loop->timers[i] = loop->timers[j];
+  loop->timers[j] = t;
+  loop->timers[i]->heap_index = i;
+  loop->timers[j]->heap_index = j;
+}
+
+static void mpio_timer_push(mpio_loop_t* loop, mpio_task_t* task) {
+  if (loop->timer_count >= loop->timer_capacity) {
+    ptrdiff_t newcap = (loop->timer_capacity == 0 ? 16 : 2*loop->timer_capacity);
+    mpio_task_t** timers = (mpio_task_t**)realloc(loop->timers, (size_t)newcap * sizeof(mpio_task_t*));
+    if (timers == NULL) mpio_fatal("out of memory");
+    loop->timers = timers;
+    loop->timer_capacity = newcap;
+  }
+  ptrdiff_t i = loop->timer_count++;
+  loop->timers[i] = task;
+  task->heap_index = i;
+  while (i > 0) {   // sift up
+    ptrdiff_t parent = (i - 1) / 2;
+    if (loop->timers[parent]->deadline <= loop->timers[i]->deadline) break;
+    mpio_timer_swap(loop, i, parent);
+    i = parent;
+  }
+}
+
+static mpio_task_t* mpio_timer_pop(mpio_loop_t* loop) {
+  mpio_assert_internal(loop->timer_count > 0);
+  mpio_task_t* task = loop->timers[0];
+  loop->timer_count--;
+  if (loop->timer_count > 0) {
+    mpio_timer_swap(loop, 0, loop->timer_count);
+    ptrdiff_t i = 0;
+    for (;;) {   // sift down
+      ptrdiff_t least = i;
+      ptrdiff_t l = 2*i + 1;
+      ptrdiff_t r = l + 1;
+      if (l < loop->timer_count && loop->timers[l]->deadline < loop->timers[least]->deadline) least = l;
+      if (r < loop->timer_count && loop->timers[r]->deadline < loop->timers[least]->deadline) least = r;
+      if (least == i) break;
+      mpio_timer_swap(loop, i, least);
+      i = least;
+    }
+  }
+  task->heap_index = -1;
+  return task;
+}
+
+// Move all expired timers to the ready queue and return the time-out until the next one (or -1)
+static int mpio_timers_expire(mpio_loop_t* loop) {
+  if (loop->timer_count == 0) return -1;
+  const int64_t now = mpio_clock_now();
+  while (loop->timer_count > 0 && loop->timers[0]->deadline <= now) {
+    mpio_ready_push(loop, mpio_timer_pop(loop));
+  }
+  if (loop->timer_count == 0) return -1;
+  int64_t timeout = loop->timers[0]->deadline - now;
+  return (timeout > 1000000 ? 1000000 : (int)timeout);
+}
+
+
+/*-----------------------------------------------------------------
+  io_uring
+-----------------------------------------------------------------*/
+
+static bool mpio_uring_enabled = true;
+
+void mpio_use_uring(bool enable) {
+  mpio_uring_enabled = enable;
+}
+
+#if MPIO_USE_URING
+
+struct mpio_uring_s {
+  int                   fd;
+  void*                 ring;        // shared submission and completion rings
+  size_t                ring_size;
+  struct io_uring_sqe*  sqes;
+  size_t                sqes_size;
+  unsigned*             sq_head;
+  unsigned*             sq_tail;
+  unsigned*             sq_array;
+  unsigned              sq_mask;
+  unsigned              sq_entries;
+  unsigned*             cq_head;
+  unsigned*             cq_tail;
+  struct io_uring_cqe*  cqes;
+  unsigned              cq_mask;
+};
+
+static int mpio_uring_enter(mpio_uring_t* u, unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t argsize) {
+  return (int)syscall(__NR_io_uring_enter, u->fd, to_submit, min_complete, flags, arg, argsize);
+}
+
+static void mpio_uring_free(mpio_uring_t* u) {
+  if (u->sqes != NULL) munmap(u->sqes, u->sqes_size);
+  if (u->ring != NULL) munmap(u->ring, u->ring_size);
+  close(u->fd);
+  mpio_free(u);
+}
+
+// Create an io_uring instance; returns NULL if io_uring is not available.
+static mpio_uring_t* mpio_uring_create(void) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = (int)syscall(__NR_io_uring_setup, MPIO_URING_ENTRIES, &p);
+  if (fd < 0) return NULL;
+  mpio_uring_t* u = mpio_zalloc_tp(mpio_uring_t);
+  u->fd = fd;
+  if ((p.features & IORING_FEAT_SINGLE_MMAP) == 0 || (p.features & IORING_FEAT_EXT_ARG) == 0) {
+    mpio_uring_free(u);
+    return NULL;
+  }
+  const size_t sq_size = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+  const size_t cq_size = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+  u->ring_size = (sq_size > cq_size ? sq_size : cq_size);
+  u->ring = mmap(NULL, u->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (u->ring == MAP_FAILED) {
+    u->ring = NULL;
+    mpio_uring_free(u);
+    return NULL;
+  }
+  u->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+  u->sqes = (struct io_uring_sqe*)mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED) {
+    u->sqes = NULL;
+    mpio_uring_free(u);
+    return NULL;
+  }
+  uint8_t* ring = (uint8_t*)u->ring;
+  u->sq_head    = (unsigned*)(ring + p.sq_off.head);
+  u->sq_tail    = (unsigned*)(ring + p.sq_off.tail);
+  u->sq_array   = (unsigned*)(ring + p.sq_off.array);
+  u->sq_mask    = *(unsigned*)(ring + p.sq_off.ring_mask);
+  u->sq_entries = p.sq_entries;
+  u->cq_head    = (unsigned*)(ring + p.cq_off.head);
+  u->cq_tail    = (unsigned*)(ring + p.cq_off.tail);
+  u->cqes       = (struct io_uring_cqe*)(ring + p.cq_off.cqes);
+  u->cq_mask    = *(unsigned*)(ring + p.cq_off.ring_mask);
+  return u;
+}
+
+// Number of queued entries that are not yet consumed by the kernel
+static inline unsigned mpio_uring_unsubmitted(mpio_uring_t* u) {
+  return *u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+}
+
+// Queue a one-shot poll of `fd` for `events` that makes `task` ready on completion
+static int mpio_uring_poll(mpio_uring_t* u, int fd, uint32_t events, mpio_task_t* task) {
+  while (mpio_uring_unsubmitted(u) >= u->sq_entries) {
+    // the submission ring is full: submit the batch so far
+    if (mpio_uring_enter(u, mpio_uring_unsubmitted(u), 0, 0, NULL, 0) < 0 && errno != EINTR && errno != EBUSY && errno != EAGAIN) return -1;
+  }
+  const unsigned tail = *u->sq_tail;
+  const unsigned index = tail & u->sq_mask;
+  struct io_uring_sqe* sqe = &u->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  uint32_t pevents = ((events & EPOLLIN) != 0 ? POLLIN : 0) | ((events & EPOLLOUT) != 0 ? POLLOUT : 0);
+  #if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  pevents = (pevents << 16) | (pevents >> 16);  // the kernel reads the low half-word first
+  #endif
+  sqe->poll32_events = pevents;
+  sqe->user_data = (uint64_t)(uintptr_t)task;
+  u->sq_array[index] = index;
+  __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// Submit the queued polls and wait for at least one completion (or the time-out in milli-seconds if >= 0).
+// Tasks of completed polls are made ready (with an error the task just retries its operation).
+static void mpio_uring_wait(mpio_loop_t* loop, int timeout) {
+  mpio_uring_t* u = loop->uring;
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  if (timeout >= 0) {
+    ts.tv_sec = timeout / 1000;
+    ts.tv_nsec = (long long)(timeout % 1000) * 1000000;
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+  }
+  if (mpio_uring_enter(u, mpio_uring_unsubmitted(u), 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) < 0) {
+    if (errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN) mpio_fatal("io_uring_enter failed");
+  }
+  unsigned head = *u->cq_head;
+  const unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    mpio_task_t* task = (mpio_task_t*)(uintptr_t)u->cqes[head & u->cq_mask].user_data;
+    if (task != NULL) mpio_ready_push(loop, task);
+  }
+  __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+}
+
+#else
+struct mpio_uring_s {
+  int fd;
+};
+
+static mpio_uring_t* mpio_uring_create(void) {
+  return NULL;
+}
+
+static void mpio_uring_free(mpio_uring_t* u) {
+  mpio_free(u);
+}
+
+static int mpio_uring_poll(mpio_uring_t* u, int fd, uint32_t events, mpio_task_t* task) {
+  (void)(u); (void)(fd); (void)(events); (void)(task);
+  errno = ENOSYS;
+  return -1;
+}
+
+static void mpio_uring_wait(mpio_loop_t* loop, int timeout) {
+  (void)(loop); (void)(timeout);
+}
+#endif
+
+
+/*-----------------------------------------------------------------
+  Tasks
+-----------------------------------------------------------------*/
+
+static void* mpio_task_start(mp_prompt_t* p, void* arg) {
+  mpio_task_t* task = (mpio_task_t*)arg;
+  task->prompt = p;
+  task->result = (task->fun)(task->arg);
+  task->done = true;
+  return NULL;
+}
+
+static mpio_task_t* mpio_task_create(mpio_task_fun_t* fun, void* arg) {
+  mpio_task_t* task = mpio_zalloc_tp(mpio_task_t);
+  task->fun = fun;
+  task->arg = arg;
+  task->heap_index = -1;
+  return task;
+}
+
+// Run a ready task until it suspends or is done. Returns `true` if it is done.
+static bool mpio_task_run(mpio_loop_t* loop, mpio_task_t* task) {
+  loop->current = task;
+  if (task->prompt == NULL) {
+    mp_prompt(&mpio_task_start, task);
+  }
+  else {
+    mp_resume_t* r = task->resume;
+    mpio_assert_internal(r != NULL);
+    task->resume = NULL;
+    mp_resume(r, NULL);
+  }
+  loop->current = NULL;
+  return task->done;
+}
+
+static void* mpio_suspend_fun(mp_resume_t* r, void* arg) {
+  mpio_task_t* task = (mpio_task_t*)arg;
+  task->resume = r;
+  return NULL;
+}
+
+// Suspend the current task (which must have been registered to become ready again)
+static void mpio_suspend(mpio_loop_t* loop) {
+  mpio_task_t* task = loop->current;
+  mpio_assert_internal(task != NULL && task->prompt != NULL);
+  mp_yield(task->prompt, &mpio_suspend_fun, task);
+}
+
+// Suspend the current task until `fd` is ready for `events` (`EPOLLIN` or `EPOLLOUT`); returns 0 on success.
+static int mpio_wait_fd(mpio_loop_t* loop, int fd, uint32_t events) {
+  if (loop->uring != NULL) {
+    if (mpio_uring_poll(loop->uring, fd, events, loop->current) != 0) return -1;
+    mpio_suspend(loop);
+    return 0;
+  }
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events | EPOLLONESHOT;
+  ev.data.ptr = loop->current;
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev) != 0) {
+    if (errno != ENOENT || epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) return -1;
+  }
+  mpio_suspend(loop);
+  return 0;
+}
+
+static inline bool mpio_would_block(void) {
+  return (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+
+/*-----------------------------------------------------------------
+  Event loop
+-----------------------------------------------------------------*/
+
+static void mpio_loop_run(mpio_loop_t* loop) {
+  struct epoll_event events[MPIO_EVENTS_MAX];
+  while (loop->live > 0) {
+    // run all tasks that are ready (including ones that become ready meanwhile)
+    mpio_task_t* task;
+    while ((task = mpio_ready_pop(loop)) != NULL) {
+      if (mpio_task_run(loop, task)) {
+        loop->live--;
+        if (task != loop->main) mpio_free(task);
+      }
+    }
+    if (loop->live <= 0) break;
+    // wait for I/O or the next timer (indefinitely if there are no timers)
+    int timeout = mpio_timers_expire(loop);
+    if (loop->ready != NULL) continue;
+    if (loop->uring != NULL) {
+      mpio_uring_wait(loop, timeout);
+      mpio_timers_expire(loop);
+      continue;
+    }
+    int n = epoll_wait(loop->epfd, events, MPIO_EVENTS_MAX, timeout);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      mpio_fatal("epoll_wait failed");
+    }
+    for (int i = 0; i < n; i++) {
+      mpio_ready_push(loop, (mpio_task_t*)events[i].data.ptr);
+    }
+    mpio_timers_expire(loop);
+  }
+}
+
+void* mpio_run(mpio_task_fun_t* fun, void* arg) {
+  if (mpio_loop_current() != NULL) mpio_fatal("cannot run an event loop inside another event loop");
+  mpio_loop_t loop;
+  memset(&loop, 0, sizeof(loop));
+  loop.epfd = -1;
+  if (mpio_uring_enabled) {
+    loop.uring = mpio_uring_create();
+  }
+  if (loop.uring == NULL) {
+    loop.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop.epfd < 0) return NULL;
+  }
+  loop.main = mpio_task_create(fun, arg);
+  loop.live = 1;
+  mpio_ready_push(&loop, loop.main);
+  _mpio_loop = &loop;
+  mpio_loop_run(&loop);
+  _mpio_loop = NULL;
+  if (loop.uring != NULL) mpio_uring_free(loop.uring);
+  if (loop.epfd >= 0) close(loop.epfd);
+  free(loop.timers);
+  void* result = loop.main->result;
+  mpio_free(loop.main);
+  return result;
+}
+
+
+/*-----------------------------------------------------------------
+  Tasks operations
+-----------------------------------------------------------------*/
+
+const char* mpio_backend(void) {
+  mpio_loop_t* loop = mpio_loop_current();
+  if (loop == NULL) return NULL;
+  return (loop->uring != NULL ? "io_uring" : "epoll");
+}
+
+void mpio_spawn(mpio_task_fun_t* fun, void* arg) {
+  mpio_loop_t* loop = mpio_loop_current();
+  if (loop == NULL) {
+    (*fun)(arg);  // no event loop: run directly
+    return;
+  }
+  loop->live++;
+  mpio_ready_push(loop, mpio_task_create(fun, arg));
+}
+
+void mpio_yield(void) {
+  mpio_loop_t* loop = mpio_loop_current();
+  if (loop == NULL || loop->current == NULL) return;
+  mpio_ready_push(loop, loop->current);
+  mpio_suspend(loop);
+}
+
+void mpio_sleep(int64_t msecs) {
+  mpio_loop_t* loop = mpio_loop_current();
+  if (loop == NULL || loop->current == NULL) {
+    if (msecs <= 0) return;
+    struct timespec t;
+    t.tv_sec = (time_t)(msecs / 1000);
+    t.tv_nsec = (long)((msecs % 1000) * 1000000);
+    while (nanosleep(&t, &t) != 0 && errno == EINTR) { }
+    return;
+  }
+  if (msecs <= 0) {
+    mpio_yield();
+    return;
+  }
+  loop->current->deadline = mpio_clock_now() + msecs;
+  mpio_timer_push(loop, loop->current);
+  mpio_suspend(loop);
+}
+
+
+/*-----------------------------------------------------------------
+  I/O operations
+-----------------------------------------------------------------*/
+
+ssize_t mpio_read(int fd, void* buf, size_t len) {
+  for (;;) {
+    ssize_t n = read(fd, buf, len);
+    if (n >= 0 || !mpio_would_block()) return n;
+    mpio_loop_t* loop = mpio_loop_current();
+    if (loop == NULL || loop->current == NULL) return n;
+    if (mpio_wait_fd(loop, fd, EPOLLIN) != 0) return -1;
+  }
+}
+
+ssize_t mpio_write(int fd, const void* buf, size_t len) {
+  for (;;) {
+    ssize_t n = write(fd, buf, len);
+    if (n >= 0 || !mpio_would_block()) return n;
+    mpio_loop_t* loop = mpio_loop_current();
+    if (loop == NULL || loop->current == NULL) return n;
+    if (mpio_wait_fd(loop, fd, EPOLLOUT) != 0) return -1;
+  }
+}
+
+ssize_t mpio_write_all(int fd, const void* buf, size_t len) {
+  const uint8_t* p = (const uint8_t*)buf;
+  size_t todo = len;
+  while (todo > 0) {
+    ssize_t n = mpio_write(fd, p, todo);
+    if (n < 0) return -1;
+    p += n;
+    todo -= (size_t)n;
+  }
+  return (ssize_t)len;
+}
+
+int mpio_accept(int fd, struct sockaddr* addr, socklen_t* addrlen) {
+  for (;;) {
+    int cfd = accept4(fd, addr, addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (cfd >= 0 || !mpio_would_block()) return cfd;
+    mpio_loop_t* loop = mpio_loop_current();
+    if (loop == NULL || loop->current == NULL) return cfd;
+    if (mpio_wait_fd(loop, fd, EPOLLIN) != 0) return -1;
+  }
+}
+
+int mpio_connect(int fd, const struct sockaddr* addr, socklen_t addrlen) {
+  int res = connect(fd, addr, addrlen);
+  if (res == 0 || errno != EINPROGRESS) return res;
+  mpio_loop_t* loop = mpio_loop_current();
+  if (loop == NULL || loop->current == NULL) return res;
+  if (mpio_wait_fd(loop, fd, EPOLLOUT) != 0) return -1;
+  int err = 0;
+  socklen_t errlen = sizeof(err);
+  if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) != 0) return -1;
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+int mpio_nonblock(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0) return -1;
+  if ((flags & O_NONBLOCK) != 0) return 0;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
@@ -16,6 +16,8 @@
 #include "internal/util.h"
 #include "internal/longjmp.h"       // mp_stack_enter
 #include "internal/gstack.h"
+#include "internal/atomic.h"        // remote free of migrated gstacks
+#include "internal/trace.h"
 
 #ifdef __cplusplus
 #include <exception>
@@ -30,14 +32,27 @@
 // To save an allocation, we reserve `extra_size` space where the 
 // `mp_prompt_t` information will be.
 // All sizes (except for `extra_size`) are `os_page_size` aligned.
+typedef struct mp_gstack_owner_s mp_gstack_owner_t;
+typedef struct mp_gsnap_s mp_gsnap_t;
+
 struct mp_gstack_s {
   mp_gstack_t*  next;               // used for the cache and delay list
+  mp_gstack_owner_t* owner;         // owning thread if this gstack can be freed by another thread (see `mp_gstack_detach`)
   uint8_t*      full;               // stack reserved memory (including noaccess gaps)
-  ssize_t       full_size;          // (for now always fixed to be `os_gstack_size`)
+  ssize_t       full_size;          // reserved size of the size class (`os_gstack_size` by default)
   uint8_t*      stack;              // stack inside the full area (without gaps)
   ssize_t       stack_size;         // actual available total stack size (includes reserved space) (depends on platform, but usually `os_gstack_size - 2*mp_gstack_gap`)
   ssize_t       initial_commit;     // initial committed memory (usually `os_page_size`)  
-  ssize_t       committed;          // current committed estimate
+  ssize_t       committed;          // current committed estimate (the high-water mark since it was last reclaimed)
+  const void*   site;               // identifies where the gstack is allocated to learn its committed size (can be NULL)
+  size_t        entries;            // number of times control entered this gstack (see `mp_gstack_entered`)
+  mp_gsnap_t*   snapshot;           // the last stack snapshot that was saved or restored into this gstack (if still alive)
+  mp_gsnap_t*   tracked;            // if not NULL, the write protected part of the stack equals this snapshot except for the `dirty` pages
+  uint8_t*      tracked_start;      // start of the write protected area (page aligned)
+  ssize_t       tracked_size;       // size of the write protected area
+  _Atomic(intptr_t)* dirty;         // bitmap of pages in the tracked area that were written to (updated atomically by the fault handler of any thread)
+  _Atomic(intptr_t)  dirty_count;   // number of dirty pages
+  ssize_t       painted;            // when profiling, the stack is painted from the base up to this size (see `mp_gstack_paint`)
   ssize_t       extra_size;         // size of extra allocated bytes.         
   uint8_t       extra[1];           // extra allocated (holds the mp_prompt_t structure)
 };
@@ -59,9 +74,23 @@ static ssize_t os_gstack_initial_commit   = 0;             // initial commit siz
 static ssize_t os_gstack_size             = 8 * MP_MIB;    // reserved memory for a stack (including the gaps)
 static ssize_t os_gstack_gap              = 64 * MP_KIB;   // noaccess gap between stacks; `os_gstack_gap > min(64*1024, os_page_size, os_gstack_size/2`.
 static bool    os_gstack_reset_decommits  = false;         // force full decommit when resetting a stack?
+static bool    os_gstack_reset_background = false;         // reset freed gpool stacks in batches from a background thread (not on Windows)
 static bool    os_gstack_grow_fast        = true;          // use doubling to grow gstacks (up to 1MiB)
 static ssize_t os_gstack_cache_max_count  = 4;             // number of prompts to keep in the thread local cache
+static ssize_t os_gstack_cache_commit_max = 256 * MP_KIB;  // committed memory above this is decommitted when a cached gstack is evicted (-1 to never decommit)
 static ssize_t os_gstack_exn_guaranteed   = 32 * MP_KIB;   // guaranteed stack size available during an exception unwind (only used on Windows)
+static bool    os_gsave_track_writes      = false;         // write protect saved stack areas to restore only changed pages (not on Windows)
+#if defined(_WIN32)
+static bool    os_gstack_learn_commit     = false;         // pre-commit gstacks to the committed size learned per site (not on Windows)
+#else
+static bool    os_gstack_learn_commit     = true;
+#endif
+static bool    os_gstack_profile          = false;         // record the peak stack usage per site when a gstack is freed (see `mp_stack_profile_get`)
+static bool    os_gpool_userfaultfd       = false;         // commit gpool stacks on demand from a `userfaultfd` handler thread (Linux only)
+static bool    os_gpool_compact           = false;         // keep gpool stacks in one accessible mapping and commit with `userfaultfd` (Linux only)
+static bool    os_gpool_numa              = false;         // allocate gstacks from gpools on the NUMA node of the current thread (Linux only)
+static bool    os_gstack_huge_pages       = false;         // back the base of gpool stacks with a transparent huge page (Linux only)
+static ssize_t os_huge_page_size          = 0;             // huge page size if `os_gstack_huge_pages` is enabled and available (initialized at startup)
 
 #if defined(_MSC_VER) && !defined(NDEBUG)  // gpool a tad smaller in msvc so debug traces work (as the gpool can be placed lower than the system stack)
 static ssize_t os_gpool_max_size          = 16 * MP_GIB;   // virtual size of one gstack pooled area (holds about 2^15 gstacks)
@@ -86,16 +115,47 @@ static ssize_t mp_unpush(const uint8_t* sp, const uint8_t* stk, ssize_t stk_size
   return (os_stack_grows_down ? ((stk + stk_size) - sp) : (sp - stk));
 }
 
+// Update the committed estimate of a gstack (and the statistics)
+static void mp_gstack_set_committed(mp_gstack_t* g, ssize_t committed) {
+  mp_stat_add(committed, committed - g->committed);
+  g->committed = committed;
+}
+
+// When profiling, freshly committed stack memory is painted so we can find the peak usage when the gstack is freed.
+#define MP_GSTACK_PAINT       (0xFD)
+
+static void mp_gstack_paint(mp_gstack_t* g, uint8_t* start, ssize_t size) {
+  if (size <= 0) return;
+  memset(start, MP_GSTACK_PAINT, (size_t)size);
+  g->painted = mp_max(g->painted, mp_unpush(os_stack_grows_down ? start : start + size, g->stack, g->stack_size));
+}
+
+// Called from the commit-on-demand handler after committing `size` bytes at `start` for an access at `page`.
+// We only paint the faulting page and the part beyond the earlier `committed` size: pages in between
+// can already be in use when a large stack frame is accessed out of order.
+static void mp_gstack_paint_commit(mp_gstack_t* g, uint8_t* page, uint8_t* start, ssize_t size, ssize_t committed) {
+  if (mp_likely(!os_gstack_profile)) return;
+  mp_gstack_paint(g, page, os_page_size);
+  uint8_t* limit = (os_stack_grows_down ? g->stack + g->stack_size - committed : g->stack + committed);
+  if (os_stack_grows_down) {
+    if (start < limit) mp_gstack_paint(g, start, mp_min(limit - start, size));
+  }
+  else {
+    uint8_t* from = (start > limit ? start : limit);
+    if (start + size > from) mp_gstack_paint(g, from, (start + size) - from);
+  }
+}
+
 
 //----------------------------------------------------------------------------------
 // Platform specific, low-level OS interface.
 //
-// By design always reserve `os_gstack_size` memory with `os_gstack_initial_commit`
-// initially committed. By making this constant, we can implement efficient caching,
-// "gpools", commit-on-demand handlers etc.
+// By design always reserve the (constant) `full_size` of a size class (`os_gstack_size` by default) with 
+// `os_gstack_initial_commit` initially committed. By making this constant per size class, we can 
+// implement efficient caching, "gpools", commit-on-demand handlers etc.
 //----------------------------------------------------------------------------------
-static uint8_t* mp_gstack_os_alloc(uint8_t** stack, ssize_t* stack_size, ssize_t* initial_commit);
-static void     mp_gstack_os_free(uint8_t* full, uint8_t* stack, ssize_t stack_size, ssize_t stk_commit);
+static uint8_t* mp_gstack_os_alloc(ssize_t full_size, ssize_t gap_size, uint8_t** stack, ssize_t* stack_size, ssize_t* initial_commit);
+static void     mp_gstack_os_free(uint8_t* full, ssize_t full_size, uint8_t* stack, ssize_t stack_size, ssize_t stk_commit);
 static bool     mp_gstack_os_init(void);
 static void     mp_gstack_os_thread_init(void);
 static void     mp_gstack_thread_done(void);  // called by hook installed in os specific include
@@ -105,6 +165,17 @@ static uint8_t* mp_os_mem_reserve(ssize_t size);
 static void     mp_os_mem_free(uint8_t* p, ssize_t size);
 static bool     mp_os_mem_commit(uint8_t* start, ssize_t size);
 
+// Used to reclaim memory of cached gstacks
+static bool     mp_os_mem_decommit(uint8_t* start, ssize_t size);
+
+// Used by write tracking of saved gstacks
+static bool     mp_os_mem_protect(uint8_t* start, ssize_t size, bool readonly);
+static bool     mp_gstack_track_fault(uint8_t* page);     // called by the fault handler
+
+// Called when a fresh gpool is created with the area of its gstacks (to commit them on demand)
+static bool     mp_os_gpool_register(uint8_t* start, ssize_t size, int numa_node);
+static int      mp_os_numa_node(void);                    // NUMA node of the current thread (or -1)
+
 // Used by signal handler to check access
 typedef enum mp_access_e {
   MP_NOACCESS,                    // no access (outside pool)
@@ -117,9 +188,11 @@ static mp_access_t  mp_gstack_check_access(mp_gstack_t* g, void* address, ssize_
 
 // The gpool interface
 typedef struct mp_gpool_s mp_gpool_t;
-static uint8_t*     mp_gpool_alloc(uint8_t** stk, ssize_t* stk_size);
+static uint8_t*     mp_gpool_alloc(ssize_t block_size, ssize_t gap_size, uint8_t** stk, ssize_t* stk_size);
 static void         mp_gpool_free(uint8_t* stk);
 static mp_access_t  mp_gpools_check_access(void* address, ssize_t* available, ssize_t* stack_size, const mp_gpool_t** gp);
+static bool         mp_gpool_set_tracked(const uint8_t* stk, mp_gstack_t* g);
+static mp_gstack_t* mp_gpool_tracked(const void* p);
 
 
 // platform specific definitions are in included files
@@ -141,7 +214,7 @@ static mp_access_t  mp_gpools_check_access(void* address, ssize_t* available, ss
 
 
 // Is a pointer in the gstack?
-static bool mp_gstack_contains(const mp_gstack_t* g, const uint8_t* p) {
+bool mp_gstack_contains(const mp_gstack_t* g, const uint8_t* p) {
   return (p >= g->stack && p < (g->stack + g->stack_size));
 }
 
@@ -150,18 +223,63 @@ static uint8_t* mp_gstack_base_at(const mp_gstack_t* g, ssize_t ofs) {
   return (os_stack_grows_down ? g->stack + g->stack_size - ofs : g->stack + ofs);
 }
 
+// Is `p` inside the committed part of the stack area of `g`? (so it can be read without faulting)
+bool mp_gstack_contains_committed(const mp_gstack_t* g, const uint8_t* p) {
+  if (os_use_overcommit) return mp_gstack_contains(g, p);
+  const ssize_t committed = g->committed;
+  const uint8_t* start = (os_stack_grows_down ? g->stack + g->stack_size - committed : g->stack);
+  return (p >= start && p < start + committed);
+}
+
 // Base of the stack
 static uint8_t* mp_gstack_base(const mp_gstack_t* g) {
   return mp_gstack_base_at(g, 0);
 }
 
 
+//----------------------------------------------------------------------------------
+// Size classes
+// By default a gstack reserves `os_gstack_size` but it can be allocated in a smaller
+// size class where each class is 4 times smaller (down to `MP_GSTACK_CLASS_MIN`).
+// Smaller classes use smaller gaps (at most 1/16th of the size) and are allocated from 
+// their own gpools so small stacks (like generators) can be packed densely.
+//----------------------------------------------------------------------------------
+
+#define MP_GSTACK_CLASS_COUNT  (4)
+#define MP_GSTACK_CLASS_MIN    (128 * MP_KIB)  // minimal reserved size of a gstack
+
+static ssize_t mp_gstack_class_full_size(ssize_t cls) {
+  return (os_gstack_size >> (2*cls));
+}
+
+static ssize_t mp_gstack_class_gap_size(ssize_t cls) {
+  if (cls == 0) return os_gstack_gap;
+  return mp_min(os_gstack_gap, mp_align_up(mp_gstack_class_full_size(cls) / 16, os_page_size));
+}
+
+// The smallest size class that can hold a stack of `stack_size` bytes (use 0 for the default class)
+static ssize_t mp_gstack_class(ssize_t stack_size) {
+  ssize_t cls = 0;
+  if (stack_size <= 0) return cls;
+  while (cls + 1 < MP_GSTACK_CLASS_COUNT) {
+    const ssize_t full_size = mp_gstack_class_full_size(cls + 1);
+    if (full_size < MP_GSTACK_CLASS_MIN || full_size % os_page_size != 0) break;
+    if (full_size - 2*mp_gstack_class_gap_size(cls + 1) < stack_size) break;
+    cls++;
+  }
+  return cls;
+}
+
+
 
 //----------------------------------------------------------------------------------
 // Interface
 //----------------------------------------------------------------------------------
 
 
+// Write tracking of saved gstacks (see `mp_gstack_track`)
+static void mp_gstack_untrack(mp_gstack_t* g);
+
 // We have a small cache per thread of stacks to avoid going to the OS too often.
 static mp_decl_thread mp_gstack_t* _mp_gstack_cache;
 static mp_decl_thread ssize_t      _mp_gstack_cache_count;
@@ -170,10 +288,10 @@ static mp_decl_thread ssize_t      _mp_gstack_cache_count;
 // We also have a delayed free list to keep gstacks alive during exception unwinding
 // (since some exception implementations allocate exception information in stack areas that are already unwound)
 // it is cleared when either: 1. another gstack is allocated, 2. clear_cache is called, 3. the thread terminates
+// This is only used with the MSVC ABI (see `mp_prompt_drop_delayed`) so usually the list is always empty.
 static mp_decl_thread mp_gstack_t* _mp_gstack_delayed_free;
 
-static void mp_gstack_clear_delayed(void) {
-  if (_mp_gstack_delayed_free == NULL) return;
+static mp_decl_noinline void mp_gstack_clear_delayed_list(void) {
   #ifdef __cplusplus
   if (std::uncaught_exception()) {
     return; // don't clear while exception unwinding is active
@@ -188,13 +306,300 @@ static void mp_gstack_clear_delayed(void) {
   mp_assert_internal(_mp_gstack_delayed_free == NULL);
 }
 
-// Allocate a growable stacklet.
-mp_gstack_t* mp_gstack_alloc(ssize_t extra_size, void** extra)
+static inline void mp_gstack_clear_delayed(void) {
+  if (mp_likely(_mp_gstack_delayed_free == NULL)) return;
+  mp_gstack_clear_delayed_list();
+}
+
+
+//----------------------------------------------------------------------------------
+// Ownership of gstacks.
+// Each gstack records the thread that allocated it; when another thread frees it
+// (for example after it was handed over with `mp_resume_detach`), the gstack is pushed 
+// on the atomic `remote_free` list of the owner which collects it into its own cache on 
+// the next allocation. This keeps gstacks local to the thread that uses them.
+// When the owner thread terminates the list is closed and remotely freed
+// gstacks are released to the OS directly.
+//----------------------------------------------------------------------------------
+
+#define MP_GSTACK_REMOTE_CLOSED  ((mp_gstack_t*)1)
+
+struct mp_gstack_owner_s {
+  _Atomic(mp_gstack_t*) remote_free;  // gstacks freed by other threads (or `MP_GSTACK_REMOTE_CLOSED`)
+  _Atomic(intptr_t)     refcount;     // one for the owner thread plus one for each owned gstack
+};
+
+static mp_decl_thread mp_gstack_owner_t* _mp_gstack_owner;
+
+static void mp_gstack_owner_release(mp_gstack_owner_t* owner) {
+  if (mp_atomic_add(&owner->refcount, -1) <= 1) {
+    mp_free(owner);
+  }
+}
+
+// Take over the current remote free list of the owner (and set it to `closed`)
+static mp_gstack_t* mp_gstack_owner_take(mp_gstack_owner_t* owner, mp_gstack_t* closed) {
+  mp_gstack_t* remote = mp_atomic_load_ptr(mp_gstack_t, &owner->remote_free);
+  while (!mp_atomic_cas_ptr(mp_gstack_t, &owner->remote_free, &remote, closed)) { };
+  return remote;
+}
+
+// Free the memory of a gstack to the OS (and release its owner)
+static void mp_gstack_os_free_owned(mp_gstack_t* g) {
+  mp_assert_internal(g->tracked == NULL);
+  mp_gstack_os_free(g->full, g->full_size, g->stack, g->stack_size, g->committed);
+  mp_stat_inc(gstack_os_frees);
+  mp_stat_add(committed, -g->committed);
+  mp_stat_add(reserved, -g->full_size);
+  if (g->dirty != NULL) {
+    mp_free((void*)g->dirty);
+  }
+  if (g->owner != NULL) {
+    mp_gstack_owner_release(g->owner);
+  }
+  mp_free(g);
+}
+
+// Free a gstack owned by another thread by pushing it on the remote free list of the owner.
+static void mp_gstack_free_remote(mp_gstack_t* g) {
+  mp_stat_inc(gstack_remote_frees);
+  mp_gstack_owner_t* owner = g->owner;
+  mp_gstack_t* remote = mp_atomic_load_ptr(mp_gstack_t, &owner->remote_free);
+  do {
+    if (remote == MP_GSTACK_REMOTE_CLOSED) {
+      // the owner thread has terminated
+      mp_gstack_os_free_owned(g);
+      return;
+    }
+    g->next = remote;
+  } while (!mp_atomic_cas_ptr(mp_gstack_t, &owner->remote_free, &remote, g));
+}
+
+// The owner of the current thread for a freshly allocated gstack.
+static mp_gstack_owner_t* mp_gstack_owner_acquire(void) {
+  mp_gstack_owner_t* owner = _mp_gstack_owner;
+  if (mp_unlikely(owner == NULL)) {
+    owner = mp_malloc_safe_tp(mp_gstack_owner_t);
+    mp_atomic_store_ptr(mp_gstack_t, &owner->remote_free, NULL);
+    mp_atomic_store(&owner->refcount, (intptr_t)1);
+    _mp_gstack_owner = owner;
+  }
+  mp_atomic_add(&owner->refcount, 1);
+  return owner;
+}
+
+// Collect gstacks that were freed by other threads into our own cache.
+static void mp_gstack_collect_remote(void) {
+  mp_gstack_owner_t* owner = _mp_gstack_owner;
+  if (mp_likely(owner == NULL || mp_atomic_load_ptr(mp_gstack_t, &owner->remote_free) == NULL)) return;
+  mp_gstack_t* g = mp_gstack_owner_take(owner, NULL);
+  while (g != NULL) {
+    mp_gstack_t* next = g->next;
+    mp_assert_internal(g->owner == owner);
+    mp_gstack_free(g, false);  // maybe move to cache
+    g = next;
+  }
+}
+
+// Prepare a gstack to be used by another thread; it returns to its owner when it is freed there.
+void mp_gstack_detach(mp_gstack_t* g) {
+  if (g == NULL) return;
+  mp_gstack_untrack(g);  // write tracking is thread local
+  mp_assert_internal(g->owner != NULL);
+}
+
+// Prepare the current thread to run on a gstack that was detached in another thread.
+void mp_gstack_attach(mp_gstack_t* g) {
+  mp_gstack_init(NULL);  // ensure thread initialization (like an alternate signal stack for commit-on-demand)
+  if (g != NULL && g->tracked != NULL) {
+    mp_error_message(EINVAL, "attaching a gstack that was not detached (%p)\n", g);
+  }
+}
+
+// Called on thread termination; close the remote free list and release the owner.
+static void mp_gstack_owner_done(void) {
+  mp_gstack_owner_t* owner = _mp_gstack_owner;
+  if (owner == NULL) return;
+  _mp_gstack_owner = NULL;
+  mp_gstack_t* g = mp_gstack_owner_take(owner, MP_GSTACK_REMOTE_CLOSED);
+  while (g != NULL) {
+    mp_gstack_t* next = g->next;
+    mp_gstack_os_free_owned(g);
+    g = next;
+  }
+  mp_gstack_owner_release(owner);
+}
+
+
+//----------------------------------------------------------------------------------
+// Learning the initial commit per site.
+// A gstack can be allocated for a `site` (like the start function of a prompt or an effect
+// handler definition). When such gstack is freed, we update an exponentially decaying average 
+// of its committed size in a small thread-local table of sites. A gstack allocated for the same 
+// site is pre-committed up to that size which avoids most commit-on-demand faults.
+//----------------------------------------------------------------------------------
+
+#define MP_GSTACK_SITES        (64)
+#define MP_GSTACK_LEARN_MAX    (1 * MP_MIB)    // never pre-commit more than this
+
+typedef struct mp_gstack_site_s {
+  const void* site;
+  ssize_t     commit;   // decaying average of the committed size
+} mp_gstack_site_t;
+
+static mp_decl_thread mp_gstack_site_t _mp_gstack_sites[MP_GSTACK_SITES];
+
+static mp_gstack_site_t* mp_gstack_site(const void* site) {
+  const uintptr_t x = (uintptr_t)site;
+  return &_mp_gstack_sites[((x >> 4) ^ (x >> 12)) % MP_GSTACK_SITES];
+}
+
+// Learn from the committed size of a gstack that is freed
+static void mp_gstack_site_learn(const mp_gstack_t* g) {
+  if (g->site == NULL || !os_gstack_learn_commit) return;
+  mp_gstack_site_t* s = mp_gstack_site(g->site);
+  if (s->site != g->site) {
+    s->site = g->site;
+    s->commit = g->committed;
+  }
+  else {
+    s->commit = s->commit - (s->commit / 4) + (g->committed / 4);
+  }
+}
+
+// Pre-commit a gstack to the committed size learned for its site
+static void mp_gstack_site_commit(mp_gstack_t* g) {
+  if (g->site == NULL || !os_gstack_learn_commit || os_use_overcommit) return;
+  const mp_gstack_site_t* s = mp_gstack_site(g->site);
+  if (s->site != g->site) return;
+  ssize_t commit = mp_min(s->commit, mp_min(MP_GSTACK_LEARN_MAX, g->stack_size));
+  if (os_gstack_cache_commit_max >= 0) { 
+    commit = mp_min(commit, mp_max(os_gstack_cache_commit_max, g->initial_commit));  // or it is reclaimed again when evicted
+  }
+  commit = mp_align_down(commit, os_page_size);
+  if (mp_likely(commit <= g->committed)) return;
+  const ssize_t size = commit - g->committed;
+  uint8_t* start;
+  mp_push(mp_gstack_base_at(g, g->committed), size, &start);
+  if (mp_os_mem_commit(start, size)) {
+    mp_gstack_set_committed(g, commit);
+  }
+}
+
+
+//----------------------------------------------------------------------------------
+// Stack profiling (see `mp_config_t.stack_profile`).
+// The committed part of a gstack is painted when it is allocated (and when pages are 
+// committed on demand), and when the gstack is freed we scan for the deepest overwritten
+// word to find its peak stack usage. This is aggregated per site in a global table.
+// With overcommit the whole stack is committed and we only paint up to `MP_GSTACK_PAINT_MAX`.
+//----------------------------------------------------------------------------------
+
+#define MP_GSTACK_PROFILE_SITES   (256)
+#define MP_GSTACK_PAINT_MAX       (1 * MP_MIB)
+
+static mp_stack_profile_t  mp_gstack_profiles[MP_GSTACK_PROFILE_SITES+1];  // the last entry aggregates sites that do not fit
+static _Atomic(uintptr_t)  mp_gstack_profile_lock_flag;
+
+static void mp_gstack_profile_lock(void) {
+  uintptr_t expected = 0;
+  while (!mp_atomic_cas(&mp_gstack_profile_lock_flag, &expected, (uintptr_t)1)) {
+    expected = 0;
+    mp_atomic_yield();
+  }
+}
+
+static void mp_gstack_profile_unlock(void) {
+  mp_atomic_store(&mp_gstack_profile_lock_flag, (uintptr_t)0);
+}
+
+// Paint the committed area of a freshly allocated gstack
+static void mp_gstack_profile_paint(mp_gstack_t* g) {
+  if (mp_likely(!os_gstack_profile)) return;
+  const ssize_t size = (os_use_overcommit ? mp_min(g->committed, MP_GSTACK_PAINT_MAX) : g->committed);
+  uint8_t* start;
+  mp_push(mp_gstack_base(g), size, &start);
+  g->painted = 0;
+  mp_gstack_paint(g, start, size);   // nothing is in use yet
+}
+
+// The peak stack usage since the gstack was painted
+static ssize_t mp_gstack_profile_used(const mp_gstack_t* g) {
+  if (g->painted <= 0) return 0;
+  const uint8_t* base = mp_gstack_base(g);
+  const uint8_t* limit = mp_gstack_base_at(g, g->painted);
+  ssize_t untouched = 0;
+  if (os_stack_grows_down) {
+    const uint8_t* p = limit;
+    while (p < base && *p == MP_GSTACK_PAINT) { p++; }
+    untouched = p - limit;
+  }
+  else {
+    const uint8_t* p = limit;
+    while (p > base && *(p-1) == MP_GSTACK_PAINT) { p--; }
+    untouched = limit - p;
+  }
+  return (g->painted - untouched);
+}
+
+static mp_stack_profile_t* mp_gstack_profile_find(const void* site) {
+  const uintptr_t x = (uintptr_t)site;
+  size_t idx = ((x >> 4) ^ (x >> 12)) % MP_GSTACK_PROFILE_SITES;
+  for (size_t i = 0; i < MP_GSTACK_PROFILE_SITES; i++, idx = (idx + 1) % MP_GSTACK_PROFILE_SITES) {
+    mp_stack_profile_t* sp = &mp_gstack_profiles[idx];
+    if (sp->site == site) return sp;
+    if (sp->count == 0) {
+      sp->site = site;
+      return sp;
+    }
+  }
+  return &mp_gstack_profiles[MP_GSTACK_PROFILE_SITES];  // table is full
+}
+
+// Record the peak stack usage of a gstack that is freed
+static void mp_gstack_profile_record(mp_gstack_t* g) {
+  if (mp_likely(!os_gstack_profile)) return;
+  const ssize_t used = mp_gstack_profile_used(g);
+  ssize_t bucket = 0;
+  while (bucket < MP_STACK_PROFILE_BUCKETS - 1 && used > (MP_KIB << bucket)) { bucket++; }
+  mp_gstack_profile_lock();
+  mp_stack_profile_t* sp = mp_gstack_profile_find(g->site);
+  sp->count++;
+  sp->used_total += used;
+  if (used > sp->used_max) sp->used_max = used;
+  if (g->committed > sp->committed_max) sp->committed_max = g->committed;
+  if (used >= g->painted && g->painted < g->committed) sp->truncated++;
+  sp->histogram[bucket]++;
+  mp_gstack_profile_unlock();
+}
+
+// Get the stack profiles of all sites so far
+ptrdiff_t mp_stack_profile_get(mp_stack_profile_t* profiles, ptrdiff_t max) {
+  ptrdiff_t n = 0;
+  mp_gstack_profile_lock();
+  for (size_t i = 0; i <= MP_GSTACK_PROFILE_SITES && n < max; i++) {
+    if (mp_gstack_profiles[i].count > 0) {
+      if (profiles != NULL) profiles[n] = mp_gstack_profiles[i];
+      n++;
+    }
+  }
+  mp_gstack_profile_unlock();
+  return n;
+}
+
+
+// Allocate a growable stacklet that can hold at least `stack_size` bytes (or 0 for the default size).
+// The initial commit is learned from earlier gstacks allocated at the same `site` (if not NULL).
+mp_gstack_t* mp_gstack_alloc(ssize_t stack_size, const void* site, ssize_t extra_size, void** extra)
 {
   if (extra != NULL) { *extra = NULL;  }
   mp_gstack_init(NULL);  // always check initialization
   mp_assert(os_page_size != 0);
   mp_gstack_clear_delayed();  // this might free some gstacks to our local cache
+  mp_gstack_collect_remote(); // and so might gstacks that were freed by other threads
+  const ssize_t cls = mp_gstack_class(stack_size);
+  const ssize_t full_size = mp_gstack_class_full_size(cls);
+  mp_stat_inc(gstack_allocs);
   
   // first look in our thread local cache..
   #if !defined(NDEBUG)
@@ -203,7 +608,7 @@ mp_gstack_t* mp_gstack_alloc(ssize_t extra_size, void** extra)
   mp_gstack_t* g = _mp_gstack_cache;  
   mp_gstack_t* prev = NULL;
   while (g != NULL) {
-    bool good = (g->extra_size >= extra_size);
+    bool good = (g->full_size == full_size && g->extra_size >= extra_size);
     #if !defined(NDEBUG)
     // only use a cached stack if it is under the parent stack (to help unwinding during debugging)
     void* stack = g->stack;
@@ -214,6 +619,7 @@ mp_gstack_t* mp_gstack_alloc(ssize_t extra_size, void** extra)
                    else { prev->next = g->next; }
       _mp_gstack_cache_count--;
       g->next = NULL;
+      mp_stat_inc(gstack_cache_hits);
       break;
     }
     else {
@@ -223,6 +629,8 @@ mp_gstack_t* mp_gstack_alloc(ssize_t extra_size, void** extra)
   }
 
   // otherwise allocate fresh
+  const bool cached = (g != NULL);
+  MP_UNUSED(cached);  // only traced
   if (g == NULL) {
     // allocate separately for security
     extra_size = mp_align_up(extra_size, sizeof(void*));    
@@ -235,7 +643,7 @@ mp_gstack_t* mp_gstack_alloc(ssize_t extra_size, void** extra)
     uint8_t* stk;
     ssize_t  stk_size;
     ssize_t  initial_commit;
-    uint8_t* full = mp_gstack_os_alloc(&stk, &stk_size, &initial_commit);
+    uint8_t* full = mp_gstack_os_alloc(full_size, mp_gstack_class_gap_size(cls), &stk, &stk_size, &initial_commit);
     if (full == NULL) { 
       mp_free(g);
       errno = ENOMEM;
@@ -254,23 +662,44 @@ mp_gstack_t* mp_gstack_alloc(ssize_t extra_size, void** extra)
     
     //mp_trace_message("alloc gstack: full: %p, base: %p, base_limit: %p\n", full, base, mp_push(base, stk_size,NULL));
     g->next = NULL;
+    g->owner = mp_gstack_owner_acquire();
     g->full = full;
-    g->full_size = os_gstack_size;
+    g->full_size = full_size;
     g->stack = stk;
     g->stack_size = stk_size;
     g->initial_commit = g->committed = initial_commit;
+    g->entries = 0;
+    g->snapshot = NULL;
+    g->tracked = NULL;
+    g->tracked_start = NULL;
+    g->tracked_size = 0;
+    g->dirty = NULL;
+    mp_atomic_store(&g->dirty_count, (intptr_t)0);
+    g->painted = 0;
     g->extra_size = extra_size;
+    mp_stat_add(committed, initial_commit);
+    mp_stat_add(reserved, full_size);
   }
 
+  g->site = site;
+  mp_gstack_site_commit(g);
+  mp_gstack_profile_paint(g);
   if (extra != NULL && extra_size > 0) {
     *extra = &g->extra[0];
   }
+  mp_trace(MP_TRACE_GSTACK_ALLOC, g, cached);
   return g;
 }
 
 
+// Note that control (re)enters a gstack: its stack may change from now on (see `mp_gstack_snapshot_is_current`)
+void mp_gstack_entered(mp_gstack_t* g) {
+  g->entries++;
+}
+
 // Enter a gstack
 void mp_gstack_enter(mp_gstack_t* g, mp_jmpbuf_t** return_jmp, mp_stack_start_fun_t* fun, void* arg) {
+  mp_gstack_entered(g);
   uint8_t* base = mp_gstack_base(g);
   uint8_t* base_commit_limit = mp_push(base, g->committed, NULL);
   uint8_t* base_limit = mp_push(base, g->stack_size, NULL);
@@ -290,35 +719,141 @@ void mp_gstack_enter(mp_gstack_t* g, mp_jmpbuf_t** return_jmp, mp_stack_start_fu
 }
 
 
+// Decommit the memory of an unused gstack that is committed beyond `keep` bytes.
+// The decommitted pages are inaccessible again and committed on demand when the gstack is reused.
+static void mp_gstack_reclaim(mp_gstack_t* g, ssize_t keep) {
+  if (keep < 0 || os_use_overcommit) return;  // with overcommit the whole stack is accessible 
+  keep = mp_max(keep, g->initial_commit);
+  if (mp_likely(g->committed <= keep)) return;
+  const ssize_t size = g->committed - keep;
+  uint8_t* start;
+  mp_push(mp_gstack_base_at(g, keep), size, &start);
+  if (mp_os_mem_decommit(start, size)) {
+    mp_stat_inc(gstack_reclaims);
+    mp_gstack_set_committed(g, keep);
+  }
+}
+
+// The cache is used LIFO so the gstacks at the top are hot and keep their high-water mark;
+// once the cache is full we reclaim the least recently cached gstack instead.
+static void mp_gstack_cache_evict(void) {
+  mp_gstack_t* g = _mp_gstack_cache;
+  if (g == NULL) return;
+  while (g->next != NULL) { g = g->next; }
+  mp_gstack_reclaim(g, os_gstack_cache_commit_max);
+}
+
 // Free a gstack
 void mp_gstack_free(mp_gstack_t* g, bool delay) {
   if (g == NULL) return;
   mp_assert(os_page_size != 0);
   //mp_trace_message("free gstack: %p\n", p);  
+  mp_trace(MP_TRACE_GSTACK_FREE, g, g->committed);
 
   // if delayed, always push it on the delayed list
   if (delay) {
+    mp_stat_inc(gstack_delayed_frees);
     g->next = _mp_gstack_delayed_free;
     _mp_gstack_delayed_free = g;
     return;
   }
 
+  // stop write tracking
+  mp_gstack_untrack(g);
+  g->snapshot = NULL;
+  mp_gstack_site_learn(g);
+  mp_gstack_profile_record(g);
+
+  // return gstacks owned by another thread
+  if (mp_unlikely(g->owner != _mp_gstack_owner)) {
+    mp_gstack_free_remote(g);
+    return;
+  }
+
   // otherwise try to put it in our thread local cache...
   if (_mp_gstack_cache_count < os_gstack_cache_max_count) {
     // allowed to cache.
-    // we keep it as-is    
+    // we keep it as-is; a high-water mark above `os_gstack_cache_commit_max` is only decommitted
+    // when it is evicted from a full cache (or by `mp_collect`) so a gstack that is reused right away
+    // does not fault its pages in again.
     g->next = _mp_gstack_cache;
     _mp_gstack_cache = g;
     _mp_gstack_cache_count++;
+    if (_mp_gstack_cache_count >= os_gstack_cache_max_count) {
+      mp_gstack_cache_evict();
+    }
     return;
   }
 
   // otherwise free it to the OS
-  mp_gstack_os_free(g->full, g->stack, g->stack_size, g->committed);
-  mp_free(g);
+  mp_gstack_os_free_owned(g);
 }
 
 
+// Reclaim the memory of unused gstacks and saves in the current thread
+void mp_collect(bool all) {
+  if (os_page_size == 0) return;  // not yet initialized
+  mp_gstack_collect_remote();
+  if (all) {
+    mp_gstack_clear_cache();
+  }
+  else {
+    mp_gstack_clear_delayed();
+    for (mp_gstack_t* g = _mp_gstack_cache; g != NULL; g = g->next) {
+      mp_gstack_reclaim(g, 0);
+    }
+  }
+  mp_save_arena_collect();
+}
+
+// Commit and touch the first `commit` bytes of a gstack
+static void mp_gstack_prewarm_commit(mp_gstack_t* g, ssize_t commit) {
+  commit = mp_align_up(mp_min(commit, g->stack_size), os_page_size);
+  #if !defined(_WIN32)  // on Windows the committed area is extended through guard pages
+  if (commit > g->committed && !os_use_overcommit) {
+    const ssize_t size = commit - g->committed;
+    uint8_t* start;
+    mp_push(mp_gstack_base_at(g, g->committed), size, &start);
+    if (mp_os_mem_commit(start, size)) {
+      mp_gstack_set_committed(g, commit);
+    }
+  }
+  #endif
+  // touch each page so the OS backs it with memory (using the paint value so it does not show up in a stack profile)
+  commit = mp_min(commit, g->committed);
+  for (ssize_t ofs = os_page_size; ofs <= commit; ofs += os_page_size) {
+    uint8_t* page;
+    mp_push(mp_gstack_base_at(g, ofs - os_page_size), os_page_size, &page);
+    *((volatile uint8_t*)page) = MP_GSTACK_PAINT;
+  }
+}
+
+// Pre-allocate `count` gstacks with `commit` bytes committed and touched and put them in the thread-local cache.
+// Gstacks that do not fit in the cache are freed to a gpool (if enabled) which reserves the gpool and extends its free list.
+// The `extra_size` should be that of later allocations (`mp_prewarm` in <mprompt.c>) or the cached gstacks cannot be reused.
+// Returns the number of gstacks in the thread-local cache.
+ssize_t mp_gstack_prewarm(ssize_t count, ssize_t commit, ssize_t extra_size) {
+  if (!mp_gstack_init(NULL)) return 0;
+  if (os_gstack_cache_commit_max >= 0) {
+    commit = mp_min(commit, os_gstack_cache_commit_max);   // or it would be decommitted again when evicted
+  }
+  ssize_t n = (os_use_gpools ? count : mp_min(count, os_gstack_cache_max_count - _mp_gstack_cache_count));
+  mp_gstack_t* gs = NULL;
+  for (; n > 0; n--) {
+    mp_gstack_t* g = mp_gstack_alloc(0, (const void*)&mp_prewarm, extra_size, NULL);  // use its own site (as in a stack profile)
+    if (g == NULL) break;
+    mp_gstack_prewarm_commit(g, commit);
+    g->next = gs;
+    gs = g;
+  }
+  while (gs != NULL) {
+    mp_gstack_t* next = gs->next;
+    mp_gstack_free(gs, false);
+    gs = next;
+  }
+  return _mp_gstack_cache_count;
+}
+
 // Clear all (thread local) cached gstacks.
 void mp_gstack_clear_cache(void) {
   mp_gstack_clear_delayed();
@@ -326,8 +861,7 @@ void mp_gstack_clear_cache(void) {
   while( g != NULL) {
     mp_gstack_t* next = _mp_gstack_cache = g->next;
     _mp_gstack_cache_count--;
-    mp_gstack_os_free(g->full, g->stack, g->stack_size, g->committed);
-    mp_free(g);
+    mp_gstack_os_free_owned(g);
     g = next;
   }
   mp_assert_internal(_mp_gstack_cache == NULL);
@@ -335,48 +869,647 @@ void mp_gstack_clear_cache(void) {
 }
 
 
+//----------------------------------------------------------------------------------
+// Arena for saved stacks.
+// Multi-shot resumptions save and free many variable sized snapshots; these are 
+// allocated from a thread-local arena with size classes instead of the general heap.
+// Small blocks are carved from larger chunks that are released wholesale when all 
+// blocks in the arena are freed (i.e. a search tree became unreachable); larger blocks 
+// are allocated separately but cached per size class (up to `MP_ARENA_CACHE_MAX` bytes). 
+// Blocks freed by another thread are pushed on the atomic `remote_free` list of the 
+// arena. When the owner thread terminates the list is closed and the arena is freed 
+// when its last block is freed.
+//----------------------------------------------------------------------------------
+
+#define MP_ARENA_SMALL_MAX   (1024)               // blocks up to this size are carved from chunks
+#define MP_ARENA_SMALL_BINS  (MP_ARENA_SMALL_MAX/16)
+#define MP_ARENA_BINS        (MP_ARENA_SMALL_BINS + 4*(8*sizeof(void*) - 10))
+#define MP_ARENA_CHUNK_SIZE  (64*MP_KIB)
+#define MP_ARENA_CACHE_MAX   (8*MP_MIB)           // maximum size of cached large blocks
+
+typedef struct mp_arena_s mp_arena_t;
+
+typedef struct mp_arena_block_s {
+  mp_arena_t* arena;
+  ssize_t     bin;
+} mp_arena_block_t;
+
+typedef struct mp_arena_free_s {
+  struct mp_arena_free_s* next;
+} mp_arena_free_t;
+
+typedef struct mp_arena_chunk_s {
+  struct mp_arena_chunk_s* next;
+  ssize_t                  _pad;   // keep blocks 16-byte aligned
+} mp_arena_chunk_t;
+
+#define MP_ARENA_REMOTE_CLOSED  ((mp_arena_free_t*)1)
+
+struct mp_arena_s {
+  _Atomic(mp_arena_free_t*) remote_free;  // blocks freed by other threads (or `MP_ARENA_REMOTE_CLOSED`)
+  _Atomic(intptr_t)   live;               // live blocks plus one for the owner thread
+  ssize_t             held;               // total bytes held (chunks plus large blocks in use or cached)
+  ssize_t             cached;             // bytes in cached large blocks
+  mp_arena_chunk_t*   chunks;             // small blocks are carved from the first chunk
+  uint8_t*            chunk_free;
+  uint8_t*            chunk_end;
+  mp_arena_free_t*    free[MP_ARENA_BINS];
+};
+
+static mp_decl_thread mp_arena_t* _mp_arena;
+
+static ssize_t mp_arena_bin(ssize_t size, ssize_t* bin_size) {
+  if (size <= MP_ARENA_SMALL_MAX) {
+    const ssize_t bin = (size <= 16 ? 0 : (size - 1) / 16);
+    *bin_size = (bin + 1) * 16;
+    return bin;
+  }
+  // four size classes per power of two
+  const size_t s = (size_t)size - 1;
+  ssize_t b = 10;
+  while ((s >> (b + 1)) != 0) { b++; }
+  const ssize_t sub = (ssize_t)((s >> (b - 2)) & 3);
+  *bin_size = (4 + sub + 1) << (b - 2);
+  return MP_ARENA_SMALL_BINS + 4*(b - 10) + sub;
+}
+
+static ssize_t mp_arena_bin_size(ssize_t bin) {
+  if (bin < MP_ARENA_SMALL_BINS) return (bin + 1) * 16;
+  const ssize_t b = 10 + (bin - MP_ARENA_SMALL_BINS) / 4;
+  const ssize_t sub = (bin - MP_ARENA_SMALL_BINS) % 4;
+  return (4 + sub + 1) << (b - 2);
+}
+
+// Free all cached large blocks
+static void mp_arena_release_cached(mp_arena_t* arena) {
+  for (size_t bin = MP_ARENA_SMALL_BINS; bin < MP_ARENA_BINS; bin++) {
+    mp_arena_free_t* f = arena->free[bin];
+    arena->free[bin] = NULL;
+    while (f != NULL) {
+      mp_arena_free_t* next = f->next;
+      mp_free((mp_arena_block_t*)f - 1);
+      f = next;
+    }
+  }
+  arena->held -= arena->cached;
+  arena->cached = 0;
+}
+
+// Free all chunks (but the first one if `keep_first`); only valid if there are no live blocks
+static void mp_arena_release_chunks(mp_arena_t* arena, bool keep_first) {
+  mp_assert_internal(mp_atomic_load(&arena->live) <= 1);
+  mp_arena_chunk_t* chunk = arena->chunks;
+  if (chunk != NULL && keep_first) {
+    arena->chunk_free = (uint8_t*)(chunk + 1);
+    chunk = chunk->next;
+    arena->chunks->next = NULL;
+  }
+  else {
+    arena->chunks = NULL;
+    arena->chunk_free = arena->chunk_end = NULL;
+  }
+  while (chunk != NULL) {
+    mp_arena_chunk_t* next = chunk->next;
+    arena->held -= MP_ARENA_CHUNK_SIZE;
+    mp_free(chunk);
+    chunk = next;
+  }
+  for (ssize_t bin = 0; bin < MP_ARENA_SMALL_BINS; bin++) {
+    arena->free[bin] = NULL;
+  }
+}
+
+// Free a block into its (own) arena
+static void mp_arena_free_local(mp_arena_t* arena, mp_arena_block_t* block) {
+  const ssize_t bin = block->bin;
+  mp_arena_free_t* f = (mp_arena_free_t*)(block + 1);
+  if (bin >= MP_ARENA_SMALL_BINS) {
+    const ssize_t size = sizeof(mp_arena_block_t) + mp_arena_bin_size(bin);
+    if (arena->cached + size > MP_ARENA_CACHE_MAX) {
+      arena->held -= size;
+      mp_free(block);
+      f = NULL;
+    }
+    else {
+      arena->cached += size;
+    }
+  }
+  if (f != NULL) {
+    f->next = arena->free[bin];
+    arena->free[bin] = f;
+  }
+  if (mp_atomic_add(&arena->live, -1) <= 2) {
+    // no more live blocks: release the chunks wholesale
+    mp_arena_release_chunks(arena, true);
+  }
+}
+
+// Collect blocks that were freed by other threads
+static void mp_arena_collect_remote(mp_arena_t* arena) {
+  if (mp_likely(mp_atomic_load_ptr(mp_arena_free_t, &arena->remote_free) == NULL)) return;
+  mp_arena_free_t* f = mp_atomic_load_ptr(mp_arena_free_t, &arena->remote_free);
+  while (!mp_atomic_cas_ptr(mp_arena_free_t, &arena->remote_free, &f, NULL)) { };
+  while (f != NULL) {
+    mp_arena_free_t* next = f->next;
+    mp_arena_free_local(arena, (mp_arena_block_t*)f - 1);
+    f = next;
+  }
+}
+
+static mp_arena_t* mp_arena_get(void) {
+  mp_arena_t* arena = _mp_arena;
+  if (mp_unlikely(arena == NULL)) {
+    arena = mp_zalloc_safe_tp(mp_arena_t);
+    mp_atomic_store_ptr(mp_arena_free_t, &arena->remote_free, NULL);
+    mp_atomic_store(&arena->live, (intptr_t)1);
+    _mp_arena = arena;
+  }
+  return arena;
+}
+
+// Allocate from the thread local arena
+void* mp_arena_alloc(ssize_t size) {
+  mp_arena_t* arena = mp_arena_get();
+  ssize_t bin_size;
+  const ssize_t bin = mp_arena_bin(size, &bin_size);
+  mp_arena_free_t* f = arena->free[bin];
+  if (f == NULL) {
+    mp_arena_collect_remote(arena);
+    f = arena->free[bin];
+  }
+  mp_arena_block_t* block;
+  if (f != NULL) {
+    arena->free[bin] = f->next;
+    block = (mp_arena_block_t*)f - 1;
+    if (bin >= MP_ARENA_SMALL_BINS) {
+      arena->cached -= sizeof(mp_arena_block_t) + bin_size;
+    }
+  }
+  else if (bin >= MP_ARENA_SMALL_BINS) {
+    block = (mp_arena_block_t*)mp_malloc_safe(sizeof(mp_arena_block_t) + bin_size);
+    arena->held += sizeof(mp_arena_block_t) + bin_size;
+  }
+  else {
+    const ssize_t bsize = sizeof(mp_arena_block_t) + bin_size;
+    if (arena->chunk_free == NULL || arena->chunk_end - arena->chunk_free < bsize) {
+      mp_arena_chunk_t* chunk = (mp_arena_chunk_t*)mp_malloc_safe(MP_ARENA_CHUNK_SIZE);
+      chunk->next = arena->chunks;
+      arena->chunks = chunk;
+      arena->chunk_free = (uint8_t*)(chunk + 1);
+      arena->chunk_end = (uint8_t*)chunk + MP_ARENA_CHUNK_SIZE;
+      arena->held += MP_ARENA_CHUNK_SIZE;
+    }
+    block = (mp_arena_block_t*)arena->chunk_free;
+    arena->chunk_free += bsize;
+  }
+  block->arena = arena;
+  block->bin = bin;
+  mp_atomic_add(&arena->live, 1);
+  return (block + 1);
+}
+
+// Free to the arena of the block
+void mp_arena_free(void* p) {
+  if (p == NULL) return;
+  mp_arena_block_t* block = (mp_arena_block_t*)p - 1;
+  if (mp_unlikely(block->bin < 0)) return;  // allocated in a scope (and released with it)
+  mp_arena_t* arena = block->arena;
+  if (mp_likely(arena == _mp_arena)) {
+    mp_arena_free_local(arena, block);
+    return;
+  }
+  // freed by another thread
+  mp_arena_free_t* f = (mp_arena_free_t*)p;
+  mp_arena_free_t* remote = mp_atomic_load_ptr(mp_arena_free_t, &arena->remote_free);
+  do {
+    if (remote == MP_ARENA_REMOTE_CLOSED) {
+      // the owner thread has terminated; small blocks are freed with their chunks
+      if (block->bin >= MP_ARENA_SMALL_BINS) {
+        mp_free(block);
+      }
+      if (mp_atomic_add(&arena->live, -1) <= 1) {
+        mp_arena_release_chunks(arena, false);
+        mp_free(arena);
+      }
+      return;
+    }
+    f->next = remote;
+  } while (!mp_atomic_cas_ptr(mp_arena_free_t, &arena->remote_free, &remote, f));
+}
+
+// Called on thread termination; close the remote free list and release the arena
+static void mp_arena_thread_done(void) {
+  mp_arena_t* arena = _mp_arena;
+  if (arena == NULL) return;
+  mp_arena_collect_remote(arena);
+  mp_arena_free_t* f = mp_atomic_load_ptr(mp_arena_free_t, &arena->remote_free);
+  while (!mp_atomic_cas_ptr(mp_arena_free_t, &arena->remote_free, &f, MP_ARENA_REMOTE_CLOSED)) { };
+  // collect blocks freed in the meantime
+  while (f != NULL) {
+    mp_arena_free_t* next = f->next;
+    mp_arena_free_local(arena, (mp_arena_block_t*)f - 1);
+    f = next;
+  }
+  _mp_arena = NULL;
+  mp_arena_release_cached(arena);
+  if (mp_atomic_add(&arena->live, -1) <= 1) {
+    mp_arena_release_chunks(arena, false);
+    mp_free(arena);
+  }
+}
+
+
+
+//----------------------------------------------------------------------------------
+// Scopes for saved stacks.
+// Multi-shot resumptions that are only used within a scope (see `mp_resume_multi_scoped`)
+// allocate by bumping a pointer in the scope instead of the arena. A scope starts with
+// the buffer in the `mp_scope_t` itself (usually in the frame of its owner) and continues 
+// in chunks from a thread-local cache; `mp_scope_done` returns the chunks to the cache
+// of the current thread. Scoped blocks have a `bin` of -1 (and the scope as their `arena`) 
+// and freeing them is a no-op.
+//----------------------------------------------------------------------------------
+
+#define MP_SCOPE_SMALL_ALIGN  (16)
+
+typedef struct mp_scope_chunk_s {
+  struct mp_scope_chunk_s* next;
+  ssize_t                  size;   // including this header (and keeps blocks 16-byte aligned)
+} mp_scope_chunk_t;
+
+static mp_decl_thread mp_scope_chunk_t* _mp_scope_cache;        // cached chunks
+static mp_decl_thread ssize_t           _mp_scope_cache_size;   // total bytes in cached chunks
+
+void mp_scope_init(mp_scope_t* scope) {
+  uint8_t* buffer = (uint8_t*)&scope->_buffer[0];
+  scope->_free = mp_align_up_ptr(buffer, MP_SCOPE_SMALL_ALIGN);
+  scope->_end = buffer + sizeof(scope->_buffer);
+  scope->_chunks = NULL;
+}
+
+// Continue the scope in a chunk (from the cache if possible) that can hold at least `bsize` bytes
+static mp_decl_noinline uint8_t* mp_scope_extend(mp_scope_t* scope, ssize_t bsize) {
+  const ssize_t needed = sizeof(mp_scope_chunk_t) + bsize;
+  mp_scope_chunk_t* chunk = NULL;
+  for (mp_scope_chunk_t** pchunk = &_mp_scope_cache; *pchunk != NULL; pchunk = &(*pchunk)->next) {
+    if ((*pchunk)->size >= needed) {
+      chunk = *pchunk;
+      *pchunk = chunk->next;
+      _mp_scope_cache_size -= chunk->size;
+      break;
+    }
+  }
+  if (chunk == NULL) {
+    const ssize_t size = mp_align_up(needed, MP_ARENA_CHUNK_SIZE);
+    chunk = (mp_scope_chunk_t*)mp_malloc_safe(size);
+    chunk->size = size;
+  }
+  chunk->next = (mp_scope_chunk_t*)scope->_chunks;
+  scope->_chunks = chunk;
+  scope->_end = (uint8_t*)chunk + chunk->size;
+  return (uint8_t*)(chunk + 1);
+}
+
+// Allocate in a scope (or the thread-local arena if `scope == NULL`)
+void* mp_arena_alloc_in(mp_scope_t* scope, ssize_t size) {
+  if (mp_likely(scope == NULL)) return mp_arena_alloc(size);
+  const ssize_t bsize = sizeof(mp_arena_block_t) + mp_align_up(size, MP_SCOPE_SMALL_ALIGN);
+  uint8_t* p = (uint8_t*)scope->_free;
+  if (mp_unlikely((uint8_t*)scope->_end - p < bsize)) {
+    p = mp_scope_extend(scope, bsize);
+  }
+  scope->_free = p + bsize;
+  mp_arena_block_t* block = (mp_arena_block_t*)p;
+  block->arena = (mp_arena_t*)scope;
+  block->bin = -1;
+  return (block + 1);
+}
+
+// The scope of an arena block (or NULL if it is not scoped)
+static mp_scope_t* mp_arena_scope_of(const void* p) {
+  const mp_arena_block_t* block = (const mp_arena_block_t*)p - 1;
+  return (block->bin < 0 ? (mp_scope_t*)block->arena : NULL);
+}
+
+// Release all memory of a scope at once (and reinitialize it)
+void mp_scope_done(mp_scope_t* scope) {
+  mp_scope_chunk_t* chunk = (mp_scope_chunk_t*)scope->_chunks;
+  while (chunk != NULL) {
+    mp_scope_chunk_t* next = chunk->next;
+    if (_mp_scope_cache_size + chunk->size <= MP_ARENA_CACHE_MAX) {
+      chunk->next = _mp_scope_cache;
+      _mp_scope_cache = chunk;
+      _mp_scope_cache_size += chunk->size;
+    }
+    else {
+      mp_free(chunk);
+    }
+    chunk = next;
+  }
+  mp_scope_init(scope);
+}
+
+// Free the cached chunks of the current thread
+static void mp_scope_release_cached(void) {
+  mp_scope_chunk_t* chunk = _mp_scope_cache;
+  while (chunk != NULL) {
+    mp_scope_chunk_t* next = chunk->next;
+    mp_free(chunk);
+    chunk = next;
+  }
+  _mp_scope_cache = NULL;
+  _mp_scope_cache_size = 0;
+}
+
+ptrdiff_t mp_save_arena_size(void) {
+  return (_mp_arena == NULL ? 0 : _mp_arena->held);
+}
+
+void mp_save_arena_collect(void) {
+  mp_scope_release_cached();
+  mp_arena_t* arena = _mp_arena;
+  if (arena == NULL) return;
+  mp_arena_collect_remote(arena);
+  mp_arena_release_cached(arena);
+  if (mp_atomic_load(&arena->live) <= 1) {
+    mp_arena_release_chunks(arena, false);
+  }
+}
+
+
 //----------------------------------------------------------------------------------
 // Saving / Restoring
 //----------------------------------------------------------------------------------
 
-struct mp_gsave_s {
+// A snapshot of the used part of a gstack. Snapshots are reference counted 
+// and shared between saves of a gstack whose stack is unchanged in the meantime 
+// (as happens for the lower prompts of a chain that is saved multiple times). 
+// A suspended stack only changes once control enters its gstack again, so if the 
+// `entries` count of the gstack is the same as when it last equaled its snapshot, 
+// the stack is unchanged (without needing to compare or track writes).
+struct mp_gsnap_s {
+  mp_gstack_t* gstack;  // the saved gstack
+  size_t  entries;      // the `entries` of the gstack when its stack last equaled this snapshot
+  ssize_t refcount;
   void*   stack;
   ssize_t stack_size;
+  uint8_t data[1];      // the saved stack
+};
+
+struct mp_gsave_s {
+  mp_gsnap_t* snap;     // the saved stack
   void*   extra;        // mp_prompt_t structure
   ssize_t extra_size;
-  uint8_t data[1];      // combined data; starts with extra
+  uint8_t data[1];      // the saved extra data
 };
 
-// save a gstack
+
+//----------------------------------------------------------------------------------
+// Write tracking (if `os_gsave_track_writes` is enabled)
+// After saving or restoring a snapshot, the (full) pages of the saved stack area are 
+// write protected and the gstack is `tracked` by that snapshot. A write to such page 
+// causes a fault where we mark the page as `dirty` and make it writable again. 
+// When the same snapshot is restored again, only the dirty pages need to be copied.
+// The protection stays while the prompt runs again, and a page can also be written by another
+// thread (through a pointer into the stack); the fault handler therefore finds the tracked 
+// gstack through its gpool block (so tracking is only used with gpools) and sets dirty bits atomically.
+// Note: write protected pages cannot be written directly by system calls (like `read`); 
+// these return `EFAULT` instead (similar to commit-on-demand gstacks).
+//----------------------------------------------------------------------------------
+
+#define MP_GSAVE_TRACK_MIN_PAGES  (4)   // only track if at least this many pages can be protected
+#define MP_GSTACK_DIRTY_BITS      (8*(ssize_t)sizeof(intptr_t))   // pages per word of the dirty bitmap
+
+static intptr_t mp_gstack_dirty_bit(ssize_t page) {
+  return (intptr_t)((uintptr_t)1 << (page % MP_GSTACK_DIRTY_BITS));
+}
+
+static bool mp_gstack_is_dirty(const mp_gstack_t* g, ssize_t page) {
+  return ((mp_atomic_load(&g->dirty[page / MP_GSTACK_DIRTY_BITS]) & mp_gstack_dirty_bit(page)) != 0);
+}
+
+// Mark a page as dirty (called from the fault handler of any thread)
+static void mp_gstack_set_dirty(mp_gstack_t* g, ssize_t page) {
+  _Atomic(intptr_t)* word = &g->dirty[page / MP_GSTACK_DIRTY_BITS];
+  const intptr_t bit = mp_gstack_dirty_bit(page);
+  intptr_t w = mp_atomic_load(word);
+  while ((w & bit) == 0) {
+    if (mp_atomic_cas(word, &w, w | bit)) {
+      mp_atomic_add(&g->dirty_count, (intptr_t)1);
+      break;
+    }
+  }
+}
+
+// Clear the dirty bitmap of `page_count` pages
+static void mp_gstack_clear_dirty(mp_gstack_t* g, ssize_t page_count) {
+  const ssize_t count = (page_count + MP_GSTACK_DIRTY_BITS - 1) / MP_GSTACK_DIRTY_BITS;
+  for (ssize_t i = 0; i < count; i++) {
+    mp_atomic_store(&g->dirty[i], (intptr_t)0);
+  }
+  mp_atomic_store(&g->dirty_count, (intptr_t)0);
+}
+
+// Start tracking writes to `g` that now equals `gs`
+static void mp_gstack_track(mp_gstack_t* g, mp_gsnap_t* gs) {
+  mp_assert_internal(g->tracked == NULL && gs->gstack == g);
+  uint8_t* start = mp_align_up_ptr((uint8_t*)gs->stack, os_page_size);
+  uint8_t* end   = mp_align_down_ptr((uint8_t*)gs->stack + gs->stack_size, os_page_size);
+  if (end - start < MP_GSAVE_TRACK_MIN_PAGES * os_page_size) return;
+  const ssize_t page_count = g->stack_size / os_page_size;
+  if (g->dirty == NULL) {
+    g->dirty = (_Atomic(intptr_t)*)mp_zalloc(((page_count + MP_GSTACK_DIRTY_BITS - 1) / MP_GSTACK_DIRTY_BITS) * sizeof(intptr_t));
+    if (g->dirty == NULL) return;
+  }
+  mp_gstack_clear_dirty(g, page_count);
+  g->tracked = gs;
+  g->tracked_start = start;
+  g->tracked_size = end - start;
+  // register with the gpool before protecting so a fault on any thread finds it
+  if (!mp_gpool_set_tracked(g->stack, g)) {
+    g->tracked = NULL;
+    return;
+  }
+  if (!mp_os_mem_protect(start, end - start, true)) {
+    mp_gpool_set_tracked(g->stack, NULL);
+    g->tracked = NULL;
+  }
+}
+
+// Stop tracking writes to `g`
+static void mp_gstack_untrack(mp_gstack_t* g) {
+  if (mp_likely(g->tracked == NULL)) return;
+  mp_os_mem_protect(g->tracked_start, g->tracked_size, false);
+  mp_gpool_set_tracked(g->stack, NULL);
+  g->tracked = NULL;
+}
+
+// Called from the fault handler (on any thread): returns `true` if `page` was write protected in a tracked gstack
+static bool mp_gstack_track_fault(uint8_t* page) {
+  mp_gstack_t* g = mp_gpool_tracked(page);
+  if (g == NULL || page < g->tracked_start || page >= g->tracked_start + g->tracked_size) return false;
+  const ssize_t idx = (page - g->tracked_start) / os_page_size;
+  mp_stat_inc(track_faults);
+  mp_trace(MP_TRACE_TRACK_FAULT, page, 0);
+  mp_gstack_set_dirty(g, idx);  // before the page becomes writable
+  return mp_os_mem_protect(page, os_page_size, false);
+}
+
+// The saved data of a stack address `p`
+static const uint8_t* mp_gsnap_data_at(const mp_gsnap_t* gs, const uint8_t* p) {
+  return gs->data + (p - (const uint8_t*)gs->stack);
+}
+
+// Restore the dirty pages of a tracked gstack (and protect them again)
+static void mp_gsnap_restore_dirty(mp_gsnap_t* gs) {
+  mp_gstack_t* g = gs->gstack;
+  // the partial pages at the ends are not protected
+  uint8_t* stack = (uint8_t*)gs->stack;
+  uint8_t* start = g->tracked_start;
+  uint8_t* end = g->tracked_start + g->tracked_size;
+  memcpy(stack, mp_gsnap_data_at(gs, stack), start - stack);
+  memcpy(end, mp_gsnap_data_at(gs, end), (stack + gs->stack_size) - end);
+  mp_stat_add(restore_bytes, gs->stack_size - g->tracked_size);
+  if (mp_atomic_load(&g->dirty_count) == 0) return;  // the rest is still in place
+  // and copy runs of dirty pages
+  const ssize_t count = g->tracked_size / os_page_size;
+  for (ssize_t i = 0; i < count; i++) {
+    if (mp_likely(i % MP_GSTACK_DIRTY_BITS == 0 && mp_atomic_load(&g->dirty[i / MP_GSTACK_DIRTY_BITS]) == 0)) { i += MP_GSTACK_DIRTY_BITS - 1; continue; }
+    if (!mp_gstack_is_dirty(g, i)) continue;
+    ssize_t j = i + 1;
+    while (j < count && mp_gstack_is_dirty(g, j)) { j++; }
+    uint8_t* p = start + (i * os_page_size);
+    const ssize_t size = (j - i) * os_page_size;
+    memcpy(p, mp_gsnap_data_at(gs, p), size);
+    mp_stat_add(restore_bytes, size);
+    mp_os_mem_protect(p, size, true);
+    i = j;
+  }
+  mp_gstack_clear_dirty(g, count);
+}
+
+// Is the gstack unchanged since it last equaled its snapshot `gs`? This is the case if control 
+// did not enter the gstack since. 
+static bool mp_gstack_snapshot_is_unchanged(const mp_gstack_t* g, const mp_gsnap_t* gs) {
+  if (g->snapshot != gs || g->entries != gs->entries) return false;
+  #if !MP_USE_ASAN
+  mp_assert_internal(memcmp(gs->data, gs->stack, gs->stack_size) == 0);
+  #endif
+  return true;
+}
+
+// Is the content of the gstack still equal to its last snapshot `gs` (with the same saved area)?
+// In that case the snapshot can be shared. A snapshot in a scope can only be shared within that scope.
+static bool mp_gstack_snapshot_is_current(const mp_gstack_t* g, const mp_gsnap_t* gs, const uint8_t* stack, ssize_t stack_size, mp_scope_t* scope) {
+  if (gs == NULL || gs->stack != stack || gs->stack_size != stack_size) return false;
+  const mp_scope_t* gs_scope = mp_arena_scope_of(gs);
+  if (gs_scope != NULL && gs_scope != scope) return false;
+  if (mp_gstack_snapshot_is_unchanged(g, gs)) return true;
+  #if !MP_USE_ASAN
+  if (g->tracked == gs) {
+    // control entered the gstack since, but the write protected pages are unchanged if none 
+    // are dirty; then only compare the partial pages at the ends
+    if (mp_atomic_load(&g->dirty_count) != 0) return false;
+    const uint8_t* end = g->tracked_start + g->tracked_size;
+    return (memcmp(mp_gsnap_data_at(gs, stack), stack, g->tracked_start - stack) == 0 &&
+            memcmp(mp_gsnap_data_at(gs, end), end, (stack + stack_size) - end) == 0);
+  }
+  #endif
+  return false;  // the stack ran since, so it is (very likely) changed: don't compare it all
+}
+
+
+// save the stack of a gstack (or share the previous snapshot if it is unchanged)
 #if MP_USE_ASAN
 __attribute__((no_sanitize("address")))
 #endif
-mp_gsave_t* mp_gstack_save(mp_gstack_t* g, uint8_t* sp) {
+static mp_gsnap_t* mp_gstack_snap(mp_gstack_t* g, uint8_t* stack, ssize_t stack_size, mp_scope_t* scope) {
+  mp_stat_inc(saves);
+  if (mp_gstack_snapshot_is_current(g, g->snapshot, stack, stack_size, scope)) {
+    mp_stat_inc(saves_shared);
+    g->snapshot->entries = g->entries;
+    g->snapshot->refcount++;
+    return g->snapshot;
+  }
+  mp_gsnap_t* gs = (mp_gsnap_t*)mp_arena_alloc_in(scope, sizeof(mp_gsnap_t) - 1 + stack_size);
+  gs->gstack = g;
+  gs->entries = g->entries;
+  gs->refcount = 1;
+  gs->stack = stack;
+  gs->stack_size = stack_size;
+  #if MP_USE_ASAN
+    for(ssize_t i = 0; i < gs->stack_size; i++) { gs->data[i] = stack[i]; }
+  #else
+    memcpy(gs->data, stack, stack_size);
+  #endif
+  mp_stat_add(save_bytes, stack_size);
+  if (os_gsave_track_writes) {
+    mp_gstack_untrack(g);
+    mp_gstack_track(g, gs);
+  }
+  g->snapshot = gs;
+  return gs;
+}
+
+static void mp_gsnap_restore(mp_gsnap_t* gs) {
+  mp_gstack_t* g = gs->gstack;
+  if (mp_gstack_snapshot_is_unchanged(g, gs)) {
+    // the stack is still in place (as for the lower prompts of a chain that is resumed multiple times)
+    mp_stat_inc(restores_skipped);
+    return;
+  }
+  g->snapshot = gs;
+  gs->entries = g->entries;
+  if (g->tracked == gs) {
+    // only restore the pages that were written to since (if any)
+    mp_gsnap_restore_dirty(gs);
+    return;
+  }
+  mp_gstack_untrack(g);
+  memcpy(gs->stack, gs->data, gs->stack_size);
+  mp_stat_add(restore_bytes, gs->stack_size);
+  if (os_gsave_track_writes) {
+    mp_gstack_track(g, gs);
+  }
+}
+
+static void mp_gsnap_free(mp_gsnap_t* gs) {
+  if (--gs->refcount > 0) return;
+  mp_gstack_t* g = gs->gstack;
+  if (g->tracked == gs) {
+    mp_gstack_untrack(g);
+  }
+  if (g->snapshot == gs) {
+    g->snapshot = NULL;
+  }
+  mp_arena_free(gs);
+}
+
+
+// save a gstack
+mp_gsave_t* mp_gstack_save(mp_gstack_t* g, uint8_t* sp, mp_scope_t* scope) {
   mp_assert_internal(mp_gstack_contains(g, sp));
   ssize_t stack_size = mp_unpush(sp, g->stack, g->stack_size);
   mp_assert_internal(stack_size >= 0 && stack_size <= g->stack_size);
-  mp_gsave_t* gs = (mp_gsave_t*)mp_malloc_safe(sizeof(mp_gsave_t) - 1 + stack_size + g->extra_size);
-  gs->stack = (os_stack_grows_down ? sp : g->stack);
-  gs->stack_size = stack_size;
+  mp_trace(MP_TRACE_GSTACK_SAVE, g, stack_size);
+  mp_gsave_t* gs = (mp_gsave_t*)mp_arena_alloc_in(scope, sizeof(mp_gsave_t) - 1 + g->extra_size);
   gs->extra = &g->extra[0];
   gs->extra_size = g->extra_size;
-  #if MP_USE_ASAN
-    for(ssize_t i = 0; i < gs->extra_size; i++) { gs->data[i] = ((uint8_t*)gs->extra)[i]; }
-    for(ssize_t i = 0; i < gs->stack_size; i++) { gs->data[i + gs->extra_size] = ((uint8_t*)gs->stack)[i]; }
-  #else
-    memcpy(gs->data, gs->extra, gs->extra_size);
-    memcpy(gs->data + gs->extra_size, gs->stack, gs->stack_size);
-  #endif
+  memcpy(gs->data, gs->extra, gs->extra_size);
+  mp_stat_add(save_bytes, gs->extra_size);
+  gs->snap = mp_gstack_snap(g, (os_stack_grows_down ? sp : g->stack), stack_size, scope);
   return gs;
 }
 
 void mp_gsave_restore(mp_gsave_t* gs) {
   memcpy(gs->extra, gs->data, gs->extra_size);
-  memcpy(gs->stack, gs->data + gs->extra_size, gs->stack_size);
+  mp_stat_add(restore_bytes, gs->extra_size);
+  mp_gsnap_restore(gs->snap);
 }
 
 void mp_gsave_free(mp_gsave_t* gs) {
-  mp_free(gs);
+  mp_gsnap_free(gs->snap);
+  mp_arena_free(gs);
 }
 
 
@@ -429,6 +1562,18 @@ bool mp_gstack_init(const mp_config_t* config) {
     // user settings
     if (config != NULL) {      
       os_gstack_reset_decommits = config->stack_reset_decommits;
+      #if !defined(_WIN32)
+      os_gsave_track_writes = config->stack_save_track_writes;
+      os_gstack_learn_commit = config->stack_learn_commit;
+      os_gstack_reset_background = config->stack_reset_background;
+      #endif
+      os_gstack_profile = config->stack_profile;
+      #if defined(__linux__)
+      os_gpool_userfaultfd = config->stack_use_userfaultfd;
+      os_gstack_huge_pages = config->stack_huge_pages;
+      os_gpool_numa = config->gpool_numa;
+      os_gpool_compact = config->gpool_compact;
+      #endif
       os_use_overcommit = config->stack_use_overcommit;      
       if (os_use_overcommit) {
         os_use_gpools = false;
@@ -453,6 +1598,12 @@ bool mp_gstack_init(const mp_config_t* config) {
       if (config->stack_gap_size > 0) {
         os_gstack_gap = mp_align_up(config->stack_gap_size, 4 * MP_KIB);
       }
+      if (config->stack_cache_commit_max >= 0) {
+        os_gstack_cache_commit_max = mp_align_up(config->stack_cache_commit_max, 4 * MP_KIB);
+      }
+      else {
+        os_gstack_cache_commit_max = -1;
+      }
       if (config->stack_cache_count >= 0) {
         os_gstack_cache_max_count = config->stack_cache_count;
       }
@@ -470,6 +1621,7 @@ bool mp_gstack_init(const mp_config_t* config) {
     os_gstack_exn_guaranteed = mp_align_up(os_gstack_exn_guaranteed, os_page_size);
     os_gstack_gap = mp_align_up(os_gstack_gap, os_page_size);
     os_gpool_max_size = mp_align_up(os_gpool_max_size, os_page_size);
+    if (os_gstack_cache_commit_max > 0) os_gstack_cache_commit_max = mp_align_up(os_gstack_cache_commit_max, os_page_size);
     os_gstack_initial_commit = (os_gstack_initial_commit == 0 ? os_page_size : mp_align_up(os_gstack_initial_commit, os_page_size));
     if (os_gstack_initial_commit > os_gstack_size) os_gstack_initial_commit = os_gstack_size;
 
@@ -495,11 +1647,45 @@ mp_config_t mp_config_default(void) {
   #endif
   cfg.stack_use_overcommit = false;
   cfg.stack_reset_decommits = false;
+  cfg.stack_reset_background = false;
+  cfg.stack_save_track_writes = false;
+  cfg.stack_learn_commit = os_gstack_learn_commit;
+  cfg.stack_profile = false;
+  cfg.stack_use_userfaultfd = false;
+  cfg.stack_huge_pages = false;
+  cfg.gpool_numa = false;
+  cfg.gpool_compact = false;
+  cfg.gpool_max_size = os_gpool_max_size;
+  cfg.stack_max_size = os_gstack_size;
+  cfg.stack_initial_commit = os_gstack_initial_commit;
+  cfg.stack_exn_guaranteed = os_gstack_exn_guaranteed;
+  cfg.stack_cache_count = os_gstack_cache_max_count;
+  cfg.stack_cache_commit_max = os_gstack_cache_commit_max;
+  cfg.stack_gap_size = os_gstack_gap;
+  return cfg;
+}
+
+mp_config_t mp_config_current(void) {
+  mp_config_t cfg;
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.gpool_enable = os_use_gpools;
+  cfg.gpool_numa = os_gpool_numa;
+  cfg.gpool_compact = os_gpool_compact;
+  cfg.stack_grow_fast = os_gstack_grow_fast;
+  cfg.stack_use_overcommit = os_use_overcommit;
+  cfg.stack_reset_decommits = os_gstack_reset_decommits;
+  cfg.stack_reset_background = os_gstack_reset_background;
+  cfg.stack_save_track_writes = os_gsave_track_writes;
+  cfg.stack_learn_commit = os_gstack_learn_commit;
+  cfg.stack_profile = os_gstack_profile;
+  cfg.stack_use_userfaultfd = os_gpool_userfaultfd;
+  cfg.stack_huge_pages = (os_huge_page_size > 0);
   cfg.gpool_max_size = os_gpool_max_size;
   cfg.stack_max_size = os_gstack_size;
   cfg.stack_initial_commit = os_gstack_initial_commit;
   cfg.stack_exn_guaranteed = os_gstack_exn_guaranteed;
   cfg.stack_cache_count = os_gstack_cache_max_count;
+  cfg.stack_cache_commit_max = os_gstack_cache_commit_max;
   cfg.stack_gap_size = os_gstack_gap;
   return cfg;
 }
@@ -507,6 +1693,10 @@ mp_config_t mp_config_default(void) {
 
 static void mp_gstack_thread_done(void) {
   mp_gstack_clear_cache();  // also does mp_gstack_clear_delayed
+  mp_gstack_owner_done();
+  mp_arena_thread_done();
+  mp_scope_release_cached();
+  mp_stats_thread_done();
 }
 
 static mp_decl_thread bool _mp_gstack_init;
@@ -514,6 +1704,7 @@ static mp_decl_thread bool _mp_gstack_init;
 static void mp_gstack_thread_init(void) {
   if (_mp_gstack_init) return;  // already initialized?
   _mp_gstack_init = true;
+  mp_stats_thread_init();
   mp_gstack_os_thread_init();  
 }
 
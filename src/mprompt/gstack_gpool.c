@@ -22,22 +22,45 @@
   | mp_gpool_t .... |xxxx| stack 1  .... |xxxx| stack 2 .... |xxx| ...   | stack N ... |xxx|
   |----------------------------------------------------------------------------------------|
 
-  The mp_gpool_t has a "free stack" itself (`free`) consisting of N (~32000) `int16_t`
-  indices which are demand initialized to zero. The top of the stack starts
-  at 0. Each entry at index `i` represents an available gstack at index `free[i] + i`:
-  so the initial on-demand zero'd `free` stack makes all gstacks available in the pool :-)
+  When the hot base of stacks is backed by huge pages (`stack_huge_pages`), the pool is
+  aligned to the huge page size and the gap comes first in each block (with stacks growing
+  down) such that every stack base is at a huge page boundary.
+
+  The mp_gpool_t has a lock-free "free stack" itself consisting of a `free_head`
+  and a `free` array of N `mp_gpool_link_t` links which are demand initialized to zero. 
+  On 64-bit systems the links are 32-bit and a gpool can hold millions of gstacks (usually
+  limited by the `gpool_max_size`); the gpool info and links then take up the first `meta_count`
+  blocks. On 32-bit systems the links are `int16_t` and a gpool holds at most 32000 gstacks.
+  Each available gstack at index `i` links to the next available gstack at index 
+  `i + 1 + free[i]`: so the initial on-demand zero'd `free` array links all gstacks 
+  in the pool in order :-) The `free_head` contains the index of the first available gstack
+  (or N if there is none) and a tag that is incremented on every update to avoid ABA issues.
 
   From this free stack we can pop gstacks to use, or push back ones that are freed
-  in a very efficient way. Moreover, reused gstacks do not need to be re-committed
-  (and re-zero initialized by the OS).
+  in a very efficient way (using a single CAS). Moreover, reused gstacks do not need 
+  to be re-committed (and re-zero initialized by the OS).
 
   note: when the stack grows down, we modiy the index to allocate gstacks in 
-  reverse; i.e. the entry at index `i` represents an available gstack at `N - (free[i] + i)`.
+  reverse; i.e. the entry at index `i` represents the available gstack at block `N + M - 1 - i`
+  (where `M` is the `meta_count`).
   On Windows, backtraces only work if the parent of a gstack is at a higher
   address and this strategy will help to ensure this is often the case.
 
-  Since the gpool list is global we use a small spinlock for thread-safe
-  allocation and free.
+  Since the gpool list is global all updates are atomic. Each thread remembers
+  the last gpool it allocated from to avoid testing full gpools over and over.
+  With `gpool_numa` each gpool belongs to the NUMA node of the thread that created 
+  it (and its memory is bound to that node); threads only allocate from the gpools
+  of their current node and create a fresh gpool for their node if those are full.
+
+  To find the gpool of an address (on free and on page faults) we use a global
+  map indexed by 1GiB granule where each entry points to (at most) 2 pools
+  that overlap with that granule. Only if there are gpools that could not be 
+  registered in the map (when they are smaller than a granule or at a very high 
+  address) we fall back to a linear search through all gpools.
+
+  With `stack_save_track_writes`, the gpool info also has a `tracked` array with
+  the write tracked gstack (if any) of each block such that the fault handler of 
+  any thread can find the gstack of a write protected page.
 -----------------------------------------------------------------------------*/
 
 // We need atomic operations for the `gpool` on systems that do not have overcommit.
@@ -46,7 +69,20 @@
 //----------------------------------------------------------------------------------
 // gpool
 //----------------------------------------------------------------------------------
+#if (INTPTR_MAX > INT32_MAX)
+typedef int32_t mp_gpool_link_t;
+#define MP_GPOOL_LINK_MIN   INT32_MIN
+#define MP_GPOOL_LINK_MAX   INT32_MAX
+#define MP_GPOOL_MAX_COUNT  (1L << 24)      // at most INT32_MAX
+#define MP_GPOOL_IDX_BITS   (32)            // bits for the index in the `free_head` (the rest is the ABA tag)
+#else
+typedef int16_t mp_gpool_link_t;
+#define MP_GPOOL_LINK_MIN   INT16_MIN
+#define MP_GPOOL_LINK_MAX   INT16_MAX
 #define MP_GPOOL_MAX_COUNT  (32000)         // at most INT16_MAX
+#define MP_GPOOL_IDX_BITS   (16)
+#endif
+#define MP_GPOOL_IDX_MASK   (((uintptr_t)1 << MP_GPOOL_IDX_BITS) - 1)
 
 static inline bool mp_gpool_grows_down(void) {
   return os_stack_grows_down;               // separate definition so we can debug reverse allocation
@@ -58,12 +94,15 @@ typedef struct mp_gpool_s {
   ssize_t  size;            // always: block_count * block_size
   ssize_t  block_count;
   ssize_t  block_size;
+  ssize_t  meta_size;       // size of the gpool info including the `free` links
+  ssize_t  meta_count;      // blocks taken by the gpool info
   ssize_t  gap_size;
+  ssize_t  stack_ofs;       // offset of the stack in a block (the gap comes first if the stack bases are huge page aligned)
+  int      numa_node;       // NUMA node the memory is bound to (or -1)
   bool     zeroed;          // is the free area surely zero'd?
-  // protected by a lock:
-  mp_spin_lock_t free_lock;
-  ssize_t  free_sp;
-  int16_t  free[MP_GPOOL_MAX_COUNT];
+  _Atomic(intptr_t) free_head;  // tag << MP_GPOOL_IDX_BITS | index of the first available gstack 
+  mp_gpool_link_t* free;    // `block_count` links (right after the gpool info)
+  _Atomic(mp_gstack_t*)* tracked; // `block_count` write tracked gstacks (after the links; NULL if not tracking writes)
 } mp_gpool_t;
 
 
@@ -80,10 +119,117 @@ static mp_gpool_t* mp_gpool_next(const mp_gpool_t* gp) {
 }
 
 
-// Create a new pool in a given reserved virtual memory area.
-static mp_gpool_t* mp_gpool_create(void* p, ssize_t size, ssize_t stack_size, ssize_t gap_size, bool zeroed) {
+//----------------------------------------------------------------------------------
+// Map from address to gpool
+//----------------------------------------------------------------------------------
+
+#define MP_GPOOL_MAP_SHIFT    (30)          // 1GiB granules
+#if (INTPTR_MAX > INT32_MAX)
+#define MP_GPOOL_MAP_BITS     (47)          // user space addresses covered by the map
+#else
+#define MP_GPOOL_MAP_BITS     (32)
+#endif
+#define MP_GPOOL_MAP_COUNT    ((size_t)1 << (MP_GPOOL_MAP_BITS - MP_GPOOL_MAP_SHIFT))
+#define MP_GPOOL_MAP_SLOTS    (2)           // a granule overlaps with at most 2 gpools (of at least 1 granule)
+
+static _Atomic(mp_gpool_t*) mp_gpool_map[MP_GPOOL_MAP_COUNT][MP_GPOOL_MAP_SLOTS];
+static _Atomic(intptr_t)    mp_gpool_map_incomplete;   // non-zero if some gpool is not in the map
+
+static inline bool mp_gpool_contains(const mp_gpool_t* gp, const void* p) {
+  const ptrdiff_t ofs = (const uint8_t*)p - (const uint8_t*)gp;
+  return (ofs >= 0 && ofs < gp->size);
+}
+
+// Register a fresh gpool in the map
+static void mp_gpool_map_register(mp_gpool_t* gp) {
+  const uintptr_t start = (uintptr_t)gp >> MP_GPOOL_MAP_SHIFT;
+  const uintptr_t end   = ((uintptr_t)gp + (uintptr_t)gp->size - 1) >> MP_GPOOL_MAP_SHIFT;
+  if (gp->size < ((ssize_t)1 << MP_GPOOL_MAP_SHIFT) || end >= MP_GPOOL_MAP_COUNT) {
+    mp_atomic_store(&mp_gpool_map_incomplete, (intptr_t)1);
+    return;
+  }
+  for (uintptr_t i = start; i <= end; i++) {
+    bool registered = false;
+    for (size_t j = 0; j < MP_GPOOL_MAP_SLOTS && !registered; j++) {
+      mp_gpool_t* expected = NULL;
+      registered = mp_atomic_cas_ptr(mp_gpool_t, &mp_gpool_map[i][j], &expected, gp);
+    }
+    if (!registered) {
+      mp_atomic_store(&mp_gpool_map_incomplete, (intptr_t)1);
+    }
+  }
+}
+
+// Find the gpool that contains `p` (or NULL)
+static mp_gpool_t* mp_gpool_find(const void* p) {
+  const uintptr_t i = (uintptr_t)p >> MP_GPOOL_MAP_SHIFT;
+  if (mp_likely(i < MP_GPOOL_MAP_COUNT)) {
+    for (size_t j = 0; j < MP_GPOOL_MAP_SLOTS; j++) {
+      mp_gpool_t* gp = mp_atomic_load_ptr(mp_gpool_t, &mp_gpool_map[i][j]);
+      if (gp == NULL) break;
+      if (mp_gpool_contains(gp, p)) return gp;
+    }
+  }
+  if (mp_likely(mp_atomic_load(&mp_gpool_map_incomplete) == 0)) return NULL;
+  // fall back to a linear search
+  for (mp_gpool_t* gp = mp_gpool_first(); gp != NULL; gp = mp_gpool_next(gp)) {
+    if (mp_gpool_contains(gp, p)) return gp;
+  }
+  return NULL;
+}
+
+
+//----------------------------------------------------------------------------------
+// Allocation
+//----------------------------------------------------------------------------------
+
+// The last gpool the current thread allocated from
+static mp_decl_thread mp_gpool_t* _mp_gpool_hint;
+
+
+// Lock-free free stack: the `free_head` encodes a tag and the index of the top entry.
+static inline uintptr_t mp_gpool_head_idx(uintptr_t head) {
+  return (head & MP_GPOOL_IDX_MASK);
+}
+
+static inline intptr_t mp_gpool_head_next(uintptr_t head, uintptr_t idx) {
+  return (intptr_t)((((head >> MP_GPOOL_IDX_BITS) + 1) << MP_GPOOL_IDX_BITS) | idx);
+}
+
+// Pop the index of an available gstack, or return 0 if the pool is full.
+static ssize_t mp_gpool_pop(mp_gpool_t* gp) {
+  intptr_t head = mp_atomic_load(&gp->free_head);
+  uintptr_t idx;
+  intptr_t next;
+  do {
+    idx = mp_gpool_head_idx((uintptr_t)head);
+    if (idx >= (uintptr_t)gp->block_count) return 0;
+    // note: `free[idx]` may be concurrently updated if `idx` is popped and pushed by another thread
+    // but in that case the tag of the head is changed as well and the CAS will fail.
+    volatile mp_gpool_link_t* link = &gp->free[idx];
+    next = mp_gpool_head_next((uintptr_t)head, idx + 1 + (intptr_t)(*link));
+  } while (!mp_atomic_cas(&gp->free_head, &head, next));
+  return (ssize_t)idx;
+}
+
+// Push back the index of an available gstack.
+static void mp_gpool_push(mp_gpool_t* gp, ssize_t idx) {
+  mp_assert_internal(idx >= gp->meta_count && idx < gp->block_count);
+  intptr_t head = mp_atomic_load(&gp->free_head);
+  intptr_t next;
+  do {
+    ssize_t delta = (ssize_t)mp_gpool_head_idx((uintptr_t)head) - idx - 1;
+    mp_assert(delta >= MP_GPOOL_LINK_MIN && delta <= MP_GPOOL_LINK_MAX);
+    gp->free[idx] = (mp_gpool_link_t)delta;
+    next = mp_gpool_head_next((uintptr_t)head, (uintptr_t)idx);
+  } while (!mp_atomic_cas(&gp->free_head, &head, next));
+}
+
+
+// Create a new pool in a given reserved virtual memory area (and commit the gpool info).
+static mp_gpool_t* mp_gpool_create(void* p, ssize_t size, ssize_t stack_size, ssize_t gap_size, bool zeroed, int numa_node) {
   // check parameters  
-  mp_assert_internal(size >= stack_size + gap_size && p != NULL && (size_t)stack_size > sizeof(mp_gpool_t));
+  mp_assert_internal(size >= stack_size + gap_size && p != NULL);
   stack_size = mp_align_up(stack_size, os_page_size);
   gap_size = mp_align_up(gap_size, os_page_size);
   ssize_t block_size = stack_size + gap_size;
@@ -96,19 +242,39 @@ static mp_gpool_t* mp_gpool_create(void* p, ssize_t size, ssize_t stack_size, ss
   if (count > MP_GPOOL_MAX_COUNT) {
     count = MP_GPOOL_MAX_COUNT;
   }
+  const ssize_t links_size = mp_align_up((ssize_t)sizeof(mp_gpool_t) + count * (ssize_t)sizeof(mp_gpool_link_t), sizeof(void*));
+  const ssize_t meta_size = links_size + (os_gsave_track_writes ? count * (ssize_t)sizeof(mp_gstack_t*) : 0);
+  const ssize_t meta_count = (meta_size + block_size - 1) / block_size;
+  if (count <= meta_count) return NULL;
   // init
+  if (!mp_os_mem_commit((uint8_t*)p, mp_align_up(meta_size, os_page_size))) {  // the links are zero'd on demand
+    return NULL;
+  }
   if (!zeroed) {
-    memset(p, 0, os_page_size); // zero out the initial page; the rest is done on-demand
+    memset(p, 0, meta_size); 
   }
   mp_gpool_t* gp = (mp_gpool_t*)p;
   gp->zeroed = zeroed;
+  gp->meta_size = meta_size;
+  gp->meta_count = meta_count;
+  gp->free = (mp_gpool_link_t*)((uint8_t*)p + sizeof(mp_gpool_t));
+  gp->tracked = (os_gsave_track_writes ? (_Atomic(mp_gstack_t*)*)((uint8_t*)p + links_size) : NULL);
   gp->full_size = size;
   gp->size = count * block_size;
   gp->block_count = count;
   gp->block_size = block_size;
   gp->gap_size = gap_size;
-  gp->free_sp = 1;  // first block is allocated to the gpool_t itself
-  gp->free_lock = mp_spin_lock_create();
+  gp->stack_ofs = 0;
+  gp->numa_node = numa_node;
+  if (os_huge_page_size > 0 && mp_gpool_grows_down() && (uintptr_t)p % os_huge_page_size == 0 && block_size % os_huge_page_size == 0) {
+    gp->stack_ofs = gap_size;  // put the gap below the stack so the stack base is at a huge page boundary
+  }
+  mp_atomic_store(&gp->free_head, (intptr_t)meta_count);  // the first blocks are allocated to the gpool info itself
+  if (!mp_os_gpool_register((uint8_t*)p + meta_count * block_size, gp->size - meta_count * block_size, numa_node)) {
+    return NULL;
+  }
+  // register for lookup before it becomes available
+  mp_gpool_map_register(gp);
   // push atomically at the head of the pools
   gp->next = mp_atomic_load_ptr(mp_gpool_t, &mp_gpools);
   while (!mp_atomic_cas_ptr(mp_gpool_t, &mp_gpools, &gp->next, gp)) {};
@@ -116,130 +282,148 @@ static mp_gpool_t* mp_gpool_create(void* p, ssize_t size, ssize_t stack_size, ss
   return gp;
 }
 
-// Allocate a fresh growable stack area from the pools
-static uint8_t* mp_gpool_alloc_stack(uint8_t** stk, ssize_t* stk_size) {
+// Allocate a growable stack area from a particular pool
+static uint8_t* mp_gpool_alloc_stack_from(mp_gpool_t* gp, uint8_t** stk, ssize_t* stk_size) {
+  ssize_t block_idx = mp_gpool_pop(gp);
+  mp_assert_internal(block_idx >= 0 && block_idx < gp->block_count);
+  if (block_idx <= 0) return NULL;
+  if (mp_gpool_grows_down()) {
+    block_idx = gp->block_count + gp->meta_count - 1 - block_idx; // grow from top
+  }
+  if (block_idx < gp->meta_count || block_idx >= gp->block_count) return NULL; // paranoia
+  uint8_t* p = ((uint8_t*)gp + (block_idx * gp->block_size));
+  //mp_trace_message("gpool_alloc: gp: %p, p: %p, block_idx: %zd\n", gp, p, block_idx);
+  *stk = p + gp->stack_ofs;
+  *stk_size = gp->block_size - gp->gap_size;
+  _mp_gpool_hint = gp;
+  return p;
+}
+
+// Allocate a fresh growable stack area from the pools with the given block size (and NUMA node if `numa_node >= 0`)
+static uint8_t* mp_gpool_alloc_stack(ssize_t block_size, int numa_node, uint8_t** stk, ssize_t* stk_size) {
+  // first try the pool we allocated from last time
+  mp_gpool_t* hint = _mp_gpool_hint;
+  if (hint != NULL && hint->block_size == block_size && (numa_node < 0 || hint->numa_node == numa_node)) {
+    uint8_t* p = mp_gpool_alloc_stack_from(hint, stk, stk_size);
+    if (p != NULL) return p;
+  }
   // for all pools
   for (mp_gpool_t* gp = mp_gpool_first(); gp != NULL; gp = mp_gpool_next(gp)) {
-    ssize_t block_idx = 0;
-    ssize_t sp;
-    volatile int16_t _access = 0;
-    _access += gp->free[gp->free_sp + 64]; // ensure no page fault happens inside the spin lock
-    mp_spin_lock(&gp->free_lock) {
-      // pop from free stack
-      sp = gp->free_sp;
-      if (sp < gp->block_count) {
-        gp->free_sp = sp + 1;
-        block_idx = gp->free[sp] + sp;
-      }
-    }    
-    mp_assert_internal(block_idx >= 0 && block_idx < gp->block_count);
-    if (block_idx > 0) {
-      if (mp_gpool_grows_down()) {
-        block_idx = gp->block_count - block_idx; // grow from top
-      }
-      if (block_idx <= 0 || block_idx >= gp->block_count) return NULL; // paranoia
-      uint8_t* p = ((uint8_t*)gp + (block_idx * gp->block_size));
-      //mp_trace_message("gpool_alloc: gp: %p, p: %p, block_idx: %zd, sp: %zd\n", gp, p, block_idx, sp);
-      *stk = p;
-      *stk_size = gp->block_size - gp->gap_size;
-      return p;
-    }
+    if (gp == hint || gp->block_size != block_size) continue;
+    if (numa_node >= 0 && gp->numa_node != numa_node) continue;
+    uint8_t* p = mp_gpool_alloc_stack_from(gp, stk, stk_size);
+    if (p != NULL) return p;
   }
   return NULL;
 }
 
-// Allocate a fresh growable stack area from the pools
-static uint8_t* mp_gpool_alloc(uint8_t** stk, ssize_t* stk_size) {
-  uint8_t* p = mp_gpool_alloc_stack(stk, stk_size);
+// Allocate a fresh growable stack area of `block_size` (including the gap) from the pools
+static uint8_t* mp_gpool_alloc(ssize_t block_size, ssize_t gap_size, uint8_t** stk, ssize_t* stk_size) {
+  // prefer the pools on the NUMA node of the current thread (if enabled)
+  const int numa_node = (os_gpool_numa ? mp_os_numa_node() : -1);
+  uint8_t* p = mp_gpool_alloc_stack(block_size, numa_node, stk, stk_size);
   if (p != NULL) return p;
 
-  // allocate a fresh gpool
-  size_t poolsize = os_gpool_max_size;
-  uint8_t* pool = mp_os_mem_reserve(poolsize);
-  if (pool == NULL) return NULL;
-
-  // commit on demand in the regular fault handler
-  ssize_t init_size = mp_align_up(sizeof(mp_gpool_t), os_page_size);
-  
-  if (!mp_os_mem_commit(pool, init_size)) {   // make initial part read/write. 
-    mp_os_mem_free(pool, poolsize);
-    return NULL;
+  // allocate a fresh gpool (pools of smaller stacks are smaller as the count is limited)
+  ssize_t poolsize = os_gpool_max_size;
+  if (poolsize / block_size > MP_GPOOL_MAX_COUNT) { poolsize = MP_GPOOL_MAX_COUNT * block_size; }
+  // with huge pages, align the pool so stack bases can be at a huge page boundary
+  const ssize_t align = os_huge_page_size;
+  uint8_t* reserved = mp_os_mem_reserve(poolsize + align);
+  if (reserved == NULL) {
+    // use a pool of another NUMA node if we cannot create one
+    return (numa_node < 0 ? NULL : mp_gpool_alloc_stack(block_size, -1, stk, stk_size));
   }
+  uint8_t* pool = (align > 0 ? mp_align_up_ptr(reserved, align) : reserved);
     
-  // make it available 
-  mp_gpool_create(pool, poolsize, os_gstack_size - os_gstack_gap, os_gstack_gap, true);
+  // make it available (the stacks are committed on demand in the regular fault handler)
+  if (mp_gpool_create(pool, poolsize, block_size - gap_size, gap_size, true, numa_node) == NULL) {
+    mp_os_mem_free(reserved, poolsize + align);
+    return NULL;
+  }
 
   // and try to allocate again 
-  return mp_gpool_alloc_stack(stk, stk_size);
+  return mp_gpool_alloc_stack(block_size, numa_node, stk, stk_size);
 }
 
 
 // Free a growable stack area back to the pools
 static void mp_gpool_free(uint8_t* stk) {  
-  // for all pools
-  for (mp_gpool_t* gp = mp_gpool_first(); gp != NULL; gp = mp_gpool_next(gp)) {
-    ptrdiff_t ofs = (uint8_t*)stk - (uint8_t*)gp;
-    if (ofs >= 0 && ofs < gp->size) {
-      mp_assert(ofs % gp->block_size == 0);
-      ptrdiff_t sp;
-      ptrdiff_t block_idx = (ofs / gp->block_size);
-      mp_assert(block_idx > 0); if (block_idx == 0) return;
-      mp_assert(block_idx < gp->block_count); if (block_idx >= gp->block_count) return;
-      ptrdiff_t idx;
-      if (mp_gpool_grows_down()) {
-        idx = gp->block_count - block_idx; // reverse if growing down
-      }
-      else {
-        idx = block_idx;
-      }
-      mp_spin_lock(&gp->free_lock) {
-        // push on free stack
-        gp->free_sp--;
-        sp = gp->free_sp;
-        //idx = gp->block_count - block_idx - sp;
-        idx = idx - sp;        
-        gp->free[sp] = (int16_t)idx;
-      }
-      mp_assert(idx >= INT16_MIN && idx <= INT16_MAX);
-      mp_assert(sp > 0);
-      return; // done
-    }
+  mp_gpool_t* gp = mp_gpool_find(stk);
+  if (gp == NULL) return;
+  ptrdiff_t ofs = (uint8_t*)stk - (uint8_t*)gp;
+  mp_assert(ofs % gp->block_size == 0);
+  ptrdiff_t block_idx = (ofs / gp->block_size);
+  mp_assert(block_idx >= gp->meta_count); if (block_idx < gp->meta_count) return;
+  mp_assert(block_idx < gp->block_count); if (block_idx >= gp->block_count) return;
+  ptrdiff_t idx;
+  if (mp_gpool_grows_down()) {
+    idx = gp->block_count + gp->meta_count - 1 - block_idx; // reverse if growing down
+  }
+  else {
+    idx = block_idx;
   }
+  // push on free stack
+  mp_gpool_push(gp, idx);
+}
+
+// The gpool and index of the block that contains `p` (or NULL if `p` is not in a gstack block)
+static mp_gpool_t* mp_gpool_block_of(const void* p, ssize_t* block_idx) {
+  mp_gpool_t* gp = mp_gpool_find(p);
+  if (gp == NULL) return NULL;
+  const ssize_t idx = ((const uint8_t*)p - (const uint8_t*)gp) / gp->block_size;
+  if (idx < gp->meta_count || idx >= gp->block_count) return NULL;
+  *block_idx = idx;
+  return gp;
+}
+
+// Set the write tracked gstack of the block of `stk`; returns `false` if `stk` is not in a gpool
+static bool mp_gpool_set_tracked(const uint8_t* stk, mp_gstack_t* g) {
+  ssize_t idx;
+  mp_gpool_t* gp = mp_gpool_block_of(stk, &idx);
+  if (gp == NULL || gp->tracked == NULL) return false;
+  mp_atomic_store_ptr(mp_gstack_t, &gp->tracked[idx], g);
+  return true;
+}
+
+// The write tracked gstack of the block that contains `p` (or NULL); can be called from any thread
+static mp_gstack_t* mp_gpool_tracked(const void* p) {
+  ssize_t idx;
+  mp_gpool_t* gp = mp_gpool_block_of(p, &idx);
+  if (gp == NULL || gp->tracked == NULL) return NULL;
+  return mp_atomic_load_ptr(mp_gstack_t, &gp->tracked[idx]);
 }
 
 // Is a pointer located in a stack page and thus can be made accessible?
 // This routine is called from exception handler thread while debugging on macOS to verify
 // if the address is in one of our stacks and is allowed to be committed.
 static mp_access_t mp_gpools_check_access(void* p, ssize_t* stack_size, ssize_t* available, const mp_gpool_t** gpool) {
-  // for all pools
   if (available != NULL) *available = 0;
   if (stack_size != NULL) *stack_size = 0;
   if (gpool != NULL) *gpool = NULL;
-  for (const mp_gpool_t* gp = mp_gpool_first(); gp != NULL; gp = mp_gpool_next(gp)) {
-    ptrdiff_t ofs = (uint8_t*)p - (uint8_t*)gp;
-    if (ofs >= 0 && ofs < gp->size) {   // in the pool?
-      if (stack_size != NULL) *stack_size = gp->block_size - gp->gap_size;
-      if (ofs <= (ptrdiff_t)sizeof(mp_gpool_t)) {
-        // the start page
-        if (available != NULL) *available = (sizeof(mp_gpool_t) - ofs);
-        if (gpool != NULL) *gpool = gp;
-        return MP_ACCESS_META;
-      }
-      else {
-        ptrdiff_t block_ofs = ofs % gp->block_size;
-        //mp_trace_message("  gp: %p, ofs: %zd, idx: %zd, bofs: %zd, b/g: %zd / %zd\n", gp, ofs, ofs / gp->block_size, block_ofs, gp->block_size, gp->gap_size);
-        if (block_ofs < (gp->block_size - gp->gap_size)) {  // not in a gap?
-          ssize_t avail = (os_stack_grows_down ? block_ofs : gp->block_size - gp->gap_size - block_ofs);
-          if (available != NULL) *available = avail;
-          if (gpool != NULL) *gpool = gp;
-          return (avail == 0 ? MP_NOACCESS_STACK_OVERFLOW : MP_ACCESS);
-        }
-        else {
-          // stack overflow
-          return MP_NOACCESS_STACK_OVERFLOW;
-        }
-      }
-    }
+  const mp_gpool_t* gp = mp_gpool_find(p);
+  if (gp == NULL) return MP_NOACCESS;   // not in a pool
+  ptrdiff_t ofs = (uint8_t*)p - (uint8_t*)gp;
+  if (stack_size != NULL) *stack_size = gp->block_size - gp->gap_size;
+  if (ofs < gp->meta_size) {
+    // the gpool info
+    if (available != NULL) *available = (gp->meta_size - ofs);
+    if (gpool != NULL) *gpool = gp;
+    return MP_ACCESS_META;
+  }
+  if (ofs < gp->meta_count * gp->block_size) {
+    return MP_NOACCESS;  // unused part of the meta blocks
+  }
+  ptrdiff_t block_ofs = (ofs % gp->block_size) - gp->stack_ofs;
+  //mp_trace_message("  gp: %p, ofs: %zd, idx: %zd, bofs: %zd, b/g: %zd / %zd\n", gp, ofs, ofs / gp->block_size, block_ofs, gp->block_size, gp->gap_size);
+  if (block_ofs >= 0 && block_ofs < (gp->block_size - gp->gap_size)) {  // not in a gap?
+    ssize_t avail = (os_stack_grows_down ? block_ofs : gp->block_size - gp->gap_size - block_ofs);
+    if (available != NULL) *available = avail;
+    if (gpool != NULL) *gpool = gp;
+    return (avail == 0 ? MP_NOACCESS_STACK_OVERFLOW : MP_ACCESS);
+  }
+  else {
+    // stack overflow
+    return MP_NOACCESS_STACK_OVERFLOW;
   }
-  return MP_NOACCESS;
 }
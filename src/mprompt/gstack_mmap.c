@@ -14,6 +14,7 @@
 #include <signal.h>    // sigaction
 #include <fcntl.h>     // file read
 #include <pthread.h>   // use pthread local storage keys to detect thread ending
+#include <time.h>      // clock_gettime
 
 // We need atomic operations for the `gpool` on systems that do not have overcommit.
 #include "internal/atomic.h"
@@ -21,6 +22,18 @@
 // forward declaration 
 static bool mp_mmap_commit_on_demand(void* addr, bool addr_in_other_thread);
 
+// Linux can serve page faults in gpools from a `userfaultfd` handler thread instead of the signal handler
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#if defined(__NR_userfaultfd)
+#include <linux/userfaultfd.h>
+#define MP_USE_USERFAULTFD  (1)
+#endif
+#endif
+
+static bool os_use_userfaultfd = false;  // set at initialization if the `userfaultfd` handler is running
+
 // macOS in debug mode needs an exception port handler 
 #include "gstack_mmap_mach.c"
 
@@ -35,7 +48,8 @@ static void mp_linux_check_vma_limit(void) {
   if (errno == ENOMEM) {
     mp_error_message(ENOMEM, "the previous error may have been caused by a low memory map limit.\n"
                               "  On Linux this can be controlled by increasing the vm.max_map_count. For example:\n"
-                              "  > sudo sysctl -w vm.max_map_count=1000000\n");
+                              "  > sudo sysctl -w vm.max_map_count=1000000\n"
+                              "  or use compact gpools (`config.gpool_compact`) which need far fewer memory maps.\n");
   }
   #endif
 }
@@ -84,6 +98,23 @@ static uint8_t* mp_os_mmap_reserve(size_t size, int prot, bool* zeroed) {
   return p;
 }
 
+#if defined(__linux__)
+// Read a small system file into `buf` (zero terminated)
+static bool mp_linux_read_file(const char* fname, char* buf, size_t size) {
+  int open_flags = O_RDONLY;
+  #if defined(O_CLOEXEC)
+  open_flags |= O_CLOEXEC;
+  #endif
+  int fd = open(fname, open_flags);
+  if (fd < 0) return false;
+  ssize_t nread = read(fd, buf, size - 1);
+  close(fd);
+  if (nread <= 0) return false;
+  buf[nread] = 0;
+  return true;
+}
+#endif
+
 // Reserve virtual memory range
 static uint8_t* mp_os_mem_reserve(ssize_t size) {
   return mp_os_mmap_reserve(size, PROT_NONE, NULL);
@@ -108,11 +139,29 @@ static bool mp_os_mem_commit(uint8_t* start, ssize_t size) {
   return true;
 }
 
+// Write protect a range of committed pages (or make them read/write again)
+static bool mp_os_mem_protect(uint8_t* start, ssize_t size, bool readonly) {
+  return (mprotect(start, size, (readonly ? PROT_READ : PROT_READ | PROT_WRITE)) == 0);
+}
+
+// Decommit a range of pages and make them inaccessible (so they are committed on demand again)
+static bool mp_os_mem_decommit(uint8_t* start, ssize_t size) {
+  #if defined(MAP_FIXED)
+  if (mmap(start, size, PROT_NONE, (MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE), -1, 0) == MAP_FAILED) {
+    mp_system_error_message(EINVAL, "failed to decommit memory at %p of size %zd\n", start, size);
+    return false;
+  }
+  return true;
+  #else
+  return (madvise(start, size, MADV_DONTNEED) == 0 && mprotect(start, size, PROT_NONE) == 0);
+  #endif
+}
+
 // Reset the memory of a gstack
 static bool mp_os_mem_reset(uint8_t* p, ssize_t size) {
   // we can only decommit if MAP_FIXED is defined
   #if defined(MAP_FIXED)  
-  if (os_gstack_reset_decommits) {
+  if (os_gstack_reset_decommits && !os_use_userfaultfd) {  // (a fresh mapping would no longer be registered with the `userfaultfd`)
     // mmap with PROT_NONE to reduce commit charge
     if (mmap(p, size, PROT_NONE, (MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE), -1, 0) == MAP_FAILED) {
       mp_system_error_message(EINVAL, "failed to decommit memory at %p of size %zd\n", p, size);
@@ -148,52 +197,71 @@ static bool mp_os_mem_reset(uint8_t* p, ssize_t size) {
 //----------------------------------------------------------------------------------
 
 
+// Is the base of a gstack backed by a huge page? (see `mp_gpool_create`)
+static bool mp_mmap_is_huge_base(uint8_t* stk, ssize_t stk_size) {
+  return (os_huge_page_size > 0 && stk_size >= os_huge_page_size && (uintptr_t)mp_base(stk, stk_size) % os_huge_page_size == 0);
+}
+
+// The initial committed size of a gstack (a full huge page if its base is backed by one)
+static ssize_t mp_mmap_initial_commit_size(uint8_t* stk, ssize_t stk_size) {
+  if (os_use_overcommit) return stk_size;
+  if (mp_mmap_is_huge_base(stk, stk_size)) {
+    return mp_max(os_gstack_initial_commit, os_huge_page_size);
+  }
+  return mp_min(os_gstack_initial_commit, stk_size);
+}
+
 // Set initial committed page in a gstack and a guard page to grow on-demand
 static bool mp_mmap_initial_commit(uint8_t* stk, ssize_t stk_size, ssize_t* initial_commit) {
   if (initial_commit != NULL) *initial_commit = 0;
   if (os_use_overcommit) {
-    // and make the stack area read/write.       
-    if (!mp_os_mem_commit(stk, stk_size)) {
+    // and make the stack area read/write (unless the gpool is compact and accessible already)
+    if (!os_gpool_compact && !mp_os_mem_commit(stk, stk_size)) {
       return false;
     }
     if (initial_commit != NULL) *initial_commit = stk_size;
   }
   else {
     // only commit the initial pages and demand-page the rest
+    const ssize_t commit = mp_mmap_initial_commit_size(stk, stk_size);
     uint8_t* base = mp_base(stk, stk_size);
     uint8_t* commit_start;
-    mp_push(base, os_gstack_initial_commit, &commit_start);
-    if (!mp_os_mem_commit(commit_start, os_gstack_initial_commit)) {
+    mp_push(base, commit, &commit_start);
+    if (!mp_os_mem_commit(commit_start, commit)) {
       return false;
     }
-    if (initial_commit != NULL) *initial_commit = os_gstack_initial_commit;
+    if (mp_mmap_is_huge_base(stk, stk_size)) {
+      mp_stat_inc(gstack_huge_pages);
+    }
+    if (initial_commit != NULL) *initial_commit = commit;
   }
   return true;
 }
 
 // Allocate a gstack
-static uint8_t* mp_gstack_os_alloc(uint8_t** stk, ssize_t* stk_size, ssize_t* initial_commit) {
+static uint8_t* mp_gstack_os_alloc(ssize_t full_size, ssize_t gap_size, uint8_t** stk, ssize_t* stk_size, ssize_t* initial_commit) {
   if (initial_commit != NULL) { *initial_commit = 0; }
   if (!os_use_gpools) {
     // use NORESERVE to let the OS commit on demand
     bool zeroed = false; // don't require zeros
-    uint8_t* full = mp_os_mmap_reserve(os_gstack_size, PROT_NONE, &zeroed);
+    uint8_t* full = mp_os_mmap_reserve(full_size, PROT_NONE, &zeroed);
     if (full == NULL) {
       return NULL;
     }
 
-    *stk = full + os_gstack_gap;
-    *stk_size = os_gstack_size - 2 * os_gstack_gap;    
+    *stk = full + gap_size;
+    *stk_size = full_size - 2 * gap_size;    
     if (!mp_mmap_initial_commit(*stk, *stk_size, initial_commit)) {
-      munmap(full, os_gstack_size);
+      munmap(full, full_size);
       return NULL;
     }
     return full;
   }
   else {
     // use the gpool allocator to commit-on-demand even on over-commit systems (using a signal handler)
-    uint8_t* full = mp_gpool_alloc(stk,stk_size);
+    uint8_t* full = mp_gpool_alloc(full_size, gap_size, stk, stk_size);
     if (full == NULL) return NULL;      
+    mp_stat_inc(gstack_gpool_allocs);
     if (!mp_mmap_initial_commit(*stk, *stk_size, initial_commit)) {
       mp_gpool_free(full);
       return NULL;
@@ -202,21 +270,444 @@ static uint8_t* mp_gstack_os_alloc(uint8_t** stk, ssize_t* stk_size, ssize_t* in
   }  
 }
 
+// Reset the committed part of a gpool gstack before it is reused.
+// A free gstack keeps at most `keep` bytes accessible (like a cached gstack) and pages 
+// committed beyond that are decommitted. Since a gstack can access the kept pages of an 
+// earlier use without faulting, we always reset the full `keep` prefix (which is cheap
+// for pages that are not present) besides the committed part.
+static ssize_t mp_gpool_reset_keep(uint8_t* stk, ssize_t stk_size) {
+  if (os_use_overcommit || os_gstack_cache_commit_max < 0) return stk_size;
+  return mp_min(mp_max(os_gstack_cache_commit_max, mp_mmap_initial_commit_size(stk, stk_size)), stk_size);
+}
+
+static void mp_gpool_reset(uint8_t* stk, ssize_t stk_size, ssize_t stk_commit) {
+  const ssize_t commit = mp_min(mp_align_up(stk_commit, os_page_size), stk_size);
+  const ssize_t keep = mp_gpool_reset_keep(stk, stk_size);
+  uint8_t* base = mp_base(stk, stk_size);
+  uint8_t* start;
+  mp_push(base, keep, &start);
+  mp_os_mem_reset(start, keep);
+  if (commit > keep) {
+    mp_push(mp_push(base, keep, NULL), commit - keep, &start);
+    mp_os_mem_decommit(start, commit - keep);
+  }
+}
+
+
+//----------------------------------------------------------------------------------
+// Background reset of freed gpool gstacks
+//
+// With `stack_reset_background` the thread that frees a gstack does not reset its 
+// memory itself but pushes it on a global queue. A background thread resets the queued
+// gstacks in batches (of `MP_RESET_BATCH`, or after `MP_RESET_DELAY_MS` when fewer are
+// queued) and only then frees them to their gpool. The queue entries are stored at 
+// the base of the freed gstack itself (which is always committed).
+//----------------------------------------------------------------------------------
+
+#define MP_RESET_BATCH      (16)
+#define MP_RESET_DELAY_MS   (10)
+
+typedef struct mp_reset_s {
+  struct mp_reset_s* next;
+  uint8_t* full;
+  uint8_t* stk;
+  ssize_t  stk_size;
+  ssize_t  stk_commit;
+} mp_reset_t;
+
+static _Atomic(mp_reset_t*) mp_resets;        // queued gstacks
+static _Atomic(intptr_t)    mp_resets_count;
+static bool                 mp_resets_running;
+static pthread_mutex_t      mp_resets_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t       mp_resets_cond  = PTHREAD_COND_INITIALIZER;
+
+// Reset and free all currently queued gstacks
+static void mp_resets_drain(void) {
+  mp_reset_t* r = mp_atomic_load_ptr(mp_reset_t, &mp_resets);
+  while (!mp_atomic_cas_ptr(mp_reset_t, &mp_resets, &r, NULL)) { };
+  intptr_t n = 0;
+  while (r != NULL) {
+    const mp_reset_t entry = *r;    // copy as the reset clears it
+    mp_gpool_reset(entry.stk, entry.stk_size, entry.stk_commit);
+    mp_gpool_free(entry.full);
+    r = entry.next;
+    n++;
+  }
+  mp_atomic_add(&mp_resets_count, -n);
+  mp_stat_add(gstack_background_resets, n);
+}
+
+static void* mp_resets_thread(void* arg) {
+  MP_UNUSED(arg);
+  mp_stats_thread_init();
+  pthread_mutex_lock(&mp_resets_mutex);
+  while (true) {
+    const intptr_t count = mp_atomic_load(&mp_resets_count);
+    if (count <= 0) {
+      pthread_cond_wait(&mp_resets_cond, &mp_resets_mutex);
+      continue;
+    }
+    if (count < MP_RESET_BATCH) {
+      // wait a bit for a full batch
+      struct timespec t;
+      clock_gettime(CLOCK_REALTIME, &t);
+      t.tv_nsec += MP_RESET_DELAY_MS * 1000000L;
+      if (t.tv_nsec >= 1000000000L) { t.tv_sec++; t.tv_nsec -= 1000000000L; }
+      pthread_cond_timedwait(&mp_resets_cond, &mp_resets_mutex, &t);
+    }
+    pthread_mutex_unlock(&mp_resets_mutex);
+    mp_resets_drain();
+    pthread_mutex_lock(&mp_resets_mutex);
+  }
+  return NULL;
+}
+
+// Start the background reset thread
+static void mp_resets_init(void) {
+  if (!os_use_gpools) os_gstack_reset_background = false;
+  if (!os_gstack_reset_background) return;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_t thread;
+  mp_resets_running = (pthread_create(&thread, &attr, &mp_resets_thread, NULL) == 0);
+  pthread_attr_destroy(&attr);
+  if (!mp_resets_running) {
+    os_gstack_reset_background = false;
+    mp_system_error_message(EINVAL, "unable to start the background reset thread\n");
+  }
+}
+
+// Queue a gstack to be reset and freed by the background thread
+static bool mp_resets_push(uint8_t* full, uint8_t* stk, ssize_t stk_size, ssize_t stk_commit) {
+  if (!mp_resets_running) return false;
+  mp_reset_t* r = (mp_reset_t*)mp_align_down_ptr(mp_base(stk, stk_size) - (os_stack_grows_down ? sizeof(mp_reset_t) : 0), 16);
+  r->full = full;
+  r->stk = stk;
+  r->stk_size = stk_size;
+  r->stk_commit = stk_commit;
+  r->next = mp_atomic_load_ptr(mp_reset_t, &mp_resets);
+  while (!mp_atomic_cas_ptr(mp_reset_t, &mp_resets, &r->next, r)) { };
+  const intptr_t count = mp_atomic_add(&mp_resets_count, 1) + 1;
+  if (count == 1 || count == MP_RESET_BATCH) {
+    // wake up the background thread to start waiting for a batch, or to drain the full batch
+    pthread_mutex_lock(&mp_resets_mutex);
+    pthread_cond_signal(&mp_resets_cond);
+    pthread_mutex_unlock(&mp_resets_mutex);
+  }
+  return true;
+}
+
+
 // Free the memory of a gstack
-static void mp_gstack_os_free(uint8_t* full, uint8_t* stk, ssize_t stk_size, ssize_t stk_commit) {
-  MP_UNUSED(stk_commit);
+static void mp_gstack_os_free(uint8_t* full, ssize_t full_size, uint8_t* stk, ssize_t stk_size, ssize_t stk_commit) {
   if (!os_use_gpools) {
-    mp_os_mem_free(full,os_gstack_size);
+    mp_os_mem_free(full,full_size);
   }
-  else {
-    // reset the full range. todo: just reset the actual committed range?
-    mp_os_mem_reset(stk,stk_size);
+  else if (!mp_resets_push(full, stk, stk_size, stk_commit)) {
+    // reset just the committed range 
+    mp_gpool_reset(stk, stk_size, stk_commit);
     mp_gpool_free(full);
   }
 }
 
 
 
+// ----------------------------------------------------
+// Commit-on-demand with `userfaultfd` (Linux)
+//
+// Instead of keeping the uncommitted part of gpool stacks inaccessible and
+// committing pages from the SEGV signal handler, the gstacks are fully
+// accessible (as with overcommit) but the gpool areas are registered with a
+// `userfaultfd`. A missing page is then served by a background handler thread
+// that fills a batch of zero pages at once (doubling up to 1MiB as in the
+// signal handler). The gaps stay inaccessible so a stack overflow still faults.
+// This does not need signal handlers or an alternate signal stack but it only
+// works if the process is allowed to handle kernel faults
+// (`vm.unprivileged_userfaultfd=1` or `CAP_SYS_PTRACE`).
+// ----------------------------------------------------
+
+#if defined(MP_USE_USERFAULTFD)
+
+#define MP_UFFD_BATCH_MAX   (1 * MP_MIB)    // maximum extra pages filled per fault
+#define MP_UFFD_MSG_COUNT   (16)            // messages read at once
+
+static int      mp_uffd = -1;
+static uint8_t* mp_uffd_zeros;              // zeros to copy from (of size `MP_UFFD_BATCH_MAX + os_page_size`)
+
+// Fill `size` bytes at `start` with zero pages and wake up the faulting threads
+static bool mp_uffd_fill(uint8_t* start, ssize_t size) {
+  struct uffdio_copy copy;
+  copy.dst  = (uintptr_t)start;
+  copy.src  = (uintptr_t)mp_uffd_zeros;
+  copy.len  = (uint64_t)size;
+  copy.mode = 0;
+  copy.copy = 0;
+  return (ioctl(mp_uffd, UFFDIO_COPY, &copy) == 0);
+}
+
+// Serve a fault at `addr`
+static void mp_uffd_fault(void* addr) {
+  uint8_t* page = mp_align_down_ptr((uint8_t*)addr, os_page_size);
+  ssize_t available = 0;
+  ssize_t stack_size = 0;
+  ssize_t extra = 0;
+  const mp_gpool_t* gp = NULL;
+  const mp_access_t access = mp_gpools_check_access(page, &stack_size, &available, &gp);
+  if (access == MP_NOACCESS_STACK_OVERFLOW && gp == NULL) {
+    // in a gap of a compact gpool (otherwise the gaps are inaccessible)
+    mp_fatal_message(EFAULT, "stack overflow at %p\n", addr);
+  }
+  if (access == MP_ACCESS && os_gstack_grow_fast) {
+    // use quadratic growth as in the signal handler
+    ssize_t used = stack_size - available;
+    if (used > 0) { extra = 2*used; }
+    if (extra > MP_UFFD_BATCH_MAX) { extra = MP_UFFD_BATCH_MAX; }
+    if (extra > available) { extra = available; }
+    extra = mp_align_down(extra, os_page_size);
+  }
+  uint8_t* fill_start;
+  mp_push(page, extra, &fill_start);
+  if (!mp_uffd_fill(fill_start, extra + os_page_size)) {
+    // part of the batch was already present (e.g. a reused gstack); fill just the faulting page
+    if (extra == 0 || !mp_uffd_fill(page, os_page_size)) {
+      // or it was filled concurrently: just wake up the thread
+      struct uffdio_range range;
+      range.start = (uintptr_t)page;
+      range.len = (uint64_t)os_page_size;
+      ioctl(mp_uffd, UFFDIO_WAKE, &range);
+      return;
+    }
+    extra = 0;
+  }
+  mp_stat_inc(page_faults);
+  mp_stat_inc(uffd_faults);
+  mp_trace(MP_TRACE_PAGE_FAULT, page, extra);
+}
+
+static void* mp_uffd_handler(void* arg) {
+  MP_UNUSED(arg);
+  mp_stats_thread_init();
+  struct uffd_msg msgs[MP_UFFD_MSG_COUNT];
+  while (true) {
+    ssize_t n = read(mp_uffd, msgs, sizeof(msgs));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+    if (n < (ssize_t)sizeof(struct uffd_msg)) break;
+    for (ssize_t i = 0; i < n / (ssize_t)sizeof(struct uffd_msg); i++) {
+      if (msgs[i].event == UFFD_EVENT_PAGEFAULT) {
+        mp_uffd_fault((void*)(uintptr_t)msgs[i].arg.pagefault.address);
+      }
+    }
+  }
+  mp_system_error_message(EINVAL, "userfaultfd handler stopped\n");
+  return NULL;
+}
+
+// Create the `userfaultfd` and start the handler thread
+static bool mp_uffd_init(void) {
+  int fd = (int)syscall(__NR_userfaultfd, O_CLOEXEC);
+  if (fd < 0) return false;   // not supported or not allowed
+  struct uffdio_api api;
+  memset(&api, 0, sizeof(api));
+  api.api = UFFD_API;
+  if (ioctl(fd, UFFDIO_API, &api) != 0 || (api.ioctls & ((uint64_t)1 << _UFFDIO_REGISTER)) == 0) {
+    close(fd);
+    return false;
+  }
+  mp_uffd_zeros = mp_os_mmap_reserve(MP_UFFD_BATCH_MAX + os_page_size, PROT_READ, NULL);
+  if (mp_uffd_zeros == NULL) {
+    close(fd);
+    return false;
+  }
+  mp_uffd = fd;
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_t thread;
+  const int err = pthread_create(&thread, &attr, &mp_uffd_handler, NULL);
+  pthread_attr_destroy(&attr);
+  if (err != 0) {
+    mp_uffd = -1;
+    close(fd);
+    mp_os_mem_free(mp_uffd_zeros, MP_UFFD_BATCH_MAX + os_page_size);
+    mp_uffd_zeros = NULL;
+    return false;
+  }
+  return true;
+}
+
+// Register the gstacks of a fresh gpool 
+static void mp_uffd_register(uint8_t* start, ssize_t size) {
+  if (!os_use_userfaultfd) return;
+  struct uffdio_register reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.range.start = (uintptr_t)start;
+  reg.range.len = (uint64_t)size;
+  reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+  if (ioctl(mp_uffd, UFFDIO_REGISTER, &reg) != 0) {
+    // still fine, the OS commits on demand
+    mp_system_error_message(EINVAL, "unable to register gpool at %p of size %zd with the userfaultfd\n", start, size);
+  }
+}
+
+#else
+
+#if defined(__linux__)
+static bool mp_uffd_init(void) {
+  return false;
+}
+#endif
+
+static void mp_uffd_register(uint8_t* start, ssize_t size) {
+  MP_UNUSED(start); MP_UNUSED(size);
+}
+
+#endif
+
+
+// ----------------------------------------------------
+// Transparent huge pages (Linux)
+//
+// With `stack_huge_pages` the gpools are marked with `MADV_HUGEPAGE` and 
+// laid out such that each stack base is at a huge page boundary (see `mp_gpool_create`).
+// The initial commit of a gstack is then a full huge page which the OS can back
+// with a single huge page on the first touch, and stack resets cover it completely
+// (see `mp_gpool_reset_keep`) so it is never split. Deeper parts of a stack may
+// use huge pages too once a full aligned huge page is committed.
+// ----------------------------------------------------
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+// The transparent huge page size, or 0 if not available
+static ssize_t mp_linux_huge_page_size(void) {
+  char buf[128];
+  if (!mp_linux_read_file("/sys/kernel/mm/transparent_hugepage/enabled", buf, sizeof(buf))) return 0;
+  if (strstr(buf, "[never]") != NULL) return 0;
+  if (!mp_linux_read_file("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", buf, sizeof(buf))) return 0;
+  const ssize_t size = (ssize_t)strtoll(buf, NULL, 10);
+  if (size <= os_page_size || size % os_page_size != 0 || (size & (size - 1)) != 0) return 0;
+  return size;
+}
+#endif
+
+
+// ----------------------------------------------------
+// NUMA (Linux)
+//
+// With `gpool_numa` every gpool is associated with the NUMA node of the thread
+// that created it, and its memory is bound to that node (with a preferred policy
+// so we still get memory if the node is full). Threads allocate gstacks from 
+// the gpools of their current node (see `mp_gpool_alloc`).
+// We use the raw `mbind` system call to avoid a dependency on `libnuma`, and
+// map the current cpu (`sched_getcpu`) to its node with a table read at startup.
+// ----------------------------------------------------
+
+#if defined(__linux__) && defined(SYS_mbind)
+#include <sched.h>   // sched_getcpu
+#include <stdio.h>   // snprintf
+
+#define MP_NUMA_MAX_NODES  (64)              // nodes in our node mask
+#define MP_NUMA_MAX_CPUS   (1024)            // cpus in our cpu to node map
+#define MP_MPOL_PREFERRED  (1)               // from <numaif.h>
+
+static bool    mp_numa_enabled;
+static uint8_t mp_numa_cpu_node[MP_NUMA_MAX_CPUS];   // NUMA node of each cpu (or 0xFF if unknown)
+
+// The highest possible NUMA node (or -1 if not available)
+static int mp_linux_numa_max_node(void) {
+  char buf[128];
+  if (!mp_linux_read_file("/sys/devices/system/node/possible", buf, sizeof(buf))) return -1;
+  // of the form "0" or "0-3" (or a list like "0,2-3")
+  const char* last = buf;
+  for (const char* p = buf; *p != 0 && *p != '\n'; p++) {
+    if (*p == '-' || *p == ',') last = p + 1;
+  }
+  return (int)strtol(last, NULL, 10);
+}
+
+// Set the node of the cpus in a list of the form "0-3,8-11" (or "0")
+static void mp_numa_set_cpus(const char* cpulist, int node) {
+  const char* p = cpulist;
+  while (*p >= '0' && *p <= '9') {
+    char* end;
+    const long lo = strtol(p, &end, 10);
+    long hi = lo;
+    if (*end == '-') { hi = strtol(end + 1, &end, 10); }
+    for (long cpu = lo; cpu <= hi && cpu < MP_NUMA_MAX_CPUS; cpu++) {
+      mp_numa_cpu_node[cpu] = (uint8_t)node;
+    }
+    p = (*end == ',' ? end + 1 : end);
+  }
+}
+
+static bool mp_numa_init(void) {
+  const int max_node = mp_linux_numa_max_node();
+  if (max_node < 0 || max_node >= MP_NUMA_MAX_NODES) return false;
+  memset(mp_numa_cpu_node, 0xFF, sizeof(mp_numa_cpu_node));
+  for (int node = 0; node <= max_node; node++) {
+    char fname[64];
+    char buf[1024];
+    snprintf(fname, sizeof(fname), "/sys/devices/system/node/node%d/cpulist", node);
+    if (mp_linux_read_file(fname, buf, sizeof(buf))) {
+      mp_numa_set_cpus(buf, node);
+    }
+  }
+  mp_numa_enabled = true;
+  return true;
+}
+
+// The NUMA node of the current thread (or -1 if not enabled)
+static int mp_os_numa_node(void) {
+  if (!mp_numa_enabled) return -1;
+  const int cpu = sched_getcpu();
+  if (cpu < 0 || cpu >= MP_NUMA_MAX_CPUS || mp_numa_cpu_node[cpu] >= MP_NUMA_MAX_NODES) return -1;
+  return (int)mp_numa_cpu_node[cpu];
+}
+
+static void mp_numa_bind(uint8_t* start, ssize_t size, int numa_node) {
+  if (numa_node < 0) return;
+  unsigned long nodemask = (1UL << numa_node);
+  if (syscall(SYS_mbind, start, (unsigned long)size, MP_MPOL_PREFERRED, &nodemask, (unsigned long)(MP_NUMA_MAX_NODES + 1), 0U) != 0) {
+    mp_system_error_message(EINVAL, "unable to bind the gpool at %p of size %zd to numa node %d\n", start, size, numa_node);
+  }
+  else {
+    mp_stat_inc(gpool_numa_binds);
+  }
+}
+
+#else
+
+static bool mp_numa_init(void) {
+  return false;
+}
+
+static int mp_os_numa_node(void) {
+  return -1;
+}
+
+static void mp_numa_bind(uint8_t* start, ssize_t size, int numa_node) {
+  MP_UNUSED(start); MP_UNUSED(size); MP_UNUSED(numa_node);
+}
+
+#endif
+
+
+// A fresh gpool is created with the area of its gstacks
+static bool mp_os_gpool_register(uint8_t* start, ssize_t size, int numa_node) {
+  mp_numa_bind(start, size, numa_node);
+  #if defined(MADV_HUGEPAGE)
+  if (os_huge_page_size > 0 && madvise(start, size, MADV_HUGEPAGE) != 0) {
+    mp_system_error_message(EINVAL, "unable to use huge pages for the gpool at %p of size %zd\n", start, size);
+  }
+  #endif
+  if (os_gpool_compact) {
+    if (!mp_os_mem_commit(start, size)) return false;  // make all stacks and gaps accessible at once
+    mp_stat_inc(gpool_compacts);
+  }
+  mp_uffd_register(start, size);
+  return true;
+}
+
+
 //--------------------------------------------------
 // Init/Done
 //--------------------------------------------------
@@ -269,6 +760,23 @@ static bool mp_gstack_os_init(void) {
   if (!(os_use_gpools || os_gstack_grow_fast) && mp_linux_use_overcommit()) {
     os_use_overcommit = true;
   }
+  else if (os_use_gpools && (os_gpool_userfaultfd || os_gpool_compact) && mp_linux_use_overcommit() && mp_uffd_init()) {
+    // gpool stacks are fully accessible and the `userfaultfd` handler commits on demand
+    os_use_userfaultfd = true;
+    os_use_overcommit = true;
+  }
+  #endif
+  os_gpool_userfaultfd = os_use_userfaultfd;  // not available otherwise
+  if (!os_use_userfaultfd) {
+    os_gpool_compact = false;  // the gaps can only be checked by the `userfaultfd` handler
+  }
+  if (os_gpool_numa && (!os_use_gpools || !mp_numa_init())) {
+    os_gpool_numa = false;  // not available
+  }
+  #if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if (os_gstack_huge_pages && os_use_gpools && !os_use_overcommit && os_stack_grows_down) {
+    os_huge_page_size = mp_linux_huge_page_size();  // 0 if not available
+  }
   #endif
   
   // register pthread key to detect thread termination
@@ -278,7 +786,11 @@ static bool mp_gstack_os_init(void) {
   atexit(&mp_gpools_process_done);
 
   mp_os_mach_process_init();  // macOS; note: must come before gpools_process_init as it may enable gpools.
+  if (!os_use_gpools) {
+    os_gsave_track_writes = false;  // the fault handler finds tracked gstacks through their gpool
+  }
   mp_gpools_process_init();  
+  mp_resets_init();
   return true;
 }
 
@@ -296,6 +808,9 @@ static mp_decl_thread stack_t* mp_sig_stack;  // every thread needs a signal sta
 static bool mp_mmap_commit_on_demand(void* addr, bool addr_in_other_thread) {
   // demand allocate?
   uint8_t* page = mp_align_down_ptr((uint8_t*)addr, os_page_size);
+  if (os_gsave_track_writes && mp_gstack_track_fault(page)) {
+    return true;  // a write to a tracked page of a saved gstack (possibly from another thread)
+  }
   ssize_t available = 0;
   ssize_t stack_size = 0;
   mp_access_t access = MP_NOACCESS;
@@ -309,6 +824,12 @@ static bool mp_mmap_commit_on_demand(void* addr, bool addr_in_other_thread) {
      // in that case we can use gpools to determine if the access is in one of our gstacks.
      access = mp_gpools_check_access( page, &stack_size, &available, NULL );
   }
+  if (access == MP_NOACCESS && g != NULL && os_use_gpools) {
+    // a signal handler (like a `SIGPROF` profiler) can run in the middle of a prompt switch where the
+    // prompt top is already updated but we still run on the previous gstack; use gpools to find it.
+    access = mp_gpools_check_access( page, &stack_size, &available, NULL );
+    g = NULL;  // do not update the committed size of the current gstack
+  }
   
   if (access == MP_ACCESS) {
     // a pointer to a valid gstack in our gpool, make the page read-write
@@ -324,7 +845,13 @@ static bool mp_mmap_commit_on_demand(void* addr, bool addr_in_other_thread) {
     uint8_t* commit_start;
     mp_push(page, extra, &commit_start);
     if (mprotect(commit_start, extra + os_page_size, PROT_READ | PROT_WRITE) == 0) {
-      if (g != NULL) { g->committed = mp_unpush(commit_start, g->stack, g->stack_size ); }
+      mp_stat_inc(page_faults);
+      mp_trace(MP_TRACE_PAGE_FAULT, page, extra);
+      if (g != NULL) { 
+        const ssize_t committed = g->committed;
+        mp_gstack_set_committed(g, mp_unpush(commit_start, g->stack, g->stack_size)); 
+        mp_gstack_paint_commit(g, page, commit_start, extra + os_page_size, committed);
+      }
     };
     return true; 
   }
@@ -361,6 +888,11 @@ static void mp_sig_handler_commit_on_demand(int signum, siginfo_t* info, void* a
 // Thread init/done: set alternate signal handler stack
 // ----------------------------------------------------
 
+// Do we need the signal handler? Not if the OS (or the `userfaultfd` handler) commits on demand
+static bool mp_gpools_use_signal_handler(void) {
+  return (os_gsave_track_writes || !os_use_overcommit || (os_use_gpools && !os_use_userfaultfd));
+}
+
 // or SIGSTKSIZE but we require just a small stack
 #define MP_SIG_STACK_SIZE   (MINSIGSTKSZ < 8*MP_KIB ? 8*MP_KIB : MINSIGSTKSZ)
 
@@ -382,7 +914,7 @@ static void mp_gpools_thread_done(void) {
 
 // Each thread needs to register an alternative stack for the signal handler to run in.
 static void mp_gpools_thread_init(void) {
-  if (!os_use_gpools && os_use_overcommit) return; // no need for stack for an on-demand commit handler if the OS has overcommit enabled
+  if (!mp_gpools_use_signal_handler()) return; // no need for stack for an on-demand commit handler if the OS has overcommit enabled
 
   // use an alternate signal stack (since we handle stack overflows)
   if (mp_sig_stack == NULL) {    
@@ -432,7 +964,7 @@ static void mp_gpools_process_done(void) {
 // At process initialization we register our page fault handler for gpool on-demand paging.
 static void mp_gpools_process_init(void) {
   mp_gpools_thread_init();
-  if (!os_use_gpools && os_use_overcommit) return; // no need for an on-demand commit handler if the OS has overcommit enabledv
+  if (!mp_gpools_use_signal_handler()) return; // no need for an on-demand commit handler if the OS has overcommit enabled
 
   // install signal handler
   if (mp_sig_segv_prev_act.sa_sigaction == NULL && mp_sig_segv_prev_act.sa_handler == NULL) {
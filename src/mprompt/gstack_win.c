@@ -63,6 +63,30 @@ static void  mp_os_mem_free(uint8_t* p, ssize_t size) {
   }
 }
 
+// Write tracking of saved gstacks is not supported on Windows
+static bool mp_os_mem_protect(uint8_t* start, ssize_t size, bool readonly) {
+  MP_UNUSED(start); MP_UNUSED(size); MP_UNUSED(readonly);
+  return false;
+}
+
+// Partially decommitting a gstack is not supported on Windows as the stack needs 
+// a contiguous committed area with a guard page.
+static bool mp_os_mem_decommit(uint8_t* start, ssize_t size) {
+  MP_UNUSED(start); MP_UNUSED(size);
+  return false;
+}
+
+// Gpools on Windows commit on demand through the exception handler
+static bool mp_os_gpool_register(uint8_t* start, ssize_t size, int numa_node) {
+  MP_UNUSED(start); MP_UNUSED(size); MP_UNUSED(numa_node);
+  return true;
+}
+
+// NUMA aware gpools are not supported on Windows
+static int mp_os_numa_node(void) {
+  return -1;
+}
+
 // Commit a range of pages
 static bool mp_os_mem_commit(uint8_t* start, ssize_t size) {
   if (VirtualAlloc(start, size, MEM_COMMIT, PAGE_READWRITE) == NULL) {   
@@ -74,26 +98,27 @@ static bool mp_os_mem_commit(uint8_t* start, ssize_t size) {
 
 
 // Allocate a gstack
-static uint8_t* mp_gstack_os_alloc(uint8_t** stk, ssize_t* stk_size, ssize_t* initial_commit) {
+static uint8_t* mp_gstack_os_alloc(ssize_t full_size, ssize_t gap_size, uint8_t** stk, ssize_t* stk_size, ssize_t* initial_commit) {
   if (!os_use_gpools) {
     // reserve virtual full stack
-    uint8_t* full = mp_os_mem_reserve(os_gstack_size);
+    uint8_t* full = mp_os_mem_reserve(full_size);
     if (full == NULL) return NULL;
 
-    *stk = full + os_gstack_gap;
-    *stk_size = os_gstack_size - 2 * os_gstack_gap;
+    *stk = full + gap_size;
+    *stk_size = full_size - 2 * gap_size;
     // and initialize the guard page and initial commit
     if (!mp_win_initial_commit(*stk, *stk_size, initial_commit, true)) {
-      mp_os_mem_free(full, os_gstack_size);
+      mp_os_mem_free(full, full_size);
       return NULL;
     }
-    //mp_trace_stack_layout(full + os_gstack_size - os_gstack_gap, full + os_gstack_gap);
+    //mp_trace_stack_layout(full + full_size - gap_size, full + gap_size);
     return full;
   }
   else {
     // Use gpool allocation
-    uint8_t* full = mp_gpool_alloc(stk, stk_size);
+    uint8_t* full = mp_gpool_alloc(full_size, gap_size, stk, stk_size);
     if (full == NULL) return NULL;
+    mp_stat_inc(gstack_gpool_allocs);
     
     // and initialize the guard page and initial commit
     if (!mp_win_initial_commit(*stk, *stk_size, initial_commit, true)) {
@@ -136,10 +161,10 @@ static bool mp_win_initial_commit(uint8_t* stk, ssize_t stk_size, ssize_t* initi
 }
 
 // Free the memory of a gstack
-static void mp_gstack_os_free(uint8_t* full, uint8_t* stk, ssize_t stk_size, ssize_t stk_commit) {
+static void mp_gstack_os_free(uint8_t* full, ssize_t full_size, uint8_t* stk, ssize_t stk_size, ssize_t stk_commit) {
   if (full == NULL) return;
   if (!os_use_gpools) {
-    mp_os_mem_free(full, os_gstack_size);
+    mp_os_mem_free(full, full_size);
   }
   else {
     stk_size   = mp_align_up(stk_size, os_page_size);
@@ -350,7 +375,13 @@ static LONG WINAPI mp_gstack_win_page_fault(PEXCEPTION_POINTERS ep)
         if (VirtualAlloc(gpage, guard_size, MEM_COMMIT, PAGE_GUARD | PAGE_READWRITE) != NULL) {
           tib->StackLimit = extend;
           tib->StackRealLimit = gpage; 
-          if (g != NULL) { g->committed = mp_unpush(extend, g->stack, g->stack_size); }
+          mp_stat_inc(page_faults);
+          mp_trace(MP_TRACE_PAGE_FAULT, page, extra);
+          if (g != NULL) { 
+            const ssize_t committed = g->committed;
+            mp_gstack_set_committed(g, mp_unpush(extend, g->stack, g->stack_size)); 
+            mp_gstack_paint_commit(g, page, extend, commit_size, committed);
+          }
           //mp_trace_message("expanded stack: extra: %zdk, available: %zdk, stack_size: %zdk, used: %zdk\n", extra/1024, available/1024, g->stack_size/1024, used/1024);
           //mp_win_trace_stack_layout(tib->StackBase, tib->StackBase - g->stack_size);
           return (exncode!=MP_CPP_EXN ? EXCEPTION_CONTINUE_EXECUTION : EXCEPTION_CONTINUE_SEARCH);
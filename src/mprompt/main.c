@@ -9,5 +9,6 @@
 -----------------------------------------------------------------------------*/
 
 #include "mprompt.c"
+#include "mpgen.c"
 #include "gstack.c"
 #include "util.c"
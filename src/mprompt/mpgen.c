@@ -0,0 +1,130 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/* ----------------------------------------------------------------------------
+  Batched generators on top of prompts.
+
+  The producer runs in its own prompt and writes directly into the buffer of
+  the consumer. Only when the buffer is full does it yield back to its prompt
+  (storing the once-resumption in the generator); the next fill resumes it
+  with a fresh buffer. When the producer function returns the generator is done.
+-----------------------------------------------------------------------------*/
+#include <string.h>
+#include "mpgen.h"
+
+struct mp_gen_s {
+  mp_gen_fun_t*  fun;
+  void*          arg;
+  ptrdiff_t      stack_size;
+  size_t         elem_size;
+  mp_prompt_t*   prompt;      // prompt of the producer (once started)
+  mp_resume_t*   resume;      // the suspended producer (waiting for the next batch)
+  uint8_t*       start;       // start of the current batch
+  uint8_t*       next;        // next free element in the current batch
+  uint8_t*       end;         // end of the current batch
+  bool           started;
+  bool           done;
+};
+
+
+mp_gen_t* mp_gen_create(ptrdiff_t stack_size, size_t elem_size, mp_gen_fun_t* fun, void* arg) {
+  mp_assert(elem_size > 0 && fun != NULL);
+  mp_gen_t* gen = mp_zalloc_safe_tp(mp_gen_t);
+  gen->fun = fun;
+  gen->arg = arg;
+  gen->stack_size = stack_size;
+  gen->elem_size = elem_size;
+  return gen;
+}
+
+void mp_gen_free(mp_gen_t* gen) {
+  if (gen == NULL) return;
+  if (gen->resume != NULL) {
+    mp_resume_drop(gen->resume);
+  }
+  mp_free(gen);
+}
+
+
+//-----------------------------------------------------------------------
+// Consumer
+//-----------------------------------------------------------------------
+
+static void* mp_gen_start(mp_prompt_t* p, void* arg) {
+  mp_gen_t* gen = (mp_gen_t*)arg;
+  gen->prompt = p;
+  (gen->fun)(gen, gen->arg);
+  gen->done = true;
+  return NULL;
+}
+
+ptrdiff_t mp_gen_fill(mp_gen_t* gen, void* buf, ptrdiff_t count) {
+  if (gen->done || count <= 0) return 0;
+  mp_assert(gen->next == NULL);  // cannot fill from inside the producer
+  gen->start = (uint8_t*)buf;
+  gen->next  = gen->start;
+  gen->end   = gen->start + (size_t)count * gen->elem_size;
+  #ifdef __cplusplus
+  try {
+  #endif
+    if (!gen->started) {
+      gen->started = true;
+      mp_prompt_ex(gen->stack_size, &mp_gen_start, gen);
+    }
+    else {
+      mp_resume_t* r = gen->resume;
+      mp_assert_internal(r != NULL);
+      gen->resume = NULL;
+      mp_resume(r, NULL);
+    }
+  #ifdef __cplusplus
+  }
+  catch (...) {
+    // an exception in the producer finishes the generator
+    gen->start = gen->next = gen->end = NULL;
+    gen->done = true;
+    throw;
+  }
+  #endif
+  // back when the batch is full, or when the producer is done
+  const ptrdiff_t n = (gen->next - gen->start) / (ptrdiff_t)gen->elem_size;
+  gen->start = gen->next = gen->end = NULL;
+  return n;
+}
+
+
+//-----------------------------------------------------------------------
+// Producer
+//-----------------------------------------------------------------------
+
+static void* mp_gen_suspend(mp_resume_t* r, void* arg) {
+  mp_gen_t* gen = (mp_gen_t*)arg;
+  gen->resume = r;
+  return NULL;
+}
+
+void* mp_gen_reserve(mp_gen_t* gen, ptrdiff_t* count) {
+  mp_assert(gen->prompt != NULL && mp_prompt_is_ancestor(gen->prompt));  // only in a running producer
+  if (mp_unlikely(gen->next >= gen->end)) {
+    mp_yield(gen->prompt, &mp_gen_suspend, gen);   // wait for the next batch
+  }
+  if (count != NULL) {
+    *count = (gen->end - gen->next) / (ptrdiff_t)gen->elem_size;
+  }
+  return gen->next;
+}
+
+void mp_gen_commit(mp_gen_t* gen, ptrdiff_t n) {
+  mp_assert(n >= 0 && gen->next + (size_t)n * gen->elem_size <= gen->end);
+  gen->next += (size_t)n * gen->elem_size;
+}
+
+void mp_gen_emit(mp_gen_t* gen, const void* elem) {
+  void* slot = mp_gen_reserve(gen, NULL);
+  memcpy(slot, elem, gen->elem_size);
+  gen->next += gen->elem_size;
+}
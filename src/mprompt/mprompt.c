@@ -14,11 +14,31 @@
 #include "internal/util.h"
 #include "internal/longjmp.h"
 #include "internal/gstack.h"
+#include "internal/trace.h"
+#include "internal/atomic.h"
+#include "internal/preempt.h"
 
 #ifdef __cplusplus
 #include <exception>
 #endif
 
+// With `MP_EXN_DIRECT`, C++ exceptions are not caught and rethrown at a prompt boundary but propagate 
+// directly through the `mp_stack_enter` frame into the parent, using its dwarf unwind information
+// (that restores the registers of the return point). This is only enabled where the unwinder follows
+// that information for all callee-saved registers (x64 with ELF); otherwise exceptions are caught in 
+// the prompt and rethrown in the parent.
+#if defined(__cplusplus) && defined(MP_EXN_DIRECT) && MP_EXN_DIRECT && defined(__x86_64__) && defined(__ELF__) && !MP_USE_ASAN
+#define MP_USE_EXN_DIRECT  (1)
+#else
+#define MP_USE_EXN_DIRECT  (0)
+#endif
+
+#if defined(__cplusplus) && !MP_USE_EXN_DIRECT
+#define MP_USE_EXN_CATCH   (1)
+#else
+#define MP_USE_EXN_CATCH   (0)
+#endif
+
 
 
 //-----------------------------------------------------------------------
@@ -39,10 +59,12 @@ typedef struct mp_resume_point_s {   // allocated on the suspended stack (which
 
 typedef struct mp_return_point_s {   // allocated on the parent stack (which performed an enter/resume)
   mp_jmpbuf_t        jmp;     // must be the first field (in order to find unwind information, see `mp_stack_enter`)
+  mp_prompt_t*       prompt;  // the prompt that returns here (can differ from the prompt that was resumed after a `mp_resume_to`)
   mp_return_kind_t   kind;    
   mp_yield_fun_t*    fun;     // if yielding, the function to execute
   void*              arg;     // if yielding, the argument to the function; if returning, the result.
-  #ifdef __cplusplus
+  mp_prompt_t*       transferred; // the prompt that just transferred to `prompt` (see `mp_resume_to` and `mp_prompt_transfer_saved`)
+  #if MP_USE_EXN_CATCH
   std::exception_ptr exn;     // returning with an exception to propagate
   #endif
 } mp_return_point_t;
@@ -70,6 +92,7 @@ struct mp_prompt_s {
 
   void*              sp;            // security: contains the (guarded) expected stack pointer for a return (if active) or resume (if suspended)
   mp_unwind_frame_t* unwind_frame;  // used to aid with unwinding on some platforms (windows only for now)
+  void*              locals[MP_PROMPT_LOCAL_COUNT];  // prompt local storage (inherited from the parent at entry, and saved with the prompt)
 };
 
 
@@ -94,6 +117,7 @@ typedef struct mp_mresume_s {
   mp_prompt_t*       prompt;
   mp_prompt_save_t*  save;
   mp_return_point_t* tail_return_point;  // need to save this as the one in the prompt may be overwritten by earlier resumes
+  mp_scope_t*        scope;              // if not NULL, the resumption and its saves are allocated in this scope
 } mp_mresume_t;
 
 
@@ -133,9 +157,12 @@ static mp_resume_t* mp_resume_as_multi(mp_mresume_t* r) {
 // Initialize
 //-----------------------------------------------------------------------
 
+static void mp_labels_init(void);
+
 void mp_init(const mp_config_t* config) {
   mp_guard_init();
   mp_gstack_init(config);
+  mp_labels_init();  // after `mp_guard_init` as the labels are guarded
 }
 
 
@@ -157,6 +184,74 @@ mp_gstack_t* mp_gstack_current(void) {
   return (top != NULL ? top->gstack : NULL);
 }
 
+// Prompt local storage of the current thread when not running in a prompt
+static mp_decl_thread void* _mp_prompt_locals[MP_PROMPT_LOCAL_COUNT];
+
+// Prompt local slots in use
+static _Atomic(intptr_t) mp_prompt_local_count;
+
+// Allocate a fresh prompt local slot (or -1 if all slots are in use)
+ptrdiff_t mp_prompt_local_new(void) {
+  intptr_t count = mp_atomic_load(&mp_prompt_local_count);
+  do {
+    if (count >= MP_PROMPT_LOCAL_COUNT) return -1;
+  } while (!mp_atomic_cas(&mp_prompt_local_count, &count, count + 1));
+  return count;
+}
+
+// The local storage of the current prompt
+void** mp_prompt_locals(void) {
+  mp_prompt_t* top = mp_prompt_top();
+  return (top != NULL ? top->locals : _mp_prompt_locals);
+}
+
+void* mp_prompt_local_get(ptrdiff_t slot) {
+  mp_assert(slot >= 0 && slot < MP_PROMPT_LOCAL_COUNT);
+  return mp_prompt_locals()[slot];
+}
+
+void mp_prompt_local_set(ptrdiff_t slot, void* value) {
+  mp_assert(slot >= 0 && slot < MP_PROMPT_LOCAL_COUNT);
+  mp_prompt_locals()[slot] = value;
+}
+
+
+//-----------------------------------------------------------------------
+// Cooperative preemption
+//-----------------------------------------------------------------------
+
+mp_decl_thread mp_preempt_t             _mp_preempt;
+static mp_decl_thread mp_preempt_fun_t* _mp_preempt_handler;
+
+mp_preempt_t* mp_preempt_current(void) {
+  return &_mp_preempt;
+}
+
+void mp_preempt_request(mp_preempt_t* preempt) {
+  mp_atomic_store(&preempt->requested, (intptr_t)1);
+}
+
+void mp_preempt_clear(mp_preempt_t* preempt) {
+  mp_atomic_store(&preempt->requested, (intptr_t)0);
+}
+
+mp_preempt_fun_t* mp_preempt_set_handler(mp_preempt_fun_t* fun) {
+  mp_preempt_fun_t* prev = _mp_preempt_handler;
+  _mp_preempt_handler = fun;
+  return prev;
+}
+
+// Not inlined so the thread-local is never cached across a handler that resumes us in another thread.
+mp_decl_noinline bool mp_maybe_yield(void) {
+  mp_preempt_t* preempt = &_mp_preempt;
+  if (mp_likely(mp_atomic_load(&preempt->requested) == 0)) return false;
+  mp_atomic_store(&preempt->requested, (intptr_t)0);
+  mp_preempt_fun_t* fun = _mp_preempt_handler;
+  if (fun == NULL) return false;
+  fun();
+  return true;
+}
+
 // walk the prompt chain; returns NULL when done.
 // with initial argument `NULL` the first prompt returned is the current top.
 mp_prompt_t* mp_prompt_parent(mp_prompt_t* p) {
@@ -179,11 +274,12 @@ static bool mp_prompt_is_ancestor(mp_prompt_t* p) {
 }
 #endif
 
-// Allocate a fresh (suspended) prompt
-mp_prompt_t* mp_prompt_create(void) {
+// Allocate a fresh (suspended) prompt with a stack that can hold at least `stack_size` bytes (or 0 for the default).
+// The `site` (if not NULL) is used to learn the initial commit of the stack.
+mp_prompt_t* mp_prompt_create_at(ptrdiff_t stack_size, const void* site) {
   // allocate a fresh growable stack
   mp_prompt_t* p;
-  mp_gstack_t* gstack = mp_gstack_alloc(sizeof(mp_prompt_t), (void**)&p);
+  mp_gstack_t* gstack = mp_gstack_alloc(stack_size, site, sizeof(mp_prompt_t), (void**)&p);
   if (gstack == NULL) { mp_fatal_message(ENOMEM, "unable to allocate a stack\n"); }
   // allocate the prompt structure at the base of the new stack
   p->parent = NULL;
@@ -193,9 +289,24 @@ mp_prompt_t* mp_prompt_create(void) {
   p->resume_point = NULL;
   p->return_point = NULL;
   p->unwind_frame = NULL;
+  mp_stat_inc(prompts_created);
   return p;
 }
 
+// Pre-allocate gstacks with room for a prompt so later prompt allocations are served by the cache
+ptrdiff_t mp_prewarm(ptrdiff_t count, ptrdiff_t commit) {
+  return mp_gstack_prewarm(count, commit, sizeof(mp_prompt_t));
+}
+
+mp_prompt_t* mp_prompt_create_ex(ptrdiff_t stack_size) {
+  return mp_prompt_create_at(stack_size, NULL);
+}
+
+// Allocate a fresh (suspended) prompt
+mp_prompt_t* mp_prompt_create(void) {
+  return mp_prompt_create_at(0, NULL);
+}
+
 // Free a prompt and drop its children
 static void mp_prompt_free(mp_prompt_t* p, bool delay) {
   mp_assert_internal(!mp_prompt_is_active(p));
@@ -224,9 +335,16 @@ static void mp_prompt_drop(mp_prompt_t* p) {
   mp_prompt_drop_internal(p, false);
 }
 
-#ifdef __cplusplus
+#if MP_USE_EXN_CATCH
+// Drop a prompt whose exception is propagated. With the MSVC ABI the exception object lives in 
+// the (already unwound) stack of the thrower so we delay freeing its gstack until the unwind is done; 
+// with the Itanium ABI exception objects are heap allocated and the gstack can be freed right away.
 static void mp_prompt_drop_delayed(mp_prompt_t* p) {
+  #if defined(_MSC_VER)
   mp_prompt_drop_internal(p, true);
+  #else
+  mp_prompt_drop_internal(p, false);
+  #endif
 }
 #endif
 
@@ -236,7 +354,9 @@ static mp_prompt_t* mp_prompt_dup(mp_prompt_t* p) {
   return p;
 }
 
-// Link a suspended prompt to the current prompt chain and set the new prompt top
+// Link a suspended prompt to the current prompt chain and set the new prompt top.
+// The context of the return point `ret` may not be saved yet (see `mp_prompt_return_saved`).
+// Before switching to the new top, call `mp_prompt_switch_start`.
 static inline mp_resume_point_t* mp_prompt_link(mp_prompt_t* p, mp_return_point_t* ret, void** sp) {
   mp_assert_internal(ret != NULL);
   mp_assert_internal(!mp_prompt_is_active(p));
@@ -244,17 +364,16 @@ static inline mp_resume_point_t* mp_prompt_link(mp_prompt_t* p, mp_return_point_
   p->parent = mp_prompt_top();
   _mp_prompt_top = p->top;
   p->top = NULL;
-  if (mp_likely(ret != NULL)) { 
-    p->return_point = ret; 
-    p->sp = mp_guard(ret->jmp.reg_sp);
-    mp_unwind_frame_update(p->unwind_frame, &ret->jmp);
-  }                           
+  mp_gstack_entered(_mp_prompt_top->gstack);     // resumes on the top of the linked chain
+  p->return_point = ret;                           
+  ret->prompt = p;
   mp_assert_internal(mp_prompt_is_active(p));  
-  mp_debug_asan_start_switch(_mp_prompt_top->gstack);
   return p->resume_point;
 }
 
 // Unlink a prompt from the current chain and make suspend it (and set the new prompt top to its parent)
+// The context of the resume point `res` may not be saved yet (see `mp_prompt_resume_saved`).
+// Before switching to the new top, call `mp_prompt_switch_start`.
 static inline mp_return_point_t* mp_prompt_unlink(mp_prompt_t* p, mp_resume_point_t* res, void** sp) {
   mp_assert_internal(mp_prompt_is_active(p));
   mp_assert_internal(mp_prompt_is_ancestor(p)); // ancestor of current top?
@@ -262,39 +381,97 @@ static inline mp_return_point_t* mp_prompt_unlink(mp_prompt_t* p, mp_resume_poin
   p->top = mp_prompt_top();
   _mp_prompt_top = p->parent;
   p->parent = NULL;  
+  if (_mp_prompt_top != NULL) { mp_gstack_entered(_mp_prompt_top->gstack); }  // returns into the parent
   p->resume_point = res;
-  if (mp_likely(res != NULL)) {   // on return/exception
-    p->sp = mp_guard(res->jmp.reg_sp);
-  }
   // note: leave return_point as-is for potential reuse in tail resumes
   mp_assert_internal(!mp_prompt_is_active(p));
-  mp_debug_asan_start_switch(_mp_prompt_top == NULL ? NULL : _mp_prompt_top->gstack);
   return p->return_point;
 }
 
+// Start switching to the stack of the current prompt top (or the system stack); the switched
+// to code calls `mp_debug_asan_end_switch`. Only needed for the address sanitizer that requires 
+// each stack switch to be announced exactly once (so not for both an unlink and link in `mp_resume_to`).
+static inline void mp_prompt_switch_start(void) {
+  mp_debug_asan_start_switch(_mp_prompt_top == NULL ? NULL : _mp_prompt_top->gstack);
+}
+
 
 //-----------------------------------------------------------------------
-// Checked longjmp
+// Checked jumps
 // We use a form of control-flow integrity by only allowing
-// a longjmp to two known code locations (one for resume, and one for return)
+// a longjmp to four known code locations (two for resume (yield and transfer), 
+// one for the initial return, and one for the return after a resume)
 //-----------------------------------------------------------------------
 
-// The code addresses are initialized on the first call to setjmp (and are located right after the setjmp call)
+// The code addresses are initialized on the first save of a context (and are located right after 
+// the `mp_setjmp` or `mp_stack_switch` call). A context saved by `mp_stack_switch` is only known
+// once we switched, so those labels (and expected stack pointers) are set at the point we switched to.
+// To not depend on the first program prompts, `mp_init` learns them eagerly (see `mp_labels_init`).
 // todo: can we make this static so these go to the readonly section? 
-static void* mp_return_label;
-static void* mp_resume_label;
+static void* mp_return_label;          // initial entry in `mp_prompt_resume`
+static void* mp_return_switch_label;   // resume in `mp_prompt_resume`
+static void* mp_resume_label;          // yield in `mp_yield`
+static void* mp_resume_to_label;       // transfer in `mp_resume_to`
+
+
+// Check if we return to one of the designated labels (with a known stack pointer)
+static inline void mp_check_return_point(void* sp, mp_return_point_t* ret) {
+  void* ip = ret->jmp.reg_ip;
+  if (mp_unlikely(mp_unguard(mp_return_label) != ip && 
+                  (mp_return_switch_label == NULL || mp_unguard(mp_return_switch_label) != ip))) {
+    mp_fatal_message(EFAULT, "potential stack corruption detected: expected ip %p or %p, but found %p\n", 
+                     mp_unguard(mp_return_label), (mp_return_switch_label == NULL ? NULL : mp_unguard(mp_return_switch_label)), ip);
+  }
+  if (mp_unlikely(mp_unguard(sp) != ret->jmp.reg_sp)) {
+    mp_fatal_message(EFAULT, "potential stack corruption detected: expected sp %p, but found %p\n", mp_unguard(sp), ret->jmp.reg_sp);
+  }
+}
+
+// Check if we resume to one of the designated labels (with a known stack pointer)
+static inline void mp_check_resume_point(void* sp, mp_resume_point_t* res) {
+  void* ip = res->jmp.reg_ip;
+  if (mp_unlikely(mp_unguard(mp_resume_label) != ip &&
+                  (mp_resume_to_label == NULL || mp_unguard(mp_resume_to_label) != ip))) {
+    mp_fatal_message(EFAULT, "potential stack corruption detected: expected ip %p or %p, but found %p\n", 
+                     mp_unguard(mp_resume_label), (mp_resume_to_label == NULL ? NULL : mp_unguard(mp_resume_to_label)), ip);
+  }
+  if (mp_unlikely(mp_unguard(sp) != res->jmp.reg_sp)) {
+    mp_fatal_message(EFAULT, "potential stack corruption detected: expected sp %p, but found %p\n", mp_unguard(sp), res->jmp.reg_sp);
+  }
+}
 
+// Called in the prompt resumed by a transfer once the context of the resume point of the 
+// prompt that transferred is saved (see `mp_resume_to`)
+static mp_decl_noinline void mp_prompt_transfer_saved(mp_return_point_t* ret) {
+  mp_prompt_t* p = ret->transferred;
+  ret->transferred = NULL;
+  mp_jmpbuf_t* jmp = &p->resume_point->jmp;
+  if (mp_unlikely(mp_resume_to_label == NULL)) {
+    mp_resume_to_label = mp_guard(jmp->reg_ip);
+  }
+  p->sp = mp_guard(jmp->reg_sp);
+}
 
-// Checked longjmp to a known location (with a known stack pointer)
-static mp_decl_noreturn void mp_checked_longjmp(void* label, void* sp, mp_jmpbuf_t* jmp) {
-  // security: check if we return to the designated label
-  if (mp_unlikely(mp_unguard(label) != jmp->reg_ip)) {
-    mp_fatal_message(EFAULT, "potential stack corruption detected: expected ip %p, but found %p\n", mp_unguard(label), jmp->reg_ip);
+// Called in the resumed prompt once the context of its return point is saved
+static inline void mp_prompt_return_saved(mp_prompt_t* p) {
+  if (mp_unlikely(p->return_point->transferred != NULL)) {
+    mp_prompt_transfer_saved(p->return_point);
+  }
+  mp_jmpbuf_t* jmp = &p->return_point->jmp;
+  if (mp_unlikely(mp_return_switch_label == NULL) && jmp->reg_ip != mp_unguard(mp_return_label)) {
+    mp_return_switch_label = mp_guard(jmp->reg_ip);
   }
-  if (mp_unlikely(mp_unguard(sp) != jmp->reg_sp)) {
-    mp_fatal_message(EFAULT, "potential stack corruption detected: expected sp %p, but found %p\n", mp_unguard(sp), jmp->reg_sp);
+  p->sp = mp_guard(jmp->reg_sp);
+  mp_unwind_frame_update(p->unwind_frame, jmp);
+}
+
+// Called in the parent once the context of the resume point of a yielded prompt is saved
+static inline void mp_prompt_resume_saved(mp_prompt_t* p) {
+  mp_jmpbuf_t* jmp = &p->resume_point->jmp;
+  if (mp_unlikely(mp_resume_label == NULL)) {
+    mp_resume_label = mp_guard(jmp->reg_ip);
   }
-  mp_longjmp(jmp); 
+  p->sp = mp_guard(jmp->reg_sp);
 }
 
 
@@ -310,6 +487,15 @@ typedef struct mp_entry_env_s {
   void* arg;
 } mp_entry_env_t;
 
+// Unlink when returning from the initial entry. This is not inlined as the prompt may have been
+// resumed in another thread in the mean time (see `mp_resume_attach`) and a compiler may otherwise 
+// reuse a thread-local address of `_mp_prompt_top` that was computed before calling the start function.
+static mp_decl_noinline mp_return_point_t* mp_prompt_unlink_return(mp_prompt_t* p, void** sp) {
+  mp_return_point_t* ret = mp_prompt_unlink(p, NULL, sp);
+  mp_prompt_switch_start();
+  return ret;
+}
+
 static  void mp_prompt_stack_entry(void* penv, mp_unwind_frame_t* unwind_frame) {
   MP_UNUSED(unwind_frame);
   mp_entry_env_t* env = (mp_entry_env_t*)penv;
@@ -319,27 +505,28 @@ static  void mp_prompt_stack_entry(void* penv, mp_unwind_frame_t* unwind_frame)
   //mp_prompt_stack_entry(p, env->fun, env->arg);
   void* sp;
   mp_return_point_t* ret;
-  #ifdef __cplusplus
+  #if MP_USE_EXN_CATCH
   try {
   #endif
     void* result = (env->fun)(p, env->arg);
     // RET: return from a prompt
-    ret = mp_prompt_unlink(p, NULL, &sp);
+    ret = mp_prompt_unlink_return(p, &sp);
     ret->arg = result;
     ret->fun = NULL;
     ret->kind = MP_RETURN;    
-  #ifdef __cplusplus
+  #if MP_USE_EXN_CATCH
   }
   catch (...) {
     mp_trace_message("catch exception to propagate across the prompt %p..\n", p);
-    ret = mp_prompt_unlink(p, NULL, &sp);
+    ret = mp_prompt_unlink_return(p, &sp);
     ret->exn = std::current_exception();
     ret->arg = NULL;
     ret->fun = NULL;
     ret->kind = MP_EXCEPTION;
   }
   #endif  
-  mp_checked_longjmp(mp_return_label, sp, &ret->jmp);
+  mp_check_return_point(sp, ret);
+  mp_longjmp(&ret->jmp);
 }
 
 
@@ -356,7 +543,7 @@ static mp_decl_noinline void* mp_prompt_exec_yield_fun(mp_return_point_t* ret, m
     return result;
   }
   else {
-    #ifdef __cplusplus
+    #if MP_USE_EXN_CATCH
     mp_assert_internal(ret->kind == MP_EXCEPTION);
     mp_trace_message("rethrow propagated exception again (from prompt %p)..\n", p);
     mp_prompt_drop_delayed(p);
@@ -368,54 +555,97 @@ static mp_decl_noinline void* mp_prompt_exec_yield_fun(mp_return_point_t* ret, m
 }
 
 
+#if MP_USE_EXN_DIRECT
+// Called when an exception propagated directly from a prompt into the frame of its return point:
+// the stack of the prompt is fully unwound so we unlink and drop it (while the unwind continues).
+static mp_decl_noinline void mp_prompt_unwound(mp_return_point_t* ret) {
+  mp_prompt_t* p = ret->prompt;
+  mp_trace_message("propagate exception directly from prompt %p..\n", p);
+  void* sp;
+  mp_prompt_unlink(p, NULL, &sp);
+  mp_prompt_switch_start();          // we are already on the stack of the parent
+  mp_debug_asan_end_switch(false);
+  mp_prompt_drop(p);
+}
+
+// The unwinder continues at the return point in `mp_prompt_resume` (see `mp_stack_enter`) where the 
+// destructor of this guard runs as a cleanup (so no exception is caught or rethrown). 
+class mp_return_guard_t {
+public:
+  mp_return_point_t* ret;   // set to NULL once we returned normally
+  mp_return_guard_t(mp_return_point_t* r) : ret(r) { }
+  ~mp_return_guard_t() {
+    if (mp_unlikely(ret != NULL)) { mp_prompt_unwound(ret); }
+  }
+};
+#endif
+
 // Resume a prompt: used for the initial entry as well as for resuming in a suspended prompt.
 static mp_decl_noinline void* mp_prompt_resume(mp_prompt_t * p, void* arg) {
+  mp_assert(p->parent == NULL);
   mp_return_point_t ret;    
-  // save our return location for yields and regular return  
-  if (mp_setjmp(&ret.jmp)) {
-    //mp_return_label:
-    // P: return from yield (YR), or a regular return (RET)
-    // printf("%s to prompt %p\n", (ret.kind == MP_RETURN ? "returned" : "yielded"), p);    
-    mp_debug_asan_end_switch(false);
-    return mp_prompt_exec_yield_fun(&ret, p);  // must be under the setjmp to preserve the stack
+  ret.transferred = NULL;
+  void* sp;
+  #if MP_USE_EXN_DIRECT
+  mp_return_guard_t guard(&ret);
+  #endif
+  if (mp_likely(p->resume_point != NULL)) {
+    // PR: resume to yield point and save our return location for yields and regular return  
+    mp_resume_point_t* res = mp_prompt_link(p,&ret,&sp);  // make active
+    mp_trace(MP_TRACE_RESUME, p, 0);
+    res->result = arg;
+    mp_check_resume_point(sp, res);
+    mp_prompt_switch_start();
+    mp_stack_switch(&ret.jmp, &res->jmp);
+    //mp_return_switch_label:
   }
-  else {
+  else if (!mp_setjmp(&ret.jmp)) {
     // security: longjmp can only jump to a known code point
     if (mp_unlikely(mp_return_label == NULL)) { 
       mp_return_label = mp_guard(ret.jmp.reg_ip); 
     }
-
-    mp_assert(p->parent == NULL);
-    void* sp;
-    mp_resume_point_t* res = mp_prompt_link(p,&ret,&sp);  // make active
-    if (res != NULL) {
-      // PR: resume to yield point
-      res->result = arg;
-      mp_checked_longjmp(mp_resume_label, sp, &res->jmp);
-    }
-    else {
-      // PI: initial entry, switch to the new stack with an initial function      
-      mp_gstack_enter(p->gstack, (mp_jmpbuf_t**)&p->return_point, &mp_prompt_stack_entry, arg);
-    }
+    // PI: initial entry, switch to the new stack with an initial function      
+    mp_prompt_link(p,&ret,&sp);  // make active
+    mp_prompt_return_saved(p);
+    mp_prompt_switch_start();
+    mp_gstack_enter(p->gstack, (mp_jmpbuf_t**)&p->return_point, &mp_prompt_stack_entry, arg);
     mp_unreachable("mp_prompt_resume");    // should never return
   }
+  // P: return from yield (YR), or a regular return (RET)
+  // printf("%s to prompt %p\n", (ret.kind == MP_RETURN ? "returned" : "yielded"), ret.prompt);    
+  #if MP_USE_EXN_DIRECT
+  guard.ret = NULL;
+  #endif
+  if (ret.kind == MP_YIELD) {
+    mp_prompt_resume_saved(ret.prompt);
+  }
+  mp_debug_asan_end_switch(false);
+  return mp_prompt_exec_yield_fun(&ret, ret.prompt);  // must be in this frame to preserve the stack
 }
 
 void* mp_prompt_enter(mp_prompt_t* p, mp_start_fun_t* fun, void* arg) {
   mp_assert_internal(!mp_prompt_is_active(p) && p->resume_point == NULL);
+  memcpy(p->locals, mp_prompt_locals(), sizeof(p->locals));   // inherit the prompt locals of the parent
   mp_entry_env_t env;
   env.prompt = p;
   env.fun = fun;
   env.arg = arg;
+  mp_trace(MP_TRACE_PROMPT_ENTER, p, 0);
   return mp_prompt_resume(p, &env);
 }
 
 // Install a fresh prompt `p` with a growable stack and start running `fun(p,arg)` on it.
 void* mp_prompt(mp_start_fun_t* fun, void* arg) {
-  mp_prompt_t* p = mp_prompt_create();
+  mp_prompt_t* p = mp_prompt_create_at(0, (const void*)fun);
   return mp_prompt_enter(p, fun, arg);  // enter the initial stack with fun(arg)
 }
 
+// Install a fresh prompt with a stack in the smallest size class that holds `stack_size` bytes
+void* mp_prompt_ex(ptrdiff_t stack_size, mp_start_fun_t* fun, void* arg) {
+  mp_prompt_t* p = mp_prompt_create_at(stack_size, (const void*)fun);
+  return mp_prompt_enter(p, fun, arg);
+}
+
 
 
 //-----------------------------------------------------------------------
@@ -435,6 +665,7 @@ void* mp_resume(mp_resume_t* resume, void* arg) {
   if (mp_unlikely(p == NULL)) return mp_mresume(mp_resume_is_multi(resume), arg);
   mp_assert_internal(p->refcount == 1);
   mp_assert_internal(p->resume_point != NULL);
+  mp_stat_inc(resumes);
   return mp_prompt_resume(p, arg);  // resume back to yield point
 }
 
@@ -448,8 +679,11 @@ static void* mp_prompt_resume_tail(mp_prompt_t* p, void* arg, mp_return_point_t*
   mp_assert_internal(p->resume_point != NULL);
   void* sp;
   mp_resume_point_t* res = mp_prompt_link(p,ret,&sp);   // make active using the given return point!
+  mp_trace(MP_TRACE_RESUME, p, 1);
   res->result = arg;
-  mp_checked_longjmp(mp_resume_label, sp, &res->jmp);
+  mp_check_resume_point(sp, res);
+  mp_prompt_switch_start();
+  mp_longjmp(&res->jmp);
 }
 
 
@@ -457,6 +691,7 @@ static void* mp_prompt_resume_tail(mp_prompt_t* p, void* arg, mp_return_point_t*
 void* mp_resume_tail(mp_resume_t* resume, void* arg) {
   mp_prompt_t* p = mp_resume_is_once(resume);
   if (mp_unlikely(p == NULL)) return mp_mresume_tail(mp_resume_is_multi(resume), arg);
+  mp_stat_inc(resumes_tail);
   return mp_prompt_resume_tail(p, arg, p->return_point);  // reuse return-point of the original entry
 }
 
@@ -499,31 +734,112 @@ int mp_resume_should_unwind(mp_resume_t* resume) {
 void* mp_yield(mp_prompt_t* p, mp_yield_fun_t* fun, void* arg) {
   mp_assert(mp_prompt_is_ancestor(p));           // can only yield up to an ancestor
   mp_assert_internal(mp_prompt_is_active(p));    // can only yield to an active prompt
-  // set our resume point (Y)
+  // YR: yielding to prompt, or resumed prompt (P), and set our resume point (Y)
   mp_resume_point_t res;
-  if (mp_setjmp(&res.jmp)) {
-    //mp_resume_label:
-    // Y: resuming with a result (from PR)
-    mp_assert_internal(mp_prompt_is_active(p));  // when resuming, we should be active again
-    mp_assert_internal(mp_prompt_is_ancestor(p));
-    mp_debug_asan_end_switch(p->parent==NULL);
-    return res.result;
-  }
-  else {
-    // security: can only longjmp to a static location
-    if (mp_unlikely(mp_resume_label == NULL)) {
-      mp_resume_label = mp_guard(res.jmp.reg_ip);
-    }
-    // YR: yielding to prompt, or resumed prompt (P)
-    void* sp;
-    mp_return_point_t* ret = mp_prompt_unlink(p, &res, &sp);
-    ret->fun = fun;
-    ret->arg = arg;
-    ret->kind = MP_YIELD;
-    mp_checked_longjmp(mp_return_label, sp, &ret->jmp);
+  void* sp;
+  mp_stat_inc(yields);
+  mp_trace(MP_TRACE_YIELD, p, 0);
+  mp_return_point_t* ret = mp_prompt_unlink(p, &res, &sp);
+  ret->fun = fun;
+  ret->arg = arg;
+  ret->kind = MP_YIELD;
+  mp_check_return_point(sp, ret);
+  mp_prompt_switch_start();
+  mp_stack_switch(&res.jmp, &ret->jmp);
+  //mp_resume_label:
+  // Y: resuming with a result (from PR)
+  mp_assert_internal(mp_prompt_is_active(p));  // when resuming, we should be active again
+  mp_assert_internal(mp_prompt_is_ancestor(p));
+  mp_prompt_return_saved(p);
+  mp_debug_asan_end_switch(p->parent==NULL);
+  return res.result;
+}
+
+
+//-----------------------------------------------------------------------
+// Symmetric transfer
+//-----------------------------------------------------------------------
+
+typedef struct mp_resume_to_env_s {
+  mp_resume_t*  target;
+  void*         arg;
+  mp_resume_t** self;
+} mp_resume_to_env_t;
+
+static void* mp_resume_to_fun(mp_resume_t* self, void* envarg) {
+  mp_resume_to_env_t* env = (mp_resume_to_env_t*)envarg;
+  *env->self = self;
+  return mp_resume(env->target, env->arg);
+}
+
+// Yield up to `p` and resume `target` in its place; this is equivalent to yielding with a function
+// that stores the resumption in `*self` and then resumes `target` with `arg`. For a once-resumption 
+// we switch directly to its resume point without returning to the parent of `p` first: the resumed
+// prompt takes over the return point of `p` (which is why return points record their prompt).
+void* mp_resume_to(mp_prompt_t* p, mp_resume_t* target, void* arg, mp_resume_t** self) {
+  mp_assert(mp_prompt_is_ancestor(p));           // can only yield up to an ancestor
+  mp_assert_internal(mp_prompt_is_active(p));    // can only yield to an active prompt
+  mp_prompt_t* q = mp_resume_is_once(target);
+  if (mp_unlikely(q == NULL)) {
+    // multi-shot resumptions need to be saved or restored from the parent
+    mp_resume_to_env_t env = { target, arg, self };
+    return mp_yield(p, &mp_resume_to_fun, &env);
   }
+  mp_assert_internal(q->refcount == 1);
+  mp_assert_internal(q->resume_point != NULL);
+  mp_stat_inc(yields);
+  mp_stat_inc(resumes_tail);
+  mp_trace(MP_TRACE_YIELD, p, 0);
+  // TR: suspend up to `p` and set our resume point (T) ...
+  mp_resume_point_t res;
+  void* sp;
+  mp_return_point_t* ret = mp_prompt_unlink(p, &res, &sp);
+  mp_check_return_point(sp, ret);              // the return point must still be valid for `p`
+  *self = mp_resume_as_once(p);
+  // ... and resume `q` in tail position of the parent
+  mp_trace(MP_TRACE_RESUME, q, 1);
+  mp_resume_point_t* qres = mp_prompt_link(q, ret, &sp);
+  ret->transferred = p;                        // `q` completes our resume point (see `mp_prompt_transfer_saved`)
+  qres->result = arg;
+  mp_check_resume_point(sp, qres);
+  mp_prompt_switch_start();                    // a single switch from `p` to (the top of) `q`
+  mp_stack_switch(&res.jmp, &qres->jmp);
+  //mp_resume_to_label:
+  // T: resuming with a result (from PR or another transfer)
+  mp_assert_internal(mp_prompt_is_active(p));  
+  mp_assert_internal(mp_prompt_is_ancestor(p));
+  mp_prompt_return_saved(p);
+  mp_debug_asan_end_switch(p->parent==NULL);
+  return res.result;
+}
+
+
+
+// Learn all code labels before any other prompt runs: a probe prompt yields (learning the initial 
+// entry and `mp_resume_label`), and a second probe transfers to it (learning `mp_resume_to_label`) 
+// and is resumed afterwards (learning `mp_return_switch_label`).
+static void* mp_labels_probe_suspend(mp_resume_t* r, void* arg) {
+  MP_UNUSED(arg);
+  return r;
+}
+
+static void* mp_labels_probe(mp_prompt_t* p, void* arg) {
+  return mp_yield(p, &mp_labels_probe_suspend, arg);
 }
 
+static void* mp_labels_probe_transfer(mp_prompt_t* p, void* envarg) {
+  mp_resume_to_env_t* env = (mp_resume_to_env_t*)envarg;
+  return mp_resume_to(p, env->target, env->arg, env->self);
+}
+
+static void mp_labels_init(void) {
+  if (mp_return_switch_label != NULL) return;
+  mp_resume_t* self = NULL;
+  mp_resume_to_env_t env = { (mp_resume_t*)mp_prompt(&mp_labels_probe, NULL), NULL, &self };
+  mp_prompt(&mp_labels_probe_transfer, &env);  // returns from the first probe
+  mp_resume(self, NULL);
+  mp_assert_internal(mp_resume_label != NULL && mp_resume_to_label != NULL && mp_return_switch_label != NULL);
+}
 
 
 //-----------------------------------------------------------------------
@@ -531,18 +847,29 @@ void* mp_yield(mp_prompt_t* p, mp_yield_fun_t* fun, void* arg) {
 //-----------------------------------------------------------------------
 
 // Create a multi-shot resumption from a single-shot one
-mp_resume_t* mp_resume_multi(mp_resume_t* once) {
+static mp_resume_t* mp_resume_multi_in(mp_resume_t* once, mp_scope_t* scope) {
   mp_prompt_t* p = mp_resume_is_once(once);
   if (p == NULL) return once; // already multi-shot
-  mp_mresume_t* r = mp_malloc_safe_tp(mp_mresume_t);
+  mp_mresume_t* r = (mp_mresume_t*)mp_arena_alloc_in(scope, sizeof(mp_mresume_t));  // from the save arena (or scope) to avoid malloc
   r->prompt = p;
   r->refcount = 1;
   r->resume_count = 0;
   r->save = NULL;
   r->tail_return_point = p->return_point;
+  r->scope = scope;
   return mp_resume_as_multi(r);
 }
 
+mp_resume_t* mp_resume_multi(mp_resume_t* once) {
+  return mp_resume_multi_in(once, NULL);
+}
+
+// Create a multi-shot resumption that is only resumed and dropped within `scope`.
+// Its saved stacks are allocated in the scope as well and released by `mp_scope_done`.
+mp_resume_t* mp_resume_multi_scoped(mp_resume_t* once, mp_scope_t* scope) {
+  return mp_resume_multi_in(once, scope);
+}
+
 // Increment the reference count of a resumption.
 static mp_mresume_t* mp_mresume_dup(mp_mresume_t* r) {
   r->refcount++;  
@@ -559,28 +886,28 @@ static void mp_mresume_drop(mp_mresume_t* r) {
       mp_prompt_save_t* next = s->next;
       mp_prompt_t* p = s->prompt;
       mp_gsave_free(s->gsave);
-      mp_free(s);
+      mp_arena_free(s);
       mp_prompt_drop(p);
       s = next;
     }
     mp_prompt_drop(r->prompt);
     //mp_trace_message("free resume: %p\n", r);
-    mp_free(r);
+    mp_arena_free(r);
   }
 }
 
 
-// Save a full prompt chain started at `p`
-static mp_prompt_save_t* mp_prompt_save(mp_prompt_t* p) {
+// Save a full prompt chain started at `p` (allocated in `scope` if not NULL)
+static mp_prompt_save_t* mp_prompt_save(mp_prompt_t* p, mp_scope_t* scope) {
   mp_assert_internal(!mp_prompt_is_active(p));  
   mp_prompt_save_t* savep = NULL;
   uint8_t* sp = (uint8_t*)p->resume_point->jmp.reg_sp;
   p = p->top;
   do {
-    mp_prompt_save_t* save = mp_malloc_tp(mp_prompt_save_t);
+    mp_prompt_save_t* save = (mp_prompt_save_t*)mp_arena_alloc_in(scope, sizeof(mp_prompt_save_t));
     save->prompt = mp_prompt_dup(p);
     save->next = savep;
-    save->gsave = mp_gstack_save(p->gstack,sp);
+    save->gsave = mp_gstack_save(p->gstack,sp,scope);
     savep = save;
     sp = (uint8_t*)(p->parent == NULL ? NULL : p->return_point->jmp.reg_sp);  // set to parent's sp
     p = p->parent;    
@@ -609,7 +936,7 @@ static mp_prompt_t* mp_resume_get_prompt(mp_mresume_t* r) {
     mp_prompt_restore(p, r->save);
   }
   else if (r->refcount > 1 || p->refcount > 1) {
-    r->save = mp_prompt_save(p);
+    r->save = mp_prompt_save(p, r->scope);
   }
   mp_prompt_dup(p);
   mp_mresume_drop(r);
@@ -620,6 +947,7 @@ static mp_prompt_t* mp_resume_get_prompt(mp_mresume_t* r) {
 // Resume with a regular resumption (and consumes `r` so dup if it needs to used later on)
 static void* mp_mresume(mp_mresume_t* r, void* arg) {
   r->resume_count++;
+  mp_stat_inc(resumes_multi);
   mp_prompt_t* p = mp_resume_get_prompt(r);
   return mp_prompt_resume(p, arg);  // set a fresh prompt 
 }
@@ -627,20 +955,56 @@ static void* mp_mresume(mp_mresume_t* r, void* arg) {
 // Resume in tail position 
 // Note: this only works if all earlier resumes were in-scope -- which should hold
 // or otherwise the tail resumption wasn't in tail position anyways.
+// A scoped resumption is only resumed in tail position if this is its last use; in that 
+// case the scope is done as we never return to its owner.
 static void* mp_mresume_tail(mp_mresume_t* r, void* arg) {
   mp_return_point_t* ret = r->tail_return_point;
-  if (ret == NULL) {
+  mp_scope_t* scope = r->scope;
+  if (ret == NULL || (scope != NULL && r->refcount > 1)) {
     return mp_mresume(r, arg);  // resume normally as the return_point may not be preserved correctly
   }
   else {
     r->tail_return_point = NULL;                    // todo: do we need `sp` as well?
     r->resume_count++;
+    mp_stat_inc(resumes_multi);
     mp_prompt_t* p = mp_resume_get_prompt(r);       
+    if (scope != NULL) { mp_scope_done(scope); }
     return mp_prompt_resume_tail(p, arg, ret);      // resume tail by reusing the original entry return point
   }
 }
 
 
+//-----------------------------------------------------------------------
+// Migrating suspended prompt chains between threads
+//-----------------------------------------------------------------------
+
+// The prompt at the root of a suspended prompt chain
+static mp_prompt_t* mp_resume_prompt(mp_resume_t* resume) {
+  mp_prompt_t* p = mp_resume_is_once(resume);
+  return (mp_likely(p != NULL) ? p : mp_resume_is_multi(resume)->prompt);
+}
+
+// Detach a resumption from the current thread such that it can be resumed (or dropped) in another thread.
+// The gstacks of the prompt chain return to the cache of the current thread when they are freed elsewhere.
+void mp_resume_detach(mp_resume_t* resume) {
+  mp_prompt_t* p = mp_resume_prompt(resume);
+  mp_assert(!mp_prompt_is_active(p));
+  for (mp_prompt_t* q = p->top; q != NULL; q = q->parent) {
+    mp_gstack_detach(q->gstack);
+  }
+}
+
+// Attach a resumption that was detached in another thread to the current thread.
+// Once attached, it can be used as any other resumption (and resumed, dup'd, or dropped).
+void mp_resume_attach(mp_resume_t* resume) {
+  mp_prompt_t* p = mp_resume_prompt(resume);
+  mp_assert(!mp_prompt_is_active(p));
+  for (mp_prompt_t* q = p->top; q != NULL; q = q->parent) {
+    mp_gstack_attach(q->gstack);
+  }
+}
+
+
 //-----------------------------------------------------------------------
 // Backtrace
 //-----------------------------------------------------------------------
@@ -758,6 +1122,87 @@ int mp_backtrace(void** bt, int len) {
 
 #endif
 
+
+//-----------------------------------------------------------------------
+// Frame pointer backtrace
+// Walk the frame pointer chain and step over each prompt boundary using the
+// frame pointer saved in the return point of the prompt. This never switches 
+// stacks, allocates, or locks, and is async-signal-safe (when called in the 
+// thread whose stack is walked). Each frame is checked against the gstack of
+// its prompt, and on the system stack we use the usual heuristic that frames 
+// only grow upward by a bounded size. Without frame pointers (see `MP_FRAME_POINTERS`)
+// backtraces are truncated (or may skip frames up to the next prompt boundary).
+//-----------------------------------------------------------------------
+
+#define MP_BACKTRACE_MAX_FRAME  (128*1024)   // maximal frame size on the system stack
+
+// A frame record is the saved frame pointer followed by the return address
+typedef struct mp_frame_s {
+  struct mp_frame_s* parent;
+  void*              ret;
+} mp_frame_t;
+
+// Is `fp` a plausible frame above `sp` on the stack of prompt `p` (or the system stack if `p == NULL`)?
+static bool mp_frame_is_valid(mp_prompt_t* p, const uint8_t* sp, const mp_frame_t* fp) {
+  if (fp == NULL || ((uintptr_t)fp % sizeof(void*)) != 0 || (const uint8_t*)fp < sp) return false;
+  if (p != NULL) {
+    // only read committed memory as a fault on another gstack would not be handled (and loop in a signal handler)
+    return (p->gstack != NULL && mp_gstack_contains_committed(p->gstack, (const uint8_t*)fp) &&
+            mp_gstack_contains_committed(p->gstack, (const uint8_t*)fp + sizeof(mp_frame_t) - 1));
+  }
+  else {
+    return ((const uint8_t*)fp - sp < MP_BACKTRACE_MAX_FRAME);
+  }
+}
+
+int mp_backtrace_fp_from(void* ip, void* sp, void* fp, void** bt, int len) {
+  int n = 0;
+  if (len <= 0) return 0;
+  if (ip != NULL) bt[n++] = ip;
+  // find the prompt that we are running on
+  mp_prompt_t* p = mp_prompt_top();
+  while (p != NULL && (p->gstack == NULL || !mp_gstack_contains(p->gstack, (const uint8_t*)fp))) {
+    p = p->parent;
+  }
+  mp_frame_t* frame = (mp_frame_t*)fp;
+  if (!mp_frame_is_valid(p, (const uint8_t*)sp, frame)) return n;
+  while (n < len && frame->ret != NULL) {
+    bt[n++] = frame->ret;
+    mp_frame_t* parent = frame->parent;
+    if (mp_frame_is_valid(p, (const uint8_t*)(frame + 1), parent)) {
+      frame = parent;
+    }
+    else if (p != NULL && p->return_point != NULL && n < len) {
+      // continue in the parent at the return point (note: the chain of the entry frame is stale)
+      const mp_jmpbuf_t* jmp = &p->return_point->jmp;
+      p = p->parent;
+      bt[n++] = jmp->reg_ip;
+      parent = (mp_frame_t*)mp_jmpbuf_fp(jmp);
+      if (!mp_frame_is_valid(p, (const uint8_t*)jmp->reg_sp, parent)) break;
+      frame = parent;
+    }
+    else {
+      break;
+    }
+  }
+  return n;
+}
+
+#if defined(__GNUC__)
+mp_decl_noinline int mp_backtrace_fp(void** bt, int len) {
+  // start at our return address
+  mp_frame_t* frame = (mp_frame_t*)__builtin_frame_address(0);
+  int n = mp_backtrace_fp_from(NULL, frame, frame, bt, len);
+  __asm__ volatile ("" : : "r"(n) : "memory");  // no tail call as that would release our frame
+  return n;
+}
+#else
+int mp_backtrace_fp(void** bt, int len) {
+  MP_UNUSED(bt); MP_UNUSED(len);
+  return 0;   // msvc does not maintain frame pointer chains
+}
+#endif
+
 /*
 void mp_gstack_win_test(mp_gstack_t* g);
 void* win_test(mp_prompt_t* p, void* arg) {
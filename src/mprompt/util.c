@@ -12,6 +12,8 @@
 
 #include "mprompt.h"
 #include "internal/util.h"
+#include "internal/atomic.h"
+#include "internal/trace.h"
 
 
 // Abstract over output and error handlers
@@ -54,6 +56,13 @@ static void mp_vfprintf( mp_output_fun* out, const char* prefix, const char* fmt
   mp_fputs(out, prefix,buf);
 }
 
+static void mp_vfprintf_args(mp_output_fun* out, const char* prefix, const char* fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  mp_vfprintf(out, prefix, fmt, args);
+  va_end(args);
+}
+
 #ifndef NDEBUG
 static void mp_show_trace_message(const char* fmt, va_list args) {
   mp_vfprintf( mp_output_handler, "libmprompt: trace: ", fmt, args);
@@ -153,6 +162,203 @@ mp_decl_noreturn void mp_unreachable(const char* msg) {
 }
 
 
+/* ----------------------------------------------------------------------------
+  Statistics
+  Each thread has its own counters that are registered in a global list 
+  when the thread is initialized. On termination the counters are merged
+  into `mp_stats_done`. The list is protected by a simple spin lock as it
+  is only used on thread initialization/termination and when statistics are requested.
+-----------------------------------------------------------------------------*/
+
+typedef struct mp_stats_link_s {
+  mp_stats_t*             stats;
+  struct mp_stats_link_s* next;
+  struct mp_stats_link_s* prev;
+} mp_stats_link_t;
+
+mp_decl_thread mp_stats_t _mp_stats;
+static mp_decl_thread mp_stats_link_t _mp_stats_link;   // registered if `stats != NULL`
+
+static mp_stats_link_t*  mp_stats_threads;   // registered threads
+static mp_stats_t        mp_stats_done;      // merged counters of terminated threads
+static _Atomic(uintptr_t) mp_stats_lock_flag;
+
+static void mp_stats_lock(void) {
+  uintptr_t expected = 0;
+  while (!mp_atomic_cas(&mp_stats_lock_flag, &expected, (uintptr_t)1)) {
+    expected = 0;
+    mp_atomic_yield();
+  }
+}
+
+static void mp_stats_unlock(void) {
+  mp_atomic_store(&mp_stats_lock_flag, (uintptr_t)0);
+}
+
+#define MP_STATS_COUNT  (sizeof(mp_stats_t) / sizeof(int64_t))
+
+static void mp_stats_merge(mp_stats_t* stats, const mp_stats_t* src) {
+  int64_t* dst = (int64_t*)stats;
+  const int64_t* s = (const int64_t*)src;
+  for (size_t i = 0; i < MP_STATS_COUNT; i++) {
+    dst[i] += s[i];
+  }
+}
+
+void mp_stats_thread_init(void) {
+  mp_stats_link_t* link = &_mp_stats_link;
+  if (link->stats != NULL) return;
+  link->stats = &_mp_stats;
+  link->prev = NULL;
+  mp_stats_lock();
+  link->next = mp_stats_threads;
+  if (mp_stats_threads != NULL) mp_stats_threads->prev = link;
+  mp_stats_threads = link;
+  mp_stats_unlock();
+}
+
+void mp_stats_thread_done(void) {
+  mp_stats_link_t* link = &_mp_stats_link;
+  mp_stats_lock();
+  if (link->stats != NULL) {
+    if (link->prev != NULL) { link->prev->next = link->next; }
+                       else { mp_stats_threads = link->next; }
+    if (link->next != NULL) { link->next->prev = link->prev; }
+    link->stats = NULL;
+  }
+  mp_stats_merge(&mp_stats_done, &_mp_stats);
+  memset(&_mp_stats, 0, sizeof(_mp_stats));
+  mp_stats_unlock();
+}
+
+mp_stats_t mp_stats_get(void) {
+  mp_stats_t stats;
+  mp_stats_lock();
+  stats = mp_stats_done;
+  for (mp_stats_link_t* link = mp_stats_threads; link != NULL; link = link->next) {
+    mp_stats_merge(&stats, link->stats);
+  }
+  if (_mp_stats_link.stats == NULL) {
+    mp_stats_merge(&stats, &_mp_stats);  // current thread is not registered (yet)
+  }
+  mp_stats_unlock();
+  return stats;
+}
+
+static void mp_stats_print_line(const char* name, int64_t value, const char* unit) {
+  mp_vfprintf_args(mp_output_handler, "libmprompt: stats: ", "%-20s: %12lld %s\n", name, (long long)value, unit);
+}
+
+void mp_stats_print(void) {
+  const mp_stats_t stats = mp_stats_get();
+  const int64_t cache_rate = (stats.gstack_allocs <= 0 ? 0 : (100 * stats.gstack_cache_hits) / stats.gstack_allocs);
+  mp_stats_print_line("prompts created", stats.prompts_created, "");
+  mp_stats_print_line("yields", stats.yields, "");
+  mp_stats_print_line("resumes", stats.resumes, "");
+  mp_stats_print_line("resumes tail", stats.resumes_tail, "");
+  mp_stats_print_line("resumes multi", stats.resumes_multi, "");
+  mp_stats_print_line("gstack allocs", stats.gstack_allocs, "");
+  mp_stats_print_line("gstack cache hits", stats.gstack_cache_hits, "");
+  mp_stats_print_line("gstack cache rate", cache_rate, "%");
+  mp_stats_print_line("gstack gpool allocs", stats.gstack_gpool_allocs, "");
+  mp_stats_print_line("gstack huge pages", stats.gstack_huge_pages, "");
+  mp_stats_print_line("gpool numa binds", stats.gpool_numa_binds, "");
+  mp_stats_print_line("gpool compacts", stats.gpool_compacts, "");
+  mp_stats_print_line("gstack os frees", stats.gstack_os_frees, "");
+  mp_stats_print_line("gstack delayed frees", stats.gstack_delayed_frees, "");
+  mp_stats_print_line("gstack remote frees", stats.gstack_remote_frees, "");
+  mp_stats_print_line("gstack bg resets", stats.gstack_background_resets, "");
+  mp_stats_print_line("gstack reclaims", stats.gstack_reclaims, "");
+  mp_stats_print_line("page faults", stats.page_faults, "");
+  mp_stats_print_line("uffd faults", stats.uffd_faults, "");
+  mp_stats_print_line("track faults", stats.track_faults, "");
+  mp_stats_print_line("committed", stats.committed / MP_KIB, "KiB");
+  mp_stats_print_line("reserved", stats.reserved / MP_KIB, "KiB");
+  mp_stats_print_line("saves", stats.saves, "");
+  mp_stats_print_line("saves shared", stats.saves_shared, "");
+  mp_stats_print_line("save bytes", stats.save_bytes / MP_KIB, "KiB");
+  mp_stats_print_line("restore bytes", stats.restore_bytes / MP_KIB, "KiB");
+  mp_stats_print_line("restores skipped", stats.restores_skipped, "");
+}
+
+
+/* ----------------------------------------------------------------------------
+  Stack profiles (see `mp_config_t.stack_profile`)
+-----------------------------------------------------------------------------*/
+
+void mp_stack_profile_print(void) {
+  mp_stack_profile_t profiles[64];
+  const ptrdiff_t n = mp_stack_profile_get(profiles, 64);
+  for (ptrdiff_t i = 0; i < n; i++) {
+    const mp_stack_profile_t* sp = &profiles[i];
+    mp_vfprintf_args(mp_output_handler, "libmprompt: stack: ", "site %p: %lld gstacks, average %lld KiB, max %lld KiB, committed max %lld KiB%s\n",
+                     sp->site, (long long)sp->count, (long long)(sp->used_total / sp->count / MP_KIB),
+                     (long long)(sp->used_max / MP_KIB), (long long)(sp->committed_max / MP_KIB),
+                     (sp->truncated > 0 ? " (truncated)" : ""));
+    for (int b = 0; b < MP_STACK_PROFILE_BUCKETS; b++) {
+      if (sp->histogram[b] == 0) continue;
+      const long long percent = (long long)((100 * sp->histogram[b]) / sp->count);
+      char bar[52];
+      const int len = (int)(percent / 2);
+      memset(bar, '#', (size_t)len);
+      bar[len] = 0;
+      if (b < MP_STACK_PROFILE_BUCKETS - 1) {
+        mp_vfprintf_args(mp_output_handler, "libmprompt: stack: ", "  <= %5lld KiB: %10lld %3lld%% %s\n", (long long)(1LL << b), (long long)sp->histogram[b], percent, bar);
+      }
+      else {
+        mp_vfprintf_args(mp_output_handler, "libmprompt: stack: ", "   > %5lld KiB: %10lld %3lld%% %s\n", (long long)(1LL << (b-1)), (long long)sp->histogram[b], percent, bar);
+      }
+    }
+  }
+}
+
+
+/* ----------------------------------------------------------------------------
+  Trace events (see `internal/trace.h`)
+-----------------------------------------------------------------------------*/
+
+#if MP_TRACE
+mp_decl_thread mp_trace_buffer_t _mp_trace_buffer;
+#endif
+
+ptrdiff_t mp_trace_events(mp_trace_event_t* events, ptrdiff_t max) {
+#if MP_TRACE
+  const uint64_t count = _mp_trace_buffer.count;
+  ptrdiff_t n = (count < MP_TRACE_SIZE ? (ptrdiff_t)count : MP_TRACE_SIZE);
+  if (n > max) n = max;
+  if (n <= 0 || events == NULL) return 0;
+  for (ptrdiff_t i = 0; i < n; i++) {
+    events[i] = _mp_trace_buffer.events[(count - (uint64_t)n + (uint64_t)i) & (MP_TRACE_SIZE - 1)];
+  }
+  return n;
+#else
+  MP_UNUSED(events); MP_UNUSED(max);
+  return 0;
+#endif
+}
+
+const char* mp_trace_kind_name(mp_trace_kind_t kind) {
+  static const char* names[MP_TRACE_KIND_COUNT] = {
+    "prompt enter", "yield", "resume", "gstack alloc", "gstack free", "gstack save", "page fault", "track fault"
+  };
+  return ((int)kind >= 0 && kind < MP_TRACE_KIND_COUNT ? names[kind] : "unknown");
+}
+
+void mp_trace_print(void) {
+#if MP_TRACE
+  mp_trace_event_t events[64];
+  const ptrdiff_t n = mp_trace_events(events, 64);
+  const uint64_t start = (n > 0 ? events[0].time : 0);
+  for (ptrdiff_t i = 0; i < n; i++) {
+    mp_vfprintf_args(mp_output_handler, "libmprompt: trace: ", "+%-12llu %-13s %p %lld\n",
+                     (unsigned long long)(events[i].time - start), mp_trace_kind_name(events[i].kind), events[i].obj, (long long)events[i].arg);
+  }
+#else
+  mp_vfprintf_args(mp_output_handler, "libmprompt: trace: ", "not enabled (compile with MP_TRACE)\n");
+#endif
+}
+
+
 /* ----------------------------------------------------------------------------
   Guard cookie
   To get an initial secure random context we rely on the OS:
@@ -0,0 +1,12 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+
+  Include all sources in one file for compilation for better optimization
+-----------------------------------------------------------------------------*/
+
+#include "mpsched.c"
+#include "mpchan.c"
+#include "../mprompt/main.c"
@@ -0,0 +1,439 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/* ----------------------------------------------------------------------------
+  Bounded channels between tasks (included from `main.c` after `mpsched.c`).
+
+  A task that cannot make progress (sending to a full channel or receiving
+  from an empty one) suspends with a once-resumption that is parked in the
+  task (`mps_task_suspended`), and registers a waiter record (that lives on
+  its own suspended gstack) with the channel. The peer wakes the waiter by
+  scheduling the task again.
+
+  There are two variants:
+  - `MPS_CHAN_LOCAL` channels are only used from a single thread and use
+    plain loads and stores.
+  - `MPS_CHAN_MPSC` channels allow any number of senders on any thread and are
+    lock-free. The items are a Vyukov bounded queue, waiting senders are a
+    Treiber stack that the receiver takes as a whole, and the receiver is a
+    single slot. A waiter always re-checks the channel after registering (and
+    a peer checks for waiters after updating the channel) so wake-ups are never lost.
+    A waiter is not scheduled while its `state` is still registering: it resumes
+    itself instead, so the task cannot run (and free the channel) while it still
+    re-checks the channel.
+    A receiver in `mps_chan_select` is registered with several channels at once;
+    its `state` ensures it is woken only once, and its `pending` count ensures it
+    (and its gstack) stays alive until all senders that took it from a channel are done with it.
+-----------------------------------------------------------------------------*/
+
+
+/*-----------------------------------------------------------------
+  Types
+-----------------------------------------------------------------*/
+
+// States of an (mpsc) waiter
+#define MPS_WAIT_REGISTERING  (0)   // being registered with its channels
+#define MPS_WAIT_ARMED        (1)   // suspended and registered
+#define MPS_WAIT_FIRED        (2)   // woken up
+
+typedef struct mps_waiter_s {
+  mps_task_t*           task;
+  struct mps_waiter_s*  next;       // in the list of waiting senders
+  bool                  fired;      // (local) receiver is woken up
+  _Atomic(intptr_t)     state;      // (mpsc) waiter state `MPS_WAIT_xxx`
+  _Atomic(intptr_t)     pending;    // (mpsc) number of channels that can still access the receiver
+} mps_waiter_t;
+
+// A slot in the mpsc queue
+typedef struct mps_chan_slot_s {
+  _Atomic(intptr_t)     seq;
+  void*                 value;
+} mps_chan_slot_t;
+
+struct mps_chan_s {
+  mps_chan_kind_t       kind;
+  intptr_t              mask;           // capacity - 1
+  intptr_t              head;           // next item to receive (only used by the receiver)
+
+  // local
+  intptr_t              count;
+  void**                items;
+  mps_waiter_t*         recv_waiter;
+  mps_waiter_t*         send_first;     // FIFO queue of waiting senders
+  mps_waiter_t*         send_last;
+  bool                  closed;
+
+  // mpsc
+  mps_chan_slot_t*      slots;
+  _Atomic(intptr_t)     tail;
+  _Atomic(mps_waiter_t*) mrecv_waiter;
+  _Atomic(mps_waiter_t*) msend_waiters; // stack of waiting senders
+  _Atomic(intptr_t)     mclosed;
+};
+
+
+/*-----------------------------------------------------------------
+  Create
+-----------------------------------------------------------------*/
+
+mps_chan_t* mps_chan_create(size_t capacity, mps_chan_kind_t kind) {
+  if (kind == MPS_CHAN_LOCAL && mps_thread_count() > 1) {
+    mps_fatal("a local channel can only be used in a single threaded scheduler");
+  }
+  intptr_t cap = 2;   // the mpsc queue needs at least 2 slots
+  while ((size_t)cap < capacity) { cap *= 2; }
+  mps_chan_t* ch = mps_zalloc_tp(mps_chan_t);
+  ch->kind = kind;
+  ch->mask = cap - 1;
+  if (kind == MPS_CHAN_LOCAL) {
+    ch->items = mps_zalloc_n_tp(void*, (size_t)cap);
+  }
+  else {
+    ch->slots = mps_zalloc_n_tp(mps_chan_slot_t, (size_t)cap);
+    for (intptr_t i = 0; i < cap; i++) {
+      mp_atomic_store(&ch->slots[i].seq, i);
+    }
+    mp_atomic_store(&ch->tail, (intptr_t)0);
+    mp_atomic_store_ptr(mps_waiter_t, &ch->mrecv_waiter, NULL);
+    mp_atomic_store_ptr(mps_waiter_t, &ch->msend_waiters, NULL);
+    mp_atomic_store(&ch->mclosed, (intptr_t)0);
+  }
+  return ch;
+}
+
+void mps_chan_free(mps_chan_t* ch) {
+  if (ch == NULL) return;
+  mps_free(ch->items);
+  mps_free(ch->slots);
+  mps_free(ch);
+}
+
+
+/*-----------------------------------------------------------------
+  Local channels
+-----------------------------------------------------------------*/
+
+static void mps_lchan_wake_receiver(mps_chan_t* ch) {
+  mps_waiter_t* wt = ch->recv_waiter;
+  if (wt == NULL) return;
+  ch->recv_waiter = NULL;
+  if (!wt->fired) {
+    wt->fired = true;
+    mps_task_schedule(mps_worker_current(), wt->task);
+  }
+}
+
+static void mps_lchan_wake_sender(mps_chan_t* ch) {
+  mps_waiter_t* wt = ch->send_first;
+  if (wt == NULL) return;
+  ch->send_first = wt->next;
+  if (ch->send_first == NULL) ch->send_last = NULL;
+  mps_task_schedule(mps_worker_current(), wt->task);
+}
+
+static void* mps_lchan_park_fun(mp_resume_t* r, void* arg) {
+  mps_waiter_t* wt = (mps_waiter_t*)arg;
+  mps_task_suspended(wt->task, r);
+  return NULL;
+}
+
+static bool mps_lchan_send(mps_chan_t* ch, void* value) {
+  while (!ch->closed && ch->count > ch->mask) {
+    // full: wait at the end of the sender queue
+    mps_waiter_t wt;
+    wt.task = mps_worker_current_safe()->current;
+    wt.next = NULL;
+    if (ch->send_last == NULL) { ch->send_first = &wt; }
+                          else { ch->send_last->next = &wt; }
+    ch->send_last = &wt;
+    mp_yield(wt.task->prompt, &mps_lchan_park_fun, &wt);
+  }
+  if (ch->closed) return false;
+  ch->items[(ch->head + ch->count) & ch->mask] = value;
+  ch->count++;
+  mps_lchan_wake_receiver(ch);
+  return true;
+}
+
+static bool mps_lchan_try_recv(mps_chan_t* ch, void** value) {
+  if (ch->count == 0) return false;
+  *value = ch->items[ch->head & ch->mask];
+  ch->head++;
+  ch->count--;
+  mps_lchan_wake_sender(ch);
+  return true;
+}
+
+static ptrdiff_t mps_lchan_select(mps_chan_t** chans, size_t count, void** value) {
+  for (;;) {
+    bool open = false;
+    for (size_t i = 0; i < count; i++) {
+      if (mps_lchan_try_recv(chans[i], value)) return (ptrdiff_t)i;
+      if (!chans[i]->closed) open = true;
+    }
+    if (!open) return -1;
+    // register with all open channels and wait
+    mps_waiter_t wt;
+    wt.task = mps_worker_current_safe()->current;
+    wt.next = NULL;
+    wt.fired = false;
+    for (size_t i = 0; i < count; i++) {
+      mps_assert(chans[i]->recv_waiter == NULL);  // at most one receiver
+      if (!chans[i]->closed) chans[i]->recv_waiter = &wt;
+    }
+    mp_yield(wt.task->prompt, &mps_lchan_park_fun, &wt);
+    for (size_t i = 0; i < count; i++) {
+      if (chans[i]->recv_waiter == &wt) chans[i]->recv_waiter = NULL;
+    }
+  }
+}
+
+static void mps_lchan_close(mps_chan_t* ch) {
+  ch->closed = true;
+  mps_lchan_wake_receiver(ch);
+  while (ch->send_first != NULL) {
+    mps_lchan_wake_sender(ch);
+  }
+}
+
+
+/*-----------------------------------------------------------------
+  Multi-producer channels: queue
+-----------------------------------------------------------------*/
+
+static bool mps_mchan_try_push(mps_chan_t* ch, void* value) {
+  intptr_t pos = mp_atomic_load(&ch->tail);
+  for (;;) {
+    mps_chan_slot_t* slot = &ch->slots[pos & ch->mask];
+    intptr_t diff = mp_atomic_load(&slot->seq) - pos;
+    if (diff == 0) {
+      if (mp_atomic_cas(&ch->tail, &pos, pos + 1)) {
+        slot->value = value;
+        mp_atomic_store(&slot->seq, pos + 1);  // publish
+        return true;
+      }
+    }
+    else if (diff < 0) {
+      return false;  // full
+    }
+    else {
+      pos = mp_atomic_load(&ch->tail);
+    }
+  }
+}
+
+// Only called by the receiver
+static bool mps_mchan_try_pop(mps_chan_t* ch, void** value) {
+  const intptr_t pos = ch->head;
+  mps_chan_slot_t* slot = &ch->slots[pos & ch->mask];
+  if (mp_atomic_load(&slot->seq) != pos + 1) return false;  // empty (or the value is not yet published)
+  *value = slot->value;
+  mp_atomic_store(&slot->seq, pos + ch->mask + 1);         // release the slot
+  ch->head = pos + 1;
+  return true;
+}
+
+static bool mps_mchan_is_full(mps_chan_t* ch) {
+  intptr_t pos = mp_atomic_load(&ch->tail);
+  return (mp_atomic_load(&ch->slots[pos & ch->mask].seq) - pos < 0);
+}
+
+static bool mps_mchan_has_value(mps_chan_t* ch) {
+  return (mp_atomic_load(&ch->slots[ch->head & ch->mask].seq) == ch->head + 1);
+}
+
+
+/*-----------------------------------------------------------------
+  Multi-producer channels: waiting
+-----------------------------------------------------------------*/
+
+// Wake up the receiver; we cannot access `wt` anymore after decrementing `pending`
+static void mps_mchan_wake_receiver(mps_chan_t* ch) {
+  mps_waiter_t* wt = mp_atomic_load_ptr(mps_waiter_t, &ch->mrecv_waiter);
+  if (mps_likely(wt == NULL)) return;
+  while (!mp_atomic_cas_ptr(mps_waiter_t, &ch->mrecv_waiter, &wt, NULL)) { /* nothing */ };
+  if (wt == NULL) return;
+  intptr_t state = mp_atomic_load(&wt->state);
+  while (state != MPS_WAIT_FIRED) {
+    if (mp_atomic_cas(&wt->state, &state, (intptr_t)MPS_WAIT_FIRED)) {
+      // if it was still registering, the receiver notices and resumes itself
+      if (state == MPS_WAIT_ARMED) mps_task_schedule(mps_worker_current(), wt->task);
+      break;
+    }
+  }
+  mp_atomic_add(&wt->pending, (intptr_t)-1);
+}
+
+// Wake up all waiting senders (they retry and may wait again)
+static void mps_mchan_wake_senders(mps_chan_t* ch) {
+  mps_waiter_t* wt = mp_atomic_load_ptr(mps_waiter_t, &ch->msend_waiters);
+  if (mps_likely(wt == NULL)) return;
+  while (!mp_atomic_cas_ptr(mps_waiter_t, &ch->msend_waiters, &wt, NULL)) { /* nothing */ };
+  mps_worker_t* w = mps_worker_current();
+  while (wt != NULL) {
+    mps_waiter_t* next = wt->next;  // read before `wt` can resume
+    intptr_t state = mp_atomic_load(&wt->state);
+    while (!mp_atomic_cas(&wt->state, &state, (intptr_t)MPS_WAIT_FIRED)) { /* nothing */ };
+    // if it was still registering, the sender notices and resumes itself
+    if (state == MPS_WAIT_ARMED) mps_task_schedule(w, wt->task);
+    wt = next;
+  }
+}
+
+typedef struct mps_mchan_send_env_s {
+  mps_chan_t*    chan;
+  mps_waiter_t*  waiter;
+} mps_mchan_send_env_t;
+
+static void* mps_mchan_send_park_fun(mp_resume_t* r, void* arg) {
+  mps_mchan_send_env_t* env = (mps_mchan_send_env_t*)arg;
+  mps_chan_t* ch = env->chan;
+  mps_waiter_t* wt = env->waiter;
+  mps_task_suspended(wt->task, r);
+  // register; receivers cannot schedule us while we are registering (so the channel stays alive)
+  wt->next = mp_atomic_load_ptr(mps_waiter_t, &ch->msend_waiters);
+  while (!mp_atomic_cas_ptr(mps_waiter_t, &ch->msend_waiters, &wt->next, wt)) { /* nothing */ };
+  if (!mps_mchan_is_full(ch) || mp_atomic_load(&ch->mclosed) != 0) {
+    mps_mchan_wake_senders(ch);  // there is room again; we cannot unregister so wake up all (including ourselves)
+  }
+  intptr_t registering = MPS_WAIT_REGISTERING;
+  if (mp_atomic_cas(&wt->state, &registering, (intptr_t)MPS_WAIT_ARMED)) {
+    return NULL;  // from now on we may already run on another thread
+  }
+  // woken up in the mean time; resume directly
+  wt->task->resume = NULL;
+  return mp_resume_tail(r, NULL);
+}
+
+static bool mps_mchan_send(mps_chan_t* ch, void* value) {
+  for (;;) {
+    if (mp_atomic_load(&ch->mclosed) != 0) return false;
+    if (mps_mchan_try_push(ch, value)) break;
+    // full: wait for the receiver
+    mps_waiter_t wt;
+    wt.task = mps_worker_current_safe()->current;
+    mp_atomic_store(&wt.state, (intptr_t)MPS_WAIT_REGISTERING);
+    mps_mchan_send_env_t env = { ch, &wt };
+    mp_yield(wt.task->prompt, &mps_mchan_send_park_fun, &env);
+  }
+  mps_mchan_wake_receiver(ch);
+  return true;
+}
+
+static bool mps_mchan_try_recv(mps_chan_t* ch, void** value) {
+  if (!mps_mchan_try_pop(ch, value)) return false;
+  mps_mchan_wake_senders(ch);
+  return true;
+}
+
+typedef struct mps_mchan_select_env_s {
+  mps_chan_t**   chans;
+  size_t         count;
+  mps_waiter_t*  waiter;
+} mps_mchan_select_env_t;
+
+static void* mps_mchan_select_park_fun(mp_resume_t* r, void* arg) {
+  mps_mchan_select_env_t* env = (mps_mchan_select_env_t*)arg;
+  mps_waiter_t* wt = env->waiter;
+  mps_task_suspended(wt->task, r);
+  // register with every channel; senders cannot schedule us while we are registering
+  bool ready = false;
+  for (size_t i = 0; i < env->count; i++) {
+    mps_chan_t* ch = env->chans[i];
+    mps_assert(mp_atomic_load_ptr(mps_waiter_t, &ch->mrecv_waiter) == NULL);  // at most one receiver
+    mp_atomic_store_ptr(mps_waiter_t, &ch->mrecv_waiter, wt);
+  }
+  for (size_t i = 0; i < env->count && !ready; i++) {
+    ready = (mps_mchan_has_value(env->chans[i]) || mp_atomic_load(&env->chans[i]->mclosed) != 0);
+  }
+  intptr_t registering = MPS_WAIT_REGISTERING;
+  if (!ready && mp_atomic_cas(&wt->state, &registering, (intptr_t)MPS_WAIT_ARMED)) {
+    return NULL;  // from now on we may already run on another thread
+  }
+  // a value arrived in the mean time; resume directly
+  mp_atomic_store(&wt->state, (intptr_t)MPS_WAIT_FIRED);
+  wt->task->resume = NULL;
+  return mp_resume_tail(r, NULL);
+}
+
+static ptrdiff_t mps_mchan_select(mps_chan_t** chans, size_t count, void** value) {
+  for (;;) {
+    bool open = false;
+    for (size_t i = 0; i < count; i++) {
+      if (mps_mchan_try_recv(chans[i], value)) return (ptrdiff_t)i;
+      if (mp_atomic_load(&chans[i]->mclosed) == 0) open = true;
+    }
+    if (!open) {
+      // closed, but a sender may have published a value just before
+      for (size_t i = 0; i < count; i++) {
+        if (mps_mchan_try_recv(chans[i], value)) return (ptrdiff_t)i;
+      }
+      return -1;
+    }
+    mps_waiter_t wt;
+    wt.task = mps_worker_current_safe()->current;
+    mp_atomic_store(&wt.state, (intptr_t)MPS_WAIT_REGISTERING);
+    mp_atomic_store(&wt.pending, (intptr_t)count);
+    mps_mchan_select_env_t env = { chans, count, &wt };
+    mp_yield(wt.task->prompt, &mps_mchan_select_park_fun, &env);
+    // unregister, and wait for senders that still access the waiter
+    for (size_t i = 0; i < count; i++) {
+      mps_waiter_t* expected = &wt;
+      if (mp_atomic_cas_ptr(mps_waiter_t, &chans[i]->mrecv_waiter, &expected, NULL)) {
+        mp_atomic_add(&wt.pending, (intptr_t)-1);
+      }
+    }
+    while (mp_atomic_load(&wt.pending) > 0) { mp_atomic_yield(); }
+  }
+}
+
+static void mps_mchan_close(mps_chan_t* ch) {
+  mp_atomic_store(&ch->mclosed, (intptr_t)1);
+  mps_mchan_wake_receiver(ch);
+  mps_mchan_wake_senders(ch);
+}
+
+
+/*-----------------------------------------------------------------
+  Interface
+-----------------------------------------------------------------*/
+
+bool mps_chan_send(mps_chan_t* ch, void* value) {
+  if (ch->kind == MPS_CHAN_LOCAL) {
+    return mps_lchan_send(ch, value);
+  }
+  else {
+    return mps_mchan_send(ch, value);
+  }
+}
+
+ptrdiff_t mps_chan_select(mps_chan_t** chans, size_t count, void** value) {
+  mps_assert(count > 0);
+  const mps_chan_kind_t kind = chans[0]->kind;
+  for (size_t i = 1; i < count; i++) {
+    if (chans[i]->kind != kind) mps_fatal("cannot select over channels of a different kind");
+  }
+  if (kind == MPS_CHAN_LOCAL) {
+    return mps_lchan_select(chans, count, value);
+  }
+  else {
+    return mps_mchan_select(chans, count, value);
+  }
+}
+
+bool mps_chan_recv(mps_chan_t* ch, void** value) {
+  return (mps_chan_select(&ch, 1, value) == 0);
+}
+
+void mps_chan_close(mps_chan_t* ch) {
+  if (ch->kind == MPS_CHAN_LOCAL) {
+    mps_lchan_close(ch);
+  }
+  else {
+    mps_mchan_close(ch);
+  }
+}
@@ -0,0 +1,761 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/* ----------------------------------------------------------------------------
+  A work-stealing M:N scheduler on top of multi-prompts.
+
+  Each task runs in its own prompt. A task suspends by yielding up to its
+  prompt where its resumption is stored in the task; the task is then pushed
+  on the local deque of the current thread (`mps_yield`), or registered as the
+  waiter of another task (`mps_await`). Each thread pops tasks from the bottom
+  of its own deque and idle threads steal from the top of the deques of other
+  threads. Since a suspended prompt chain may be resumed on another thread,
+  resumptions are always detached when suspended and attached when resumed.
+-----------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <mprompt.h>
+#include "mpsched.h"
+#include "internal/atomic.h"
+
+
+/*-----------------------------------------------------------------
+  Defines
+-----------------------------------------------------------------*/
+
+#if defined(_MSC_VER)
+#define mps_decl_noinline        __declspec(noinline)
+#define mps_decl_thread          __declspec(thread)
+#elif (defined(__GNUC__) && (__GNUC__>=3))  // includes clang and icc
+#define mps_decl_noinline        __attribute__((noinline))
+#define mps_decl_thread          __thread
+#else
+#define mps_decl_noinline
+#define mps_decl_thread          __thread
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define mps_unlikely(x)          __builtin_expect((x),0)
+#define mps_likely(x)            __builtin_expect((x),1)
+#else
+#define mps_unlikely(x)          (x)
+#define mps_likely(x)            (x)
+#endif
+
+#define mps_assert(x)            assert(x)
+#define mps_assert_internal(x)   mps_assert(x)
+#define mps_zalloc_tp(tp)        (tp*)mps_zalloc_safe(sizeof(tp))
+#define mps_zalloc_n_tp(tp,n)    (tp*)mps_zalloc_safe((n)*sizeof(tp))
+
+
+static inline void* mps_zalloc_safe(size_t size) {
+  void* p = calloc(1, size);
+  if (p != NULL) return p;
+  fprintf(stderr,"out of memory\n");
+  abort();
+}
+
+static inline void mps_free(void* p) {
+  free(p);
+}
+
+static void mps_fatal(const char* msg) {
+  fprintf(stderr, "libmpsched: fatal error: %s\n", msg);
+  abort();
+}
+
+
+/*-----------------------------------------------------------------
+  Types
+-----------------------------------------------------------------*/
+
+typedef struct mps_worker_s mps_worker_t;
+typedef struct mps_sched_s  mps_sched_t;
+
+// `waiter` is NULL while running, a waiting task, or `MPS_TASK_DONE` when finished.
+#define MPS_TASK_DONE  ((mps_task_t*)1)
+
+struct mps_task_s {
+  mps_task_fun_t*       fun;
+  void*                 arg;
+  void*                 result;
+  mp_prompt_t*          prompt;     // set when started
+  mp_resume_t*          resume;     // the (detached) resumption when suspended (NULL if not yet started)
+  _Atomic(mps_task_t*)  waiter;
+};
+
+// Buffer of a work-stealing deque; older buffers are kept alive as they can still be read by thieves.
+typedef struct mps_buffer_s {
+  struct mps_buffer_s*  prev;
+  intptr_t              mask;       // capacity - 1
+  _Atomic(mps_task_t*)  items[1];
+} mps_buffer_t;
+
+// Chase-Lev work-stealing deque. The owner pushes and pops at the bottom, thieves steal at the top.
+// (using sequentially consistent atomics throughout, see: N.M. Lê et al,
+//  "Correct and Efficient Work-Stealing for Weak Memory Models", PPoPP'13)
+typedef struct mps_deque_s {
+  _Atomic(intptr_t)       top;
+  _Atomic(intptr_t)       bottom;
+  _Atomic(mps_buffer_t*)  buffer;
+} mps_deque_t;
+
+struct mps_worker_s {
+  mps_sched_t*  sched;
+  mps_deque_t   deque;
+  mps_task_t*   current;      // currently running task
+  mps_task_t*   yielded;      // task that yielded last
+  uint32_t      rnd;          // random state to pick a victim
+  _Atomic(intptr_t)       runs;     // incremented when a task starts and when it stops running (odd while running)
+  _Atomic(mp_preempt_t*)  preempt;  // preemption flag of the worker thread (set when the worker starts)
+  _Atomic(intptr_t)       preempt_runs;  // `runs` of the task the timer asked to yield
+  intptr_t      timer_runs;   // `runs` at the previous timer tick (only used by the timer thread)
+};
+
+typedef struct mps_monitor_s mps_monitor_t;
+
+struct mps_sched_s {
+  size_t            count;
+  mps_worker_t*     workers;
+  mps_task_t*       root;
+  _Atomic(intptr_t) done;         // set when the root task is done
+  mps_monitor_t*    idle;         // idle workers park here until there is new work
+  _Atomic(intptr_t) parked;       // number of parked workers
+  size_t            time_slice;   // in micro-seconds (0 if preemption is disabled)
+  mps_monitor_t*    timer;        // protects `timer_stop` and `timer_done`
+  bool              timer_stop;   // set when the first worker is done
+  bool              timer_done;   // set when the timer thread stopped (or if there is no timer)
+};
+
+
+/*-----------------------------------------------------------------
+  Threads
+-----------------------------------------------------------------*/
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+typedef HANDLE mps_thread_t;
+
+typedef DWORD (WINAPI mps_thread_fun_t)(LPVOID arg);
+
+static bool mps_thread_create(mps_thread_t* thread, mps_thread_fun_t* fun, void* arg) {
+  *thread = CreateThread(NULL, 0, fun, arg, 0, NULL);
+  return (*thread != NULL);
+}
+
+static void mps_thread_join(mps_thread_t thread) {
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+static void mps_thread_idle(void) {
+  SwitchToThread();
+}
+
+static size_t mps_processor_count(void) {
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  return (size_t)si.dwNumberOfProcessors;
+}
+
+struct mps_monitor_s {
+  SRWLOCK             lock;
+  CONDITION_VARIABLE  cond;
+};
+
+static void mps_monitor_init(mps_monitor_t* m) {
+  InitializeSRWLock(&m->lock);
+  InitializeConditionVariable(&m->cond);
+}
+
+static void mps_monitor_done(mps_monitor_t* m) {
+  (void)(m);
+}
+
+static void mps_monitor_enter(mps_monitor_t* m) {
+  AcquireSRWLockExclusive(&m->lock);
+}
+
+static void mps_monitor_leave(mps_monitor_t* m) {
+  ReleaseSRWLockExclusive(&m->lock);
+}
+
+// Wait until notified or (if `usecs > 0`) a timeout; can wake up spuriously.
+static void mps_monitor_wait(mps_monitor_t* m, size_t usecs) {
+  SleepConditionVariableSRW(&m->cond, &m->lock, (usecs == 0 ? INFINITE : (DWORD)((usecs + 999) / 1000)), 0);
+}
+
+static void mps_monitor_notify_all(mps_monitor_t* m) {
+  WakeAllConditionVariable(&m->cond);
+}
+
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+typedef pthread_t mps_thread_t;
+
+typedef void* (mps_thread_fun_t)(void* arg);
+
+static bool mps_thread_create(mps_thread_t* thread, mps_thread_fun_t* fun, void* arg) {
+  return (pthread_create(thread, NULL, fun, arg) == 0);
+}
+
+static void mps_thread_join(mps_thread_t thread) {
+  pthread_join(thread, NULL);
+}
+
+static void mps_thread_idle(void) {
+  sched_yield();
+}
+
+static size_t mps_processor_count(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n <= 0 ? 1 : (size_t)n);
+}
+
+struct mps_monitor_s {
+  pthread_mutex_t  lock;
+  pthread_cond_t   cond;
+};
+
+static void mps_monitor_init(mps_monitor_t* m) {
+  pthread_mutex_init(&m->lock, NULL);
+  pthread_cond_init(&m->cond, NULL);
+}
+
+static void mps_monitor_done(mps_monitor_t* m) {
+  pthread_cond_destroy(&m->cond);
+  pthread_mutex_destroy(&m->lock);
+}
+
+static void mps_monitor_enter(mps_monitor_t* m) {
+  pthread_mutex_lock(&m->lock);
+}
+
+static void mps_monitor_leave(mps_monitor_t* m) {
+  pthread_mutex_unlock(&m->lock);
+}
+
+// Wait until notified or (if `usecs > 0`) a timeout; can wake up spuriously.
+static void mps_monitor_wait(mps_monitor_t* m, size_t usecs) {
+  if (usecs == 0) {
+    pthread_cond_wait(&m->cond, &m->lock);
+    return;
+  }
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint64_t nsecs = (uint64_t)ts.tv_nsec + (uint64_t)usecs * 1000;
+  ts.tv_sec += (time_t)(nsecs / 1000000000UL);
+  ts.tv_nsec = (long)(nsecs % 1000000000UL);
+  pthread_cond_timedwait(&m->cond, &m->lock, &ts);
+}
+
+static void mps_monitor_notify_all(mps_monitor_t* m) {
+  pthread_cond_broadcast(&m->cond);
+}
+#endif
+
+
+/*-----------------------------------------------------------------
+  Current worker
+-----------------------------------------------------------------*/
+
+static mps_decl_thread mps_worker_t* _mps_worker;
+
+// A task may resume in another thread than where it was suspended but a compiler can
+// reuse the address of a thread-local that was computed before the suspension. We
+// therefore always access the current worker through this non-inlined function.
+static mps_decl_noinline mps_worker_t* mps_worker_current(void) {
+  #if defined(__GNUC__)
+  __asm__ volatile ("");  // prevent the compiler from regarding this function as pure
+  #endif
+  return _mps_worker;
+}
+
+static mps_worker_t* mps_worker_current_safe(void) {
+  mps_worker_t* w = mps_worker_current();
+  if (mps_unlikely(w == NULL || w->current == NULL)) {
+    mps_fatal("trying to use a scheduler operation outside a task");
+  }
+  return w;
+}
+
+
+/*-----------------------------------------------------------------
+  Work-stealing deque
+-----------------------------------------------------------------*/
+
+#define MPS_DEQUE_INITIAL_SIZE  (64)
+
+static mps_buffer_t* mps_buffer_alloc(intptr_t capacity, mps_buffer_t* prev) {
+  mps_buffer_t* buf = (mps_buffer_t*)mps_zalloc_safe(sizeof(mps_buffer_t) + (size_t)(capacity - 1)*sizeof(_Atomic(mps_task_t*)));
+  buf->mask = capacity - 1;
+  buf->prev = prev;
+  return buf;
+}
+
+static void mps_deque_init(mps_deque_t* d) {
+  mp_atomic_store(&d->top, (intptr_t)0);
+  mp_atomic_store(&d->bottom, (intptr_t)0);
+  mp_atomic_store_ptr(mps_buffer_t, &d->buffer, mps_buffer_alloc(MPS_DEQUE_INITIAL_SIZE, NULL));
+}
+
+static void mps_deque_done(mps_deque_t* d) {
+  mps_buffer_t* buf = mp_atomic_load_ptr(mps_buffer_t, &d->buffer);
+  while (buf != NULL) {
+    mps_buffer_t* prev = buf->prev;
+    mps_free(buf);
+    buf = prev;
+  }
+  mp_atomic_store_ptr(mps_buffer_t, &d->buffer, NULL);
+}
+
+// Double the capacity (only called by the owner)
+static mps_buffer_t* mps_deque_grow(mps_deque_t* d, mps_buffer_t* buf, intptr_t top, intptr_t bottom) {
+  mps_buffer_t* nbuf = mps_buffer_alloc(2*(buf->mask + 1), buf);
+  for (intptr_t i = top; i < bottom; i++) {
+    mp_atomic_store_ptr(mps_task_t, &nbuf->items[i & nbuf->mask], mp_atomic_load_ptr(mps_task_t, &buf->items[i & buf->mask]));
+  }
+  mp_atomic_store_ptr(mps_buffer_t, &d->buffer, nbuf);
+  return nbuf;
+}
+
+// Push at the bottom (only called by the owner)
+static void mps_deque_push(mps_deque_t* d, mps_task_t* t) {
+  intptr_t b = mp_atomic_load(&d->bottom);
+  intptr_t top = mp_atomic_load(&d->top);
+  mps_buffer_t* buf = mp_atomic_load_ptr(mps_buffer_t, &d->buffer);
+  if (mps_unlikely(b - top > buf->mask)) {
+    buf = mps_deque_grow(d, buf, top, b);
+  }
+  mp_atomic_store_ptr(mps_task_t, &buf->items[b & buf->mask], t);
+  mp_atomic_store(&d->bottom, b + 1);
+}
+
+// Pop from the bottom (only called by the owner)
+static mps_task_t* mps_deque_pop(mps_deque_t* d) {
+  intptr_t b = mp_atomic_load(&d->bottom) - 1;
+  mps_buffer_t* buf = mp_atomic_load_ptr(mps_buffer_t, &d->buffer);
+  mp_atomic_store(&d->bottom, b);
+  intptr_t top = mp_atomic_load(&d->top);
+  if (top > b) {
+    // empty
+    mp_atomic_store(&d->bottom, b + 1);
+    return NULL;
+  }
+  mps_task_t* t = mp_atomic_load_ptr(mps_task_t, &buf->items[b & buf->mask]);
+  if (top == b) {
+    // last element: race with thieves
+    if (!mp_atomic_cas(&d->top, &top, top + 1)) {
+      t = NULL;
+    }
+    mp_atomic_store(&d->bottom, b + 1);
+  }
+  return t;
+}
+
+// Is the deque empty at this moment? (called by any thread)
+static bool mps_deque_is_empty(mps_deque_t* d) {
+  return (mp_atomic_load(&d->top) >= mp_atomic_load(&d->bottom));
+}
+
+// Steal from the top (called by other threads)
+static mps_task_t* mps_deque_steal(mps_deque_t* d) {
+  intptr_t top = mp_atomic_load(&d->top);
+  intptr_t b = mp_atomic_load(&d->bottom);
+  if (top >= b) return NULL;  // empty
+  mps_buffer_t* buf = mp_atomic_load_ptr(mps_buffer_t, &d->buffer);
+  mps_task_t* t = mp_atomic_load_ptr(mps_task_t, &buf->items[top & buf->mask]);
+  if (!mp_atomic_cas(&d->top, &top, top + 1)) return NULL;  // lost the race
+  return t;
+}
+
+
+/*-----------------------------------------------------------------
+  Tasks
+-----------------------------------------------------------------*/
+
+static mps_task_t* mps_task_create(mps_task_fun_t* fun, void* arg) {
+  mps_task_t* t = mps_zalloc_tp(mps_task_t);
+  t->fun = fun;
+  t->arg = arg;
+  mp_atomic_store_ptr(mps_task_t, &t->waiter, NULL);
+  return t;
+}
+
+// Wake up the parked workers (if any) as there is new work or the scheduler is done.
+// Workers increment `parked` before checking for work, so either they see the new
+// work, or we see them parked (see `mps_worker_park`).
+static void mps_sched_wakeup(mps_sched_t* sched) {
+  if (mps_likely(mp_atomic_load(&sched->parked) == 0)) return;
+  mps_monitor_enter(sched->idle);
+  mps_monitor_notify_all(sched->idle);
+  mps_monitor_leave(sched->idle);
+}
+
+// Make a (suspended or fresh) task runnable on the current thread
+static void mps_task_schedule(mps_worker_t* w, mps_task_t* t) {
+  mps_deque_push(&w->deque, t);
+  mps_sched_wakeup(w->sched);
+}
+
+// Finish a task and wake up its waiter (if any). Called on the stack of the task.
+static void mps_task_complete(mps_task_t* t, void* result) {
+  t->result = result;
+  mps_task_t* waiter = mp_atomic_load_ptr(mps_task_t, &t->waiter);
+  while (!mp_atomic_cas_ptr(mps_task_t, &t->waiter, &waiter, MPS_TASK_DONE)) { /* nothing */ };
+  // note: we cannot access `t` anymore as the waiter may free it
+  mps_worker_t* w = mps_worker_current();
+  if (waiter != NULL) {
+    mps_task_schedule(w, waiter);
+  }
+  if (mps_unlikely(t == w->sched->root)) {
+    mp_atomic_store(&w->sched->done, (intptr_t)1);
+    mps_sched_wakeup(w->sched);
+  }
+}
+
+static void* mps_task_start(mp_prompt_t* p, void* arg) {
+  mps_task_t* t = (mps_task_t*)arg;
+  t->prompt = p;
+  void* result = (t->fun)(t->arg);
+  mps_task_complete(t, result);
+  return NULL;
+}
+
+// Run a task until it is suspended or done
+static void mps_task_run(mps_worker_t* w, mps_task_t* t) {
+  w->current = t;
+  mp_atomic_add(&w->runs, (intptr_t)1);
+  mp_preempt_clear(mp_preempt_current());  // a request for a previous task is stale
+  mp_resume_t* r = t->resume;
+  if (r == NULL) {
+    mp_prompt(&mps_task_start, t);
+  }
+  else {
+    t->resume = NULL;
+    mp_resume_attach(r);
+    mp_resume(r, NULL);
+  }
+  mp_atomic_add(&w->runs, (intptr_t)1);
+  w->current = NULL;
+}
+
+
+/*-----------------------------------------------------------------
+  Suspending
+-----------------------------------------------------------------*/
+
+// Called in the context of the worker after the task is suspended.
+static void mps_task_suspended(mps_task_t* t, mp_resume_t* r) {
+  t->resume = r;
+  mp_resume_detach(r);  // as we may be stolen and resumed by another thread
+}
+
+static void* mps_yield_fun(mp_resume_t* r, void* arg) {
+  mps_task_t* t = (mps_task_t*)arg;
+  mps_task_suspended(t, r);
+  mps_worker_current()->yielded = t;
+  return NULL;
+}
+
+void mps_yield(void) {
+  mps_task_t* t = mps_worker_current_safe()->current;
+  mp_yield(t->prompt, &mps_yield_fun, t);
+}
+
+// Preemption handler of the worker threads: yield if we are running the task the timer asked to yield.
+static void mps_preempt_fun(void) {
+  mps_worker_t* w = mps_worker_current();
+  if (w != NULL && w->current != NULL && mp_atomic_load(&w->runs) == mp_atomic_load(&w->preempt_runs)) {
+    mps_yield();
+  }
+}
+
+typedef struct mps_await_env_s {
+  mps_task_t* self;
+  mps_task_t* task;
+} mps_await_env_t;
+
+static void* mps_await_fun(mp_resume_t* r, void* arg) {
+  mps_await_env_t* env = (mps_await_env_t*)arg;
+  mps_task_t* self = env->self;
+  mps_task_t* task = env->task;
+  mps_task_suspended(self, r);
+  mps_task_t* expected = NULL;
+  if (!mp_atomic_cas_ptr(mps_task_t, &task->waiter, &expected, self)) {
+    // finished in the mean time; resume directly
+    mps_assert_internal(expected == MPS_TASK_DONE);
+    self->resume = NULL;
+    return mp_resume_tail(r, NULL);
+  }
+  // from now on `self` may already run on another thread
+  return NULL;
+}
+
+void* mps_await(mps_task_t* task) {
+  mps_assert(task != NULL);
+  mps_task_t* waiter = mp_atomic_load_ptr(mps_task_t, &task->waiter);
+  if (waiter != MPS_TASK_DONE) {
+    mps_assert(waiter == NULL);  // at most one waiter
+    mps_await_env_t env = { mps_worker_current_safe()->current, task };
+    mp_yield(env.self->prompt, &mps_await_fun, &env);
+    mps_assert_internal(mp_atomic_load_ptr(mps_task_t, &task->waiter) == MPS_TASK_DONE);
+  }
+  void* result = task->result;
+  mps_free(task);
+  return result;
+}
+
+mps_task_t* mps_spawn(mps_task_fun_t* fun, void* arg) {
+  mps_worker_t* w = mps_worker_current_safe();
+  mps_task_t* t = mps_task_create(fun, arg);
+  mps_task_schedule(w, t);
+  return t;
+}
+
+size_t mps_thread_count(void) {
+  mps_worker_t* w = mps_worker_current();
+  return (w == NULL ? 0 : w->sched->count);
+}
+
+
+/*-----------------------------------------------------------------
+  Preemption timer
+-----------------------------------------------------------------*/
+
+static size_t mps_time_slice;   // in micro-seconds; 0 to disable preemption
+
+void mps_set_time_slice(size_t usecs) {
+  mps_time_slice = usecs;
+}
+
+// Every time slice, ask each worker that is still running the same task as at the previous tick to yield.
+// The request is only acted upon at the next preemption point of the task.
+#if defined(_WIN32)
+static DWORD WINAPI mps_timer_start(LPVOID arg) {
+#else
+static void* mps_timer_start(void* arg) {
+#endif
+  mps_sched_t* sched = (mps_sched_t*)arg;
+  mps_monitor_enter(sched->timer);
+  while (!sched->timer_stop) {
+    mps_monitor_wait(sched->timer, sched->time_slice);
+    if (sched->timer_stop) break;
+    for (size_t i = 0; i < sched->count; i++) {
+      mps_worker_t* w = &sched->workers[i];
+      intptr_t runs = mp_atomic_load(&w->runs);
+      mp_preempt_t* preempt = mp_atomic_load_ptr(mp_preempt_t, &w->preempt);
+      if ((runs & 1) != 0 && runs == w->timer_runs && preempt != NULL) {
+        mp_atomic_store(&w->preempt_runs, runs);
+        mp_preempt_request(preempt);
+      }
+      w->timer_runs = runs;
+    }
+  }
+  sched->timer_done = true;
+  mps_monitor_notify_all(sched->timer);
+  mps_monitor_leave(sched->timer);
+  return 0;
+}
+
+// Called by each worker when it is done: wake up the timer and wait until it stopped
+// (as it may still access the preemption flag of the worker thread).
+static void mps_timer_stop(mps_sched_t* sched) {
+  mps_monitor_enter(sched->timer);
+  sched->timer_stop = true;
+  mps_monitor_notify_all(sched->timer);
+  while (!sched->timer_done) {
+    mps_monitor_wait(sched->timer, 0);
+  }
+  mps_monitor_leave(sched->timer);
+}
+
+
+/*-----------------------------------------------------------------
+  Workers
+-----------------------------------------------------------------*/
+
+#define MPS_IDLE_SPIN   (64)      // when idle, first spin this many times,
+#define MPS_IDLE_YIELD  (128)     // then yield the thread up to this many times,
+#define MPS_PARK_MIN    (100)     // and then park with a time out (in micro-seconds) that doubles
+#define MPS_PARK_MAX    (100000)  // up to this maximum
+
+static uint32_t mps_random(mps_worker_t* w) {
+  uint32_t x = w->rnd;   // xorshift32
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  w->rnd = x;
+  return x;
+}
+
+static mps_task_t* mps_worker_steal(mps_worker_t* w) {
+  mps_sched_t* sched = w->sched;
+  if (sched->count <= 1) return NULL;
+  size_t start = mps_random(w) % sched->count;
+  for (size_t i = 0; i < sched->count; i++) {
+    mps_worker_t* victim = &sched->workers[(start + i) % sched->count];
+    if (victim == w) continue;
+    mps_task_t* t = mps_deque_steal(&victim->deque);
+    if (t != NULL) return t;
+  }
+  return NULL;
+}
+
+// Find the next task to run: first our own tasks, then a task that yielded, and finally steal.
+static mps_task_t* mps_worker_next(mps_worker_t* w) {
+  mps_task_t* t = mps_deque_pop(&w->deque);
+  if (t != NULL) {
+    if (w->yielded != NULL) {
+      // make the yielded task available again (after this one)
+      mps_task_schedule(w, w->yielded);
+      w->yielded = NULL;
+    }
+    return t;
+  }
+  t = w->yielded;
+  if (t != NULL) {
+    w->yielded = NULL;
+    return t;
+  }
+  return mps_worker_steal(w);
+}
+
+static bool mps_sched_has_work(mps_sched_t* sched) {
+  for (size_t i = 0; i < sched->count; i++) {
+    if (!mps_deque_is_empty(&sched->workers[i].deque)) return true;
+  }
+  return false;
+}
+
+// Park an idle worker until there is new work (see `mps_sched_wakeup`), the scheduler is done, or a time out.
+static void mps_worker_park(mps_worker_t* w, size_t usecs) {
+  mps_sched_t* sched = w->sched;
+  mps_monitor_enter(sched->idle);
+  mp_atomic_add(&sched->parked, (intptr_t)1);
+  if (mp_atomic_load(&sched->done) == 0 && !mps_sched_has_work(sched)) {
+    mps_monitor_wait(sched->idle, usecs);
+  }
+  mp_atomic_add(&sched->parked, (intptr_t)-1);
+  mps_monitor_leave(sched->idle);
+}
+
+static void mps_worker_loop(mps_worker_t* w) {
+  mps_sched_t* sched = w->sched;
+  mps_worker_t* prev = _mps_worker;
+  _mps_worker = w;
+  mp_preempt_fun_t* prev_preempt = mp_preempt_set_handler(&mps_preempt_fun);
+  mp_atomic_store_ptr(mp_preempt_t, &w->preempt, mp_preempt_current());
+  size_t idle = 0;
+  size_t park = MPS_PARK_MIN;
+  while (mp_atomic_load(&sched->done) == 0) {
+    mps_task_t* t = mps_worker_next(w);
+    if (t != NULL) {
+      idle = 0;
+      park = MPS_PARK_MIN;
+      mps_task_run(w, t);
+    }
+    else if (++idle < MPS_IDLE_SPIN) {
+      mp_atomic_yield();
+    }
+    else if (idle < MPS_IDLE_YIELD) {
+      mps_thread_idle();
+    }
+    else {
+      if (park == MPS_PARK_MIN) mp_collect(false);  // going idle: decommit the high-water mark of cached gstacks
+      mps_worker_park(w, park);
+      if (park < MPS_PARK_MAX) park *= 2;
+    }
+  }
+  mps_timer_stop(sched);  // the timer may still access our preemption flag
+  mp_preempt_set_handler(prev_preempt);
+  _mps_worker = prev;
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI mps_thread_start(LPVOID arg) {
+#else
+static void* mps_thread_start(void* arg) {
+#endif
+  mps_worker_loop((mps_worker_t*)arg);
+  return 0;
+}
+
+
+/*-----------------------------------------------------------------
+  Run
+-----------------------------------------------------------------*/
+
+void* mps_run(size_t thread_count, mps_task_fun_t* fun, void* arg) {
+  if (thread_count == 0) thread_count = mps_processor_count();
+  mps_sched_t sched;
+  sched.count = thread_count;
+  sched.workers = mps_zalloc_n_tp(mps_worker_t, thread_count);
+  sched.root = mps_task_create(fun, arg);
+  sched.time_slice = mps_time_slice;
+  mp_atomic_store(&sched.done, (intptr_t)0);
+  mps_monitor_t idle_monitor;
+  mps_monitor_init(&idle_monitor);
+  sched.idle = &idle_monitor;
+  mp_atomic_store(&sched.parked, (intptr_t)0);
+  mps_monitor_t timer_monitor;
+  mps_monitor_init(&timer_monitor);
+  sched.timer = &timer_monitor;
+  sched.timer_stop = false;
+  sched.timer_done = (sched.time_slice == 0);
+  for (size_t i = 0; i < thread_count; i++) {
+    mps_worker_t* w = &sched.workers[i];
+    w->sched = &sched;
+    w->rnd = (uint32_t)(2654435761U * (i + 1));
+    mp_atomic_store(&w->runs, (intptr_t)0);
+    mp_atomic_store_ptr(mp_preempt_t, &w->preempt, NULL);
+    mp_atomic_store(&w->preempt_runs, (intptr_t)0);
+    mps_deque_init(&w->deque);
+  }
+  mps_task_schedule(&sched.workers[0], sched.root);
+
+  // start the worker threads; the current thread becomes worker 0
+  mps_thread_t* threads = mps_zalloc_n_tp(mps_thread_t, thread_count);
+  for (size_t i = 1; i < thread_count; i++) {
+    if (!mps_thread_create(&threads[i], &mps_thread_start, &sched.workers[i])) {
+      mps_fatal("unable to create a worker thread");
+    }
+  }
+  mps_thread_t timer;
+  if (sched.time_slice > 0 && !mps_thread_create(&timer, &mps_timer_start, &sched)) {
+    mps_fatal("unable to create the preemption timer thread");
+  }
+  mps_worker_loop(&sched.workers[0]);
+  for (size_t i = 1; i < thread_count; i++) {
+    mps_thread_join(threads[i]);
+  }
+  if (sched.time_slice > 0) {
+    mps_thread_join(timer);
+  }
+  mps_free(threads);
+  mps_monitor_done(&timer_monitor);
+  mps_monitor_done(&idle_monitor);
+
+  // clean up
+  void* result = sched.root->result;
+  mps_free(sched.root);
+  for (size_t i = 0; i < thread_count; i++) {
+    mps_deque_done(&sched.workers[i].deque);
+  }
+  mps_free(sched.workers);
+  return result;
+}
@@ -0,0 +1,491 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+
+  Micro benchmarks for the cost of prompts, yields and resumes, effect
+  operations, multi-shot stack saves, and gstack allocation.
+
+  Usage: mp-bench [--csv|--json] [--quick] [--gpool|--overcommit] [--iters=<N>]
+
+  Results are printed to stdout (as CSV by default), one row per benchmark
+  with the best time per operation in nano seconds over a few runs.
+  The `baseline/` rows use plain calls and `ucontext` context switches (where available)
+  for comparison. Note that gpools and overcommit are chosen at initialization
+  so each configuration needs a separate run.
+-----------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <mprompt.h>
+#include <mpeff.h>
+#include <mpgen.h>
+
+#if defined(__GNUC__)
+#define mpb_noinline   __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define mpb_noinline   __declspec(noinline)
+#else
+#define mpb_noinline
+#endif
+
+#if defined(__linux__)
+#define MPB_HAS_UCONTEXT  (1)
+#include <ucontext.h>
+#else
+#define MPB_HAS_UCONTEXT  (0)
+#endif
+
+#define UNUSED(x)  ((void)(x))
+
+
+/*-----------------------------------------------------------------
+  Nano second timer
+-----------------------------------------------------------------*/
+typedef int64_t mpb_nsecs_t;
+
+#ifdef _WIN32
+#include <windows.h>
+static mpb_nsecs_t mpb_now(void) {
+  static LARGE_INTEGER mfreq; // = 0
+  if (mfreq.QuadPart == 0) QueryPerformanceFrequency(&mfreq);
+  LARGE_INTEGER t;
+  QueryPerformanceCounter(&t);
+  // calculate in parts to avoid overflow
+  int64_t secs = t.QuadPart / mfreq.QuadPart;
+  int64_t frac = t.QuadPart % mfreq.QuadPart;
+  return (secs * 1000000000LL) + ((frac * 1000000000LL) / mfreq.QuadPart);
+}
+#else
+#include <time.h>
+static mpb_nsecs_t mpb_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((mpb_nsecs_t)t.tv_sec * 1000000000LL) + (mpb_nsecs_t)t.tv_nsec;
+}
+#endif
+
+// Prevent the compiler from optimizing away results
+static volatile intptr_t mpb_sink;
+
+
+/*-----------------------------------------------------------------
+  Baselines
+-----------------------------------------------------------------*/
+
+static mpb_noinline void* bench_call_fun(void* arg) {
+  mpb_sink = (intptr_t)arg;
+  return arg;
+}
+
+static void bench_call(long n) {
+  void* (*volatile f)(void*) = &bench_call_fun;
+  for (long i = 0; i < n; i++) {
+    f((void*)i);
+  }
+}
+
+#if MPB_HAS_UCONTEXT
+static ucontext_t bench_uc_main;
+static ucontext_t bench_uc_coro;
+static long       bench_uc_count;
+
+static void bench_uc_entry(void) {
+  while (true) {
+    bench_uc_count++;
+    swapcontext(&bench_uc_coro, &bench_uc_main);
+  }
+}
+
+// a round trip switches twice like a yield and resume
+static void bench_ucontext(long n) {
+  static char* stack;
+  const size_t stack_size = 64 * 1024;
+  if (stack == NULL) stack = (char*)malloc(stack_size);
+  getcontext(&bench_uc_coro);
+  bench_uc_coro.uc_stack.ss_sp = stack;
+  bench_uc_coro.uc_stack.ss_size = stack_size;
+  bench_uc_coro.uc_link = NULL;
+  makecontext(&bench_uc_coro, &bench_uc_entry, 0);
+  bench_uc_count = 0;
+  for (long i = 0; i < n; i++) {
+    swapcontext(&bench_uc_main, &bench_uc_coro);
+  }
+  mpb_sink = bench_uc_count;
+}
+
+// creating a context each time is the closest to entering a fresh prompt
+static void bench_uc_create_entry(void) {
+  bench_uc_count++;
+}
+
+static void bench_ucontext_create(long n) {
+  static char* stack;
+  const size_t stack_size = 64 * 1024;
+  if (stack == NULL) stack = (char*)malloc(stack_size);
+  bench_uc_count = 0;
+  for (long i = 0; i < n; i++) {
+    getcontext(&bench_uc_coro);
+    bench_uc_coro.uc_stack.ss_sp = stack;
+    bench_uc_coro.uc_stack.ss_size = stack_size;
+    bench_uc_coro.uc_link = &bench_uc_main;
+    makecontext(&bench_uc_coro, &bench_uc_create_entry, 0);
+    swapcontext(&bench_uc_main, &bench_uc_coro);
+  }
+  mpb_sink = bench_uc_count;
+}
+#endif
+
+
+/*-----------------------------------------------------------------
+  Prompts
+-----------------------------------------------------------------*/
+
+static void* bench_prompt_fun(mp_prompt_t* p, void* arg) {
+  UNUSED(p);
+  return arg;
+}
+
+// create, enter, and return from a prompt
+static void bench_prompt(long n) {
+  for (long i = 0; i < n; i++) {
+    mpb_sink = (intptr_t)mp_prompt(&bench_prompt_fun, (void*)i);
+  }
+}
+
+static void bench_prompt_small(long n) {
+  for (long i = 0; i < n; i++) {
+    mpb_sink = (intptr_t)mp_prompt_ex(64 * 1024, &bench_prompt_fun, (void*)i);
+  }
+}
+
+// yield and resume round trips: the yield function returns the resumption to the caller of `mp_resume`
+static void* bench_yield_capture(mp_resume_t* r, void* arg) {
+  UNUSED(arg);
+  return r;
+}
+
+static void* bench_yield_fun(mp_prompt_t* p, void* arg) {
+  long n = (long)(intptr_t)arg;
+  for (long i = 0; i < n; i++) {
+    mp_yield(p, &bench_yield_capture, NULL);
+  }
+  return NULL;
+}
+
+static void bench_yield_resume(long n) {
+  mp_resume_t* r = (mp_resume_t*)mp_prompt(&bench_yield_fun, (void*)(intptr_t)n);
+  while (r != NULL) {
+    r = (mp_resume_t*)mp_resume(r, NULL);
+  }
+}
+
+// yield and tail resume (as in a generator)
+static void* bench_yield_tail(mp_resume_t* r, void* arg) {
+  return mp_resume_tail(r, arg);
+}
+
+static void* bench_resume_tail_fun(mp_prompt_t* p, void* arg) {
+  long n = (long)(intptr_t)arg;
+  for (long i = 0; i < n; i++) {
+    mpb_sink = (intptr_t)mp_yield(p, &bench_yield_tail, (void*)i);
+  }
+  return NULL;
+}
+
+static void bench_resume_tail(long n) {
+  mp_prompt(&bench_resume_tail_fun, (void*)(intptr_t)n);
+}
+
+// symmetric transfer between two sibling prompts (each hand-off is one switch)
+typedef struct bench_pipe_s {
+  mp_resume_t* producer;
+  mp_resume_t* consumer;
+  long         count;
+} bench_pipe_t;
+
+static void* bench_pipe_park(mp_resume_t* r, void* arg) {
+  ((bench_pipe_t*)arg)->consumer = r;
+  return NULL;
+}
+
+static void* bench_pipe_consumer(mp_prompt_t* p, void* arg) {
+  bench_pipe_t* pipe = (bench_pipe_t*)arg;
+  intptr_t i = (intptr_t)mp_yield(p, &bench_pipe_park, pipe);
+  while (i >= 0) {
+    mpb_sink = i;
+    i = (intptr_t)mp_resume_to(p, pipe->producer, NULL, &pipe->consumer);
+  }
+  return NULL;
+}
+
+static void* bench_pipe_producer(mp_prompt_t* p, void* arg) {
+  bench_pipe_t* pipe = (bench_pipe_t*)arg;
+  for (long i = 0; i < pipe->count; i += 2) {
+    mp_resume_to(p, pipe->consumer, (void*)(intptr_t)i, &pipe->producer);
+  }
+  mp_resume_to(p, pipe->consumer, (void*)(intptr_t)(-1), &pipe->producer);
+  return NULL;
+}
+
+static void bench_transfer(long n) {
+  bench_pipe_t pipe = { NULL, NULL, n };
+  mp_prompt(&bench_pipe_consumer, &pipe);
+  mp_prompt(&bench_pipe_producer, &pipe);
+  mp_resume_drop(pipe.producer);
+}
+
+// batched generator: one element per op (and one switch per batch of 256)
+static void bench_gen_producer(mp_gen_t* gen, void* arg) {
+  long n = (long)(intptr_t)arg;
+  for (long i = 0; i < n; i++) {
+    intptr_t x = i;
+    mp_gen_emit(gen, &x);
+  }
+}
+
+static void bench_gen_batch(long n) {
+  mp_gen_t* gen = mp_gen_create(64 * 1024, sizeof(intptr_t), &bench_gen_producer, (void*)(intptr_t)n);
+  intptr_t buf[256];
+  mp_gen_iter_t it;
+  mp_gen_iter_init(&it, gen, buf, 256, sizeof(intptr_t));
+  for (intptr_t* x; (x = (intptr_t*)mp_gen_iter_next(&it)) != NULL; ) {
+    mpb_sink = *x;
+  }
+  mp_gen_free(gen);
+}
+
+
+/*-----------------------------------------------------------------
+  Gstack allocation: keep many prompts alive at once so most
+  gstacks are fresh allocations instead of thread-local cache hits.
+-----------------------------------------------------------------*/
+#define BENCH_GSTACK_BATCH  (64)
+
+static void bench_gstack_alloc(long n) {
+  mp_prompt_t* ps[BENCH_GSTACK_BATCH];
+  for (long i = 0; i < n; i += BENCH_GSTACK_BATCH) {
+    for (int j = 0; j < BENCH_GSTACK_BATCH; j++) {
+      ps[j] = mp_prompt_create();
+    }
+    for (int j = 0; j < BENCH_GSTACK_BATCH; j++) {
+      mpb_sink = (intptr_t)mp_prompt_enter(ps[j], &bench_prompt_fun, NULL);
+    }
+  }
+}
+
+
+/*-----------------------------------------------------------------
+  Effect operations: one effect with a handler per operation kind
+-----------------------------------------------------------------*/
+MPE_DEFINE_EFFECT1(bench, op)
+
+static void* bench_op_tail(mpe_resume_t* r, void* local, void* arg) {
+  return mpe_resume_tail(r, local, arg);
+}
+
+static void* bench_op_abort(mpe_resume_t* r, void* local, void* arg) {
+  UNUSED(r); UNUSED(local);
+  return arg;
+}
+
+static void* bench_perform_body(void* arg) {
+  long n = (long)(intptr_t)arg;
+  for (long i = 0; i < n; i++) {
+    mpb_sink = (intptr_t)mpe_perform(MPE_OPTAG(bench,op), (void*)i);
+  }
+  return NULL;
+}
+
+#define BENCH_HDEF(name,kind,opfun) \
+  static const mpe_handlerdef_t name = { MPE_EFFECT(bench), NULL, { \
+    { kind, MPE_OPTAG(bench,op), opfun }, \
+    { MPE_OP_NULL, mpe_op_null, NULL } \
+  } };
+
+BENCH_HDEF(bench_hdef_tail_noop,   MPE_OP_TAIL_NOOP,   &bench_op_tail)
+BENCH_HDEF(bench_hdef_tail,        MPE_OP_TAIL,        &bench_op_tail)
+BENCH_HDEF(bench_hdef_scoped_once, MPE_OP_SCOPED_ONCE, &bench_op_tail)
+BENCH_HDEF(bench_hdef_scoped,      MPE_OP_SCOPED,      &bench_op_tail)
+BENCH_HDEF(bench_hdef_once,        MPE_OP_ONCE,        &bench_op_tail)
+BENCH_HDEF(bench_hdef_multi,       MPE_OP_MULTI,       &bench_op_tail)
+BENCH_HDEF(bench_hdef_abort,       MPE_OP_ABORT,       &bench_op_abort)
+BENCH_HDEF(bench_hdef_never,       MPE_OP_NEVER,       &bench_op_abort)
+
+// perform `n` times under a single handler
+static void bench_perform(const mpe_handlerdef_t* hdef, long n) {
+  mpe_handle(hdef, NULL, &bench_perform_body, (void*)(intptr_t)n);
+}
+
+static void bench_perform_tail_noop(long n)   { bench_perform(&bench_hdef_tail_noop, n); }
+static void bench_perform_tail(long n)        { bench_perform(&bench_hdef_tail, n); }
+static void bench_perform_scoped_once(long n) { bench_perform(&bench_hdef_scoped_once, n); }
+static void bench_perform_scoped(long n)      { bench_perform(&bench_hdef_scoped, n); }
+static void bench_perform_once(long n)        { bench_perform(&bench_hdef_once, n); }
+static void bench_perform_multi(long n)       { bench_perform(&bench_hdef_multi, n); }
+
+// handle and perform once per iteration (for operations that do not resume)
+static void bench_handle_perform(const mpe_handlerdef_t* hdef, long n) {
+  for (long i = 0; i < n; i++) {
+    mpb_sink = (intptr_t)mpe_handle(hdef, NULL, &bench_perform_body, (void*)(intptr_t)1);
+  }
+}
+
+static void bench_perform_abort(long n)       { bench_handle_perform(&bench_hdef_abort, n); }
+static void bench_perform_never(long n)       { bench_handle_perform(&bench_hdef_never, n); }
+
+// the cost of a handler frame itself (without and with a prompt)
+static void bench_handle_tail_noop(long n)    { bench_handle_perform(&bench_hdef_tail_noop, n); }
+static void bench_handle_scoped_once(long n)  { bench_handle_perform(&bench_hdef_scoped_once, n); }
+
+
+/*-----------------------------------------------------------------
+  Multi-shot resumptions: resume twice from below a stack of a given depth,
+  which saves and restores the stack in between.
+-----------------------------------------------------------------*/
+
+static void* bench_op_twice(mpe_resume_t* r, void* local, void* arg) {
+  UNUSED(arg);
+  intptr_t x = (intptr_t)mpe_resume(r, local, (void*)1);
+  intptr_t y = (intptr_t)mpe_resume_final(r, local, (void*)0);
+  return (void*)(x + y);
+}
+
+BENCH_HDEF(bench_hdef_twice, MPE_OP_MULTI, &bench_op_twice)
+
+static mpb_noinline intptr_t bench_deep(long kib) {
+  if (kib <= 0) {
+    return (intptr_t)mpe_perform(MPE_OPTAG(bench,op), NULL);
+  }
+  volatile char buf[1024];
+  buf[0] = (char)kib;
+  intptr_t res = bench_deep(kib - 1);
+  return res + buf[0] - (char)kib;
+}
+
+static void* bench_multi_body(void* arg) {
+  return (void*)bench_deep((long)(intptr_t)arg);
+}
+
+static void bench_multi(long kib, long n) {
+  for (long i = 0; i < n; i++) {
+    mpb_sink = (intptr_t)mpe_handle(&bench_hdef_twice, NULL, &bench_multi_body, (void*)(intptr_t)kib);
+  }
+}
+
+static void bench_multi_0k(long n)   { bench_multi(0, n); }
+static void bench_multi_4k(long n)   { bench_multi(4, n); }
+static void bench_multi_64k(long n)  { bench_multi(64, n); }
+static void bench_multi_512k(long n) { bench_multi(512, n); }
+
+
+/*-----------------------------------------------------------------
+  Driver
+-----------------------------------------------------------------*/
+
+typedef void (bench_fun_t)(long n);
+
+typedef struct bench_s {
+  const char*  name;
+  bench_fun_t* fun;
+  long         divisor;     // run (iterations / divisor) times for expensive benchmarks
+} bench_t;
+
+static const bench_t benchmarks[] = {
+  { "baseline/call",              &bench_call, 1 },
+#if MPB_HAS_UCONTEXT
+  { "baseline/ucontext_switch",   &bench_ucontext, 1 },
+  { "baseline/ucontext_create",   &bench_ucontext_create, 1 },
+#endif
+  { "prompt/create_enter_return", &bench_prompt, 1 },
+  { "prompt/small_stack",         &bench_prompt_small, 1 },
+  { "prompt/yield_resume",        &bench_yield_resume, 1 },
+  { "prompt/yield_resume_tail",   &bench_resume_tail, 1 },
+  { "prompt/transfer",            &bench_transfer, 1 },
+  { "prompt/gen_batch",           &bench_gen_batch, 1 },
+  { "gstack/alloc_free",          &bench_gstack_alloc, 10 },
+  { "perform/tail_noop",          &bench_perform_tail_noop, 1 },
+  { "perform/tail",               &bench_perform_tail, 1 },
+  { "perform/scoped_once",        &bench_perform_scoped_once, 1 },
+  { "perform/scoped",             &bench_perform_scoped, 1 },
+  { "perform/once",               &bench_perform_once, 1 },
+  { "perform/multi",              &bench_perform_multi, 1 },
+  { "perform/abort",              &bench_perform_abort, 1 },
+  { "perform/never",              &bench_perform_never, 1 },
+  { "handle/tail_noop",           &bench_handle_tail_noop, 1 },
+  { "handle/scoped_once",         &bench_handle_scoped_once, 1 },
+  { "multi/depth_0k",             &bench_multi_0k, 4 },
+  { "multi/depth_4k",             &bench_multi_4k, 10 },
+  { "multi/depth_64k",            &bench_multi_64k, 100 },
+  { "multi/depth_512k",           &bench_multi_512k, 1000 },
+  { NULL, NULL, 0 }
+};
+
+typedef enum bench_format_e {
+  BENCH_CSV,
+  BENCH_JSON
+} bench_format_t;
+
+int main(int argc, char** argv) {
+  bench_format_t format = BENCH_CSV;
+  const char* config_name = "default";
+  long iterations = 1000000L;
+  int  runs = 3;
+  mp_config_t config = mp_config_default();
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    if (strcmp(arg, "--csv") == 0)  format = BENCH_CSV;
+    else if (strcmp(arg, "--json") == 0) format = BENCH_JSON;
+    else if (strcmp(arg, "--quick") == 0) { iterations = 1000L; runs = 1; }
+    else if (strncmp(arg, "--iters=", 8) == 0) iterations = atol(arg + 8);
+    else if (strcmp(arg, "--gpool") == 0) {
+      config.gpool_enable = true;
+      config_name = "gpool";
+    }
+    else if (strcmp(arg, "--overcommit") == 0) {
+      config.stack_use_overcommit = true;
+      config_name = "overcommit";
+    }
+    else {
+      fprintf(stderr, "usage: %s [--csv|--json] [--quick] [--gpool|--overcommit] [--iters=<N>]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (iterations <= 0) iterations = 1;
+  mp_init(&config);
+
+  if (format == BENCH_CSV) {
+    printf("benchmark,config,iterations,ns_per_op,ops_per_sec\n");
+  }
+  else {
+    printf("[\n");
+  }
+  for (const bench_t* b = benchmarks; b->name != NULL; b++) {
+    long n = iterations / b->divisor;
+    if (n < 1) n = 1;
+    b->fun(n < 100 ? n : 100);   // warm up
+    mpb_nsecs_t best = INT64_MAX;
+    for (int run = 0; run < runs; run++) {
+      mpb_nsecs_t start = mpb_now();
+      b->fun(n);
+      mpb_nsecs_t t = mpb_now() - start;
+      if (t < best) best = t;
+    }
+    double ns = (double)best / (double)n;
+    double ops = (ns > 0 ? 1e9 / ns : 0);
+    if (format == BENCH_CSV) {
+      printf("%s,%s,%ld,%.2f,%.0f\n", b->name, config_name, n, ns, ops);
+    }
+    else {
+      printf("  { \"benchmark\": \"%s\", \"config\": \"%s\", \"iterations\": %ld, \"ns_per_op\": %.2f, \"ops_per_sec\": %.0f }%s\n",
+             b->name, config_name, n, ns, ops, ((b+1)->name != NULL ? "," : ""));
+    }
+    fflush(stdout);
+  }
+  if (format == BENCH_JSON) {
+    printf("]\n");
+  }
+  return 0;
+}
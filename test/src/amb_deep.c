@@ -0,0 +1,73 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/* ----------------------------------------------------------------------------
+   Ambiguity with a large stack frame that is modified between the flips.
+   Each resumption must see the stack as it was at the flip.
+-----------------------------------------------------------------------------*/
+
+#include "test.h"
+#include <mprompt.h>
+
+#define DEEP_SIZE   (64*1024)
+#define DEEP_FLIPS  (8)
+
+static long deep_index(long i) {
+  return ((i * 5 * 1024) + 100) % DEEP_SIZE;
+}
+
+static uint8_t deep_mark(bool b) {
+  return (b ? 0xAA : 0x55);
+}
+
+/*-----------------------------------------------------------------
+  Benchmark
+-----------------------------------------------------------------*/
+
+static void* bench_deep(void* arg) {
+  UNUSED(arg);
+  volatile uint8_t buf[DEEP_SIZE];
+  volatile bool choice[DEEP_FLIPS];
+  for (long i = 0; i < DEEP_SIZE; i++) { buf[i] = (uint8_t)i; }
+  long n = 0;
+  for (long i = 0; i < DEEP_FLIPS; i++) {
+    bool b = amb_flip();
+    for (long k = 0; k < DEEP_FLIPS; k++) {
+      long idx = deep_index(k);
+      uint8_t expect = (k < i ? deep_mark(choice[k]) : (uint8_t)idx);
+      mpt_assert(buf[idx] == expect, "amb-deep: stack is not restored");
+    }
+    choice[i] = b;
+    buf[deep_index(i)] = deep_mark(b);
+    n = 2*n + (b ? 1 : 0);
+  }
+  return mpe_voidp_long(n);
+}
+
+/*-----------------------------------------------------------------
+  Bench
+-----------------------------------------------------------------*/
+
+static void test() {
+  blist xs = NULL;
+  mp_save_arena_collect();
+  mpt_bench{ xs = mpe_blist_voidp(amb_handle(&bench_deep, NULL)); }
+  mpt_assert(mp_save_arena_size() == 0, "amb-deep: scoped saves should not use the arena");
+  long count = blist_length(xs);
+  long sum = 0;
+  for (blist x = xs; x != NULL; x = x->next) { sum += mpe_long_voidp(x->value); }
+  mpt_printf("amb-deep  : %ld results\n", count);
+  mpt_assert(count == (1 << DEEP_FLIPS) && sum == (count * (count - 1)) / 2, "amb-deep");
+  blist_free(xs);
+  mp_save_arena_collect();
+  mpt_assert(mp_save_arena_size() == 0, "amb-deep: saved stacks are not all freed");
+}
+
+
+void amb_deep_run(void) {
+  test();
+}
@@ -0,0 +1,129 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/* ----------------------------------------------------------------------------
+   The handler lookup is cached per thread and validated by a version of
+   the frame chain. Check that cached handlers are not used after the chain
+   changed: when a different handler is pushed at the same address, and
+   when a resumption is resumed under another handler context.
+-----------------------------------------------------------------------------*/
+
+#include "test.h"
+#include <mprompt.h>
+
+// Another (tail) effect that can take the place of a reader frame
+MPE_DEFINE_EFFECT1(other, ask)
+MPE_DEFINE_OP0(other, ask, long)
+
+// Effect that returns its resumption
+MPE_DEFINE_EFFECT1(hold, suspend)
+MPE_DEFINE_VOIDOP0(hold, suspend)
+
+static void* handle_ask(mpe_resume_t* r, void* local, void* arg) {
+  UNUSED(arg);
+  return mpe_resume_tail(r, local, local);
+}
+
+static const mpe_handlerdef_t reader_hdef = { MPE_EFFECT(reader), NULL, {
+  { MPE_OP_TAIL_NOOP, MPE_OPTAG(reader,ask), &handle_ask },
+  { MPE_OP_NULL, mpe_op_null, NULL }
+} };
+
+static const mpe_handlerdef_t other_hdef = { MPE_EFFECT(other), NULL, {
+  { MPE_OP_TAIL_NOOP, MPE_OPTAG(other,ask), &handle_ask },
+  { MPE_OP_NULL, mpe_op_null, NULL }
+} };
+
+static void* handle_hold_suspend(mpe_resume_t* r, void* local, void* arg) {
+  UNUSED(arg); UNUSED(local);
+  return r; // return the resumption as is
+}
+
+static void* hold_handle(mpe_actionfun_t* action, void* arg) {
+  static const mpe_handlerdef_t hold_hdef = { MPE_EFFECT(hold), NULL, {
+    { MPE_OP_ONCE, MPE_OPTAG(hold,suspend), &handle_hold_suspend },
+    { MPE_OP_NULL, mpe_op_null, NULL }
+  } };
+  return mpe_handle(&hold_hdef, NULL, action, arg);
+}
+
+
+/*-----------------------------------------------------------------
+  Re-push at the same address
+-----------------------------------------------------------------*/
+
+static void* ask_action(void* arg) {
+  UNUSED(arg);
+  return mpe_voidp_long(reader_ask());
+}
+
+// Handle in turn from the same call site so each (promptless) handler
+// frame is pushed at the same address as the one popped before it.
+static void* same_address_action(void* arg) {
+  long* res = (long*)arg;
+  const mpe_handlerdef_t* hdefs[3] = { &reader_hdef, &other_hdef, &reader_hdef };
+  for (int i = 0; i < 3; i++) {
+    res[i] = mpe_long_voidp(mpe_handle(hdefs[i], mpe_voidp_long(i + 2), &ask_action, NULL));
+  }
+  res[3] = reader_ask();
+  return NULL;
+}
+
+
+/*-----------------------------------------------------------------
+  Resume under another handler context
+-----------------------------------------------------------------*/
+
+// Ask twice with a suspension in between
+static void* hold_body(void* arg) {
+  UNUSED(arg);
+  long x = reader_ask();
+  hold_suspend();
+  long y = reader_ask();
+  return mpe_voidp_long(10*x + y);
+}
+
+static void* reader_hold_body(void* arg) {
+  return reader_handle(&hold_body, 3, arg);
+}
+
+static void* with_hold_handle(void* arg) {
+  return hold_handle((mpe_actionfun_t*)arg, NULL);
+}
+
+// Cache the current reader, then resume the suspended body under it
+static void* ask_and_resume(void* arg) {
+  mpe_resume_t* r = (mpe_resume_t*)arg;
+  long before = reader_ask();
+  long res = mpe_long_voidp(mpe_resume_final(r, NULL, NULL));
+  long after = reader_ask();
+  return mpe_voidp_long(100*before + 10*after + res % 10);
+}
+
+static long suspend_and_resume(mpe_actionfun_t* body) {
+  mpe_resume_t* r = (mpe_resume_t*)reader_handle(&with_hold_handle, 1, (void*)body);
+  return mpe_long_voidp(reader_handle(&ask_and_resume, 2, r));
+}
+
+
+/*-----------------------------------------------------------------
+  testing
+-----------------------------------------------------------------*/
+
+void find_cache_run(void) {
+  // an `other` frame at the address of a cached reader frame does not hide the outer reader
+  long res[4] = { 0, 0, 0, 0 };
+  reader_handle(&same_address_action, 1, res);
+  mpt_printf("find-cache same address: %ld, %ld, %ld, %ld\n", res[0], res[1], res[2], res[3]);
+  mpt_assert(res[0] == 2 && res[1] == 1 && res[2] == 4 && res[3] == 1, "find-cache: same address");
+
+  // after resuming, the reader is the one in the resumed context and not the one cached before
+  long res1 = suspend_and_resume(&reader_hold_body);  // reader inside the suspension
+  long res2 = suspend_and_resume(&hold_body);         // reader outside the suspension
+  mpt_printf("find-cache resume: %ld, %ld\n", res1, res2);
+  mpt_assert(res1 == 223 && res2 == 222, "find-cache: resume");
+}
@@ -0,0 +1,106 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+
+  Suspend under a handler in one thread, and resume (or release) it 
+  under a different handler in another thread.
+-----------------------------------------------------------------------------*/
+#include "test.h"
+#include <mprompt.h>
+#include <thread>
+
+/* ---------------------------------------------------------------------------
+  Parking effect
+-----------------------------------------------------------------------------*/
+
+// Effect that returns its resumption
+MPE_DEFINE_EFFECT1(park, suspend)
+MPE_DEFINE_VOIDOP0(park, suspend)
+
+static void* op_park_suspend(mpe_resume_t* r, void* local, void* arg) {
+  UNUSED(arg); UNUSED(local);
+  return r; // return the resumption as is
+}
+ 
+static void* park_handle(mpe_actionfun_t action, void* arg) {
+  static const mpe_handlerdef_t park_hdef = { MPE_EFFECT(park), NULL, {
+    { MPE_OP_ONCE, MPE_OPTAG(park,suspend), &op_park_suspend },
+    { MPE_OP_NULL, mpe_op_null, NULL }
+  } };
+  return mpe_handle(&park_hdef, NULL, action, arg);
+}
+
+
+/* ---------------------------------------------------------------------------
+  Test
+-----------------------------------------------------------------------------*/
+
+// Ask twice with a suspension in between
+static void* migrate_body(void* arg) {
+  UNUSED(arg);
+  long x = reader_ask();   // returns 1 in the main thread
+  park_suspend();          // suspend and resume in another thread under a new reader
+  long y = reader_ask();   // now it returns 2
+  return mpe_voidp_long(x + y);
+}
+
+// Same but with a destructor that should run on release
+static void* migrate_raii_body(void* arg) {
+  test_raii_t raii("migrate body", (bool*)arg);
+  return migrate_body(arg);
+}
+
+static void* with_park_handle(void* arg) {
+  return park_handle(&migrate_body, arg);
+}
+
+static void* with_park_raii_handle(void* arg) {
+  return park_handle(&migrate_raii_body, arg);
+}
+
+static void* with_resume(void* arg) {
+  mpe_resume_t* r = (mpe_resume_t*)arg;
+  return mpe_resume_final(r, NULL, NULL);
+}
+
+static void resume_in_thread(mpe_resume_t* r, long* res) {
+  mpe_resume_attach(r);
+  *res = mpe_long_voidp(reader_handle(&with_resume, 2, r));
+}
+
+static void release_in_thread(mpe_resume_t* r) {
+  mpe_resume_attach(r);
+  mpe_resume_release(r);
+}
+
+static void test(long count) {
+  long res = 0;
+  const int64_t remote_frees = mp_stats_get().gstack_remote_frees;
+  mpt_bench{
+    for (long i = 0; i < count; i++) {
+      mpe_resume_t* r = (mpe_resume_t*)reader_handle(&with_park_handle, 1, NULL);
+      mpe_resume_detach(r);
+      long n = 0;
+      std::thread t(&resume_in_thread, r, &n);
+      t.join();
+      res += n;
+    }
+  }
+  mpt_printf("migrate   : %ld\n", res);
+  mpt_assert(res == 3*count, "test-migrate");
+  mpt_assert(mp_stats_get().gstack_remote_frees - remote_frees >= count, "test-migrate: gstacks are not returned to their owner");
+
+  // release in another thread (unwinding the migrated stack)
+  bool destructed = false;
+  mpe_resume_t* r = (mpe_resume_t*)reader_handle(&with_park_raii_handle, 1, &destructed);
+  mpe_resume_detach(r);
+  std::thread t(&release_in_thread, r);
+  t.join();
+  mpt_assert(destructed, "test-migrate: release did not unwind");
+}
+
+void migrate_run(void) {
+  test(100);
+}
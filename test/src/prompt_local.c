@@ -0,0 +1,64 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/* ----------------------------------------------------------------------------
+   Prompt local storage: inherited by the handler prompt, and 
+   restored with the stack on each resume of a multi-shot resumption.
+-----------------------------------------------------------------------------*/
+
+#include "test.h"
+#include <mprompt.h>
+
+static ptrdiff_t local_slot = -1;
+
+static long local_get(void) {
+  return mpe_long_voidp(mp_prompt_local_get(local_slot));
+}
+
+static void local_set(long i) {
+  mp_prompt_local_set(local_slot, mpe_voidp_long(i));
+}
+
+/*-----------------------------------------------------------------
+  Benchmark
+-----------------------------------------------------------------*/
+
+static void* bench_local(void* arg) {
+  UNUSED(arg);
+  mpt_assert(local_get() == 1, "prompt-local: not inherited");
+  local_set(2);
+  bool x = amb_flip();
+  mpt_assert(local_get() == 2, "prompt-local: not restored at the first flip");
+  local_set(x ? 3 : 4);
+  bool y = amb_flip();
+  mpt_assert(local_get() == (x ? 3 : 4), "prompt-local: not restored at the second flip");
+  local_set(5);
+  return mpe_voidp_long((x ? 2 : 0) + (y ? 1 : 0));
+}
+
+/*-----------------------------------------------------------------
+  Bench
+-----------------------------------------------------------------*/
+
+static void test() {
+  if (local_slot < 0) { local_slot = mp_prompt_local_new(); }
+  mpt_assert(local_slot >= 0, "prompt-local: no slot available");
+  local_set(1);
+  blist xs = NULL;
+  mpt_bench{ xs = mpe_blist_voidp(amb_handle(&bench_local, NULL)); }
+  long sum = 0;
+  for (blist x = xs; x != NULL; x = x->next) { sum += mpe_long_voidp(x->value); }
+  mpt_printf("prompt-local: %ld results\n", blist_length(xs));
+  mpt_assert(blist_length(xs) == 4 && sum == 6, "prompt-local");
+  mpt_assert(local_get() == 1, "prompt-local: changed in the parent");
+  blist_free(xs);
+}
+
+
+void prompt_local_run(void) {
+  test();
+}
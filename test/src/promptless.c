@@ -0,0 +1,101 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+
+/* ----------------------------------------------------------------------------
+   Handlers with only tail resumptive operations run without a prompt;
+   they should behave just like prompted handlers, also when an operation
+   of an outer handler unwinds through them.
+-----------------------------------------------------------------------------*/
+
+#include "test.h"
+#include <mprompt.h>
+
+MPE_DEFINE_EFFECT1(bail, out)
+MPE_DEFINE_VOIDOP1(bail, out, long)
+
+static void* handle_bail_out(mpe_resume_t* r, void* local, void* arg) {
+  UNUSED(r); UNUSED(local);
+  return arg;
+}
+
+static void* bail_handle(mpe_actionfun_t* action, void* arg) {
+  static const mpe_handlerdef_t bail_hdef = { MPE_EFFECT(bail), NULL, {
+    { MPE_OP_ABORT, MPE_OPTAG(bail,out), &handle_bail_out },
+    { MPE_OP_NULL, mpe_op_null, NULL }
+  } };
+  return mpe_handle(&bail_hdef, NULL, action, arg);
+}
+
+/*-----------------------------------------------------------------
+  Example programs
+-----------------------------------------------------------------*/
+
+static void* count_action(void* arg) {
+  UNUSED(arg);
+  for (long i = 0; i < 100; i++) {
+    state_set(state_get() + 1);
+  }
+  return mpe_voidp_long(state_get());
+}
+
+// count and then bail out through the (promptless) state handler
+static void* count_bail(void* arg) {
+  long n = mpe_long_voidp(count_action(arg));
+  bail_out(n);
+  return mpe_voidp_long(-1);  // never reached
+}
+
+static void* state_bail(void* arg) {
+  return state_handle(&count_bail, 0, arg);
+}
+
+static void* ustate_bail(void* arg) {
+  return ustate_handle(&count_bail, 0, arg);
+}
+
+// count and then raise (an `MPE_OP_NEVER` operation) through the (promptless) state handler
+static void* count_raise(void* arg) {
+  count_action(arg);
+  exn_raise("promptless");
+  return mpe_voidp_long(-1);  // never reached
+}
+
+static void* ustate_raise(void* arg) {
+  return ustate_handle(&count_raise, 0, arg);
+}
+
+/*-----------------------------------------------------------------
+  testing
+-----------------------------------------------------------------*/
+
+static long prompts_created(void) {
+  return (long)mp_stats_get().prompts_created;
+}
+
+void promptless_run(void) {
+  // same results as a prompted handler, without creating prompts
+  long created = prompts_created();
+  long res1 = mpe_long_voidp(state_handle(&count_action, 0, NULL));
+  long res2 = mpe_long_voidp(ustate_handle(&count_action, 0, NULL));
+  mpt_assert(prompts_created() == created, "promptless: no prompts");
+  long res3 = mpe_long_voidp(ostate_handle(&count_action, 0, NULL));
+  mpt_assert(prompts_created() == created + 1, "promptless: prompted");
+  mpt_printf("promptless: %ld, %ld, %ld\n", res1, res2, res3);
+  mpt_assert(res1 == 100 && res2 == 100 && res3 == 100, "promptless");
+
+  // unwind through promptless handlers
+  long res4 = mpe_long_voidp(bail_handle(&state_bail, NULL));
+  long res5 = mpe_long_voidp(bail_handle(&ustate_bail, NULL));
+  void* res6 = exn_handle(&ustate_raise, NULL);
+  mpt_printf("promptless unwind: %ld, %ld, %p\n", res4, res5, res6);
+  mpt_assert(res4 == 100 && res5 == 100 && res6 == NULL, "promptless unwind");
+  mpt_assert(mpe_handler_local(MPE_EFFECT(state)) == NULL && mpe_handler_local(MPE_EFFECT(bail)) == NULL, "promptless unwind: frames");
+
+  // and the handlers still work afterwards
+  long res7 = mpe_long_voidp(state_handle(&count_action, 0, NULL));
+  mpt_assert(res7 == 100, "promptless: after unwind");
+}
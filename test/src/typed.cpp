@@ -0,0 +1,120 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+-----------------------------------------------------------------------------*/
+#include "test.h"
+#include <mpeff.hpp>
+
+/*-----------------------------------------------------------------
+  Typed effects
+-----------------------------------------------------------------*/
+
+struct tstate : mpe::effect<tstate, MPE_OP_TAIL_NOOP> {
+  virtual long get() = 0;
+  virtual void set(long x) = 0;
+};
+
+struct tstate_handler : tstate {
+  long value;
+  tstate_handler(long init) : value(init) { }
+  long get() override { return value; }
+  void set(long x) override { value = x; }
+};
+
+struct tamb : mpe::effect<tamb> {
+  // flip: resumes twice
+};
+
+struct tamb_handler : tamb { };
+
+struct texn : mpe::effect<texn, MPE_OP_NEVER> { };
+
+struct texn_handler : texn { };
+
+
+/*-----------------------------------------------------------------
+  Benchmark
+-----------------------------------------------------------------*/
+
+static long tcounter(void) {
+  long count = 0;
+  long i;
+  while ((i = mpe::handler_of<tstate>().get()) > 0) {
+    mpe::handler_of<tstate>().set(i-1);
+    count++;
+  }
+  return count;
+}
+
+// Increment through a tail operation that performs an operation of a C handler itself
+static long tcounter_tail(void) {
+  long count = 0;
+  while (mpe::perform_tail<tstate>([](tstate& h) { long i = h.get(); h.set(i - 1); return i + state_get(); }) > 0) {
+    count++;
+  }
+  return count;
+}
+
+static void* tcounter_tail_action(void* arg) {
+  tstate_handler* h = (tstate_handler*)arg;
+  return mpe_voidp_long(mpe::handle(*h, [&]() { return tcounter_tail(); }));
+}
+
+static bool tflip(void) {
+  return mpe::perform<tamb, MPE_OP_MULTI, bool, long>([](tamb& h, mpe::resume<bool,long> r) {
+    UNUSED(h);
+    return r(true) + r.final(false);
+  });
+}
+
+static long txor(void) {
+  bool x = tflip();
+  bool y = tflip();
+  return ((x && !y) || (!x && y) ? 1 : 0);
+}
+
+static long tsafe_div(long x, long y) {
+  if (y == 0) {
+    mpe::perform_abort<texn, long, MPE_OP_NEVER>([](texn& h) { UNUSED(h); return -1L; });
+  }
+  return x / y;
+}
+
+
+/*-----------------------------------------------------------------
+  Run
+-----------------------------------------------------------------*/
+
+static void test(long count) {
+  long res = 0;
+  tstate_handler s(count);
+  mpt_bench{ res = mpe::handle(s, [&]() { return tcounter(); }); }
+  mpt_printf("tcounter  : %ld\n", res);
+  mpt_assert(res == count, "tcounter");
+
+  tstate_handler u(count/10);
+  mpt_bench{ res = mpe_long_voidp(state_handle(&tcounter_tail_action, 0, &u)); }
+  mpt_printf("tucounter : %ld\n", res);
+  mpt_assert(res == count/10, "tucounter");
+
+  tamb_handler a;
+  mpt_bench{ res = mpe::handle(a, [&]() { return txor(); }); }
+  mpt_printf("txor      : %ld\n", res);
+  mpt_assert(res == 2, "txor");
+
+  texn_handler e;
+  long d = 0;
+  mpt_bench{ d = mpe::handle(e, [&]() { return tsafe_div(42, 2) + tsafe_div(1, 0); }); }
+  mpt_printf("texn      : %ld\n", d);
+  mpt_assert(d == -1, "texn");
+}
+
+void typed_run(void) {
+#ifdef NDEBUG
+  test(10010010L);
+#else
+  test(100100L);
+#endif
+}
@@ -35,6 +35,10 @@ void mstate_run(void);
 void nqueens_run(void);
 void amb_run(void);
 void amb_state_run(void);
+void amb_deep_run(void);
+void prompt_local_run(void);
+void promptless_run(void);
+void find_cache_run(void);
 void rehandle_run(void);
 
 
@@ -43,12 +47,16 @@ void throw_run(void);
 void exn_run(void);
 void multi_unwind_run(void);
 void thread_rehandle_run(void);
+void migrate_run(void);
+void typed_run(void);
 #else
 // dummies in C
 static inline void throw_run(void) { }
 static inline void exn_run(void) { }
 static inline void multi_unwind_run(void) { };
 static inline void thread_rehandle_run(void) { };
+static inline void migrate_run(void) { };
+static inline void typed_run(void) { };
 #endif
 
 #ifdef __cplusplus
@@ -0,0 +1,187 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+
+  Test frame pointer backtraces through nested prompts, both directly
+  and from a `SIGPROF` handler while prompts are switching.
+-----------------------------------------------------------------------------*/
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE   // for REG_RIP etc.
+#endif
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <mprompt.h>
+
+#if defined(__GNUC__)
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define USE_SIGPROF 1
+#include <signal.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#else
+#define USE_SIGPROF 0
+#endif
+
+// we can only check for complete backtraces if everything has frame pointers
+#if defined(MP_FRAME_POINTERS) || (defined(__GNUC__) && !defined(__OPTIMIZE__))
+#define CHECK_COMPLETE 1
+#else
+#define CHECK_COMPLETE 0
+#endif
+
+#define DEPTH  (4)
+#define BT_MAX (256)
+
+static void* refs[DEPTH];     // a code address in each level just before it enters the next prompt
+static void* bt[BT_MAX];
+static int   bt_len;
+
+// return an address right after the call
+static __attribute__((noinline)) void* here(void) {
+  return __builtin_return_address(0);
+}
+
+// does the backtrace contain a return address in each level?
+static bool bt_is_complete(void** trace, int n, bool verbose) {
+  for (int level = 0; level < DEPTH; level++) {
+    bool found = false;
+    for (int i = 0; i < n && !found; i++) {
+      found = ((uint8_t*)trace[i] >= (uint8_t*)refs[level] && (uint8_t*)trace[i] < (uint8_t*)refs[level] + 256);
+    }
+    if (!found) {
+      if (verbose) printf("missing frame for level %d\n", level);
+      return false;
+    }
+  }
+  return true;
+}
+
+static void* level_fun(mp_prompt_t* p, void* arg);
+
+static __attribute__((noinline)) void* level(intptr_t n) {
+  if (n >= DEPTH) {
+    bt_len = mp_backtrace_fp(bt, BT_MAX);
+    return (void*)(intptr_t)bt_len;
+  }
+  refs[n] = here();
+  void* res = mp_prompt(&level_fun, (void*)(n + 1));
+  __asm__ volatile ("" : : "r"(res) : "memory");   // no tail call
+  return res;
+}
+
+static void* level_fun(mp_prompt_t* p, void* arg) {
+  (void)(p);
+  return level((intptr_t)arg);
+}
+
+
+#if USE_SIGPROF
+// -------------------------------
+// Sample backtraces from a SIGPROF handler while prompts yield and resume
+
+static volatile long samples;
+static volatile long samples_complete;
+static volatile long samples_in_loop;  // samples taken while spinning in the innermost level
+static volatile bool spinning;
+
+static void on_sigprof(int sig, siginfo_t* info, void* ucontext) {
+  (void)(sig); (void)(info);
+  ucontext_t* uc = (ucontext_t*)ucontext;
+  #if defined(__x86_64__)
+  void* ip = (void*)uc->uc_mcontext.gregs[REG_RIP];
+  void* sp = (void*)uc->uc_mcontext.gregs[REG_RSP];
+  void* fp = (void*)uc->uc_mcontext.gregs[REG_RBP];
+  #else
+  void* ip = (void*)uc->uc_mcontext.pc;
+  void* sp = (void*)uc->uc_mcontext.sp;
+  void* fp = (void*)uc->uc_mcontext.regs[29];
+  #endif
+  void* trace[BT_MAX];
+  int n = mp_backtrace_fp_from(ip, sp, fp, trace, BT_MAX);
+  samples++;
+  if (spinning) {
+    samples_in_loop++;
+    if (bt_is_complete(trace, n, false)) samples_complete++;
+  }
+}
+
+static void* yielder(mp_resume_t* r, void* arg) {
+  return mp_resume_tail(r, arg);
+}
+
+static void* spin_fun(mp_prompt_t* p, void* arg);
+
+static __attribute__((noinline)) void* spin_level(intptr_t n) {
+  if (n >= DEPTH) {
+    // spin until sampled a few times, yielding to our prompt in between
+    mp_prompt_t* p = mp_prompt_top();
+    long start = samples;
+    volatile long x = 0;
+    for (long i = 0; samples_in_loop < 10 && samples - start < 2000 && i < 1000000; i++) {
+      spinning = true;
+      for (int j = 0; j < 1000; j++) { x = x + j; }
+      spinning = false;
+      mp_yield(p, &yielder, NULL);
+    }
+    return NULL;
+  }
+  refs[n] = here();
+  void* res = mp_prompt(&spin_fun, (void*)(n + 1));
+  __asm__ volatile ("" : : "r"(res) : "memory");
+  return res;
+}
+
+static void* spin_fun(mp_prompt_t* p, void* arg) {
+  (void)(p);
+  return spin_level((intptr_t)arg);
+}
+
+static bool sigprof_test(void) {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = &on_sigprof;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, NULL);
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = 1000;  // 1 kHz
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, NULL);
+  spin_level(0);
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  signal(SIGPROF, SIG_IGN);
+  printf("sigprof: %ld samples, %ld while spinning, %ld complete\n", samples, samples_in_loop, samples_complete);
+  return (samples > 0 && (!CHECK_COMPLETE || samples_complete == samples_in_loop));
+}
+#endif
+
+
+int main() {
+  mp_config_t config = mp_config_default();
+  mp_init(&config);
+  level(0);
+  printf("backtrace: %d frames\n", bt_len);
+  bool ok = (bt_len > 0);
+  if (CHECK_COMPLETE) {
+    ok = ok && bt_is_complete(bt, bt_len, true);
+  }
+  #if USE_SIGPROF
+  ok = sigprof_test() && ok;
+  #endif
+  printf("done: %s\n", (ok ? "ok" : "failed"));
+  return (ok ? 0 : 1);
+}
+
+#else
+int main() {
+  printf("done: skipped (needs frame pointers)\n");
+  return 0;
+}
+#endif
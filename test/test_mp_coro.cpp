@@ -0,0 +1,92 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+
+  Test the interoperation of C++20 coroutines and prompts (`mpcoro.hpp`)
+  using a simple run queue to simulate asynchronous completion.
+-----------------------------------------------------------------------------*/
+#include <stdio.h>
+#include <deque>
+#include <stdexcept>
+#include <mpcoro.hpp>
+
+// A run queue of suspended coroutines
+static std::deque<std::coroutine_handle<>> run_queue;
+
+struct defer {
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h) { run_queue.push_back(h); }
+  void await_resume() const noexcept { }
+};
+
+static void run_all() {
+  while (!run_queue.empty()) {
+    std::coroutine_handle<> h = run_queue.front();
+    run_queue.pop_front();
+    h.resume();
+  }
+}
+
+// Coroutines
+static mp::task<int> co_add(int x, int y, bool suspend) {
+  if (suspend) {
+    co_await defer{};
+  }
+  co_return x + y;
+}
+
+static mp::task<int> co_fail() {
+  co_await defer{};
+  throw std::runtime_error("co_fail");
+  co_return 0;
+}
+
+// Regular code running under a prompt that awaits coroutines
+static int legacy_sum(mp_prompt_t* p, int n, bool suspend) {
+  int sum = 0;
+  for (int i = 0; i < n; i++) {
+    sum = mp::await(p, co_add(sum, i, suspend));
+  }
+  return sum;
+}
+
+static mp::task<int> co_main(bool suspend) {
+  int x = co_await mp::on_prompt([=](mp_prompt_t* p) { return legacy_sum(p, 100, suspend); });
+  int y = co_await co_add(x, 1, suspend);
+  co_await mp::on_prompt([](mp_prompt_t* p) { mp::await(p, co_add(0, 0, true)); });  // void result
+  co_return y;
+}
+
+static mp::task<int> co_exn() {
+  try {
+    co_await mp::on_prompt([](mp_prompt_t* p) { return mp::await(p, co_fail()); });
+  }
+  catch (const std::runtime_error& e) {
+    printf("caught: %s\n", e.what());
+    co_return 1;
+  }
+  co_return 0;
+}
+
+template<class T>
+static T run(mp::task<T> t) {
+  t.start();
+  run_all();
+  if (!t.done()) {
+    printf("error: task did not complete\n");
+    exit(1);
+  }
+  return t.result();
+}
+
+int main() {
+  int r1 = run(co_main(false));
+  int r2 = run(co_main(true));
+  int r3 = run(co_exn());
+  printf("results: %d, %d, %d\n", r1, r2, r3);
+  const bool ok = (r1 == 4951 && r2 == 4951 && r3 == 1);
+  printf("done\n");
+  return (ok ? 0 : 1);
+}
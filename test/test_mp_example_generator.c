@@ -4,12 +4,17 @@
   under the terms of the MIT License. A copy of the license can be
   found in the "LICENSE" file at the root of this distribution.
 
-  Example of using low-level prompts for a generator
+  Example of using low-level prompts for a generator, 
+  and of the batched generators in `mpgen.h` (and `mpgen.hpp`)
 -----------------------------------------------------------------------------*/
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <mprompt.h>
+#include <mpgen.h>
+#ifdef __cplusplus
+#include <mpgen.hpp>
+#endif
 
 typedef void* (iterator_fun)(intptr_t arg);
 
@@ -39,7 +44,7 @@ static void* gen_action(mp_prompt_t* p, void* arg) {
 // Foreach
 static void gen_foreach( iterator_fun* iter, intptr_t n ) {
   iter_env_t env = { iter, n };
-  mp_prompt( &gen_action, &env );
+  mp_prompt_ex( 64*1024, &gen_action, &env );  // a generator only needs a small stack
 }
 
 // Our foreach body
@@ -48,7 +53,72 @@ static void* my_foreach_body(intptr_t i) {
   return NULL;
 }
 
+
+// Batched generator: the producer fills the buffer of the consumer directly
+static void gen_squares(mp_gen_t* gen, void* arg) {
+  intptr_t n = (intptr_t)arg;
+  intptr_t i = 0;
+  while (i < n) {
+    ptrdiff_t count;
+    intptr_t* buf = (intptr_t*)mp_gen_reserve(gen, &count);
+    ptrdiff_t k = 0;
+    for (; k < count && i < n; k++, i++) {
+      buf[k] = i*i;
+    }
+    mp_gen_commit(gen, k);
+  }
+  intptr_t last = -1; 
+  mp_gen_emit(gen, &last);
+}
+
+static intptr_t gen_batched(intptr_t n, ptrdiff_t batch) {
+  mp_gen_t* gen = mp_gen_create(64*1024, sizeof(intptr_t), &gen_squares, (void*)n);
+  intptr_t buf[256];
+  mp_gen_iter_t it;
+  mp_gen_iter_init(&it, gen, buf, batch, sizeof(intptr_t));
+  intptr_t sum = 0;
+  intptr_t count = 0;
+  for (intptr_t* x; (x = (intptr_t*)mp_gen_iter_next(&it)) != NULL; ) {
+    sum += *x;
+    count++;
+  }
+  mp_gen_free(gen);
+  printf("batched (%zd): %zd elements, sum %zd\n", batch, count, sum);
+  return (count == n + 1 ? sum : -1);
+}
+
+// Dropping a generator before it is done
+static bool gen_partial(void) {
+  mp_gen_t* gen = mp_gen_create(64*1024, sizeof(intptr_t), &gen_squares, (void*)1000);
+  intptr_t buf[16];
+  ptrdiff_t n = mp_gen_fill(gen, buf, 16);
+  mp_gen_free(gen);
+  return (n == 16 && buf[15] == 15*15);
+}
+
+#ifdef __cplusplus
+static long gen_range(long n) {
+  mp::generator<long> gen([n](mp::gen_output<long>& out) {
+    for (long i = 0; i < n; i++) { out.emit(i*i); }
+  }, 64*1024);
+  long sum = 0;
+  for (long x : gen) { sum += x; }
+  printf("range: sum %ld\n", sum);
+  return sum;
+}
+#endif
+
 int main() {
   gen_foreach( my_foreach_body, 10);
-  printf("\ndone\n");
+  printf("\n");
+
+  // sum of squares below 1000, minus the final -1
+  const intptr_t expect = 332833500 - 1;
+  bool ok = (gen_batched(1000, 1) == expect && gen_batched(1000, 7) == expect && gen_batched(1000, 256) == expect);
+  ok = ok && gen_partial();
+  #ifdef __cplusplus
+  ok = ok && (gen_range(1000) == 332833500) && (gen_range(0) == 0);
+  #endif
+  printf("done\n");
+  return (ok ? 0 : 1);
 }
@@ -0,0 +1,68 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+
+  Example of using symmetric transfer (`mp_resume_to`) between two sibling 
+  prompts: a producer hands each value directly to a consumer and back.
+-----------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <mprompt.h>
+
+typedef struct pipe_s {
+  mp_resume_t* producer;   // suspended producer (while the consumer runs)
+  mp_resume_t* consumer;   // suspended consumer (while the producer runs)
+  bool         multi;      // park the consumer as a multi-shot resumption (which transfers through the parent)
+} pipe_t;
+
+#define PIPE_DONE  (-1)
+
+// Park the consumer initially
+static void* pipe_park(mp_resume_t* r, void* arg) {
+  pipe_t* pipe = (pipe_t*)arg;
+  pipe->consumer = (pipe->multi ? mp_resume_multi(r) : r);
+  return NULL;
+}
+
+// Consumer: sums all values it receives
+static void* consumer(mp_prompt_t* p, void* arg) {
+  pipe_t* pipe = (pipe_t*)arg;
+  intptr_t sum = 0;
+  intptr_t i = (intptr_t)mp_yield(p, &pipe_park, pipe);
+  while (i != PIPE_DONE) {
+    printf("%zd.", i);
+    sum += i;
+    i = (intptr_t)mp_resume_to(p, pipe->producer, NULL, &pipe->consumer);
+  }
+  return (void*)sum;   // returns to the caller of the producer
+}
+
+// Producer: hands each value to the consumer
+static void* producer(mp_prompt_t* p, void* arg) {
+  pipe_t* pipe = (pipe_t*)arg;
+  for (intptr_t i = 0; i < 10; i++) {
+    mp_resume_to(p, pipe->consumer, (void*)i, &pipe->producer);
+  }
+  mp_resume_to(p, pipe->consumer, (void*)PIPE_DONE, &pipe->producer);
+  return NULL;  // never reached as the consumer returns in our place
+}
+
+static intptr_t pipeline(bool multi) {
+  pipe_t pipe = { NULL, NULL, multi };
+  mp_prompt(&consumer, &pipe);                          // runs until the consumer is parked
+  intptr_t sum = (intptr_t)mp_prompt(&producer, &pipe); // returns with the result of the consumer
+  mp_resume_drop(pipe.producer);
+  printf("\nsum: %zd\n", sum);
+  return sum;
+}
+
+int main() {
+  intptr_t sum1 = pipeline(false);
+  intptr_t sum2 = pipeline(true);
+  printf("done\n");
+  return (sum1 == 45 && sum2 == 45 ? 0 : 1);
+}
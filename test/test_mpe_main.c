@@ -8,6 +8,7 @@
 -----------------------------------------------------------------------------*/
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <mprompt.h>
 #include <mpeff.h>
@@ -16,6 +17,10 @@
 static void test_c(void);
 static void test_cpp(void);
 static void test_cpp_threaded(void);
+static void test_cross_thread_write(void);
+static void test_prewarm(void);
+static void test_stats(void);
+static void test_gstack_features(void);
 
 int main(int argc, char** argv) {
   mpt_printf("testing..\n");
@@ -27,7 +32,33 @@ int main(int argc, char** argv) {
   //config.stack_max_size = 1 * 1024 * 1024L;
   //config.stack_initial_commit = 64 * 1024L; 
   //config.stack_cache_count = 0; // disable per-thread cache
+  if (argc > 1 && strcmp(argv[1], "--track-writes") == 0) {
+    config.stack_save_track_writes = true;  // only restore changed pages of multi-shot resumptions
+  }
+  if (argc > 1 && strcmp(argv[1], "--reclaim") == 0) {
+    config.stack_cache_commit_max = 0;      // decommit cached gstacks beyond their initial commit
+  }
+  if (argc > 1 && strcmp(argv[1], "--profile") == 0) {
+    config.stack_profile = true;            // record the peak stack usage per start function or handler
+  }
+  if (argc > 1 && strcmp(argv[1], "--reset-background") == 0) {
+    config.stack_reset_background = true;   // reset freed gpool stacks from a background thread
+  }
+  if (argc > 1 && strcmp(argv[1], "--compact") == 0) {
+    config.gpool_compact = true;            // keep gpool stacks in one mapping (if userfaultfd is available)
+  }
+  if (argc > 1 && strcmp(argv[1], "--numa") == 0) {
+    config.gpool_numa = true;               // allocate gstacks from gpools of the current NUMA node
+  }
+  if (argc > 1 && strcmp(argv[1], "--huge-pages") == 0) {
+    config.stack_huge_pages = true;         // back the base of gpool stacks with a transparent huge page (if available)
+  }
+  if (argc > 1 && strcmp(argv[1], "--userfaultfd") == 0) {
+    config.stack_use_userfaultfd = true;    // commit gpool stacks from a userfaultfd handler thread (if available)
+  }
   mp_init(&config);
+  test_prewarm();
+  test_stats();
 
   size_t start_rss = 0;
   mpt_timer_t start = mpt_show_process_info_start(&start_rss);
@@ -38,11 +69,163 @@ int main(int argc, char** argv) {
   
   mpt_printf("done.\n");
   mpt_show_process_info(stderr, start, start_rss);
+
+  mp_stats_print();
+  mp_stats_t stats = mp_stats_get();
+  mpt_assert(stats.prompts_created > 0 && stats.gstack_allocs >= stats.gstack_cache_hits, "stats");
+  mpt_assert(stats.resumes_multi > 0 && stats.saves >= stats.saves_shared && stats.reserved >= 0, "stats");
+  test_gstack_features();
+  test_cross_thread_write();
+
+  if (config.stack_profile) {
+    mp_stack_profile_print();
+    mp_stack_profile_t profiles[8];
+    const ptrdiff_t n = mp_stack_profile_get(profiles, 8);
+    int64_t used_max = 0;
+    for (ptrdiff_t i = 0; i < n; i++) {
+      mpt_assert(profiles[i].count > 0 && profiles[i].used_max <= profiles[i].committed_max, "stack profile");
+      if (profiles[i].used_max > used_max) used_max = profiles[i].used_max;
+    }
+    mpt_assert(n > 0 && used_max > 0, "stack profile");
+  }
+
+#if MP_TRACE
+  mp_trace_print();
+  mp_trace_event_t events[16];
+  mpt_assert(mp_trace_events(events, 16) == 16 && events[0].time <= events[15].time, "trace");
+#endif
+}
+
+// Prompts allocated after pre-warming are served from the thread-local cache
+static void* prewarm_fun(mp_prompt_t* p, void* arg) {
+  (void)(p);
+  return arg;
+}
+
+static void test_prewarm(void) {
+  mpt_assert(mp_prewarm(4, 64 * 1024L) > 0, "prewarm");
+  mp_stats_t before = mp_stats_get();
+  for (int i = 0; i < 100; i++) {
+    mpt_assert(mp_prompt(&prewarm_fun, (void*)(intptr_t)i) == (void*)(intptr_t)i, "prewarm");
+  }
+  mp_stats_t after = mp_stats_get();
+  mpt_assert(after.gstack_allocs - before.gstack_allocs == 100, "prewarm allocs");
+  mpt_assert(after.gstack_cache_hits - before.gstack_cache_hits == 100, "prewarm cache hits");
+  mpt_assert(after.gstack_os_frees == before.gstack_os_frees, "prewarm frees");
+}
+
+// Nest `n` prompts so `n` gstacks are live at once (and freed beyond the thread-local cache afterwards)
+static void* nest_fun(mp_prompt_t* p, void* arg) {
+  (void)(p);
+  const intptr_t n = (intptr_t)arg;
+  return (n <= 1 ? arg : mp_prompt(&nest_fun, (void*)(n - 1)));
+}
+
+// Use about `arg` KiB of stack (so a gstack grows beyond its initial commit)
+static intptr_t deep_use(intptr_t n) {
+  volatile char buf[1024];
+  buf[0] = (char)n;
+  return (n <= 1 ? buf[0] : deep_use(n - 1) + buf[0]);
+}
+
+static void* deep_fun(mp_prompt_t* p, void* arg) {
+  (void)(p);
+  return (void*)deep_use((intptr_t)arg);
+}
+
+static void* resume_fun(mp_resume_t* r, void* arg) {
+  return mp_resume(r, arg);
+}
+
+static void* resume_tail_fun(mp_resume_t* r, void* arg) {
+  return mp_resume_tail(r, arg);
+}
+
+static void* yield_fun(mp_prompt_t* p, void* arg) {
+  void* x = mp_yield(p, &resume_fun, arg);
+  return mp_yield(p, &resume_tail_fun, x);
+}
+
+// Exact counts for a known (single threaded) workload
+static void test_stats(void) {
+  const mp_config_t current = mp_config_current();
+  const int64_t cache_max = current.stack_cache_count;
+  mp_collect(true);  // start with an empty thread-local cache
+  mp_stats_t before = mp_stats_get();
+
+  // sequential prompts: the first allocates a fresh gstack and the others reuse it from the cache
+  for (int i = 0; i < 10; i++) {
+    mpt_assert(mp_prompt(&prewarm_fun, (void*)(intptr_t)i) == (void*)(intptr_t)i, "stats");
+  }
+  mp_stats_t after = mp_stats_get();
+  mpt_assert(after.prompts_created - before.prompts_created == 10, "stats: prompts created");
+  mpt_assert(after.gstack_allocs - before.gstack_allocs == 10, "stats: sequential allocs");
+  mpt_assert(after.gstack_cache_hits - before.gstack_cache_hits == (cache_max > 0 ? 9 : 0), "stats: sequential cache hits");
+  mpt_assert(after.gstack_os_frees - before.gstack_os_frees == (cache_max > 0 ? 0 : 10), "stats: sequential frees");
+
+  // nested prompts: only one gstack is cached; when freed, the cache keeps `cache_max` gstacks and frees the rest
+  const int64_t cached = (cache_max > 0 ? 1 : 0);
+  const int64_t kept = (cache_max < 8 ? cache_max : 8);
+  before = after;
+  mpt_assert(mp_prompt(&nest_fun, (void*)8) == (void*)1, "stats");
+  after = mp_stats_get();
+  mpt_assert(after.gstack_allocs - before.gstack_allocs == 8, "stats: nested allocs");
+  mpt_assert(after.gstack_cache_hits - before.gstack_cache_hits == cached, "stats: nested cache hits");
+  mpt_assert(after.gstack_os_frees - before.gstack_os_frees == 8 - kept, "stats: nested frees");
+  mpt_assert(after.gstack_gpool_allocs - before.gstack_gpool_allocs <= 8 - cached, "stats: nested gpool allocs");
+
+  // yields and resumes
+  before = after;
+  mpt_assert(mp_prompt(&yield_fun, (void*)42) == (void*)42, "stats");
+  after = mp_stats_get();
+  mpt_assert(after.prompts_created - before.prompts_created == 1 && after.yields - before.yields == 2, "stats: yields");
+  mpt_assert(after.resumes - before.resumes == 1 && after.resumes_tail - before.resumes_tail == 1, "stats: resumes");
+  mpt_assert(after.resumes_multi == before.resumes_multi && after.saves == before.saves, "stats: no multi-shot resumes");
+  mpt_assert(after.gstack_delayed_frees == before.gstack_delayed_frees && after.gstack_remote_frees == before.gstack_remote_frees, "stats: no delayed or remote frees");
+}
+
+// Check that the requested gstack features are engaged (if available on this system)
+static void test_gstack_features(void) {
+  const mp_config_t current = mp_config_current();
+  mp_stats_t stats = mp_stats_get();
+  if (current.stack_use_userfaultfd) {
+    mpt_assert(stats.uffd_faults > 0 && stats.uffd_faults <= stats.page_faults, "userfaultfd faults");
+  }
+  if (current.stack_reset_background) {
+    // free a batch of gstacks to the gpool and wait (at most 10s) until the background thread reset them
+    mpt_assert(mp_prompt(&nest_fun, (void*)64) == (void*)1, "background resets");
+    const mpt_timer_t start = mpt_timer_start();
+    do {
+      stats = mp_stats_get();
+    } while (stats.gstack_background_resets == 0 && mpt_timer_end(start) < 10000000);
+    mpt_assert(stats.gstack_background_resets > 0 && stats.gstack_background_resets <= stats.gstack_os_frees, "background resets");
+  }
+  if (current.stack_cache_commit_max == 0 && !current.stack_use_overcommit && current.stack_cache_count > 1) {
+    // a gstack that grew is cached as-is and only decommitted when evicted from a full cache (or collected)
+    mp_collect(true);
+    const int64_t reclaims = mp_stats_get().gstack_reclaims;
+    mp_prompt(&deep_fun, (void*)256);
+    mpt_assert(mp_stats_get().gstack_reclaims == reclaims, "reclaim deferred");
+    mp_collect(false);
+    mpt_assert(mp_stats_get().gstack_reclaims == reclaims + 1, "reclaim collected");
+  }
+  if (current.stack_huge_pages) {
+    mpt_assert(stats.gstack_huge_pages > 0 && stats.gstack_huge_pages <= stats.gstack_gpool_allocs, "huge pages");
+  }
+  if (current.gpool_numa) {
+    mpt_assert(stats.gpool_numa_binds > 0, "numa binds");
+  }
+  if (current.gpool_compact) {
+    // the stacks in a compact gpool are accessible and committed by the `userfaultfd` handler
+    mpt_assert(stats.gpool_compacts > 0 && current.stack_use_userfaultfd && stats.uffd_faults > 0, "compact gpools");
+  }
 }
 
 static void test_c(void) {
   // effect handlers
   reader_run();
+  promptless_run();
+  find_cache_run();
   counter_run();
   countern_run();
   mstate_run();
@@ -51,6 +234,8 @@ static void test_c(void) {
   // multi-shot tests
   amb_run();
   amb_state_run();
+  amb_deep_run();
+  prompt_local_run();
   nqueens_run();
 }
 
@@ -62,6 +247,8 @@ static void test_cpp(void) {
   exn_run();
   multi_unwind_run();
   throw_run();
+  migrate_run();
+  typed_run();
 }
 
 
@@ -77,6 +264,37 @@ void test_cpp_threaded(void) {
   t.join();  
 }
 
+// Another thread writes to a saved stack through a pointer (to a write protected page when tracking writes)
+static void write_in_thread(volatile long* p) {
+  *p = 1;
+}
+
+static void* resume_twice_fun(mp_resume_t* r, void* arg) {
+  long* res = (long*)arg;
+  mp_resume_t* m = mp_resume_multi(r);
+  res[0] = (long)(intptr_t)mp_resume(mp_resume_dup(m), NULL);
+  res[1] = (long)(intptr_t)mp_resume(m, NULL);
+  return NULL;
+}
+
+static void* cross_write_fun(mp_prompt_t* p, void* arg) {
+  volatile long buf[8*1024];   // 64 KiB
+  for (size_t i = 0; i < 8*1024; i++) { buf[i] = 0; }
+  mp_yield(p, &resume_twice_fun, arg);
+  // each resume starts from the saved stack
+  const long before = buf[4096];
+  std::thread t(&write_in_thread, &buf[4096]);
+  t.join();
+  return (void*)(intptr_t)before;
+}
+
+static void test_cross_thread_write(void) {
+  long res[2] = { -1, -1 };
+  mp_prompt(&cross_write_fun, res);
+  mpt_printf("cross thread write: %ld, %ld\n", res[0], res[1]);
+  mpt_assert(res[0] == 0 && res[1] == 0, "cross thread write");
+}
+
 #else // C
 static void test_cpp(void) {
   // nothing
@@ -84,4 +302,7 @@ static void test_cpp(void) {
 static void test_cpp_threaded(void) {
   // nothing
 }
+static void test_cross_thread_write(void) {
+  // nothing
+}
 #endif  
\ No newline at end of file
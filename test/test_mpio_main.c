@@ -0,0 +1,248 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+
+  Test the io_uring (or epoll) event loop
+-----------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <mprompt.h>
+#include <mpio.h>
+#include "test.h"
+
+static void backend_test(bool use_epoll);
+static void sleep_test(void);
+static void pipe_test(long count);
+static void echo_test(long clients, long messages);
+
+int main(int argc, char** argv) {
+  mp_config_t config = mp_config_default();
+  mp_init(&config);
+  const bool use_epoll = (argc > 1 && strcmp(argv[1], "--epoll") == 0);
+  mpio_use_uring(!use_epoll);
+
+  size_t start_rss = 0;
+  mpt_timer_t start = mpt_show_process_info_start(&start_rss);
+
+  backend_test(use_epoll);
+  sleep_test();
+  pipe_test(10000);
+  echo_test(50, 100);
+
+  mpt_printf("done.\n");
+  mpt_show_process_info(stderr, start, start_rss);
+  return 0;
+}
+
+
+// -------------------------------
+// The backend is only known inside an event loop
+
+static void* backend_main(void* arg) {
+  (void)(arg);
+  return (void*)mpio_backend();
+}
+
+static void backend_test(bool use_epoll) {
+  const char* backend = (const char*)mpio_run(&backend_main, NULL);
+  mpt_printf("backend: %s\n", (backend == NULL ? "none" : backend));
+  mpt_assert(backend != NULL && mpio_backend() == NULL, "test-backend");
+  if (use_epoll) mpt_assert(strcmp(backend, "epoll") == 0, "test-backend-epoll");
+}
+
+
+// -------------------------------
+// Sleeping tasks wake up in order of their deadline
+
+typedef struct sleep_env_s {
+  long* order;
+  long  count;
+} sleep_env_t;
+
+static sleep_env_t sleep_env;
+
+static void* sleeper(void* arg) {
+  long n = (long)(intptr_t)arg;
+  mpio_sleep(5*n);
+  sleep_env.order[sleep_env.count++] = n;
+  return NULL;
+}
+
+static void* sleep_main(void* arg) {
+  const long n = (long)(intptr_t)arg;
+  for (long i = n; i > 0; i--) {
+    mpio_spawn(&sleeper, (void*)(intptr_t)i);
+  }
+  mpio_yield();
+  return (void*)(intptr_t)n;
+}
+
+static void sleep_test(void) {
+  long order[8];
+  sleep_env.order = order;
+  sleep_env.count = 0;
+  long res = 0;
+  mpt_bench{ res = (long)(intptr_t)mpio_run(&sleep_main, (void*)(intptr_t)8); }
+  mpt_printf("sleep: %ld tasks\n", sleep_env.count);
+  mpt_assert(res == 8 && sleep_env.count == 8, "test-sleep");
+  for (long i = 0; i < 8; i++) {
+    mpt_assert(order[i] == i + 1, "test-sleep-order");
+  }
+}
+
+
+// -------------------------------
+// A producer writes numbers into a pipe that a consumer sums
+
+typedef struct pipe_env_s {
+  int  fd;
+  long count;
+} pipe_env_t;
+
+static void* producer(void* arg) {
+  pipe_env_t* env = (pipe_env_t*)arg;
+  for (long i = 1; i <= env->count; i++) {
+    mpt_assert(mpio_write_all(env->fd, &i, sizeof(i)) == (ssize_t)sizeof(i), "test-pipe-write");
+  }
+  close(env->fd);
+  return NULL;
+}
+
+static void* consumer(void* arg) {
+  pipe_env_t* env = (pipe_env_t*)arg;
+  long sum = 0;
+  long buf[64];
+  size_t partial = 0;  // bytes of a partially read number
+  for (;;) {
+    ssize_t n = mpio_read(env->fd, (uint8_t*)buf + partial, sizeof(buf) - partial);
+    mpt_assert(n >= 0, "test-pipe-read");
+    if (n == 0) break;
+    size_t avail = partial + (size_t)n;
+    size_t m = avail / sizeof(long);
+    for (size_t i = 0; i < m; i++) sum += buf[i];
+    partial = avail % sizeof(long);
+    if (partial > 0) memmove(buf, (uint8_t*)buf + m*sizeof(long), partial);
+  }
+  close(env->fd);
+  return (void*)(intptr_t)sum;
+}
+
+static void* pipe_main(void* arg) {
+  long count = (long)(intptr_t)arg;
+  int fds[2];
+  mpt_assert(pipe(fds) == 0, "test-pipe-create");
+  mpio_nonblock(fds[0]);
+  mpio_nonblock(fds[1]);
+  static pipe_env_t wenv;
+  wenv.fd = fds[1];
+  wenv.count = count;
+  mpio_spawn(&producer, &wenv);
+  pipe_env_t renv = { fds[0], count };
+  return consumer(&renv);
+}
+
+static void pipe_test(long count) {
+  long res = 0;
+  mpt_bench{ res = (long)(intptr_t)mpio_run(&pipe_main, (void*)(intptr_t)count); }
+  mpt_printf("pipe: %ld numbers: %ld\n", count, res);
+  mpt_assert(res == count*(count + 1)/2, "test-pipe");
+}
+
+
+// -------------------------------
+// A TCP echo server on localhost with a task per connection
+
+typedef struct echo_env_s {
+  int   listen_fd;
+  struct sockaddr_in addr;
+  long  clients;
+  long  messages;
+  long  total;       // sum of all echoed numbers
+  long  done;        // finished clients
+} echo_env_t;
+
+static echo_env_t echo_env;
+
+static void* echo_handler(void* arg) {
+  int fd = (int)(intptr_t)arg;
+  char buf[256];
+  ssize_t n;
+  while ((n = mpio_read(fd, buf, sizeof(buf))) > 0) {
+    if (mpio_write_all(fd, buf, (size_t)n) < 0) break;
+  }
+  close(fd);
+  return NULL;
+}
+
+static void* echo_server(void* arg) {
+  (void)(arg);
+  for (long i = 0; i < echo_env.clients; i++) {
+    int fd = mpio_accept(echo_env.listen_fd, NULL, NULL);
+    mpt_assert(fd >= 0, "test-echo-accept");
+    mpio_spawn(&echo_handler, (void*)(intptr_t)fd);
+  }
+  close(echo_env.listen_fd);
+  return NULL;
+}
+
+static void* echo_client(void* arg) {
+  long id = (long)(intptr_t)arg;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  mpt_assert(fd >= 0, "test-echo-socket");
+  mpio_nonblock(fd);
+  mpt_assert(mpio_connect(fd, (struct sockaddr*)&echo_env.addr, sizeof(echo_env.addr)) == 0, "test-echo-connect");
+  long sum = 0;
+  for (long i = 0; i < echo_env.messages; i++) {
+    long msg = id*echo_env.messages + i;
+    mpt_assert(mpio_write_all(fd, &msg, sizeof(msg)) == (ssize_t)sizeof(msg), "test-echo-write");
+    long reply = 0;
+    size_t got = 0;
+    while (got < sizeof(reply)) {
+      ssize_t n = mpio_read(fd, (uint8_t*)&reply + got, sizeof(reply) - got);
+      mpt_assert(n > 0, "test-echo-read");
+      got += (size_t)n;
+    }
+    mpt_assert(reply == msg, "test-echo-reply");
+    sum += reply;
+  }
+  close(fd);
+  echo_env.total += sum;
+  echo_env.done++;
+  return NULL;
+}
+
+static void* echo_main(void* arg) {
+  (void)(arg);
+  mpio_spawn(&echo_server, NULL);
+  for (long i = 0; i < echo_env.clients; i++) {
+    mpio_spawn(&echo_client, (void*)(intptr_t)i);
+  }
+  return NULL;
+}
+
+static void echo_test(long clients, long messages) {
+  memset(&echo_env, 0, sizeof(echo_env));
+  echo_env.clients = clients;
+  echo_env.messages = messages;
+  echo_env.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  mpt_assert(echo_env.listen_fd >= 0, "test-echo-listen");
+  echo_env.addr.sin_family = AF_INET;
+  echo_env.addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  echo_env.addr.sin_port = 0;  // any free port
+  socklen_t len = sizeof(echo_env.addr);
+  mpt_assert(bind(echo_env.listen_fd, (struct sockaddr*)&echo_env.addr, len) == 0, "test-echo-bind");
+  mpt_assert(getsockname(echo_env.listen_fd, (struct sockaddr*)&echo_env.addr, &len) == 0, "test-echo-name");
+  mpt_assert(listen(echo_env.listen_fd, 128) == 0, "test-echo-listen");
+  mpio_nonblock(echo_env.listen_fd);
+  mpt_bench{ mpio_run(&echo_main, NULL); }
+  const long n = clients*messages;
+  mpt_printf("echo: %ld clients x %ld messages: %ld\n", clients, messages, echo_env.total);
+  mpt_assert(echo_env.done == clients && echo_env.total == n*(n - 1)/2, "test-echo");
+}
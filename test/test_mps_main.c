@@ -0,0 +1,222 @@
+/* ----------------------------------------------------------------------------
+  Copyright (c) 2021, Microsoft Research, Daan Leijen
+  This is free software; you can redistribute it and/or modify it
+  under the terms of the MIT License. A copy of the license can be
+  found in the "LICENSE" file at the root of this distribution.
+
+  Test the work-stealing scheduler
+-----------------------------------------------------------------------------*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <mprompt.h>
+#include <mpsched.h>
+#include "test.h"
+
+static void fib_test(size_t thread_count, long n, long expect);
+static void yield_test(size_t thread_count, long tasks, long yields);
+static void chan_test(size_t thread_count, mps_chan_kind_t kind, long producers, long count);
+static void preempt_test(size_t thread_count, size_t time_slice);
+
+int main() {
+  mp_config_t config = mp_config_default();
+  //config.gpool_enable = true;
+  mp_init(&config);
+
+  size_t start_rss = 0;
+  mpt_timer_t start = mpt_show_process_info_start(&start_rss);
+
+  fib_test(1, 20, 6765);
+  fib_test(4, 24, 46368);
+  fib_test(0, 24, 46368);
+  yield_test(4, 1000, 10);
+  chan_test(1, MPS_CHAN_LOCAL, 4, 10000);
+  chan_test(1, MPS_CHAN_MPSC, 4, 10000);
+  chan_test(4, MPS_CHAN_MPSC, 8, 10000);
+  preempt_test(1, 1000);
+  preempt_test(4, 1000);
+
+  mpt_printf("done.\n");
+  mpt_show_process_info(stderr, start, start_rss);
+  return 0;
+}
+
+
+// -------------------------------
+// Fibonacci with a task per call
+
+static void* fib(void* arg) {
+  long n = (long)(intptr_t)arg;
+  if (n < 2) return arg;
+  mps_task_t* t = mps_spawn(&fib, (void*)(intptr_t)(n - 1));
+  long y = (long)(intptr_t)fib((void*)(intptr_t)(n - 2));
+  long x = (long)(intptr_t)mps_await(t);
+  return (void*)(intptr_t)(x + y);
+}
+
+static void fib_test(size_t thread_count, long n, long expect) {
+  long res = 0;
+  mpt_bench{ res = (long)(intptr_t)mps_run(thread_count, &fib, (void*)(intptr_t)n); }
+  mpt_printf("fib(%ld) on %zu threads: %ld\n", n, thread_count, res);
+  mpt_assert(res == expect, "test-fib");
+}
+
+
+// -------------------------------
+// Many tasks that yield repeatedly
+
+static void* yielder(void* arg) {
+  long yields = (long)(intptr_t)arg;
+  long count = 0;
+  for (long i = 0; i < yields; i++) {
+    mps_yield();
+    count++;
+  }
+  return (void*)(intptr_t)count;
+}
+
+typedef struct yield_env_s {
+  long tasks;
+  long yields;
+} yield_env_t;
+
+static void* yield_main(void* arg) {
+  yield_env_t* env = (yield_env_t*)arg;
+  mps_task_t** ts = (mps_task_t**)calloc((size_t)env->tasks, sizeof(mps_task_t*));
+  for (long i = 0; i < env->tasks; i++) {
+    ts[i] = mps_spawn(&yielder, (void*)(intptr_t)env->yields);
+  }
+  long total = 0;
+  for (long i = 0; i < env->tasks; i++) {
+    total += (long)(intptr_t)mps_await(ts[i]);
+  }
+  free(ts);
+  return (void*)(intptr_t)total;
+}
+
+static void yield_test(size_t thread_count, long tasks, long yields) {
+  yield_env_t env = { tasks, yields };
+  long res = 0;
+  mpt_bench{ res = (long)(intptr_t)mps_run(thread_count, &yield_main, &env); }
+  mpt_printf("yield: %ld tasks x %ld yields on %zu threads: %ld\n", tasks, yields, thread_count, res);
+  mpt_assert(res == tasks*yields, "test-yield");
+}
+
+
+// -------------------------------
+// Producers send into two channels; the consumer selects over both
+
+typedef struct chan_env_s {
+  mps_chan_kind_t kind;
+  long            producers;
+  long            count;
+  mps_chan_t*     chans[2];
+  long            per_chan[2];    // values received per channel
+} chan_env_t;
+
+typedef struct producer_env_s {
+  mps_chan_t* chan;
+  long        count;
+} producer_env_t;
+
+static void* chan_producer(void* arg) {
+  producer_env_t* env = (producer_env_t*)arg;
+  for (long i = 1; i <= env->count; i++) {
+    mpt_assert(mps_chan_send(env->chan, (void*)(intptr_t)i), "test-chan-send");
+    if (i % 100 == 0) mps_yield();
+  }
+  return NULL;
+}
+
+static void* chan_closer(void* arg) {
+  chan_env_t* env = (chan_env_t*)arg;
+  producer_env_t* penvs = (producer_env_t*)calloc((size_t)env->producers, sizeof(producer_env_t));
+  mps_task_t** ts = (mps_task_t**)calloc((size_t)env->producers, sizeof(mps_task_t*));
+  for (long i = 0; i < env->producers; i++) {
+    penvs[i].chan = env->chans[i % 2];
+    penvs[i].count = env->count;
+    ts[i] = mps_spawn(&chan_producer, &penvs[i]);
+  }
+  for (long i = 0; i < env->producers; i++) {
+    mps_await(ts[i]);
+  }
+  mps_chan_close(env->chans[0]);
+  mps_chan_close(env->chans[1]);
+  free(ts);
+  free(penvs);
+  return NULL;
+}
+
+static void* chan_main(void* arg) {
+  chan_env_t* env = (chan_env_t*)arg;
+  env->chans[0] = mps_chan_create(16, env->kind);
+  env->chans[1] = mps_chan_create(4, env->kind);
+  mps_task_t* closer = mps_spawn(&chan_closer, env);
+  long sum = 0;
+  void* value;
+  ptrdiff_t i;
+  while ((i = mps_chan_select(env->chans, 2, &value)) >= 0) {
+    env->per_chan[i]++;
+    sum += (long)(intptr_t)value;
+  }
+  mpt_assert(!mps_chan_recv(env->chans[0], &value), "test-chan-closed");
+  mpt_assert(!mps_chan_send(env->chans[1], NULL), "test-chan-send-closed");
+  mps_await(closer);
+  mps_chan_free(env->chans[0]);
+  mps_chan_free(env->chans[1]);
+  return (void*)(intptr_t)sum;
+}
+
+static void chan_test(size_t thread_count, mps_chan_kind_t kind, long producers, long count) {
+  chan_env_t env = { kind, producers, count, { NULL, NULL }, { 0, 0 } };
+  long res = 0;
+  mpt_bench{ res = (long)(intptr_t)mps_run(thread_count, &chan_main, &env); }
+  mpt_printf("chan (%s): %ld producers x %ld values on %zu threads: %ld (%ld/%ld)\n", (kind == MPS_CHAN_LOCAL ? "local" : "mpsc"),
+             producers, count, thread_count, res, env.per_chan[0], env.per_chan[1]);
+  mpt_assert(res == producers*(count*(count + 1)/2), "test-chan");
+  mpt_assert(env.per_chan[0] + env.per_chan[1] == producers*count, "test-chan-count");
+}
+
+
+// -------------------------------
+// A CPU bound task is preempted so a task on the same thread can stop it
+
+typedef struct preempt_env_s {
+  volatile long stop;
+  long          preempted;
+} preempt_env_t;
+
+static void* preempt_spinner(void* arg) {
+  preempt_env_t* env = (preempt_env_t*)arg;
+  long preempted = 0;
+  while (env->stop == 0) {
+    if (mp_maybe_yield()) preempted++;
+  }
+  return (void*)(intptr_t)preempted;
+}
+
+static void* preempt_stopper(void* arg) {
+  preempt_env_t* env = (preempt_env_t*)arg;
+  env->stop = 1;
+  return NULL;
+}
+
+static void* preempt_main(void* arg) {
+  preempt_env_t* env = (preempt_env_t*)arg;
+  mps_task_t* stopper = mps_spawn(&preempt_stopper, env);
+  mps_task_t* spinner = mps_spawn(&preempt_spinner, env);  // runs first as it is the most recent
+  env->preempted = (long)(intptr_t)mps_await(spinner);
+  mps_await(stopper);
+  return (void*)(intptr_t)fib((void*)(intptr_t)16);
+}
+
+static void preempt_test(size_t thread_count, size_t time_slice) {
+  preempt_env_t env = { 0, 0 };
+  long res = 0;
+  mps_set_time_slice(time_slice);
+  mpt_bench{ res = (long)(intptr_t)mps_run(thread_count, &preempt_main, &env); }
+  mps_set_time_slice(0);
+  mpt_printf("preempt: %zu threads with a %zuus time slice: %ld preemptions\n", thread_count, time_slice, env.preempted);
+  mpt_assert(res == 987, "test-preempt");
+  mpt_assert(thread_count > 1 || env.preempted > 0, "test-preempt-spinner");
+}